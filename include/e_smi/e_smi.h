@@ -167,6 +167,7 @@ typedef enum {
 	ESMI_NO_HSMP_MSG_SUP,	//!< HSMP message/feature not supported.
 	ESMI_PRE_REQ_NOT_SAT,	//!< Prerequisite to execute the command not satisfied
 	ESMI_SMU_BUSY,		//!< SMU is busy
+	ESMI_NO_DATA,		//!< Nothing sampled or modelled yet
 } esmi_status_t;
 
 /****************************************************************************/
@@ -877,10 +878,1852 @@ esmi_status_t esmi_core_boostlimit_set(uint32_t cpu_ind, uint32_t boostlimit);
 esmi_status_t esmi_socket_boostlimit_set(uint32_t socket_idx,
 					 uint32_t boostlimit);
 
+/**
+ *  @brief Set the boostlimit values of many cores, writing only the changes
+ *
+ *  @details This function sets the boostlimit of every cpu index below
+ *  @p ncpus to @p boostlimits[cpu index]. A value of 0 leaves the core
+ *  untouched. The library remembers the last boostlimit written to each
+ *  physical core through any of the boostlimit set APIs, and cores which
+ *  already run at the requested value are not written again.
+ *  SMT siblings share one boostlimit, the highest of their requested values
+ *  is used. The changed cores of each socket are written from a separate
+ *  thread.
+ *  Supported on all hsmp protocol versions
+ *
+ *  @param[in] boostlimits array of boostlimits indexed by cpu index.
+ *
+ *  @param[in] ncpus number of entries in @p boostlimits.
+ *
+ *  @param[inout] nwrites Input buffer to return the number of cores written,
+ *  may be NULL.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure, this is the first error seen
+ *  while the remaining cores were still written.
+ *
+ */
+esmi_status_t esmi_core_boostlimit_batch_set(const uint32_t *boostlimits,
+					     uint32_t ncpus, uint32_t *nwrites);
+
+/**
+ *  @brief Forget the boostlimits remembered by esmi_core_boostlimit_batch_set()
+ *
+ *  @details The next batch writes every requested core. This is needed
+ *  when boostlimits are changed outside of this library, e.g. through APML
+ *  or by another process.
+ *
+ */
+void esmi_core_boostlimit_batch_reset(void);
+
 /** @} */  // end of PerfCont
 
 /*****************************************************************************/
 
+/** @defgroup QosAlloc QoS class boost limit allocator
+ *  Below functions map cgroups to boostlimits and keep the per core
+ *  boostlimits in line with the cores each cgroup currently occupies.
+ *  @{
+ */
+
+#define ESMI_QOS_MAX_CLASSES	16	//!< maximum number of QoS classes
+
+/**
+ * @brief How the cores occupied by a QoS class are found
+ */
+typedef enum {
+	ESMI_QOS_TRACK_CPUSET,		//!< effective cpuset of the cgroup
+	ESMI_QOS_TRACK_RUNQUEUE,	//!< cpus the runnable threads are queued on
+} esmi_qos_track_t;
+
+/**
+ *  @brief Add a QoS class
+ *
+ *  @details This function adds a class for the cgroup @p cgroup_path with
+ *  the boostlimit @p boostlimit. A relative @p cgroup_path is taken below
+ *  /sys/fs/cgroup. Both cgroup v1 and v2 hierarchies are supported.
+ *  With ::ESMI_QOS_TRACK_CPUSET the class occupies the effective cpuset of
+ *  the cgroup, or every cpu if the cgroup has no cpuset controller.
+ *  With ::ESMI_QOS_TRACK_RUNQUEUE the class occupies the cpus its runnable
+ *  threads were seen on during the last few esmi_qos_alloc_apply() calls.
+ *
+ *  @param[in] cgroup_path path of the cgroup directory.
+ *
+ *  @param[in] boostlimit boostlimit in MHz for the cores of the class.
+ *
+ *  @param[in] track how the cores of the class are found.
+ *
+ *  @param[inout] class_id Input buffer to return the class id.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_DEV_BUSY is returned if ::ESMI_QOS_MAX_CLASSES classes
+ *  are in use.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_qos_class_add(const char *cgroup_path, uint32_t boostlimit,
+				 esmi_qos_track_t track, uint32_t *class_id);
+
+/**
+ *  @brief Remove a QoS class
+ *
+ *  @details The cores of the class fall back to the other classes or the
+ *  default boostlimit on the next esmi_qos_alloc_apply() call.
+ *
+ *  @param[in] class_id a class id returned by esmi_qos_class_add().
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_qos_class_remove(uint32_t class_id);
+
+/**
+ *  @brief Change the boostlimit of a QoS class
+ *
+ *  @param[in] class_id a class id returned by esmi_qos_class_add().
+ *
+ *  @param[in] boostlimit boostlimit in MHz for the cores of the class.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_qos_class_boostlimit_set(uint32_t class_id, uint32_t boostlimit);
+
+/**
+ *  @brief Set the boostlimit of cores not occupied by any QoS class
+ *
+ *  @param[in] boostlimit boostlimit in MHz, 0 leaves such cores untouched.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_qos_default_boostlimit_set(uint32_t boostlimit);
+
+/**
+ *  @brief Refresh the cores of all QoS classes and apply their boostlimits
+ *
+ *  @details A core occupied by several classes gets the highest of their
+ *  boostlimits. Only the cores whose boostlimit changes are written, see
+ *  esmi_core_boostlimit_batch_set(). Call this periodically to follow the
+ *  scheduler.
+ *
+ *  @param[inout] nwrites Input buffer to return the number of cores written,
+ *  may be NULL.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure. If a cgroup could not be
+ *  read, its class is treated as occupying no core and the error is
+ *  returned after the remaining classes were applied.
+ *
+ */
+esmi_status_t esmi_qos_alloc_apply(uint32_t *nwrites);
+
+/** @} */  // end of QosAlloc
+
+/*****************************************************************************/
+
+/** @defgroup TurboPlan Turbo budget planner
+ *  Below functions split a socket power target into per core boostlimits,
+ *  giving frequency to the cores with the highest priority weight first.
+ *  Each physical core has a power model P(f) = a + b * u * f^3 learned from
+ *  core energy deltas, the effective frequency f and the C0 share u of the
+ *  core. Without an MSR driver the frequency limit is used with u = 1.
+ *  @{
+ */
+
+/**
+ *  @brief Set the priority weight of a core
+ *
+ *  @details The planner maximizes the sum of weight times frequency over
+ *  the cores of a socket. A weight of 0 keeps the core at the socket's
+ *  minimum frequency. All cores start with a weight of 1.
+ *  SMT siblings share the weight of their physical core.
+ *
+ *  @param[in] cpu_ind a cpu index
+ *
+ *  @param[in] weight priority weight of the core.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_turbo_core_weight_set(uint32_t cpu_ind, uint32_t weight);
+
+/**
+ *  @brief Sample the cores of a socket and update their power models
+ *
+ *  @details A model needs two samples at least 1 ms apart before it can be
+ *  used. esmi_turbo_plan_apply() samples as well, calling this in between
+ *  plans only refines the models.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_turbo_model_update(uint32_t sock_ind);
+
+/**
+ *  @brief Get the modelled power of a core at a given frequency
+ *
+ *  @details The power is modelled at the C0 share of the last sample.
+ *
+ *  @param[in] cpu_ind a cpu index
+ *
+ *  @param[in] freq frequency in MHz.
+ *
+ *  @param[inout] ppower Input buffer to return the power in mW.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_NO_DATA is returned if the core has no model yet.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_turbo_core_power_estimate(uint32_t cpu_ind, uint32_t freq,
+					     uint32_t *ppower);
+
+/**
+ *  @brief Plan and apply per core boostlimits for a socket power target
+ *
+ *  @details This function updates the power models, estimates the uncore
+ *  power as the socket power minus the modelled core power, and spends the
+ *  rest of @p power_target on core frequency in 100MHz steps within the
+ *  socket's frequency range. The previous plan is the starting point, so
+ *  repeated calls only move the steps affected by the change in load or
+ *  weights. Only the cores whose boostlimit changes are written, see
+ *  esmi_core_boostlimit_batch_set().
+ *  Call this periodically, the first call only collects the first sample.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[in] power_target socket power target in mW.
+ *
+ *  @param[inout] nwrites Input buffer to return the number of cores written,
+ *  may be NULL.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_NO_DATA is returned while a core of the socket
+ *  has no model yet, or its frequency did not vary enough yet to tell
+ *  the dynamic power from the static power.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_turbo_plan_apply(uint32_t sock_ind, uint32_t power_target,
+				    uint32_t *nwrites);
+
+/**
+ *  @brief Get the boostlimit planned for a core
+ *
+ *  @param[in] cpu_ind a cpu index
+ *
+ *  @param[inout] pboostlimit Input buffer to return the boostlimit in MHz.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_NO_DATA is returned if no plan was made yet.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_turbo_core_plan_get(uint32_t cpu_ind, uint32_t *pboostlimit);
+
+/** @} */  // end of TurboPlan
+
+/*****************************************************************************/
+
+/** @defgroup PowerEst Per core power estimation
+ *  Below functions estimate per core power from the C0 residency in
+ *  /proc/stat and the core frequency limit, using a per socket model
+ *  P = a + u * (b + c * f^3) fitted while core energy can be read.
+ *  @{
+ */
+
+/**
+ *  @brief Sample the cores of a socket for the power model
+ *
+ *  @details This function reads the C0 residency and frequency limit of
+ *  the cores of @p sock_ind. With @p train set it also reads the core
+ *  energy and fits the model of the socket against the measured power.
+ *  Once the model is trained, updates without @p train avoid the cost of
+ *  reading core energy. Call this periodically, the interval between two
+ *  calls is the interval the estimates cover.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[in] train true to read core energy and fit the model.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_core_power_model_update(uint32_t sock_ind, bool train);
+
+/**
+ *  @brief Get the estimated power of a core
+ *
+ *  @details This function returns the modelled power of the physical core
+ *  of @p cpu_ind over the last esmi_core_power_model_update() interval of
+ *  its socket. The error bound is twice the RMS prediction error seen
+ *  while training, about a 95% bound for well behaved errors.
+ *
+ *  @param[in] cpu_ind a cpu index
+ *
+ *  @param[inout] ppower Input buffer to return the power in mW.
+ *
+ *  @param[inout] perror Input buffer to return the error bound in mW,
+ *  may be NULL.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_NO_DATA is returned until the model has enough
+ *  training samples.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_core_power_estimate_get(uint32_t cpu_ind, uint32_t *ppower,
+					   uint32_t *perror);
+
+/** @} */  // end of PowerEst
+
+/*****************************************************************************/
+
+/** @defgroup PhaseDet Workload phase detection
+ *  Below functions detect workload phase changes online from socket power,
+ *  C0 residency, DDR bandwidth utilization and the socket frequency limit,
+ *  using a CUSUM change point detector per signal and socket.
+ *  @{
+ */
+
+/**
+ * @brief Workload phase of a socket
+ */
+typedef enum {
+	ESMI_PHASE_UNKNOWN,		//!< not classified yet
+	ESMI_PHASE_IDLE,		//!< C0 residency below 10%
+	ESMI_PHASE_COMPUTE_BOUND,	//!< active with low DDR bandwidth use
+	ESMI_PHASE_MEMORY_BOUND,	//!< active with high DDR bandwidth use
+} esmi_phase_t;
+
+#define ESMI_PHASE_SIG_POWER		BIT(0)	//!< socket power changed
+#define ESMI_PHASE_SIG_C0		BIT(1)	//!< C0 residency changed
+#define ESMI_PHASE_SIG_DDR_BW		BIT(2)	//!< DDR bandwidth changed
+#define ESMI_PHASE_SIG_FREQ_LIMIT	BIT(3)	//!< frequency limit changed
+
+/**
+ * @brief Phase change event
+ */
+struct esmi_phase_event {
+	uint32_t sock_ind;		//!< socket index
+	uint64_t time_ns;		//!< CLOCK_MONOTONIC time of the change
+	esmi_phase_t prev_phase;	//!< phase before the change
+	esmi_phase_t phase;		//!< phase after the change
+	uint32_t signals;		//!< ESMI_PHASE_SIG_* change points seen
+	uint32_t power;			//!< socket power in mW
+	uint32_t c0_residency;		//!< socket C0 residency in %
+	uint32_t ddr_bw_pct;		//!< DDR bandwidth utilization in %
+	uint16_t freq_limit;		//!< socket frequency limit in MHz
+	uint16_t freq_limit_src;	//!< bit mask of frequency limit sources
+};
+
+/**
+ *  @brief Sample a socket and detect phase changes
+ *
+ *  @details This function samples the signals of @p sock_ind once and
+ *  feeds them to the change point detectors. Signals whose HSMP message is
+ *  not supported on the platform are skipped. It costs four HSMP messages
+ *  and no allocation, which is cheap enough to run at 10Hz.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[inout] event Input buffer to return the phase change, only set
+ *  if @p changed is true.
+ *
+ *  @param[inout] changed Input buffer set to true if the phase changed.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_phase_tick(uint32_t sock_ind, struct esmi_phase_event *event,
+			      bool *changed);
+
+/**
+ *  @brief Get the current phase of a socket
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[inout] phase Input buffer to return the phase.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_phase_get(uint32_t sock_ind, esmi_phase_t *phase);
+
+/**
+ *  @brief Get the label of a phase
+ *
+ *  @param[in] phase a phase
+ *
+ *  @retval Pointer to the label, e.g. "memory-bound".
+ *
+ */
+char *esmi_phase_name(esmi_phase_t phase);
+
+/** @} */  // end of PhaseDet
+
+/*****************************************************************************/
+
+/** @defgroup ThrottlePred Time to throttle prediction
+ *  Below functions predict how long a socket runs before power (PPT) or
+ *  thermal throttling starts, from a short power trend window and a first
+ *  order thermal RC model learned per socket.
+ *  @{
+ */
+
+/**
+ * @brief Limit expected to throttle the socket first
+ */
+typedef enum {
+	ESMI_THROTTLE_NONE,		//!< no throttling within the horizon
+	ESMI_THROTTLE_POWER,		//!< socket power reaches the power cap
+	ESMI_THROTTLE_THERMAL,		//!< temperature limit or PROCHOT
+} esmi_throttle_t;
+
+/**
+ *  @brief Sample a socket for the time to throttle predictor
+ *
+ *  @details This function reads the socket power, power cap, temperature
+ *  and PROCHOT status of @p sock_ind and updates the power trend and the
+ *  thermal model in constant time. Call this periodically, e.g. every
+ *  100ms to 1s; the trend window covers the last 32 samples.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_throttle_sample(uint32_t sock_ind);
+
+/**
+ *  @brief Set the temperature limit used for thermal predictions
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[in] temp_limit temperature limit in milli degree celsius,
+ *  95000 by default.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_throttle_temp_limit_set(uint32_t sock_ind, uint32_t temp_limit);
+
+/**
+ *  @brief Get the predicted time until a socket throttles
+ *
+ *  @details This function returns the time until the extrapolated socket
+ *  power reaches the power cap or the thermal model reaches the
+ *  temperature limit, whichever comes first, as of the last
+ *  esmi_throttle_sample() call. The time is 0 while the socket throttles
+ *  and INFINITY if no throttling is expected within 600 seconds.
+ *  The confidence is between 0 and 1, it grows with the number of samples
+ *  and with how well the trend or the thermal model fit them.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[inout] ptime Input buffer to return the time in seconds.
+ *
+ *  @param[inout] pconfidence Input buffer to return the confidence.
+ *
+ *  @param[inout] pcause Input buffer to return the limit expected to
+ *  throttle first.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_NO_DATA is returned if the socket was not sampled.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_time_to_throttle_get(uint32_t sock_ind, float *ptime,
+					float *pconfidence, esmi_throttle_t *pcause);
+
+/** @} */  // end of ThrottlePred
+
+/*****************************************************************************/
+
+/** @defgroup SamplerRt Sampler runtime
+ *  Below functions configure and run the background sampler thread which
+ *  executes the library's periodic sampling tasks. The thread sleeps on an
+ *  absolute CLOCK_MONOTONIC schedule, can be pinned and run as SCHED_FIFO,
+ *  and the buffers it touches are locked and pre-faulted so that steady
+ *  state sampling does not page fault.
+ *  @{
+ */
+
+#define ESMI_SAMPLER_MAX_TASKS		16	//!< maximum number of tasks
+#define ESMI_SAMPLER_HIST_BUCKETS	16	//!< lateness histogram buckets
+#define ESMI_SAMPLER_NAME_LEN		16	//!< task name length
+#define ESMI_SAMPLER_MAX_SCALE		64	//!< most a task rate is lowered by
+
+/**
+ * @brief Sampler runtime configuration
+ */
+struct esmi_sampler_config {
+	uint64_t period_ns;	//!< tick period, 1ms by default
+	int32_t cpu;		//!< cpu to pin to, -1 for a housekeeping cpu
+				//!< of @p sock_ind, the first cpu of the
+				//!< socket which is not isolated or nohz_full
+	uint32_t sock_ind;	//!< sampled socket, used to pick the cpu
+	int32_t sched_priority;	//!< SCHED_FIFO priority, 0 keeps SCHED_OTHER
+	bool lock_memory;	//!< mlock the buffers and the thread stack
+	bool hugepages;		//!< back the buffers with hugepages
+	bool prefault;		//!< touch every page before sampling starts
+	uint32_t arena_size;	//!< bytes reserved for sampling buffers
+};
+
+/**
+ * @brief Sampler timing statistics
+ *
+ * Lateness is the time between the deadline of a tick and the wake up of
+ * the thread. hist[0] counts ticks less than 1us late, hist[i] ticks
+ * between 2^(i-1) and 2^i us late, the last bucket also counts anything
+ * later. A deadline miss is a tick skipped because the previous one woke
+ * up more than one period late.
+ */
+struct esmi_sampler_jitter {
+	uint64_t ticks;					//!< ticks run
+	uint64_t deadline_misses;			//!< ticks skipped
+	uint64_t max_lateness_ns;			//!< worst lateness
+	uint64_t hist[ESMI_SAMPLER_HIST_BUCKETS];	//!< lateness histogram
+};
+
+/**
+ * @brief Sampler CPU usage against its budget
+ *
+ * Usage is the sampler thread CPU time of the last budget window, one
+ * second or 8 ticks whichever is longer, in parts per million of one cpu.
+ * System calls count the reads, writes and ioctls, HSMP and MSR batch
+ * included, that the library issued on the sampler thread. Those of tasks
+ * added by the caller are only counted when they go through the library.
+ */
+struct esmi_sampler_usage {
+	uint32_t budget_ppm;	//!< budget, 0 if none
+	uint32_t usage_ppm;	//!< usage of the last window
+	uint64_t syscalls_per_s;	//!< library system calls per second
+	uint32_t throttled;	//!< tasks running below their requested rate
+};
+
+/**
+ * @brief Active rate of a sampler task
+ */
+struct esmi_sampler_rate {
+	char name[ESMI_SAMPLER_NAME_LEN];	//!< library task name, empty
+						//!< for tasks added by the caller
+	uint32_t task_id;	//!< id returned by esmi_sampler_task_add()
+	uint32_t divider;	//!< requested divider
+	uint32_t scale;		//!< budget throttling, the task runs every
+				//!< @p divider * @p scale ticks
+	uint64_t period_ns;	//!< active period of the task
+	uint64_t cost_ns;	//!< CPU time of the task in the last window,
+				//!< measured only while a budget is set
+};
+
+/**
+ *  @brief Set the sampler configuration
+ *
+ *  @details The configuration applies on the next esmi_sampler_start().
+ *  @p hugepages and @p arena_size can not change anymore once a subsystem
+ *  reserved sampling buffers. Without reserved hugepages the buffers are
+ *  backed by transparent hugepages where available.
+ *
+ *  @param[in] cfg the configuration.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_DEV_BUSY is returned while the sampler runs or the
+ *  buffers are in use.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_sampler_config_set(const struct esmi_sampler_config *cfg);
+
+/**
+ *  @brief Get the sampler configuration
+ *
+ *  @details While the sampler runs, @p cpu is the cpu it is pinned to.
+ *
+ *  @param[inout] cfg Input buffer to return the configuration.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_sampler_config_get(struct esmi_sampler_config *cfg);
+
+/**
+ *  @brief Add a task to the sampler
+ *
+ *  @details @p fn is called with @p arg from the sampler thread every
+ *  @p divider ticks. Tasks can be added while the sampler runs. Tasks
+ *  run with the sampler task lock held, so a task must not add or remove
+ *  sampler tasks, esmi_sampler_task_remove() from a task deadlocks.
+ *
+ *  @param[in] fn the task function.
+ *
+ *  @param[in] arg argument passed to @p fn.
+ *
+ *  @param[in] divider run the task every @p divider ticks.
+ *
+ *  @param[inout] task_id Input buffer to return the task id.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_sampler_task_add(void (*fn)(void *arg), void *arg,
+				    uint32_t divider, uint32_t *task_id);
+
+/**
+ *  @brief Remove a task from the sampler
+ *
+ *  @details Once this returns the task is not running and is not called
+ *  again. Must not be called from a sampler task.
+ *
+ *  @param[in] task_id a task id returned by esmi_sampler_task_add().
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_sampler_task_remove(uint32_t task_id);
+
+/**
+ *  @brief Start the sampler thread
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_PERMISSION is returned if memory could not be locked or
+ *  SCHED_FIFO is not permitted.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_sampler_start(void);
+
+/**
+ *  @brief Stop the sampler thread
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *
+ */
+esmi_status_t esmi_sampler_stop(void);
+
+/**
+ *  @brief Get the sampler timing statistics
+ *
+ *  @param[inout] stats Input buffer to return the statistics.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_sampler_jitter_get(struct esmi_sampler_jitter *stats);
+
+/**
+ *  @brief Reset the sampler timing statistics
+ */
+void esmi_sampler_jitter_reset(void);
+
+/**
+ *  @brief Set the sampler CPU budget
+ *
+ *  @details While the sampler thread uses more than @p budget_ppm of one
+ *  cpu, the rates of the tasks that cost the most, such as the DIMM and
+ *  power breakdown sweeps, are halved until the estimated usage fits, down
+ *  to 1/::ESMI_SAMPLER_MAX_SCALE of the requested rate. Once the usage is
+ *  below half the budget the rates are doubled back one task per window.
+ *  A budget of 0 restores every rate and stops the accounting.
+ *
+ *  @param[in] budget_ppm budget in parts per million of one cpu, e.g. 5000
+ *  for 0.5%, at most 1000000.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_INVALID_INPUT is returned if the budget exceeds one cpu.
+ *
+ */
+esmi_status_t esmi_sampler_budget_set(uint32_t budget_ppm);
+
+/**
+ *  @brief Get the sampler CPU usage
+ *
+ *  @param[inout] usage Input buffer to return the usage.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_sampler_usage_get(struct esmi_sampler_usage *usage);
+
+/**
+ *  @brief Get the active rates of the sampler tasks
+ *
+ *  @param[inout] rates Input buffer of @p max entries.
+ *
+ *  @param[in] max number of entries in @p rates.
+ *
+ *  @param[inout] count Input buffer to return the number of tasks.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_sampler_rates_get(struct esmi_sampler_rate *rates, uint32_t max,
+				     uint32_t *count);
+
+/** @} */  // end of SamplerRt
+
+/*****************************************************************************/
+
+/** @defgroup DiagEvents Diagnostic events
+ *  Failed HSMP, energy, MSR and sysfs driver calls, including the batch
+ *  reads behind esmi_all_energies_get() and the core activity, failed
+ *  initialization, the rejected arguments and unsupported HSMP messages
+ *  of the energy, HSMP and system management functions, and optionally
+ *  slow driver calls, are recorded in a per process lock-free
+ *  ring of the last 1024 events.
+ *  Recording costs a few atomic operations and nothing is reported until
+ *  the ring is drained.
+ *  @{
+ */
+
+#define ESMI_EVENT_ERROR	BIT(0)	//!< the driver call failed
+#define ESMI_EVENT_SLOW		BIT(1)	//!< the call exceeded the threshold
+
+/**
+ * @brief Diagnostic event
+ */
+struct esmi_event {
+	uint64_t time_ns;	//!< CLOCK_MONOTONIC time the call returned
+	uint64_t latency_ns;	//!< call latency, 0 without a slow threshold
+	const char *api;	//!< name of the public function, or of the
+				//!< sampler task for background reads
+	uint32_t index;		//!< socket index for HSMP calls, energy
+				//!< sensor or cpu index otherwise, 0 for
+				//!< checks and whole batches
+	uint32_t msg_id;	//!< HSMP message id, 0 for energy reads
+	int32_t err;		//!< errno of the driver call, 0 for checks
+	esmi_status_t status;	//!< esmi status of the call
+	uint32_t flags;		//!< ESMI_EVENT_* reasons the call was recorded
+};
+
+/**
+ *  @brief Set the slow call threshold
+ *
+ *  @details Calls taking at least @p threshold_ns are recorded with
+ *  ::ESMI_EVENT_SLOW. With the default of 0 only failed calls are
+ *  recorded and calls are not timed.
+ *
+ *  @param[in] threshold_ns threshold in nano seconds, 0 to disable.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *
+ */
+esmi_status_t esmi_event_slow_threshold_set(uint64_t threshold_ns);
+
+/**
+ *  @brief Drain recorded events
+ *
+ *  @details This function copies up to @p max of the oldest events not
+ *  drained yet, in the order they were recorded. Events overwritten before
+ *  they were drained are counted in @p lost.
+ *
+ *  @param[inout] events Input buffer of @p max events.
+ *
+ *  @param[in] max number of entries in @p events.
+ *
+ *  @param[inout] count Input buffer to return the number of events copied.
+ *
+ *  @param[inout] lost Input buffer to return the number of events lost,
+ *  may be NULL.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_events_drain(struct esmi_event *events, uint32_t max,
+				uint32_t *count, uint64_t *lost);
+
+/** @} */  // end of DiagEvents
+
+/*****************************************************************************/
+
+/** @defgroup DimmEnergy DIMM energy accumulators
+ *  Below functions integrate the DIMM power sensors into per DIMM and per
+ *  socket energy counters in micro Joules. Readings are integrated with
+ *  the trapezoidal rule at the time the sensor took them, gaps longer than
+ *  a second are integrated with the last power held and counted as stale.
+ *  The populated DIMMs are found by probing the DIMM address space once
+ *  per socket.
+ *  @{
+ */
+
+#define ESMI_DIMM_MAX		32	//!< maximum DIMMs tracked per socket
+
+/**
+ * @brief DIMM energy accumulator
+ */
+struct esmi_dimm_energy {
+	uint8_t dimm_addr;	//!< DIMM address
+	uint16_t power;		//!< last power reading in mW
+	uint64_t energy;	//!< accumulated energy in uJ
+	uint64_t stale_ms;	//!< time integrated with the power held
+	uint64_t readings;	//!< sensor readings integrated
+};
+
+/**
+ *  @brief Sample the DIMM power sensors of a socket
+ *
+ *  @details This function reads every populated DIMM of @p sock_ind once
+ *  and integrates new readings. The first call on a socket probes the
+ *  populated DIMMs. Use it when the sampler runtime is not used, the
+ *  sensors update every few ms so sampling more often adds nothing.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_dimm_energy_sample(uint32_t sock_ind);
+
+/**
+ *  @brief Sample the DIMM power sensors from the sampler
+ *
+ *  @details This function probes the populated DIMMs of every socket and
+ *  adds a sampler task reading them every @p interval_ms. The sampler is
+ *  started with esmi_sampler_start().
+ *
+ *  @param[in] interval_ms sampling interval in ms
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_DEV_BUSY is returned if the task was added already.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_dimm_energy_start(uint32_t interval_ms);
+
+/**
+ *  @brief Remove the DIMM sampling task from the sampler
+ *
+ *  @details The accumulators keep their values.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *
+ */
+esmi_status_t esmi_dimm_energy_stop(void);
+
+/**
+ *  @brief Get the energy accumulators of the DIMMs of a socket
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[inout] energies Input buffer of @p max entries.
+ *
+ *  @param[in] max number of entries in @p energies, ::ESMI_DIMM_MAX
+ *  entries always fit.
+ *
+ *  @param[inout] count Input buffer to return the number of entries filled.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_NO_DATA is returned if the socket was not
+ *  sampled yet.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_dimm_energies_get(uint32_t sock_ind, struct esmi_dimm_energy *energies,
+				     uint32_t max, uint32_t *count);
+
+/**
+ *  @brief Get the DIMM energy of a socket
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[inout] penergy Input buffer to return the energy in uJ summed
+ *  over the DIMMs of the socket.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_NO_DATA is returned if the socket was not
+ *  sampled yet.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_socket_dimm_energy_get(uint32_t sock_ind, uint64_t *penergy);
+
+/**
+ *  @brief Get core, socket and DIMM energies in one call
+ *
+ *  @details Any of the buffers may be NULL. Sockets not sampled yet
+ *  report 0 DIMM energy.
+ *
+ *  @param[inout] core_energy Input buffer of one entry per physical core,
+ *  filled as by esmi_all_energies_get().
+ *
+ *  @param[inout] sock_energy Input buffer of one entry per socket for the
+ *  socket energy in uJ.
+ *
+ *  @param[inout] dimm_energy Input buffer of one entry per socket for the
+ *  DIMM energy in uJ.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_energies_bulk_get(uint64_t *core_energy, uint64_t *sock_energy,
+				     uint64_t *dimm_energy);
+
+/** @} */  // end of DimmEnergy
+
+/*****************************************************************************/
+
+/** @defgroup PowerBreakdown Per socket power breakdown
+ *  Below functions split the socket power into cores, uncore and memory.
+ *  A tick reads the package and core energy counters, the SVI rail power
+ *  and the DIMM power of all sockets back to back, and stores one record
+ *  per socket into a ring of the last ::ESMI_BREAKDOWN_HISTORY records.
+ *  @{
+ */
+
+#define ESMI_BREAKDOWN_HISTORY		256	//!< records kept per socket
+
+#define ESMI_BREAKDOWN_CORES_OVER_PACKAGE	BIT(0)	//!< core power exceeds
+							//!< the package power
+#define ESMI_BREAKDOWN_COUNTER_RESET	BIT(1)	//!< an energy counter went back,
+						//!< powers are not valid
+#define ESMI_BREAKDOWN_RAIL_MISMATCH	BIT(2)	//!< rails and package differ
+						//!< by more than 20%
+#define ESMI_BREAKDOWN_NO_RAILS		BIT(3)	//!< rail power not read
+#define ESMI_BREAKDOWN_NO_DIMM		BIT(4)	//!< DIMM power not read
+#define ESMI_BREAKDOWN_SKEW		BIT(5)	//!< the reads took more than
+						//!< a tenth of the interval
+
+/**
+ * @brief Power breakdown record of a socket, powers in mW
+ */
+struct esmi_power_breakdown {
+	uint64_t time_ns;	//!< CLOCK_MONOTONIC time of the sample
+	uint32_t interval_us;	//!< time since the previous sample
+	uint32_t package;	//!< package power from the socket energy
+	uint32_t cores;		//!< sum of the core power
+	uint32_t uncore;	//!< package minus cores, 0 if negative
+	uint32_t dimm;		//!< sum of the DIMM power
+	uint32_t rails;		//!< SVI power of all rails
+	uint16_t sock_ind;	//!< socket index
+	uint16_t flags;		//!< ESMI_BREAKDOWN_* consistency flags
+};
+
+/**
+ *  @brief Sample the power breakdown of all sockets
+ *
+ *  @details The first call only sets the baseline of the energy counters
+ *  and probes the DIMMs, later calls store one record per socket.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_power_breakdown_tick(void);
+
+/**
+ *  @brief Sample the power breakdown from the sampler
+ *
+ *  @details This function takes the baseline tick and adds a sampler task
+ *  ticking every @p interval_ms. The sampler is started with
+ *  esmi_sampler_start().
+ *
+ *  @param[in] interval_ms sampling interval in ms
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_DEV_BUSY is returned if the task was added already.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_power_breakdown_start(uint32_t interval_ms);
+
+/**
+ *  @brief Remove the power breakdown task from the sampler
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *
+ */
+esmi_status_t esmi_power_breakdown_stop(void);
+
+/**
+ *  @brief Read power breakdown records of a socket
+ *
+ *  @details This function moves up to @p max of the oldest records out of
+ *  the ring of @p sock_ind.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[inout] records Input buffer of @p max records.
+ *
+ *  @param[in] max number of entries in @p records.
+ *
+ *  @param[inout] count Input buffer to return the number of records read.
+ *
+ *  @param[inout] lost Input buffer to return the number of records
+ *  overwritten since the previous read, may be NULL.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_power_breakdown_read(uint32_t sock_ind,
+					struct esmi_power_breakdown *records,
+					uint32_t max, uint32_t *count, uint64_t *lost);
+
+/** @} */  // end of PowerBreakdown
+
+/*****************************************************************************/
+
+/** @defgroup ApuSplit MI300A power split
+ *  Below functions turn successive metrics tables of an MI300A socket
+ *  into the average power of the CPU, GPU, IO die and HBM domains and the
+ *  CPU and GPU busy fractions between them. The last ::ESMI_APU_HISTORY
+ *  samples are kept per socket.
+ *  @{
+ */
+
+#define ESMI_APU_HISTORY	64	//!< samples kept per socket
+
+/**
+ * @brief Power split of an MI300A socket over one interval, powers in mW
+ */
+struct esmi_apu_split {
+	uint64_t time_ns;	//!< CLOCK_MONOTONIC time of the table read
+	uint32_t interval_us;	//!< time since the previous new table
+	uint32_t ticks;		//!< SMU accumulation ticks in the interval
+	uint32_t sock_ind;	//!< socket index
+	uint32_t socket;	//!< socket power
+	uint32_t cpu;		//!< CCD power
+	uint32_t gpu;		//!< XCD power
+	uint32_t iod;		//!< AID power
+	uint32_t hbm;		//!< HBM power
+	float cpu_busy;		//!< average C0 residency, 0 to 1
+	float gpu_busy;		//!< average GFX busy, 0 to 1
+};
+
+/**
+ *  @brief Read the metrics table and add a power split sample
+ *
+ *  @details A sample is added when the SMU refreshed the table since the
+ *  previous call. The first call only sets the baseline.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[inout] updated Input buffer to return whether a sample was added.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_apu_split_update(uint32_t sock_ind, bool *updated);
+
+/**
+ *  @brief Get the power split history of a socket
+ *
+ *  @details This function copies the newest @p max samples, oldest first.
+ *  The history is not consumed.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[inout] splits Input buffer of @p max samples.
+ *
+ *  @param[in] max number of entries in @p splits.
+ *
+ *  @param[inout] count Input buffer to return the number of samples copied.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_apu_split_history_get(uint32_t sock_ind, struct esmi_apu_split *splits,
+					 uint32_t max, uint32_t *count);
+
+/** @} */  // end of ApuSplit
+
+/*****************************************************************************/
+
+/** @defgroup CoreRank Core performance ranking
+ *  Below functions rank the cpus of a socket by their frequency headroom,
+ *  the lower of the current frequency limit and the boost limit,
+ *  discounted by the load of the SMT siblings and by the recent power of
+ *  the core. The order is kept between updates and repaired
+ *  incrementally, a top k query costs O(k).
+ *  @{
+ */
+
+/**
+ *  @brief Refresh the core ranking of a socket
+ *
+ *  @details Loads and core power are measured over the interval since the
+ *  previous update of the socket, so the first update ranks by headroom
+ *  only. Call it periodically, e.g. every 100ms.
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_core_rank_update(uint32_t sock_ind);
+
+/**
+ *  @brief Get the best ranked cpus of a socket
+ *
+ *  @param[in] sock_ind a socket index
+ *
+ *  @param[in] k number of cpus requested
+ *
+ *  @param[inout] cpu_list Input buffer of @p k entries to return the cpus,
+ *  best first.
+ *
+ *  @param[inout] scores Input buffer of @p k entries to return the scores
+ *  in MHz, may be NULL.
+ *
+ *  @param[inout] count Input buffer to return the number of cpus returned.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_NO_DATA is returned if the socket was not
+ *  ranked yet.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_core_rank_topk_get(uint32_t sock_ind, uint32_t k, uint32_t *cpu_list,
+				      uint32_t *scores, uint32_t *count);
+
+/** @} */  // end of CoreRank
+
+/*****************************************************************************/
+
+/** @defgroup EnergyBudget Per cgroup energy budgets
+ *  Below functions charge cgroups for the energy of the cores they run on
+ *  and lower the boost limit of those cores as a cgroup approaches its
+ *  energy budget for the current window. Limits are written through the
+ *  diff based batch writer.
+ *  @{
+ */
+
+#define ESMI_BUDGET_MAX		16	//!< maximum number of budgets
+
+/**
+ * @brief Energy budget of a cgroup
+ */
+struct esmi_energy_budget {
+	uint64_t budget_uj;	//!< energy allowed per window in uJ
+	uint32_t window_s;	//!< window length in seconds, e.g. 3600
+	uint32_t ramp_pct;	//!< share of the budget used before throttling
+				//!< starts, below 100
+	uint32_t boost_max;	//!< boost limit in MHz while not throttled
+	uint32_t boost_min;	//!< boost limit in MHz once the budget is used
+};
+
+/**
+ * @brief Energy budget state of a cgroup
+ */
+struct esmi_energy_budget_status {
+	uint64_t consumed_uj;		//!< energy charged in the current window
+	uint64_t window_left_ms;	//!< time until the window rolls over
+	uint32_t boostlimit;		//!< current boost limit in MHz
+};
+
+/**
+ *  @brief Add an energy budget for a cgroup
+ *
+ *  @param[in] cgroup_path path of the cgroup, absolute or relative to
+ *  /sys/fs/cgroup.
+ *
+ *  @param[in] cfg the budget.
+ *
+ *  @param[inout] budget_id Input buffer to return the budget id.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_DEV_BUSY is returned if ::ESMI_BUDGET_MAX budgets are
+ *  in use.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_energy_budget_add(const char *cgroup_path,
+				     const struct esmi_energy_budget *cfg,
+				     uint32_t *budget_id);
+
+/**
+ *  @brief Remove an energy budget
+ *
+ *  @details The cores throttled for it are restored by the next apply.
+ *
+ *  @param[in] budget_id a budget id returned by esmi_energy_budget_add().
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_energy_budget_remove(uint32_t budget_id);
+
+/**
+ *  @brief Charge the budgets and apply the boost limits
+ *
+ *  @details This function charges every cgroup for the energy used since
+ *  the previous call and writes the boost limits which changed. Call it
+ *  periodically, e.g. every second.
+ *
+ *  @param[inout] nwrites Input buffer to return the number of boost limit
+ *  writes, may be NULL.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure, the limits of the other
+ *  cgroups are applied even if one cgroup could not be read.
+ *
+ */
+esmi_status_t esmi_energy_budget_apply(uint32_t *nwrites);
+
+/**
+ *  @brief Get the state of an energy budget
+ *
+ *  @param[in] budget_id a budget id returned by esmi_energy_budget_add().
+ *
+ *  @param[inout] status Input buffer to return the state.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_energy_budget_status_get(uint32_t budget_id,
+					    struct esmi_energy_budget_status *status);
+
+/** @} */  // end of EnergyBudget
+
+/*****************************************************************************/
+
+/** @defgroup FlightRec Flight recorder
+ *  Below functions record socket power, temperature, frequency limit,
+ *  C0 residency and PROCHOT at a high rate on the sampler into a fixed
+ *  ring, and freeze the samples around a trigger so that transient events
+ *  shorter than the usual monitoring interval can be looked at afterwards.
+ *  @{
+ */
+
+#define ESMI_FLIGHT_RING		4096	//!< samples kept per socket
+#define ESMI_FLIGHT_MAX_TRIGGERS	8	//!< trigger conditions
+#define ESMI_FLIGHT_EXTERNAL		0xFFFFFFFF	//!< trigger index of
+							//!< esmi_flight_recorder_trigger()
+#define ESMI_FLIGHT_MAGIC		"ESMIFLT1"	//!< dump file magic
+#define ESMI_FLIGHT_VERSION		1	//!< dump file version
+
+#define ESMI_FLIGHT_HAS_POWER		BIT(0)	//!< power was read
+#define ESMI_FLIGHT_HAS_TEMP		BIT(1)	//!< temperature was read
+#define ESMI_FLIGHT_HAS_LIMIT		BIT(2)	//!< frequency limit was read
+#define ESMI_FLIGHT_HAS_C0		BIT(3)	//!< C0 residency was read
+#define ESMI_FLIGHT_HAS_PROCHOT		BIT(4)	//!< PROCHOT was read
+
+/**
+ * @brief Flight recorder sample, 24 bytes
+ */
+struct esmi_flight_sample {
+	uint64_t time_ns;	//!< CLOCK_MONOTONIC time of the sample
+	uint32_t power;		//!< socket power in mW
+	uint32_t temp;		//!< socket temperature in milli degree celsius
+	uint16_t freq_limit;	//!< frequency limit in MHz
+	uint16_t limit_mask;	//!< frequency limit sources
+	uint8_t c0;		//!< C0 residency in percent
+	uint8_t prochot;	//!< PROCHOT status
+	uint8_t valid;		//!< ESMI_FLIGHT_HAS_* fields read
+	uint8_t sock_ind;	//!< socket index
+};
+
+/**
+ * @brief Sample field a trigger looks at
+ */
+typedef enum {
+	ESMI_FLIGHT_POWER,		//!< socket power in mW
+	ESMI_FLIGHT_TEMP,		//!< temperature in milli degree celsius
+	ESMI_FLIGHT_FREQ_LIMIT,		//!< frequency limit in MHz
+	ESMI_FLIGHT_LIMIT_MASK,		//!< frequency limit sources
+	ESMI_FLIGHT_C0,			//!< C0 residency in percent
+	ESMI_FLIGHT_PROCHOT,		//!< PROCHOT status
+} esmi_flight_field_t;
+
+/**
+ * @brief Trigger condition on a field
+ */
+typedef enum {
+	ESMI_FLIGHT_ABOVE,		//!< field above value
+	ESMI_FLIGHT_BELOW,		//!< field below value
+	ESMI_FLIGHT_BITS_SET,		//!< a bit of value appears in the field
+	ESMI_FLIGHT_RISE,		//!< field rose by more than value
+					//!< since the previous sample
+	ESMI_FLIGHT_CHANGED,		//!< field differs from the previous sample
+} esmi_flight_op_t;
+
+/**
+ * @brief Trigger, a sample of any socket matching it fires the recorder
+ */
+struct esmi_flight_trigger {
+	uint32_t field;		//!< ::esmi_flight_field_t
+	uint32_t op;		//!< ::esmi_flight_op_t
+	uint32_t value;		//!< threshold, step or bit mask
+};
+
+/**
+ * @brief Flight recorder configuration
+ */
+struct esmi_flight_config {
+	uint32_t interval_us;	//!< sampling interval, rounded to sampler ticks
+	uint32_t pre_ms;	//!< window kept before the trigger
+	uint32_t post_ms;	//!< window recorded after the trigger
+	uint32_t ntriggers;	//!< number of entries in @p triggers
+	struct esmi_flight_trigger triggers[ESMI_FLIGHT_MAX_TRIGGERS];	//!< triggers
+};
+
+/**
+ * @brief Flight recorder state
+ */
+struct esmi_flight_status {
+	uint64_t samples;	//!< ticks recorded
+	uint64_t triggers;	//!< trigger conditions fired
+	uint64_t windows;	//!< windows frozen
+	uint64_t dropped;	//!< triggers lost to a window not dumped yet
+	bool armed;		//!< recording the post trigger window
+	bool ready;		//!< a frozen window waits to be dumped
+};
+
+/**
+ * @brief Dump file header, followed by @p nsamples samples of
+ * @p sample_size bytes each in the byte order of the host
+ */
+struct esmi_flight_header {
+	char magic[8];		//!< ::ESMI_FLIGHT_MAGIC without the terminator
+	uint32_t version;	//!< ::ESMI_FLIGHT_VERSION
+	uint32_t sample_size;	//!< size of struct esmi_flight_sample
+	uint32_t nsamples;	//!< samples in the file, socket by socket,
+				//!< oldest first
+	uint32_t interval_us;	//!< sampling interval
+	uint64_t trigger_ns;	//!< CLOCK_MONOTONIC time of the trigger
+	uint32_t pre_ms;	//!< window before the trigger
+	uint32_t post_ms;	//!< window after the trigger
+	uint32_t trigger_sock;	//!< socket whose sample fired the trigger
+	uint32_t trigger_index;	//!< index of the trigger, or
+				//!< ::ESMI_FLIGHT_EXTERNAL
+};
+
+/**
+ *  @brief Start the flight recorder
+ *
+ *  @details Adds the recording task to the sampler, which has to be
+ *  started with esmi_sampler_start(). Every sample costs five HSMP or
+ *  sysfs reads per socket, fields the platform does not support are left
+ *  out after the first read. The pre and post windows together have to
+ *  fit ::ESMI_FLIGHT_RING samples.
+ *
+ *  @param[in] cfg the configuration.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_DEV_BUSY is returned if the recorder runs already.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_flight_recorder_start(const struct esmi_flight_config *cfg);
+
+/**
+ *  @brief Stop the flight recorder
+ *
+ *  @details A frozen window stays available to esmi_flight_recorder_dump().
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *
+ */
+esmi_status_t esmi_flight_recorder_stop(void);
+
+/**
+ *  @brief Fire the flight recorder from the caller
+ *
+ *  @details The trigger takes effect on the next recorder tick.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_NOT_INITIALIZED is returned if the recorder is not
+ *  running.
+ *
+ */
+esmi_status_t esmi_flight_recorder_trigger(void);
+
+/**
+ *  @brief Get the flight recorder state
+ *
+ *  @param[inout] st Input buffer to return the state.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_flight_recorder_status_get(struct esmi_flight_status *st);
+
+/**
+ *  @brief Write the frozen window to a file
+ *
+ *  @details The file holds a struct esmi_flight_header followed by the
+ *  samples. Once written, the recorder can freeze the next window. Without
+ *  a frozen window nothing is written and @p nsamples is 0.
+ *
+ *  @param[in] path file to write.
+ *
+ *  @param[inout] nsamples Input buffer to return the number of samples
+ *  written.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_flight_recorder_dump(const char *path, uint32_t *nsamples);
+
+/** @} */  // end of FlightRec
+
+/*****************************************************************************/
+
+/** @defgroup AdaptiveSweep Adaptive core energy sweep
+ *  Below functions read the core energies like esmi_all_energies_get(),
+ *  but read idle cores less often. Whether a core is idle comes from the
+ *  per cpu idle times of /proc/stat since the previous sweep. The energy
+ *  of a core not read is extrapolated from its last measured power and
+ *  corrected by its next real read.
+ *  @{
+ */
+
+/**
+ * @brief Adaptive sweep statistics
+ */
+struct esmi_energy_sweep_stats {
+	uint64_t sweeps;	//!< sweeps done
+	uint64_t reads;		//!< core energy reads
+	uint64_t skipped;	//!< core energies extrapolated
+	uint32_t cores;		//!< physical cores per sweep
+	uint32_t reduction_ppm;	//!< share of the reads saved, parts per million
+	uint64_t max_correction;	//!< worst difference between an
+					//!< extrapolation and the next read in uJ
+	uint64_t error_bound;	//!< bound of the error of the last sweep summed
+				//!< over the extrapolated cores in uJ
+};
+
+/**
+ *  @brief Get the energy of all physical cores, reading busy ones only
+ *
+ *  @details Like esmi_all_energies_get() this function fills one entry per
+ *  physical core. A core whose SMT siblings were all busy for less than the
+ *  idle threshold since the previous sweep is read every max_skip sweeps
+ *  only, in between its energy is extrapolated. Reported energies never
+ *  decrease: when a real read comes in below the extrapolation, the
+ *  reported value is held until the counter passes it.
+ *
+ *  @param[inout] penergy Input buffer of one entry per physical core to
+ *  return the energies in micro Joules.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_energy_sweep_get(uint64_t *penergy);
+
+/**
+ *  @brief Configure the adaptive sweep
+ *
+ *  @details The defaults are 5% and 8 sweeps. A threshold of 0 reads every
+ *  core on every sweep.
+ *
+ *  @param[in] idle_threshold_pct busy share of the interval, in percent,
+ *  below which a core counts as idle.
+ *
+ *  @param[in] max_skip_sweeps an idle core is read every @p max_skip_sweeps
+ *  sweeps.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_energy_sweep_config_set(uint32_t idle_threshold_pct,
+					   uint32_t max_skip_sweeps);
+
+/**
+ *  @brief Get the adaptive sweep statistics
+ *
+ *  @param[inout] st Input buffer to return the statistics.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_energy_sweep_stats_get(struct esmi_energy_sweep_stats *st);
+
+/** @} */  // end of AdaptiveSweep
+
+/*****************************************************************************/
+/** @defgroup CoreActivity Effective core frequency
+ *  Below functions sample the APERF and MPERF counters of every cpu
+ *  together with the core energies. MPERF counts at the reference (P0)
+ *  frequency while a cpu is in C0, APERF at the frequency it actually
+ *  runs at, so over an interval their ratio times the reference frequency
+ *  is the effective frequency while active. The reference frequency is
+ *  measured against the TSC, which counts at the same rate.
+ *  @{
+ */
+
+/**
+ * @brief Activity of a physical core over the interval between two sweeps
+ */
+struct esmi_core_activity {
+	uint64_t interval_ns;	//!< length of the interval, 0 on the first sweep
+	uint64_t energy;	//!< energy over the interval in micro Joules
+	uint32_t power;		//!< average power over the interval in mW
+	uint32_t eff_freq;	//!< effective frequency while in C0 in MHz
+	uint32_t ref_freq;	//!< reference (P0) frequency in MHz
+	uint32_t busy_ppm;	//!< share of the interval the busiest SMT
+				//!< sibling spent in C0, parts per million
+};
+
+/**
+ *  @brief Get the effective frequency and power of all physical cores
+ *
+ *  @details Each call is one sweep: the APERF and MPERF counters of all
+ *  cpus are read in one batch (with msr_safe) or one read per counter,
+ *  then the core energies, and the entries describe the interval since
+ *  the previous sweep, so frequency and power cover the same time. The
+ *  frequency of a core is averaged over its SMT siblings weighted by
+ *  their time in C0. The first sweep only sets the baseline and returns
+ *  entries with an interval of 0. The counters are read through the
+ *  msr_safe or msr driver, see --writemsrallowlist of e_smi_tool.
+ *
+ *  @param[inout] act Input buffer of one entry per physical core.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_core_activity_get(struct esmi_core_activity *act);
+
+/** @} */  // end of CoreActivity
+
+/*****************************************************************************/
+/** @defgroup IdleResidency Core idle state residency
+ *  Below functions sample the cpuidle time and usage counters of every
+ *  cpu in the same pass as the core energies, so that the idle state
+ *  residency of a core and its energy cover the same interval.
+ *  @{
+ */
+
+#define ESMI_IDLE_MAX_STATES	10	//!< idle states sampled per cpu
+#define ESMI_IDLE_NAME_LEN	16	//!< length of an idle state name
+
+/**
+ * @brief Snapshot of all physical cores over the interval between two
+ * sweeps, in structure of arrays layout. The arrays are provided by the
+ * caller, the per state arrays hold the row of core c at c * states.
+ */
+struct esmi_idle_snapshot {
+	uint64_t interval_ns;	//!< length of the interval, 0 on the first sweep
+	uint32_t cores;		//!< physical cores, set by the call
+	uint32_t states;	//!< idle states per core, set by the call
+	uint64_t *energy;	//!< [cores] energy over the interval in micro Joules
+	uint32_t *power;	//!< [cores] average power in mW
+	uint32_t *residency;	//!< [cores * states] share of the interval spent
+				//!< in each state averaged over the SMT siblings, ppm
+	uint32_t *entries;	//!< [cores * states] entries into each state
+				//!< summed over the SMT siblings
+};
+
+/**
+ *  @brief Get the idle states sampled by esmi_idle_residency_get()
+ *
+ *  @param[inout] nstates Input buffer to return the number of states.
+ *
+ *  @param[inout] names Input buffer of ::ESMI_IDLE_MAX_STATES entries to
+ *  return the state names in, may be NULL.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_idle_states_get(uint32_t *nstates,
+				   char names[][ESMI_IDLE_NAME_LEN]);
+
+/**
+ *  @brief Get the idle state residency and energy of all physical cores
+ *
+ *  @details Each call is one sweep over the cached cpuidle counter fds of
+ *  all cpus followed by esmi_all_energies_get(). The snapshot describes
+ *  the interval since the previous sweep, the first sweep only sets the
+ *  baseline and returns an interval of 0 with zeroed arrays.
+ *
+ *  @param[inout] snap Input snapshot with the arrays sized for the number
+ *  of physical cores and the number of states of esmi_idle_states_get().
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_idle_residency_get(struct esmi_idle_snapshot *snap);
+
+/** @} */  // end of IdleResidency
+
+/*****************************************************************************/
+/** @defgroup PowerDomains Energy and power domains
+ *  Below functions present every energy and power reading of the platform
+ *  as a domain with a type, a parent, a unit and the source it is read
+ *  from, and read any set of domains in one call. The domains are
+ *  enumerated once, which probes the DIMMs of every socket.
+ *  @{
+ */
+
+#define ESMI_DOMAIN_NONE	0xFFFFFFFF	//!< parent of a top level domain
+
+/**
+ * @brief Domain types
+ */
+typedef enum {
+	ESMI_DOMAIN_SOCKET,	//!< socket package energy
+	ESMI_DOMAIN_CORE,	//!< physical core energy
+	ESMI_DOMAIN_DIMM,	//!< DIMM energy integrated from its power sensor
+	ESMI_DOMAIN_RAILS,	//!< SVI power of all rails of a socket
+	ESMI_DOMAIN_CCD,	//!< MI300A CPU dies energy
+	ESMI_DOMAIN_XCD,	//!< MI300A GPU dies energy
+	ESMI_DOMAIN_AID,	//!< MI300A IO dies energy
+	ESMI_DOMAIN_HBM,	//!< MI300A HBM energy
+	ESMI_DOMAIN_TYPE_MAX
+} esmi_domain_type_t;
+
+/**
+ * @brief Domain units
+ */
+typedef enum {
+	ESMI_DOMAIN_UJ,		//!< accumulated energy in micro Joules
+	ESMI_DOMAIN_MW,		//!< instantaneous power in milli Watts
+} esmi_domain_unit_t;
+
+/**
+ * @brief Sources behind the domains
+ */
+typedef enum {
+	ESMI_SOURCE_ENERGY,	//!< energy counters, as by esmi_core_energy_get()
+				//!< and esmi_socket_energy_get()
+	ESMI_SOURCE_DIMM,	//!< HSMP DIMM power sensors
+	ESMI_SOURCE_SVI,	//!< HSMP SVI rail telemetry
+	ESMI_SOURCE_METRICS,	//!< HSMP metrics table accumulators
+} esmi_domain_source_t;
+
+/**
+ * @brief Description of a domain
+ */
+struct esmi_domain {
+	uint32_t id;		//!< domain id, the index in the enumeration
+	uint32_t parent;	//!< id of the parent domain or ::ESMI_DOMAIN_NONE
+	uint32_t sock_ind;	//!< socket of the domain
+	uint32_t index;		//!< core index, DIMM address, else the socket
+	uint8_t type;		//!< ::esmi_domain_type_t
+	uint8_t unit;		//!< ::esmi_domain_unit_t
+	uint8_t source;		//!< ::esmi_domain_source_t
+};
+
+/**
+ * @brief Reading of a domain
+ */
+struct esmi_domain_reading {
+	uint64_t value;		//!< energy or power in the unit of the domain
+	uint64_t time_ns;	//!< CLOCK_MONOTONIC time of the underlying read
+	esmi_status_t status;	//!< status of the read of this domain
+};
+
+/**
+ *  @brief Enumerate the energy and power domains
+ *
+ *  @details Sockets come first, then the cores, DIMMs, rails and the
+ *  MI300A dies. A core and a DIMM have their socket as parent. The first
+ *  call probes the sources, later calls return the same domains.
+ *
+ *  @param[inout] domains Input buffer of @p max entries, may be NULL to
+ *  get the count only.
+ *
+ *  @param[in] max number of entries in @p domains.
+ *
+ *  @param[inout] count Input buffer to return the number of domains.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_domains_get(struct esmi_domain *domains, uint32_t max,
+			       uint32_t *count);
+
+/**
+ *  @brief Read a set of domains
+ *
+ *  @details The requested domains are grouped into the fewest reads of
+ *  their sources: one batch for all cores, and per socket at most one
+ *  socket energy read, one DIMM sensor sweep, one rail read and one
+ *  metrics table read. The reads of different sockets run in parallel.
+ *  Every reading carries its own status, the call returns the first
+ *  failure.
+ *
+ *  @param[in] ids array of @p n domain ids.
+ *
+ *  @param[in] n number of domain ids.
+ *
+ *  @param[inout] out Input buffer of @p n readings.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_domains_read(const uint32_t *ids, uint32_t n,
+				struct esmi_domain_reading *out);
+
+/** @} */  // end of PowerDomains
+
+/*****************************************************************************/
+/** @defgroup PubSub Telemetry subscriptions
+ *  Below functions let several components of a process subscribe to the
+ *  same metrics at their own rates. Subscriptions to the same metric of
+ *  the same socket or core share one source, which is read once per
+ *  period of its fastest subscriber by a sampler task, and every reading
+ *  is fanned out to the subscribers that are due. The sampler is started
+ *  with esmi_sampler_start().
+ *  @{
+ */
+
+#define ESMI_MAX_SUBSCRIPTIONS		32	//!< subscriptions at a time
+#define ESMI_SUBSCRIPTION_QUEUE		64	//!< samples queued per subscriber
+
+/**
+ * @brief Metrics available for subscriptions
+ */
+typedef enum {
+	ESMI_METRIC_SOCKET_POWER,	//!< socket power in mW
+	ESMI_METRIC_SOCKET_ENERGY,	//!< socket energy in uJ
+	ESMI_METRIC_CORE_ENERGY,	//!< core energy in uJ, indexed by core
+	ESMI_METRIC_SOCKET_TEMP,	//!< socket temperature in milli degree C
+	ESMI_METRIC_CORE_BOOSTLIMIT,	//!< core boost limit in MHz, indexed by cpu
+	ESMI_METRIC_SOCKET_C0,		//!< socket C0 residency in percent
+	ESMI_METRIC_SOCKET_FREQ_LIMIT,	//!< socket frequency limit in MHz
+	ESMI_METRIC_DDR_BW,		//!< utilized DDR bandwidth in GB/s
+	ESMI_METRIC_MAX
+} esmi_metric_t;
+
+/**
+ * @brief A sample delivered to a subscriber
+ */
+struct esmi_sample {
+	uint64_t time_ns;	//!< CLOCK_MONOTONIC time of the read
+	uint64_t value;		//!< value in the unit of the metric
+	uint32_t metric;	//!< ::esmi_metric_t
+	uint32_t index;		//!< socket, core or cpu index
+	esmi_status_t status;	//!< status of the read
+};
+
+/**
+ * @brief Subscription callback, called on the sampler thread
+ */
+typedef void (*esmi_subscriber_fn)(const struct esmi_sample *sample, void *arg);
+
+/**
+ * @brief Subscription statistics
+ */
+struct esmi_pubsub_stats {
+	uint32_t subscriptions;	//!< active subscriptions
+	uint32_t sources;	//!< distinct metrics read for them
+	uint64_t reads;		//!< source reads done
+	uint64_t deliveries;	//!< samples delivered, a delivery beyond the
+				//!< reads is a read saved by coalescing
+	uint64_t dropped;	//!< samples dropped on full queues
+};
+
+/**
+ *  @brief Subscribe to a metric
+ *
+ *  @details The metric is read once right away to validate @p index. The
+ *  subscriber then receives a sample about every @p period_ms, from the
+ *  first reading of the shared source at or after it is due, so a
+ *  subscriber slower than the fastest one on the same source sees a
+ *  jitter of up to that source period but keeps its average rate. With a
+ *  @p fn the samples are passed to it on the sampler thread, it must not
+ *  block nor call the subscription functions. Without one they are
+ *  queued, up to ::ESMI_SUBSCRIPTION_QUEUE, for esmi_subscription_read().
+ *
+ *  @param[in] metric the ::esmi_metric_t to read.
+ *
+ *  @param[in] index socket, core or cpu index as the metric needs.
+ *
+ *  @param[in] period_ms delivery period in ms.
+ *
+ *  @param[in] fn callback, NULL to queue the samples instead.
+ *
+ *  @param[in] arg argument passed to @p fn.
+ *
+ *  @param[inout] sub_id Input buffer to return the subscription id.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_subscribe(esmi_metric_t metric, uint32_t index, uint32_t period_ms,
+			     esmi_subscriber_fn fn, void *arg, uint32_t *sub_id);
+
+/**
+ *  @brief Cancel a subscription
+ *
+ *  @details Once this returns the callback of the subscription is not
+ *  running and is not called anymore.
+ *
+ *  @param[in] sub_id a subscription id returned by esmi_subscribe().
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_unsubscribe(uint32_t sub_id);
+
+/**
+ *  @brief Read queued samples of a subscription
+ *
+ *  @details The queue is a single producer single consumer ring, it is
+ *  read without taking a lock and only one thread may read a given
+ *  subscription at a time.
+ *
+ *  @param[in] sub_id a subscription id returned by esmi_subscribe() without
+ *  a callback.
+ *
+ *  @param[inout] samples Input buffer of @p max samples.
+ *
+ *  @param[in] max number of entries in @p samples.
+ *
+ *  @param[inout] count Input buffer to return the number of samples read.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_subscription_read(uint32_t sub_id, struct esmi_sample *samples,
+				     uint32_t max, uint32_t *count);
+
+/**
+ *  @brief Get the subscription statistics
+ *
+ *  @param[inout] stats Input buffer to return the statistics.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval None-zero is returned upon failure.
+ *
+ */
+esmi_status_t esmi_pubsub_stats_get(struct esmi_pubsub_stats *stats);
+
+/** @} */  // end of PubSub
+
+/*****************************************************************************/
+
 /** @defgroup ddrQuer ddr_bandwidth Monitor
  *  This function provides the DDR Bandwidth for a system
  *  @{
@@ -1317,6 +3160,39 @@ esmi_status_t esmi_metrics_table_version_get(uint32_t *metrics_version);
  */
 esmi_status_t esmi_metrics_table_get(uint8_t sock_ind, struct hsmp_metric_table *metrics_table);
 
+/**
+ *  @brief Get the metrics table from the shared cache
+ *
+ *  @details Return a copy of the table read within the freshness window,
+ *  reading it again once the window expired. The same cache serves
+ *  esmi_socket_energy_get() on platforms with a metrics table, so polling
+ *  several metrics costs one table read per window.
+ *
+ *  @param[in] sock_ind Socket index.
+ *  @param[inout] metrics_table input buffer to return the metrics table.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval Non-zero is returned upon failure.
+ */
+esmi_status_t esmi_metrics_table_cached_get(uint8_t sock_ind,
+					    struct hsmp_metric_table *metrics_table);
+
+#define ESMI_MTBL_MAX_WINDOW_US	1000000	//!< longest freshness window, 1s
+
+/**
+ *  @brief Set the freshness window of the metrics table cache
+ *
+ *  @details The default is 1000us, about one SMU refresh. 0 reads the
+ *  table on every call.
+ *
+ *  @param[in] window_us window in micro seconds, at most
+ *  ::ESMI_MTBL_MAX_WINDOW_US.
+ *
+ *  @retval ::ESMI_SUCCESS is returned upon successful call.
+ *  @retval ::ESMI_INVALID_INPUT is returned if @p window_us is too long.
+ */
+esmi_status_t esmi_metrics_table_freshness_set(uint32_t window_us);
+
 /**
  *  @brief Get the DRAM address for the metrics table.
  *
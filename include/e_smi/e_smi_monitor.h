@@ -15,6 +15,7 @@
  *  created by driver installation.
  */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <asm/amd_hsmp.h>
 #include <e_smi/e_smi.h>
@@ -29,6 +30,8 @@
 #define ENERGY_PWR_UNIT_MSR     0xC0010299
 #define ENERGY_CORE_MSR         0xC001029A
 #define ENERGY_PKG_MSR          0xC001029B
+#define MPERF_RO_MSR            0xC00000E7
+#define APERF_RO_MSR            0xC00000E8
 
 #define AMD_ENERGY_UNIT_MASK    0x1F00
 #define AMD_ENERGY_UNIT_OFFSET  8
@@ -74,6 +77,7 @@ struct system_metrics {
 	esmi_status_t msr_status;	// MSR driver status
 	esmi_status_t msr_safe_status;	// MSR safe driver status
 	esmi_status_t hsmp_status;	// hsmp driver status
+	esmi_status_t mtbl_status;	// metrics table socket energy status
 	struct cpu_mapping *map;
 	uint8_t df_pstate_max_limit;	// df pstate maximum limit
 	uint8_t gmi3_link_width_limit;	// gmi3 maximum link width
@@ -95,15 +99,93 @@ typedef enum {
 	MONITOR_TYPE_MAX			//!< Max Monitor Type coordinate
 } monitor_types_t;
 
-int read_energy_drv(uint32_t sensor_id, uint64_t *val);
-int read_msr_drv(monitor_types_t type, uint32_t sensor_id, uint64_t *pval, uint64_t reg);
-int batch_read_energy_drv(uint64_t *pval, uint32_t cpus);
-int batch_read_msr_drv(monitor_types_t type, uint64_t *pval, uint32_t cpus);
+/*
+ * The driver accessors, the batch ones included, record failed and slow
+ * calls in the diagnostic event ring under the name of the calling API
+ * function.
+ */
+int read_energy_drv_traced(uint32_t sensor_id, uint64_t *val, const char *api);
+int read_msr_drv_traced(monitor_types_t type, uint32_t sensor_id, uint64_t *pval,
+			uint64_t reg, const char *api);
+#define read_energy_drv(id, pval) \
+	read_energy_drv_traced(id, pval, __func__)
+#define read_msr_drv(type, id, pval, reg) \
+	read_msr_drv_traced(type, id, pval, reg, __func__)
+int batch_read_energy_drv_traced(uint64_t *pval, uint32_t cpus, const char *api);
+int batch_read_msr_drv_traced(monitor_types_t type, uint64_t *pval, uint32_t cpus,
+			      const char *api);
+#define batch_read_energy_drv(pval, cpus) \
+	batch_read_energy_drv_traced(pval, cpus, __func__)
+#define batch_read_msr_drv(type, pval, cpus) \
+	batch_read_msr_drv_traced(type, pval, cpus, __func__)
+
+/*
+ * One raw MSR read of a batch, laid out like the operations of the
+ * msr_safe batch ioctl so that a batch is passed without a copy.
+ */
+struct msr_batch_op {
+	uint16_t cpu;
+	uint16_t isrdmsr;
+	int32_t err;
+	uint32_t msr;
+	uint64_t msrdata;
+	uint64_t wmask;
+};
+int batch_read_msr_ops_traced(monitor_types_t type, struct msr_batch_op *ops,
+			      uint32_t nops, const char *api);
+#define batch_read_msr_ops(type, ops, nops) \
+	batch_read_msr_ops_traced(type, ops, nops, __func__)
 
 int find_energy(char *devname, char *hwmon_name);
 int find_msr_safe();
 int find_msr();
-int hsmp_xfer(struct hsmp_message *msg, int mode);
+int hsmp_xfer_traced(struct hsmp_message *msg, int mode, const char *api);
+#define hsmp_xfer(msg, mode)	hsmp_xfer_traced(msg, mode, __func__)
 void init_platform_info(struct system_metrics *sm);
 
+esmi_status_t errno_to_esmi_status(int err);
+int cpu_socket_get(uint32_t core_ind);
+esmi_status_t socket_freq_limit_raw_get_traced(uint32_t sock_ind, uint16_t *freq,
+					       uint16_t *src_mask, const char *api);
+#define socket_freq_limit_raw_get(sock_ind, freq, src_mask) \
+	socket_freq_limit_raw_get_traced(sock_ind, freq, src_mask, __func__)
+
+void boostlimit_cache_update(uint32_t core_ind, uint32_t boostlimit);
+void boostlimit_cache_socket_update(uint32_t sock_ind, uint32_t boostlimit);
+void boostlimit_cache_exit(void);
+esmi_status_t cgroup_cpuset_get(const char *path, uint8_t *mask, uint32_t ncpus);
+void cgroup_path_resolve(const char *cgroup_path, char *path, size_t len);
+void qos_exit(void);
+void turbo_exit(void);
+void estimate_exit(void);
+void phase_exit(void);
+void throttle_exit(void);
+
+uint64_t event_clock(void);
+void event_trace(const char *api, uint32_t index, uint32_t msg_id, int err,
+		 uint64_t start_ns);
+esmi_status_t event_status(const char *api, uint32_t index, esmi_status_t status);
+
+void *sampler_arena_alloc(size_t size);
+void sampler_task_name_set(uint32_t task_id, const char *name);
+void sampler_exit(void);
+esmi_status_t dimm_socket_power_get(uint32_t sock_ind, uint32_t *power);
+void dimm_exit(void);
+void breakdown_exit(void);
+void apu_exit(void);
+void rank_exit(void);
+void budget_exit(void);
+void flight_exit(void);
+void sweep_exit(void);
+void activity_exit(void);
+void idle_exit(void);
+void domain_exit(void);
+void workers_run(void *(*fn)(void *), void *args, size_t size, uint32_t n);
+void workers_exit(void);
+void pubsub_exit(void);
+
+esmi_status_t mtbl_cache_read(uint32_t sock_ind, size_t offset, size_t size, void *buf);
+esmi_status_t mtbl_cache_probe(uint32_t sock_ind);
+void mtbl_cache_exit(void);
+
 #endif  // INCLUDE_E_SMI_E_SMI_MONITOR_H_
@@ -21,5 +21,13 @@ int writesys_u32(char *filepath, uint32_t val);
 int readsys_u64(char *filepath, uint64_t *pval);
 int readsys_str(char *filepath, char *pval, uint32_t val);
 int readmsr_u64(char *filepath, uint64_t *pval, uint64_t reg);
+int parse_cpulist(const char *str, uint8_t *mask, uint32_t ncpus);
+uint64_t monotonic_ns(void);
+int procstat_read(uint64_t *busy, uint64_t *total, uint32_t ncpus);
+void procstat_close(void);
+void fd_cache_close(void);
+
+/* read, write and ioctl calls issued by the library on this thread */
+extern __thread uint64_t lib_syscalls;
 
 #endif  // INCLUDE_E_SMI_E_SMI_UTILS_H_
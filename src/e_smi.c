@@ -15,9 +15,11 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include <e_smi/e_smi.h>
 #include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
 
 #define HSMP_DRIVER_VERSION_FILE1 "/sys/module/hsmp_common/version"
 #define HSMP_DRIVER_VERSION_FILE2 "/sys/module/amd_hsmp/version"
@@ -44,13 +46,78 @@ extern char energymon_path[DRVPATHSIZ];
 extern bool *lut;
 extern int lut_size;
 
-#define check_sup(x)    ((x >= lut_size) || !lut[x])
+#define check_sup(x)    (ensure_hsmp(), (x >= lut_size) || !lut[x])
 
 #define TU_POS 16
 #define ESU_POS 8
 #define TU_BITS 4
 #define ESU_BITS 5
 
+/*
+ * Topology and the HSMP transport are brought up on first use rather than
+ * in esmi_init(), the energy backend too unless esmi_init() needed it to
+ * tell whether any driver is present. Unlike pthread_once() these guards
+ * can be re-armed, so esmi_exit() followed by esmi_init() probes again.
+ * A guard is only latched on a definitive result, an init that failed on
+ * a busy or timed out SMU is retried by the next caller.
+ */
+struct init_guard {
+	int done;
+	esmi_status_t status;
+	pthread_mutex_t lock;
+};
+
+static struct init_guard topo_guard = { 0, ESMI_SUCCESS, PTHREAD_MUTEX_INITIALIZER };
+static struct init_guard hsmp_guard = { 0, ESMI_SUCCESS, PTHREAD_MUTEX_INITIALIZER };
+static struct init_guard energy_guard = { 0, ESMI_SUCCESS, PTHREAD_MUTEX_INITIALIZER };
+
+static int init_transient(esmi_status_t ret)
+{
+	switch (ret) {
+	case ESMI_DEV_BUSY:
+	case ESMI_INTERRUPTED:
+	case ESMI_NO_MEMORY:
+	case ESMI_HSMP_TIMEOUT:
+	case ESMI_SMU_BUSY:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static esmi_status_t run_once(struct init_guard *guard,
+			      esmi_status_t (*init_fn)(void))
+{
+	esmi_status_t ret;
+
+	if (__atomic_load_n(&guard->done, __ATOMIC_ACQUIRE))
+		return guard->status;
+
+	pthread_mutex_lock(&guard->lock);
+	if (guard->done) {
+		ret = guard->status;
+	} else {
+		ret = init_fn();
+		if (!init_transient(ret)) {
+			guard->status = ret;
+			__atomic_store_n(&guard->done, 1, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&guard->lock);
+
+	return ret;
+}
+
+static void reset_guard(struct init_guard *guard)
+{
+	pthread_mutex_lock(&guard->lock);
+	__atomic_store_n(&guard->done, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&guard->lock);
+}
+
+static esmi_status_t ensure_hsmp(void);
+static struct cpu_mapping *cpu_map(void);
+
 /*
  * To Calculate maximum possible number of cores and sockets,
  * cpu/present and node/possible entires may return 0-127.
@@ -58,20 +125,11 @@ extern int lut_size;
  */
 static int read_index(char *filepath)
 {
-	FILE *fp;
 	char buf[FILESIZ];
 	int i, j;
 
-	fp = fopen(filepath, "r");
-	if (fp == NULL) {
+	if (readsys_str(filepath, buf, FILESIZ))
 		return -1;
-	}
-
-	if (fgets(buf, FILESIZ, fp) == NULL) {
-		buf[0] = '\0';
-		fclose(fp);
-		return -1;
-	}
 
 	for (i = 0, j = 0; ((buf[i] != '\0') && (buf[i] != '\n')); i++) {
                 if (buf[i] < '0' || buf[i] > '9') {
@@ -79,7 +137,6 @@ static int read_index(char *filepath)
                 }
         }
 
-	fclose(fp);
 	return atoi(&buf[j]);
 }
 
@@ -90,17 +147,17 @@ esmi_status_t esmi_first_online_core_on_socket(uint32_t sock_ind,
 					       uint32_t *pcore_ind)
 {
 	char filepath[FILEPATHSIZ];
-	FILE *fp;
-	int i, socket;
+	uint32_t socket;
+	int i;
 
 	if (NULL == psm) {
-		return ESMI_IO_ERROR;
+		return event_status(__func__, 0, ESMI_IO_ERROR);
 	}
 	if (sock_ind >= psm->total_sockets) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
         if (NULL == pcore_ind) {
-                return ESMI_ARG_PTR_NULL;
+                return event_status(__func__, 0, ESMI_ARG_PTR_NULL);
         }
 
 	for (i = 0; i < psm->total_cores; i++) {
@@ -108,25 +165,17 @@ esmi_status_t esmi_first_online_core_on_socket(uint32_t sock_ind,
 			 "%s/cpu%d/topology/physical_package_id",
 			 CPU_SYS_PATH, i);
 
-		fp = fopen(filepath, "r");
-		if (fp == NULL) {
+		if (readsys_u32(filepath, &socket))
 			continue;
-		}
-
-		if (fscanf(fp, "%d", &socket) < 0) {
-			fclose(fp);
-			continue;
-		}
 
 		if (sock_ind == socket) {
 			//return first online core on given socket
 			*pcore_ind = i;
-			fclose(fp);
 			return ESMI_SUCCESS;
 		}
-		fclose(fp);
 	}
-	return ESMI_IO_ERROR; //when no online core found on given socket
+	//when no online core found on given socket
+	return event_status(__func__, sock_ind, ESMI_IO_ERROR);
 }
 
 /*
@@ -178,6 +227,8 @@ char * esmi_get_err_msg(esmi_status_t esmi_err)
 			return "Prerequisite to execute the command not satisfied";
 		case ESMI_SMU_BUSY:
 			return "SMU is busy";
+		case ESMI_NO_DATA:
+			return "No data sampled yet";
 		default:
 			return "Unknown error";
 	}
@@ -186,7 +237,7 @@ char * esmi_get_err_msg(esmi_status_t esmi_err)
 /*
  * Map linux errors to esmi errors
  */
-static esmi_status_t errno_to_esmi_status(int err)
+esmi_status_t errno_to_esmi_status(int err)
 {
 	switch (err) {
 		case 0:		return ESMI_SUCCESS;
@@ -250,13 +301,31 @@ static esmi_status_t create_hsmp_monitor()
 	return ESMI_NO_HSMP_DRV;
 }
 
-static void parse_lines(char **str, FILE *fp, int *val, const char *cmp_str)
+/*
+ * fgets() into a fixed buffer: the tail of a line longer than the buffer,
+ * the cpu flags, is skipped so that it can not match a key.
+ */
+static char *read_line_start(char *str, FILE *fp)
+{
+	size_t len;
+	int c;
+
+	if (!fgets(str, CPU_INFO_LINE_SIZE, fp))
+		return NULL;
+	len = strlen(str);
+	if (len && str[len - 1] != '\n')
+		while ((c = fgetc(fp)) != EOF && c != '\n')
+			;
+
+	return str;
+}
+
+static void parse_lines(char *str, FILE *fp, int *val, const char *cmp_str)
 {
-	size_t size = CPU_INFO_LINE_SIZE;
 	char *tok;
 
-	while (getline(str, &size, fp) != -1) {
-		if ((tok = strtok(*str, delim1)) && (!strncmp(tok, cmp_str, strlen(cmp_str)))) {
+	while (read_line_start(str, fp)) {
+		if ((tok = strtok(str, delim1)) && (!strncmp(tok, cmp_str, strlen(cmp_str)))) {
 			tok  = strtok(NULL, delim2);
 			*val = atoi(tok);
 			break;
@@ -266,44 +335,36 @@ static void parse_lines(char **str, FILE *fp, int *val, const char *cmp_str)
 
 static esmi_status_t create_cpu_mappings(struct system_metrics *psm)
 {
-	size_t size = CPU_INFO_LINE_SIZE;
+	char str[CPU_INFO_LINE_SIZE];
 	int i = 0;
-	char *str;
 	FILE *fp;
 	char *tok;
 
-	str = malloc(CPU_INFO_LINE_SIZE);
-	if (!str)
-		return ESMI_NO_MEMORY;
 	/* If create_cpu_mappings() is called multiple times
 	 * dont allocate the memory again.
 	 */
 	if (!psm->map) {
 		psm->map = malloc(psm->total_cores * sizeof(struct cpu_mapping));
-		if (!psm->map) {
-			free(str);
+		if (!psm->map)
 			return ESMI_NO_MEMORY;
-		}
 	}
 
 	fp = fopen(CPU_INFO_PATH, "r");
 	if (!fp) {
-		free(str);
 		free(psm->map);
+		psm->map = NULL;
 		return ESMI_FILE_ERROR;
 	}
-	while (getline(&str, &size, fp) != -1) {
+	while (i < psm->total_cores && read_line_start(str, fp)) {
 		if ((tok = strtok(str, delim1)) && (!strncmp(tok, proc_str, strlen(proc_str)))) {
 			tok  = strtok(NULL, delim2);
 			psm->map[i].proc_id = atoi(tok);
-			parse_lines(&str, fp, &psm->map[i].sock_id, node_str);
-			parse_lines(&str, fp, &psm->map[i].apic_id, apic_str);
+			parse_lines(str, fp, &psm->map[i].sock_id, node_str);
+			parse_lines(str, fp, &psm->map[i].apic_id, apic_str);
 			i++;
 		}
 	}
 
-	free(str);
-
 	fclose(fp);
 
 	return ESMI_SUCCESS;
@@ -372,8 +433,23 @@ static bool check_for_64bit_rapl_reg(struct system_metrics *psysm)
 	return ret;
 }
 
+/*
+ * The metrics table carries the socket energy, it serves socket energy
+ * reads on top of the core energy backend selected below.
+ */
+static esmi_status_t create_mtbl_energy_monitor(void)
+{
+	if (psm->hsmp_status || check_sup(HSMP_GET_METRIC_TABLE))
+		return ESMI_NOT_SUPPORTED;
+
+	return mtbl_cache_probe(0);
+}
+
 static void create_energy_monitor(struct system_metrics *psm)
 {
+	if (create_mtbl_energy_monitor() == ESMI_SUCCESS)
+		psm->mtbl_status = ESMI_INITIALIZED;
+
 	if (check_for_64bit_rapl_reg(psm)) {
 		if (psm->hsmp_status == ESMI_INITIALIZED
 		    && psm->hsmp_rapl_reading)
@@ -401,6 +477,86 @@ static void create_energy_monitor(struct system_metrics *psm)
 	return;
 }
 
+static esmi_status_t init_topology(void)
+{
+	return create_cpu_mappings(psm);
+}
+
+/*
+ * Query the HSMP protocol version, which also selects the platform
+ * specific message table used by check_sup().
+ */
+static esmi_status_t init_hsmp(void)
+{
+	struct hsmp_message msg = { 0 };
+	esmi_status_t ret;
+
+	ret = create_hsmp_monitor();
+	if (ret != ESMI_SUCCESS)
+		return ret;
+
+	msg.msg_id = HSMP_GET_PROTO_VER;
+	msg.response_sz = 1;
+	msg.sock_ind = 0;
+	ret = errno_to_esmi_status(hsmp_xfer_traced(&msg, O_RDONLY, __func__));
+	if (ret == ESMI_SUCCESS) {
+		psm->hsmp_proto_ver = msg.args[0];
+		init_platform_info(psm);
+		psm->hsmp_status = ESMI_INITIALIZED;
+	}
+
+	return ret;
+}
+
+/*
+ * Energy backend selection depends on the HSMP RAPL support, the choice
+ * is made again while HSMP is only transiently unavailable.
+ */
+static esmi_status_t init_energy(void)
+{
+	esmi_status_t ret;
+
+	ret = ensure_hsmp();
+	create_energy_monitor(psm);
+
+	return init_transient(ret) ? ret : ESMI_SUCCESS;
+}
+
+static esmi_status_t ensure_hsmp(void)
+{
+	if (!psm)
+		return ESMI_IO_ERROR;
+
+	return run_once(&hsmp_guard, init_hsmp);
+}
+
+static void ensure_energy(void)
+{
+	if (psm)
+		run_once(&energy_guard, init_energy);
+}
+
+static struct cpu_mapping *cpu_map(void)
+{
+	if (!psm)
+		return NULL;
+	run_once(&topo_guard, init_topology);
+
+	return psm->map;
+}
+
+/*
+ * Socket of a cpu index, as addressed by the per core HSMP messages.
+ * Returns -1 if the cpu index is invalid or the topology is unavailable.
+ */
+int cpu_socket_get(uint32_t core_ind)
+{
+	if (!psm || core_ind >= psm->total_cores || !cpu_map())
+		return -1;
+
+	return psm->map[core_ind].sock_id;
+}
+
 /*
  * First initialization function to be executed and confirming
  * all the monitor or driver objects should be initialized or not
@@ -416,41 +572,37 @@ esmi_status_t esmi_init()
 	if (!psm) {
 		psm = calloc(1, sizeof(*psm));
 		if (!psm)
-			return ESMI_NO_MEMORY;
+			return event_status(__func__, 0, ESMI_NO_MEMORY);
 	}
 	psm->init_status = ESMI_NOT_INITIALIZED;
 	psm->energy_status = ESMI_NOT_INITIALIZED;
 	psm->msr_status = ESMI_NOT_INITIALIZED;
 	psm->msr_safe_status = ESMI_NOT_INITIALIZED;
 	psm->hsmp_status = ESMI_NOT_INITIALIZED;
+	psm->mtbl_status = ESMI_NOT_INITIALIZED;
+	reset_guard(&topo_guard);
+	reset_guard(&hsmp_guard);
+	reset_guard(&energy_guard);
 
 	ret = detect_packages(psm);
 	if (ret != ESMI_SUCCESS) {
 		return ret;
 	}
 	if (psm->cpu_family < 0x19)
-		return ESMI_NOT_SUPPORTED;
+		return event_status(__func__, 0, ESMI_NOT_SUPPORTED);
 
-	ret = create_hsmp_monitor();
-	if (ret == ESMI_SUCCESS) {
-		ret = create_cpu_mappings(psm);
-		if (ret != ESMI_SUCCESS)
-			return ret;
-
-		struct hsmp_message msg = { 0 };
-		msg.msg_id = HSMP_GET_PROTO_VER;
-		msg.response_sz = 1;
-		msg.sock_ind = 0;
-		ret = hsmp_xfer(&msg, O_RDONLY);
-		if (ret == ESMI_SUCCESS) {
-			psm->hsmp_status = ESMI_INITIALIZED;
-			psm->hsmp_proto_ver = msg.args[0];
-			init_platform_info(psm);
-		}
+	/*
+	 * Only the presence of the HSMP node is checked here, the protocol
+	 * version and the topology are read by the first call that needs
+	 * them. The energy backend, which may have to scan hwmon for the
+	 * amd_energy driver, is only brought up here when HSMP is not there.
+	 */
+	if (create_hsmp_monitor() == ESMI_SUCCESS) {
+		psm->init_status = ESMI_INITIALIZED;
+		return psm->init_status;
 	}
 
-	create_energy_monitor(psm);
-
+	ensure_energy();
 	if (psm->energy_status && psm->msr_status && psm->msr_safe_status && psm->hsmp_status)
 		psm->init_status = ESMI_NO_DRV;
 	else
@@ -461,6 +613,28 @@ esmi_status_t esmi_init()
 
 void esmi_exit(void)
 {
+	pubsub_exit();
+	flight_exit();
+	breakdown_exit();
+	dimm_exit();
+	sampler_exit();
+	budget_exit();
+	qos_exit();
+	turbo_exit();
+	estimate_exit();
+	phase_exit();
+	throttle_exit();
+	apu_exit();
+	rank_exit();
+	sweep_exit();
+	activity_exit();
+	idle_exit();
+	domain_exit();
+	workers_exit();
+	procstat_close();
+	fd_cache_close();
+	boostlimit_cache_exit();
+	mtbl_cache_exit();
 	if (psm) {
 		if (psm->map) {
 			free(psm->map);
@@ -469,19 +643,26 @@ void esmi_exit(void)
 		free(psm);
 		psm = NULL;
 	}
+	reset_guard(&topo_guard);
+	reset_guard(&hsmp_guard);
+	reset_guard(&energy_guard);
 
 	return;
 }
 
+/*
+ * The common checks of the public functions, their failures are recorded
+ * in the diagnostic event ring.
+ */
 #define CHECK_ESMI_GET_INPUT(parg) \
 	if (NULL == psm) {\
-		return ESMI_IO_ERROR;\
+		return event_status(__func__, 0, ESMI_IO_ERROR);\
 	}\
 	if (psm->init_status == ESMI_NOT_INITIALIZED) {\
-		return ESMI_NOT_INITIALIZED;\
+		return event_status(__func__, 0, ESMI_NOT_INITIALIZED);\
 	}\
 	if (NULL == parg) {\
-		return ESMI_ARG_PTR_NULL;\
+		return event_status(__func__, 0, ESMI_ARG_PTR_NULL);\
 	}\
 
 /* get cpu family */
@@ -533,45 +714,57 @@ esmi_status_t esmi_number_of_sockets_get(uint32_t *sockets)
 	return ESMI_SUCCESS;
 }
 
-#define CHECK_ENERGY_GET_INPUT(parg) \
+/* with mtbl_ok the metrics table counts as an energy source */
+#define CHECK_ENERGY_SRC_INPUT(parg, mtbl_ok) \
 	if (NULL == psm) {\
-		return ESMI_IO_ERROR;\
+		return event_status(__func__, 0, ESMI_IO_ERROR);\
 	}\
 	if (psm->init_status == ESMI_NOT_INITIALIZED) {\
-		return ESMI_NOT_INITIALIZED;\
-	} else if ((psm->energy_status == ESMI_NOT_INITIALIZED) && \
+		return event_status(__func__, 0, ESMI_NOT_INITIALIZED);\
+	}\
+	ensure_energy();\
+	if ((!(mtbl_ok) || psm->mtbl_status == ESMI_NOT_INITIALIZED) && \
+			(psm->energy_status == ESMI_NOT_INITIALIZED) && \
 			(psm->msr_status == ESMI_NOT_INITIALIZED) && \
 			(psm->msr_safe_status == ESMI_NOT_INITIALIZED) && \
 			(psm->hsmp_status == ESMI_NOT_INITIALIZED || !psm->hsmp_rapl_reading)) {\
-		return ESMI_NO_ENERGY_DRV;\
+		return event_status(__func__, 0, ESMI_NO_ENERGY_DRV);\
 	}\
 	if (NULL == parg) {\
-		return ESMI_ARG_PTR_NULL;\
+		return event_status(__func__, 0, ESMI_ARG_PTR_NULL);\
 	}\
 
+#define CHECK_ENERGY_GET_INPUT(parg)	CHECK_ENERGY_SRC_INPUT(parg, false)
+
 #define CHECK_HSMP_GET_INPUT(parg) \
 	if (NULL == psm) {\
-		return ESMI_IO_ERROR;\
+		return event_status(__func__, 0, ESMI_IO_ERROR);\
 	}\
 	if (psm->init_status == ESMI_NOT_INITIALIZED) {\
-		return ESMI_NOT_INITIALIZED;\
-	} else if (psm->hsmp_status == ESMI_NOT_INITIALIZED) {\
-		return ESMI_NO_HSMP_DRV;\
+		return event_status(__func__, 0, ESMI_NOT_INITIALIZED);\
+	}\
+	ensure_hsmp();\
+	if (psm->hsmp_status == ESMI_NOT_INITIALIZED) {\
+		return event_status(__func__, 0, ESMI_NO_HSMP_DRV);\
 	}\
 	if (NULL == parg) {\
-		return ESMI_ARG_PTR_NULL;\
+		return event_status(__func__, 0, ESMI_ARG_PTR_NULL);\
 	}\
 
-#define CHECK_HSMP_INPUT() \
+#define CHECK_HSMP_INPUT_API(api) \
 	if (NULL == psm) {\
-		return ESMI_IO_ERROR;\
+		return event_status(api, 0, ESMI_IO_ERROR);\
 	}\
 	if (psm->init_status == ESMI_NOT_INITIALIZED) {\
-		return ESMI_NOT_INITIALIZED;\
-	} else if (psm->hsmp_status == ESMI_NOT_INITIALIZED) {\
-		return ESMI_NO_HSMP_DRV;\
+		return event_status(api, 0, ESMI_NOT_INITIALIZED);\
+	}\
+	ensure_hsmp();\
+	if (psm->hsmp_status == ESMI_NOT_INITIALIZED) {\
+		return event_status(api, 0, ESMI_NO_HSMP_DRV);\
 	}\
 
+#define CHECK_HSMP_INPUT()	CHECK_HSMP_INPUT_API(__func__)
+
 /*
  * Energy Monitor functions
  *
@@ -584,12 +777,12 @@ esmi_status_t esmi_rapl_units_hsmp_mailbox_get(uint32_t sock_ind, uint8_t *tu, u
 
 	msg.msg_id	= HSMP_GET_RAPL_UNITS;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (!tu || !esu)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz	= 1;
 	msg.sock_ind	= sock_ind;
@@ -613,12 +806,15 @@ esmi_status_t esmi_rapl_core_counter_hsmp_mailbox_get(uint32_t core_ind,
 
 	msg.msg_id	= HSMP_GET_RAPL_CORE_COUNTER;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (!counter0 || !counter1)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
+
+	if (!cpu_map())
+		return event_status(__func__, 0, ESMI_IO_ERROR);
 
 	msg.response_sz	= 2;
 	msg.num_args	= 1;
@@ -644,12 +840,12 @@ esmi_status_t esmi_rapl_package_counter_hsmp_mailbox_get(uint32_t sock_ind,
 
 	msg.msg_id	= HSMP_GET_RAPL_PACKAGE_COUNTER;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (!counter0 || !counter1)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz	= 2;
 	msg.sock_ind	= sock_ind;
@@ -672,7 +868,10 @@ esmi_status_t esmi_core_energy_hsmp_mailbox_get(uint32_t core_ind, uint64_t *pen
 	uint32_t counter1, counter0;
 
 	if (!penergy)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
+
+	if (!cpu_map())
+		return event_status(__func__, 0, ESMI_IO_ERROR);
 
 	ret = esmi_rapl_units_hsmp_mailbox_get(psm->map[core_ind].sock_id, &tu, &esu);
 	if (ret)
@@ -697,7 +896,7 @@ esmi_status_t esmi_package_energy_hsmp_mailbox_get(uint32_t sock_ind, uint64_t *
 	uint32_t counter1, counter0;
 
 	if (!penergy)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	ret = esmi_rapl_units_hsmp_mailbox_get(sock_ind, &tu, &esu);
 	if (ret)
@@ -721,7 +920,7 @@ esmi_status_t esmi_core_energy_get(uint32_t core_ind, uint64_t *penergy)
 
 	CHECK_ENERGY_GET_INPUT(penergy);
 	if (core_ind >= psm->total_cores) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 	core_ind %= psm->total_cores/psm->threads_per_core;
 
@@ -744,6 +943,23 @@ esmi_status_t esmi_core_energy_get(uint32_t core_ind, uint64_t *penergy)
 	return errno_to_esmi_status(ret);
 }
 
+/*
+ * Socket energy from the metrics table, the accumulator is in UQ16 Joules.
+ * The arguments are checked by the caller.
+ */
+static esmi_status_t mtbl_socket_energy_get(uint32_t sock_ind, uint64_t *penergy)
+{
+	uint64_t acc;
+	esmi_status_t ret;
+
+	ret = mtbl_cache_read(sock_ind, offsetof(struct hsmp_metric_table, socket_energy_acc),
+			      sizeof(acc), &acc);
+	if (ret == ESMI_SUCCESS)
+		*penergy = (acc >> 16) * 1000000 + (((acc & 0xffff) * 1000000) >> 16);
+
+	return ret;
+}
+
 /*
  * Function to get the enenrgy of the socket with provided socket index
  */
@@ -753,10 +969,12 @@ esmi_status_t esmi_socket_energy_get(uint32_t sock_ind, uint64_t *penergy)
 	esmi_status_t ret;
 	uint32_t core_ind;
 
-	CHECK_ENERGY_GET_INPUT(penergy);
+	CHECK_ENERGY_SRC_INPUT(penergy, true);
 	if (sock_ind >= psm->total_sockets) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
+	if (!psm->mtbl_status)
+		return mtbl_socket_energy_get(sock_ind, penergy);
 
 	if (!psm->hsmp_status && psm->hsmp_rapl_reading) {
 		return  esmi_package_energy_hsmp_mailbox_get(sock_ind, penergy);
@@ -820,35 +1038,24 @@ esmi_status_t esmi_all_energies_get(uint64_t *penergy)
  */
 esmi_status_t esmi_hsmp_driver_version_get(struct hsmp_driver_version *hsmp_driver_ver)
 {
-	FILE *hsmp_driver_ver_file  = NULL;
-	FILE *hsmp_driver_ver_file1 = NULL;
-	FILE *hsmp_driver_ver_file2 = NULL;
 	char line_buffer[MAX_BUFFER_SIZE] = {0};
 	char delimiter[] = ".";
 	char* token = NULL;
+	int err;
 
 	CHECK_HSMP_GET_INPUT(hsmp_driver_ver);
 
 	hsmp_driver_ver->major = 0;
 	hsmp_driver_ver->minor = 0;
 
-	//Open version file
-	hsmp_driver_ver_file1 = fopen(HSMP_DRIVER_VERSION_FILE1, "r");
-	if(NULL != hsmp_driver_ver_file1) {
-		hsmp_driver_ver_file = hsmp_driver_ver_file1;
-	} else {
-		hsmp_driver_ver_file2 = fopen(HSMP_DRIVER_VERSION_FILE2, "r");
-		if(NULL != hsmp_driver_ver_file2) {
-			hsmp_driver_ver_file = hsmp_driver_ver_file2;
-		} else {
-			return ESMI_FILE_NOT_FOUND;
-		}
-	}
-
 	//Read first line from version file, which will have the version number
-	if(!fgets(line_buffer, MAX_BUFFER_SIZE, hsmp_driver_ver_file)) {
-		return ESMI_FILE_ERROR;
-	}
+	err = readsys_str(HSMP_DRIVER_VERSION_FILE1, line_buffer, MAX_BUFFER_SIZE);
+	if (err == ENOENT)
+		err = readsys_str(HSMP_DRIVER_VERSION_FILE2, line_buffer, MAX_BUFFER_SIZE);
+	if (err == ENOENT)
+		return event_status(__func__, 0, ESMI_FILE_NOT_FOUND);
+	if (err)
+		return event_status(__func__, 0, ESMI_FILE_ERROR);
 
 	//Fetch major version
 	token = strtok(line_buffer, delimiter);
@@ -862,8 +1069,6 @@ esmi_status_t esmi_hsmp_driver_version_get(struct hsmp_driver_version *hsmp_driv
 		hsmp_driver_ver->minor = atoi(token);
 	}
 
-	fclose(hsmp_driver_ver_file);
-
 	return ESMI_SUCCESS;
 }
 
@@ -874,7 +1079,7 @@ esmi_status_t esmi_smu_fw_version_get(struct smu_fw_version *smu_fw)
 
 	msg.msg_id = HSMP_GET_SMU_VER;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(smu_fw);
 
@@ -900,12 +1105,12 @@ esmi_status_t esmi_socket_power_get(uint32_t sock_ind, uint32_t *ppower)
 
 	msg.msg_id = HSMP_GET_SOCKET_POWER;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(ppower);
 
 	if (sock_ind >= psm->total_sockets) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 
 	msg.response_sz = 1;
@@ -928,12 +1133,12 @@ esmi_status_t esmi_socket_power_cap_get(uint32_t sock_ind, uint32_t *pcap)
 
 	msg.msg_id = HSMP_GET_SOCKET_POWER_LIMIT;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(pcap);
 
 	if (sock_ind >= psm->total_sockets) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 
 	msg.response_sz = 1;
@@ -956,12 +1161,12 @@ esmi_status_t esmi_socket_power_cap_max_get(uint32_t sock_ind, uint32_t *pmax)
 
 	msg.msg_id = HSMP_GET_SOCKET_POWER_LIMIT_MAX;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(pmax);
 
 	if (sock_ind >= psm->total_sockets) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 
 	msg.response_sz = 1;
@@ -986,13 +1191,13 @@ esmi_status_t esmi_socket_power_cap_set(uint32_t sock_ind, uint32_t cap)
 
 	msg.msg_id = HSMP_SET_SOCKET_POWER_LIMIT;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	/* TODO check against minimum limit */
 	if (sock_ind >= psm->total_sockets) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 
 	msg.num_args = 1;
@@ -1017,16 +1222,16 @@ esmi_status_t esmi_core_boostlimit_get(uint32_t core_ind,
 
 	msg.msg_id = HSMP_GET_BOOST_LIMIT;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(pboostlimit);
 
 	if (core_ind >= psm->total_cores) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 
-	if (!psm->map)
-		return ESMI_IO_ERROR;
+	if (!cpu_map())
+		return event_status(__func__, 0, ESMI_IO_ERROR);
 
 	msg.num_args = 1;
 	msg.response_sz = 1;
@@ -1053,24 +1258,25 @@ esmi_status_t esmi_core_boostlimit_set(uint32_t core_ind,
 
 	msg.msg_id = HSMP_SET_BOOST_LIMIT;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (core_ind >= psm->total_cores) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 
 	if (boostlimit > UINT16_MAX)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
-	if (!psm->map)
-		return ESMI_IO_ERROR;
+	if (!cpu_map())
+		return event_status(__func__, 0, ESMI_IO_ERROR);
 
 	msg.num_args = 1;
 	msg.sock_ind = psm->map[core_ind].sock_id;
 	msg.args[0] = (psm->map[core_ind].apic_id << 16) | boostlimit;
 	ret = hsmp_xfer(&msg, O_WRONLY);
+	boostlimit_cache_update(core_ind, ret ? 0 : boostlimit);
 
 	return errno_to_esmi_status(ret);
 }
@@ -1087,22 +1293,23 @@ esmi_status_t esmi_socket_boostlimit_set(uint32_t sock_ind,
 
 	msg.msg_id = HSMP_SET_BOOST_LIMIT_SOCKET;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	/* TODO check boostlimit against a valid range */
 	if (sock_ind >= psm->total_sockets) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 
 	if (boostlimit > UINT16_MAX)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args = 1;
 	msg.sock_ind = sock_ind;
 	msg.args[0] = boostlimit;
 	ret = hsmp_xfer(&msg, O_WRONLY);
+	boostlimit_cache_socket_update(sock_ind, ret ? 0 : boostlimit);
 
 	return errno_to_esmi_status(ret);
 }
@@ -1115,12 +1322,12 @@ esmi_status_t esmi_prochot_status_get(uint32_t sock_ind, uint32_t *prochot)
 
 	msg.msg_id = HSMP_GET_PROC_HOT;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(prochot);
 
 	if (sock_ind >= psm->total_sockets) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 
 	msg.response_sz = 1;
@@ -1146,10 +1353,10 @@ esmi_status_t esmi_xgmi_width_set(uint8_t min, uint8_t max)
 	CHECK_HSMP_INPUT();
 
 	if (psm->total_sockets < 2)
-		return ESMI_NOT_SUPPORTED;
+		return event_status(__func__, 0, ESMI_NOT_SUPPORTED);
 
 	if ((min > max) || (min > 2) || (max > 2))
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	width = (min << 8) | max;
 	for (i = 0; i < psm->total_sockets; i++) {
@@ -1173,12 +1380,12 @@ esmi_status_t esmi_apb_enable(uint32_t sock_ind)
 
 	msg.msg_id = HSMP_SET_AUTO_DF_PSTATE;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	/*
 	 * While the socket is in PC6 or if PROCHOT_L is
@@ -1199,15 +1406,15 @@ esmi_status_t esmi_apb_disable(uint32_t sock_ind, uint8_t pstate)
 
 	msg.msg_id = HSMP_SET_DF_PSTATE;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	if (pstate > 3)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args = 1;
 	msg.sock_ind = sock_ind;
@@ -1226,14 +1433,14 @@ esmi_status_t esmi_fclk_mclk_get(uint32_t sock_ind,
 
 	msg.msg_id = HSMP_GET_FCLK_MCLK;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
         if (!(fclk && mclk))
-                return ESMI_ARG_PTR_NULL;
+                return event_status(__func__, 0, ESMI_ARG_PTR_NULL);
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz = 2;
 	msg.sock_ind = sock_ind;
@@ -1253,12 +1460,12 @@ esmi_status_t esmi_cclk_limit_get(uint32_t sock_ind, uint32_t *cclk)
 
 	msg.msg_id = HSMP_GET_CCLK_THROTTLE_LIMIT;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(cclk);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz = 1;
 	msg.sock_ind = sock_ind;
@@ -1283,11 +1490,11 @@ esmi_status_t esmi_socket_c0_residency_get(uint32_t sock_ind,
 
 	msg.msg_id = HSMP_GET_C0_PERCENT;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(pc0_residency);
 	if (sock_ind >= psm->total_sockets) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 
 	msg.response_sz = 1;
@@ -1308,16 +1515,16 @@ esmi_status_t esmi_socket_lclk_dpm_level_set(uint32_t sock_ind, uint8_t nbio_id,
 
 	msg.msg_id = HSMP_SET_NBIO_DPM_LEVEL;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	if (nbio_id > 3)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	if ((min > max) || (max > psm->max_dpm_level))
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	dpm_val = (nbio_id << 16) | (max << 8) | min;
 
@@ -1338,15 +1545,15 @@ esmi_status_t esmi_socket_lclk_dpm_level_get(uint8_t sock_ind, uint8_t nbio_id,
 
 	msg.msg_id	= HSMP_GET_NBIO_DPM_LEVEL;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(dpm);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	if (nbio_id > 3)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args	= 1;
 	msg.response_sz	= 1;
@@ -1369,12 +1576,12 @@ esmi_status_t esmi_ddr_bw_get(uint8_t sock_ind, struct ddr_bw_metrics *ddr_bw)
 
 	msg.msg_id = HSMP_GET_DDR_BANDWIDTH;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(ddr_bw);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz = 1;
 	msg.sock_ind = sock_ind;
@@ -1398,10 +1605,10 @@ esmi_status_t esmi_socket_temperature_get(uint32_t sock_ind, uint32_t *ptmon)
 
 	msg.msg_id = HSMP_GET_TEMP_MONITOR;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	if (sock_ind >= psm->total_sockets) {
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 	}
 
 	CHECK_HSMP_GET_INPUT(ptmon);
@@ -1427,10 +1634,10 @@ esmi_status_t esmi_dimm_temp_range_and_refresh_rate_get(uint8_t sock_ind, uint8_
 
 	msg.msg_id	= HSMP_GET_DIMM_TEMP_RANGE;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	CHECK_HSMP_GET_INPUT(rate);
 
@@ -1455,10 +1662,10 @@ esmi_status_t esmi_dimm_power_consumption_get(uint8_t sock_ind, uint8_t dimm_add
 
 	msg.msg_id	= HSMP_GET_DIMM_POWER;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	CHECK_HSMP_GET_INPUT(dimm_pow);
 
@@ -1494,10 +1701,10 @@ esmi_status_t esmi_dimm_thermal_sensor_get(uint8_t sock_ind, uint8_t dimm_addr,
 
 	msg.msg_id	= HSMP_GET_DIMM_THERMAL;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	CHECK_HSMP_GET_INPUT(dimm_temp);
 
@@ -1516,39 +1723,60 @@ esmi_status_t esmi_dimm_thermal_sensor_get(uint8_t sock_ind, uint8_t dimm_addr,
 	return errno_to_esmi_status(ret);
 }
 
-esmi_status_t esmi_socket_current_active_freq_limit_get(uint32_t sock_ind, uint16_t *freq,
-							char **src_type)
+/*
+ * Socket frequency limit and the raw bit mask of its limiting sources,
+ * the bits index freqlimitsrcnames[]. Shared by the public frequency
+ * limit getter and the sampler tasks, so failures are recorded under
+ * the name of the caller.
+ */
+esmi_status_t socket_freq_limit_raw_get_traced(uint32_t sock_ind, uint16_t *freq,
+					       uint16_t *src_mask, const char *api)
 {
 	struct hsmp_message msg = { 0 };
 	esmi_status_t ret;
-	uint8_t src_len;
-	uint16_t limit;
-	uint8_t index = 0;
-	uint8_t ind = 0;
 
 	msg.msg_id	= HSMP_GET_SOCKET_FREQ_LIMIT;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(api, 0, ESMI_NO_HSMP_MSG_SUP);
 
-	CHECK_HSMP_INPUT();
+	CHECK_HSMP_INPUT_API(api);
 
-	if (freq == NULL || src_type == NULL)
-		return ESMI_INVALID_INPUT;
+	if (freq == NULL || src_mask == NULL)
+		return event_status(api, 0, ESMI_INVALID_INPUT);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
-
-	/* frequency limit source names array length */
-	src_len = ARRAY_SIZE(freqlimitsrcnames);
+		return event_status(api, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz = 1;
 	msg.sock_ind	= sock_ind;
-	ret = hsmp_xfer(&msg, O_RDONLY);
+	ret = hsmp_xfer_traced(&msg, O_RDONLY, api);
 	if (ret)
 		return errno_to_esmi_status(ret);
 
 	*freq = msg.args[0] >> 16;
-	limit = msg.args[0] & 0xFFFF;
+	*src_mask = msg.args[0] & 0xFFFF;
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_socket_current_active_freq_limit_get(uint32_t sock_ind, uint16_t *freq,
+							char **src_type)
+{
+	esmi_status_t ret;
+	uint8_t src_len;
+	uint16_t limit;
+	uint8_t index = 0;
+	uint8_t ind = 0;
+
+	if (src_type == NULL)
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
+
+	ret = socket_freq_limit_raw_get(sock_ind, freq, &limit);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+
+	/* frequency limit source names array length */
+	src_len = ARRAY_SIZE(freqlimitsrcnames);
 
 	while (limit != 0 && index < src_len) {
 		if ((limit & 1) == 1) {
@@ -1569,15 +1797,15 @@ esmi_status_t esmi_current_freq_limit_core_get(uint32_t core_id, uint32_t *freq)
 
 	msg.msg_id	= HSMP_GET_CCLK_CORE_LIMIT;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(freq);
 
 	if (core_id >= psm->total_cores)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
-	if (!psm->map)
-		return ESMI_IO_ERROR;
+	if (!cpu_map())
+		return event_status(__func__, 0, ESMI_IO_ERROR);
 
 	msg.num_args	= 1;
 	msg.response_sz = 1;
@@ -1597,12 +1825,12 @@ esmi_status_t esmi_pwr_svi_telemetry_all_rails_get(uint32_t sock_ind, uint32_t *
 
 	msg.msg_id	= HSMP_GET_RAILS_SVI;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(power);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz	= 1;
 	msg.sock_ind	= sock_ind;
@@ -1620,15 +1848,15 @@ esmi_status_t esmi_socket_freq_range_get(uint8_t sock_ind, uint16_t *fmax, uint1
 
 	msg.msg_id	= HSMP_GET_SOCKET_FMAX_FMIN;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	if (!fmax || !fmin)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	CHECK_HSMP_INPUT();
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz	= 1;
 	msg.sock_ind	= sock_ind;
@@ -1687,19 +1915,19 @@ esmi_status_t esmi_current_io_bandwidth_get(uint8_t sock_ind, struct link_id_bw_
 
 	msg.msg_id	= HSMP_GET_IOLINK_BANDWITH;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(io_bw);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	/* Only Aggregate Banwdith is valid Bandwidth type for IO links */
 	if (link.bw_type != 1)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	if(validate_link_name(link.link_name, &encode_val))
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz = 1;
 	msg.num_args	= 1;
@@ -1721,15 +1949,15 @@ esmi_status_t esmi_current_xgmi_bw_get(struct link_id_bw_type link,
 
 	msg.msg_id	= HSMP_GET_XGMI_BANDWITH;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(xgmi_bw);
 
 	if(validate_link_name(link.link_name, &encode_val))
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	if (validate_bw_type(link.bw_type))
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz = 1;
 	msg.num_args	= 1;
@@ -1759,16 +1987,16 @@ esmi_status_t esmi_gmi3_link_width_range_set(uint8_t sock_ind, uint8_t min_link_
 
 	msg.msg_id	= HSMP_SET_GMI3_WIDTH;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	ret = validate_max_min_values(max_link_width, min_link_width, psm->gmi3_link_width_limit);
 	if (ret)
-		return ret;
+		return event_status(__func__, 0, ret);
 
 	msg.num_args	= 1;
 	msg.sock_ind	= sock_ind;
@@ -1785,15 +2013,15 @@ esmi_status_t esmi_pcie_link_rate_set(uint8_t sock_ind, uint8_t rate_ctrl, uint8
 
 	msg.msg_id	= HSMP_SET_PCI_RATE;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(prev_mode);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	if (rate_ctrl > psm->pci_gen5_rate_ctl)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args	= 1;
 	msg.response_sz	= 1;
@@ -1814,15 +2042,15 @@ esmi_status_t esmi_pwr_efficiency_mode_set(uint8_t sock_ind, uint8_t mode)
 
 	msg.msg_id	= HSMP_SET_POWER_MODE;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	if (mode > psm->max_pwr_eff_mode)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args	= 1;
 	msg.sock_ind	= sock_ind;
@@ -1839,12 +2067,12 @@ esmi_status_t esmi_pwr_efficiency_mode_get(uint8_t sock_ind, uint8_t *mode)
 
 	msg.msg_id	= HSMP_SET_POWER_MODE;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(mode);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args	= 1;
 	msg.response_sz = 1;
@@ -1866,15 +2094,15 @@ esmi_status_t esmi_df_pstate_range_set(uint8_t sock_ind, uint8_t max_pstate,
 
 	msg.msg_id	= HSMP_SET_PSTATE_MAX_MIN;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	if (max_pstate > min_pstate || min_pstate > psm->df_pstate_max_limit)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args	= 1;
 	msg.sock_ind	= sock_ind;
@@ -1917,7 +2145,7 @@ esmi_status_t esmi_metrics_table_version_get(uint32_t *metrics_version)
 
 	msg.msg_id	= HSMP_GET_METRIC_TABLE_VER;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(metrics_version);
 
@@ -1938,35 +2166,52 @@ esmi_status_t esmi_metrics_table_get(uint8_t sock_ind, struct hsmp_metric_table
 	struct hsmp_message msg = { 0 };
 	esmi_status_t ret = 0;
 	char filepath[FILEPATHSIZ];
-	FILE *fp;
-	int num;
+	ssize_t num;
+	int fd;
 
 	msg.msg_id	= HSMP_GET_METRIC_TABLE;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	snprintf(filepath, FILEPATHSIZ,
 		 "%s/socket%d/metrics_bin",
 		 HSMP_METRICTABLE_PATH, sock_ind);
 
-	fp = fopen(filepath, "rb");
+	fd = open(filepath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return event_status(__func__, 0, ESMI_FILE_ERROR);
 
-	if(fp == NULL)
-		return ESMI_FILE_ERROR;
-
-	num = fread(metrics_table, sizeof(struct hsmp_metric_table), 1, fp);
-	if (num != 1) {
+	num = pread(fd, metrics_table, sizeof(struct hsmp_metric_table), 0);
+	lib_syscalls++;
+	if (num != sizeof(struct hsmp_metric_table)) {
 		perror("error reading file");
-		ret = ferror(fp);
+		ret = num < 0 ? errno : EIO;
 	}
 
-	fclose(fp);
+	close(fd);
 	return errno_to_esmi_status(ret);
 }
 
+/*
+ * To get the metrics table from the shared cache
+ */
+esmi_status_t esmi_metrics_table_cached_get(uint8_t sock_ind,
+					    struct hsmp_metric_table *metrics_table)
+{
+	if (check_sup(HSMP_GET_METRIC_TABLE))
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
+
+	if (sock_ind >= psm->total_sockets)
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
+
+	CHECK_HSMP_GET_INPUT(metrics_table);
+
+	return mtbl_cache_read(sock_ind, 0, sizeof(*metrics_table), metrics_table);
+}
+
 /*
  * To get the the dram address of the metrics table
  */
@@ -1977,14 +2222,14 @@ esmi_status_t esmi_dram_address_metrics_table_get(uint8_t sock_ind, uint64_t *dr
 
 	msg.msg_id	= HSMP_GET_METRIC_TABLE_DRAM_ADDR;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
     if (!dram_addr)
-		return ESMI_ARG_PTR_NULL;
+		return event_status(__func__, 0, ESMI_ARG_PTR_NULL);
     if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz	= 2;
 	msg.sock_ind	= sock_ind;
@@ -2005,12 +2250,12 @@ esmi_status_t esmi_test_hsmp_mailbox(uint8_t sock_ind, uint32_t *data)
 
 	msg.msg_id	= HSMP_TEST;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(data);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.response_sz = 1;
 	msg.num_args	= 1;
@@ -2033,12 +2278,12 @@ esmi_status_t esmi_cpurail_isofreq_policy_set(uint8_t sock_ind, bool *val)
 
 	msg.msg_id	= HSMP_CPU_RAIL_ISO_FREQ_POLICY;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(val);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args	= 1;
 	msg.response_sz = 1;
@@ -2062,12 +2307,12 @@ esmi_status_t esmi_cpurail_isofreq_policy_get(uint8_t sock_ind, bool *val)
 
 	msg.msg_id	= HSMP_CPU_RAIL_ISO_FREQ_POLICY;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(val);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args	= 1;
 	msg.response_sz = 1;
@@ -2091,12 +2336,12 @@ esmi_status_t esmi_dfc_enable_set(uint8_t sock_ind, bool *val)
 
 	msg.msg_id	= HSMP_DFC_ENABLE_CTRL;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(val);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args	= 1;
 	msg.sock_ind	= sock_ind;
@@ -2120,12 +2365,12 @@ esmi_status_t esmi_dfc_ctrl_setting_get(uint8_t sock_ind, bool *val)
 
 	msg.msg_id	= HSMP_DFC_ENABLE_CTRL;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_GET_INPUT(val);
 
 	if (sock_ind >= psm->total_sockets)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args	= 1;
 	msg.sock_ind	= sock_ind;
@@ -2149,12 +2394,12 @@ esmi_status_t esmi_xgmi_pstate_range_set(uint8_t min_state, uint8_t max_state)
 
 	msg.msg_id	= HSMP_SET_XGMI_PSTATE_RANGE;
 	if (check_sup(msg.msg_id))
-		return ESMI_NO_HSMP_MSG_SUP;
+		return event_status(__func__, 0, ESMI_NO_HSMP_MSG_SUP);
 
 	CHECK_HSMP_INPUT();
 
 	if (max_state > min_state || min_state > 1)
-		return ESMI_INVALID_INPUT;
+		return event_status(__func__, 0, ESMI_INVALID_INPUT);
 
 	msg.num_args	= 1;
 	msg.sock_ind	= 0;
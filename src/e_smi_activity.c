@@ -0,0 +1,191 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Effective core frequency.
+ *
+ * A sweep reads the read-only APERF and MPERF copies of every cpu in one
+ * batch, then the core energies, and takes a TSC and a monotonic time
+ * stamp on either side. Every sweep reads in the same order, so the
+ * interval between two sweeps is the same for the counters of a core and
+ * its energy, up to the jitter of one sweep.
+ *
+ * MPERF and the TSC count at the reference frequency, MPERF only in C0.
+ * For a physical core the APERF and MPERF deltas are summed over its SMT
+ * siblings: sum(dAPERF) / sum(dMPERF) * ref is the frequency while active,
+ * weighted by the time each sibling was active. The reference frequency is
+ * dTSC / dt. The busy share is that of the busiest sibling, a lower bound
+ * of the time the core was in C0.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+struct activity_stamp {
+	uint64_t tsc;
+	uint64_t ns;
+};
+
+static pthread_mutex_t activity_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct msr_batch_op *ops;		// MPERF, APERF per cpu
+static uint64_t *prev_mperf, *prev_aperf;	// per cpu
+static uint64_t *energy, *prev_energy;		// per physical core
+static struct activity_stamp prev_stamp;
+static monitor_types_t msr_type;
+static uint32_t ncpus, nphys;
+
+static void activity_free(void)
+{
+	free(ops);
+	free(prev_mperf);
+	free(energy);
+	ops = NULL;
+	prev_mperf = prev_aperf = NULL;
+	energy = prev_energy = NULL;
+	memset(&prev_stamp, 0, sizeof(prev_stamp));
+}
+
+static esmi_status_t activity_state_init(void)
+{
+	uint32_t threads, cpu;
+	esmi_status_t ret;
+
+	if (ops)
+		return ESMI_SUCCESS;
+
+	if (!find_msr_safe())
+		msr_type = MSR_SAFE_TYPE;
+	else if (!find_msr())
+		msr_type = MSR_TYPE;
+	else
+		return ESMI_NO_MSR_DRV;
+
+	ret = esmi_number_of_cpus_get(&ncpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_threads_per_core_get(&threads);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	if (!threads || ncpus < threads || ncpus > UINT16_MAX)
+		return ESMI_IO_ERROR;
+	nphys = ncpus / threads;
+
+	ops = calloc(ncpus * 2, sizeof(*ops));
+	prev_mperf = calloc(ncpus * 2, sizeof(*prev_mperf));
+	energy = calloc(nphys * 2, sizeof(*energy));
+	if (!ops || !prev_mperf || !energy) {
+		activity_free();
+		return ESMI_NO_MEMORY;
+	}
+	prev_aperf = prev_mperf + ncpus;
+	prev_energy = energy + nphys;
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		ops[2 * cpu].cpu = ops[2 * cpu + 1].cpu = cpu;
+		ops[2 * cpu].msr = MPERF_RO_MSR;
+		ops[2 * cpu + 1].msr = APERF_RO_MSR;
+	}
+
+	return ESMI_SUCCESS;
+}
+
+void activity_exit(void)
+{
+	pthread_mutex_lock(&activity_lock);
+	activity_free();
+	ncpus = nphys = 0;
+	pthread_mutex_unlock(&activity_lock);
+}
+
+static void activity_core(struct esmi_core_activity *act, uint32_t core,
+			  uint64_t dtsc, uint64_t dns)
+{
+	uint64_t dm, da, sum_m = 0, sum_a = 0, max_m = 0;
+	struct msr_batch_op *m, *a;
+	uint32_t cpu;
+
+	memset(act, 0, sizeof(*act));
+	act->interval_ns = dns;
+	act->ref_freq = dtsc * 1000 / dns;
+	if (energy[core] >= prev_energy[core])
+		act->energy = energy[core] - prev_energy[core];
+	act->power = act->energy * 1000000 / dns;
+
+	for (cpu = core; cpu < ncpus; cpu += nphys) {
+		m = &ops[2 * cpu];
+		a = &ops[2 * cpu + 1];
+		/* an offline sibling or one gone through a reset */
+		if (m->err || a->err || !prev_mperf[cpu] ||
+		    m->msrdata < prev_mperf[cpu] || a->msrdata < prev_aperf[cpu])
+			continue;
+		dm = m->msrdata - prev_mperf[cpu];
+		da = a->msrdata - prev_aperf[cpu];
+		sum_m += dm;
+		sum_a += da;
+		if (dm > max_m)
+			max_m = dm;
+	}
+	if (sum_m)
+		act->eff_freq = (double)sum_a / sum_m * act->ref_freq;
+	if (dtsc)
+		act->busy_ppm = max_m >= dtsc ? 1000000 : max_m * 1000000 / dtsc;
+}
+
+esmi_status_t esmi_core_activity_get(struct esmi_core_activity *act)
+{
+	struct activity_stamp start, end, stamp;
+	esmi_status_t ret;
+	uint32_t core, cpu;
+	int err;
+
+	if (!act)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&activity_lock);
+	ret = activity_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	start.ns = monotonic_ns();
+	start.tsc = __rdtsc();
+	err = batch_read_msr_ops(msr_type, ops, ncpus * 2);
+	if (err) {
+		ret = errno_to_esmi_status(err);
+		goto unlock;
+	}
+	ret = esmi_all_energies_get(energy);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	end.tsc = __rdtsc();
+	end.ns = monotonic_ns();
+	stamp.tsc = start.tsc + (end.tsc - start.tsc) / 2;
+	stamp.ns = start.ns + (end.ns - start.ns) / 2;
+
+	for (core = 0; core < nphys; core++) {
+		if (prev_stamp.ns && stamp.ns > prev_stamp.ns)
+			activity_core(&act[core], core, stamp.tsc - prev_stamp.tsc,
+				      stamp.ns - prev_stamp.ns);
+		else
+			memset(&act[core], 0, sizeof(act[core]));
+	}
+
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		prev_mperf[cpu] = ops[2 * cpu].err ? 0 : ops[2 * cpu].msrdata;
+		prev_aperf[cpu] = ops[2 * cpu + 1].err ? 0 : ops[2 * cpu + 1].msrdata;
+	}
+	memcpy(prev_energy, energy, nphys * sizeof(*energy));
+	prev_stamp = stamp;
+
+unlock:
+	pthread_mutex_unlock(&activity_lock);
+	return ret;
+}
@@ -0,0 +1,202 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * MI300A power split tracker.
+ *
+ * The metrics table carries UQ16 Joule accumulators for the socket, the
+ * CCDs (CPU), XCDs (GPU), AIDs (IO die) and HBM, and UQ10 percent
+ * accumulators of C0 residency and GFX busy which grow by one sample per
+ * SMU tick. Successive tables are turned into average power over the
+ * interval and busy fractions over the ticks in between. Differences are
+ * taken in unsigned arithmetic of the counter width, so a wrap of a
+ * counter still yields the right delta. A table with an unchanged
+ * accumulation counter is not new and is skipped, so polling faster than
+ * the SMU refresh rate only costs the table read.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define APU_UQ16		(1.0 / 65536)
+#define APU_UQ10		(1.0 / 1024)
+
+enum apu_domain {
+	APU_SOCKET,
+	APU_CCD,
+	APU_XCD,
+	APU_AID,
+	APU_HBM,
+	APU_DOMAINS
+};
+
+struct apu_socket {
+	struct hsmp_metric_table mtbl;
+	struct esmi_apu_split ring[ESMI_APU_HISTORY];
+	uint32_t head, count;
+	uint64_t energy[APU_DOMAINS];	// previous accumulators, UQ16 J
+	uint64_t c0_acc, gfx_acc;	// previous busy accumulators, UQ10 %
+	uint32_t ticks;			// previous accumulation counter
+	uint64_t read_ns;		// time of the previous new table
+	bool init;
+};
+
+static pthread_mutex_t apu_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct apu_socket *sockets;
+static uint32_t nsockets;
+
+static esmi_status_t apu_state_init(void)
+{
+	esmi_status_t ret;
+
+	if (sockets)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_sockets_get(&nsockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	sockets = calloc(nsockets, sizeof(*sockets));
+	if (!sockets)
+		return ESMI_NO_MEMORY;
+
+	return ESMI_SUCCESS;
+}
+
+void apu_exit(void)
+{
+	pthread_mutex_lock(&apu_lock);
+	free(sockets);
+	sockets = NULL;
+	nsockets = 0;
+	pthread_mutex_unlock(&apu_lock);
+}
+
+static void apu_energy(const struct hsmp_metric_table *mtbl, uint64_t *energy)
+{
+	energy[APU_SOCKET] = mtbl->socket_energy_acc;
+	energy[APU_CCD] = mtbl->ccd_energy_acc;
+	energy[APU_XCD] = mtbl->xcd_energy_acc;
+	energy[APU_AID] = mtbl->aid_energy_acc;
+	energy[APU_HBM] = mtbl->hbm_energy_acc;
+}
+
+static void apu_sample(struct apu_socket *as, uint32_t sock_ind, uint64_t now)
+{
+	const struct hsmp_metric_table *mtbl = &as->mtbl;
+	uint64_t energy[APU_DOMAINS];
+	struct esmi_apu_split *s;
+	uint32_t dticks, power[APU_DOMAINS];
+	double dt;
+	int i;
+
+	apu_energy(mtbl, energy);
+	dticks = mtbl->accumulation_counter - as->ticks;
+	dt = (now - as->read_ns) / 1e9;
+	for (i = 0; i < APU_DOMAINS; i++)
+		/* UQ16 J over s, in mW */
+		power[i] = (energy[i] - as->energy[i]) * APU_UQ16 * 1000 / dt + 0.5;
+
+	s = &as->ring[as->head];
+	as->head = (as->head + 1) % ESMI_APU_HISTORY;
+	if (as->count < ESMI_APU_HISTORY)
+		as->count++;
+
+	s->time_ns = now;
+	s->interval_us = (now - as->read_ns) / 1000;
+	s->ticks = dticks;
+	s->sock_ind = sock_ind;
+	s->socket = power[APU_SOCKET];
+	s->cpu = power[APU_CCD];
+	s->gpu = power[APU_XCD];
+	s->iod = power[APU_AID];
+	s->hbm = power[APU_HBM];
+	s->cpu_busy = (mtbl->socket_c0_residency_acc - as->c0_acc) *
+		      APU_UQ10 / 100 / dticks;
+	s->gpu_busy = (mtbl->socket_gfx_busy_acc - as->gfx_acc) *
+		      APU_UQ10 / 100 / dticks;
+}
+
+esmi_status_t esmi_apu_split_update(uint32_t sock_ind, bool *updated)
+{
+	struct apu_socket *as;
+	esmi_status_t ret;
+	uint64_t now;
+
+	if (!updated)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&apu_lock);
+	ret = apu_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	as = &sockets[sock_ind];
+
+	*updated = false;
+	ret = esmi_metrics_table_cached_get(sock_ind, &as->mtbl);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	now = monotonic_ns();
+
+	if (as->init && as->mtbl.accumulation_counter == as->ticks)
+		goto unlock;
+	if (as->init && now > as->read_ns) {
+		apu_sample(as, sock_ind, now);
+		*updated = true;
+	}
+	apu_energy(&as->mtbl, as->energy);
+	as->c0_acc = as->mtbl.socket_c0_residency_acc;
+	as->gfx_acc = as->mtbl.socket_gfx_busy_acc;
+	as->ticks = as->mtbl.accumulation_counter;
+	as->read_ns = now;
+	as->init = true;
+
+unlock:
+	pthread_mutex_unlock(&apu_lock);
+	return ret;
+}
+
+esmi_status_t esmi_apu_split_history_get(uint32_t sock_ind, struct esmi_apu_split *splits,
+					 uint32_t max, uint32_t *count)
+{
+	struct apu_socket *as;
+	esmi_status_t ret;
+	uint32_t n, first, i;
+
+	if (!splits || !count)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&apu_lock);
+	ret = apu_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	as = &sockets[sock_ind];
+
+	/* the newest max samples, oldest first */
+	n = as->count < max ? as->count : max;
+	first = (as->head + ESMI_APU_HISTORY - n) % ESMI_APU_HISTORY;
+	for (i = 0; i < n; i++)
+		splits[i] = as->ring[(first + i) % ESMI_APU_HISTORY];
+	*count = n;
+
+unlock:
+	pthread_mutex_unlock(&apu_lock);
+	return ret;
+}
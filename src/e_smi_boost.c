@@ -0,0 +1,263 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Diff based batch writer for per core boost limits.
+ *
+ * Every boost limit written through the library is remembered per physical
+ * core, so a batch only sends HSMP messages for the cores whose limit
+ * actually changes. The HSMP mailbox of each socket is independent, hence
+ * the changed cores are grouped by socket and each socket is written from
+ * its own persistent worker thread.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+
+struct boost_batch {
+	uint32_t *cores;		// physical cores to write, in order
+	uint32_t ncores;
+	uint32_t nwrites;
+	esmi_status_t status;
+};
+
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* last limit written per physical core, 0 when unknown */
+static uint32_t *applied;
+static uint32_t nphys;
+
+/* batch scratch, sized once so a batch does not allocate */
+static uint32_t *want;
+static uint32_t *order;
+static int *core_sock;
+static struct boost_batch *batches;
+static uint32_t nsockets;
+
+/* called with cache_lock held */
+static void boost_free(void)
+{
+	free(__atomic_exchange_n(&applied, NULL, __ATOMIC_ACQ_REL));
+	free(want);
+	free(order);
+	free(core_sock);
+	free(batches);
+	want = order = NULL;
+	core_sock = NULL;
+	batches = NULL;
+	nphys = nsockets = 0;
+}
+
+static esmi_status_t boostlimit_cache_init(void)
+{
+	uint32_t *cache;
+	uint32_t cpus, threads, sockets;
+	esmi_status_t ret;
+	uint32_t i;
+
+	if (__atomic_load_n(&applied, __ATOMIC_ACQUIRE))
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_cpus_get(&cpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_threads_per_core_get(&threads);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_number_of_sockets_get(&sockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	if (!threads || !sockets || cpus < threads)
+		return ESMI_IO_ERROR;
+
+	pthread_mutex_lock(&cache_lock);
+	if (applied) {
+		pthread_mutex_unlock(&cache_lock);
+		return ESMI_SUCCESS;
+	}
+	nphys = cpus / threads;
+	nsockets = sockets;
+	want = calloc(nphys, sizeof(*want));
+	order = calloc(nphys, sizeof(*order));
+	core_sock = calloc(nphys, sizeof(*core_sock));
+	batches = calloc(nsockets, sizeof(*batches));
+	cache = calloc(nphys, sizeof(*cache));
+	if (!want || !order || !core_sock || !batches || !cache) {
+		free(cache);
+		boost_free();
+		pthread_mutex_unlock(&cache_lock);
+		return ESMI_NO_MEMORY;
+	}
+	for (i = 0; i < nphys; i++)
+		core_sock[i] = cpu_socket_get(i);
+	__atomic_store_n(&applied, cache, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&cache_lock);
+
+	return ESMI_SUCCESS;
+}
+
+void boostlimit_cache_update(uint32_t core_ind, uint32_t boostlimit)
+{
+	uint32_t *cache = __atomic_load_n(&applied, __ATOMIC_ACQUIRE);
+
+	if (cache)
+		__atomic_store_n(&cache[core_ind % nphys], boostlimit, __ATOMIC_RELAXED);
+}
+
+/* core_sock is only stable under batch_lock, esmi_exit() frees it */
+void boostlimit_cache_socket_update(uint32_t sock_ind, uint32_t boostlimit)
+{
+	uint32_t *cache;
+	uint32_t i;
+
+	pthread_mutex_lock(&batch_lock);
+	cache = __atomic_load_n(&applied, __ATOMIC_ACQUIRE);
+	if (cache) {
+		for (i = 0; i < nphys; i++)
+			if (core_sock[i] == (int)sock_ind)
+				__atomic_store_n(&cache[i], boostlimit, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&batch_lock);
+}
+
+void boostlimit_cache_exit(void)
+{
+	pthread_mutex_lock(&batch_lock);
+	pthread_mutex_lock(&cache_lock);
+	boost_free();
+	pthread_mutex_unlock(&cache_lock);
+	pthread_mutex_unlock(&batch_lock);
+}
+
+static void *boost_batch_write(void *arg)
+{
+	struct boost_batch *b = arg;
+	esmi_status_t ret;
+	uint32_t i, core;
+
+	for (i = 0; i < b->ncores; i++) {
+		core = b->cores[i];
+		ret = esmi_core_boostlimit_set(core, want[core]);
+		if (ret != ESMI_SUCCESS) {
+			if (b->status == ESMI_SUCCESS)
+				b->status = ret;
+			continue;
+		}
+		b->nwrites++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Write per cpu boost limits, skipping the physical cores which already
+ * run at the requested limit. SMT siblings share one limit, so the
+ * highest non zero request among the siblings of a core is used.
+ */
+esmi_status_t esmi_core_boostlimit_batch_set(const uint32_t *boostlimits,
+					     uint32_t ncpus, uint32_t *nwrites)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+	uint32_t busy = 0, written = 0;
+	uint32_t i, core, pos;
+	int sock;
+
+	if (!boostlimits)
+		return ESMI_ARG_PTR_NULL;
+
+	ret = boostlimit_cache_init();
+	if (ret != ESMI_SUCCESS)
+		return ret;
+
+	for (i = 0; i < ncpus; i++)
+		if (boostlimits[i] > UINT16_MAX)
+			return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&batch_lock);
+	if (!applied) {
+		pthread_mutex_unlock(&batch_lock);
+		return ESMI_NOT_INITIALIZED;
+	}
+
+	memset(want, 0, nphys * sizeof(*want));
+	for (i = 0; i < ncpus; i++) {
+		core = i % nphys;
+		if (boostlimits[i] > want[core])
+			want[core] = boostlimits[i];
+	}
+
+	/* count the changed cores of each socket, then lay them out */
+	for (i = 0; i < nsockets; i++) {
+		batches[i].ncores = 0;
+		batches[i].nwrites = 0;
+		batches[i].status = ESMI_SUCCESS;
+	}
+	for (core = 0; core < nphys; core++) {
+		sock = core_sock[core];
+		if (!want[core] || sock < 0 || sock >= (int)nsockets ||
+		    want[core] == __atomic_load_n(&applied[core], __ATOMIC_RELAXED))
+			continue;
+		batches[sock].ncores++;
+	}
+	for (i = 0, pos = 0; i < nsockets; i++) {
+		batches[i].cores = &order[pos];
+		pos += batches[i].ncores;
+		if (batches[i].ncores)
+			busy++;
+		batches[i].ncores = 0;
+	}
+	for (core = 0; core < nphys; core++) {
+		sock = core_sock[core];
+		if (!want[core] || sock < 0 || sock >= (int)nsockets ||
+		    want[core] == __atomic_load_n(&applied[core], __ATOMIC_RELAXED))
+			continue;
+		batches[sock].cores[batches[sock].ncores++] = core;
+	}
+
+	/* the sockets on the workers, a single busy socket is written inline */
+	if (busy > 1) {
+		workers_run(boost_batch_write, batches, sizeof(*batches), nsockets);
+	} else {
+		for (i = 0; i < nsockets; i++)
+			if (batches[i].ncores)
+				boost_batch_write(&batches[i]);
+	}
+	for (i = 0; i < nsockets; i++) {
+		if (!batches[i].ncores)
+			continue;
+		written += batches[i].nwrites;
+		if (ret == ESMI_SUCCESS)
+			ret = batches[i].status;
+	}
+	pthread_mutex_unlock(&batch_lock);
+
+	if (nwrites)
+		*nwrites = written;
+
+	return ret;
+}
+
+/*
+ * Forget the cached limits, the next batch writes every requested core.
+ * Needed after the limits were changed outside of this library, e.g.
+ * through APML or by another process.
+ */
+void esmi_core_boostlimit_batch_reset(void)
+{
+	uint32_t *cache = __atomic_load_n(&applied, __ATOMIC_ACQUIRE);
+	uint32_t i;
+
+	if (!cache)
+		return;
+	for (i = 0; i < nphys; i++)
+		__atomic_store_n(&cache[i], 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,315 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Per socket power breakdown.
+ *
+ * A tick reads the package energy of every socket, the energy of every
+ * core, the SVI rail power and the DIMM power back to back and takes the
+ * middle of the reads as the time of the sample. Core and package power
+ * are energy deltas over the interval since the previous tick, the uncore
+ * is the package minus the cores. Every record carries flags for readings
+ * which do not add up, so consumers can drop or weight them. Records are
+ * kept per socket in a fixed ring which overwrites the oldest ones.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define BRK_CORE_SLACK		1.02	/* cores may exceed the package by 2% */
+#define BRK_RAIL_TOLERANCE	0.2	/* rails vs package relative difference */
+#define BRK_SKEW_SHARE		10	/* reads may take 1/10 of the interval */
+
+struct brk_socket {
+	struct esmi_power_breakdown ring[ESMI_BREAKDOWN_HISTORY];
+	uint64_t head, tail;		// next to write, next to read
+	uint64_t lost;
+	uint64_t pkg_energy;		// previous package energy in uJ
+	uint64_t core_energy;		// previous sum of core energy in uJ
+	bool rails_sup;			// rails message supported
+	bool dimm_sup;			// DIMM power message supported
+	bool rails_ok;			// rails read on this tick
+	bool dimm_ok;			// DIMM power read on this tick
+};
+
+static pthread_mutex_t brk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t task_ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct brk_socket *sockets;
+static uint64_t *core_energy;		// per physical core
+static int *core_sock;
+static uint64_t *pkg, *cores;		// per socket scratch
+static uint32_t *rails, *dimm;
+static uint32_t nsockets, nphys;
+static uint64_t last_ns;		// time of the previous tick, 0 before
+static uint32_t task_id;
+static bool task_running;
+
+/* the state is touched from the sampler thread, keep it in the arena */
+static esmi_status_t brk_state_init(void)
+{
+	uint32_t ncpus, threads, i;
+	esmi_status_t ret;
+
+	if (sockets)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_sockets_get(&nsockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_number_of_cpus_get(&ncpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_threads_per_core_get(&threads);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	if (!threads || ncpus < threads)
+		return ESMI_IO_ERROR;
+	nphys = ncpus / threads;
+
+	core_energy = sampler_arena_alloc(nphys * sizeof(*core_energy));
+	core_sock = sampler_arena_alloc(nphys * sizeof(*core_sock));
+	pkg = sampler_arena_alloc(nsockets * 2 * sizeof(*pkg));
+	rails = sampler_arena_alloc(nsockets * 2 * sizeof(*rails));
+	sockets = sampler_arena_alloc(nsockets * sizeof(*sockets));
+	if (!core_energy || !core_sock || !pkg || !rails || !sockets) {
+		sockets = NULL;
+		return ESMI_NO_MEMORY;
+	}
+	cores = pkg + nsockets;
+	dimm = rails + nsockets;
+	for (i = 0; i < nphys; i++)
+		core_sock[i] = cpu_socket_get(i);
+	for (i = 0; i < nsockets; i++) {
+		sockets[i].rails_sup = true;
+		sockets[i].dimm_sup = true;
+	}
+	last_ns = 0;
+
+	return ESMI_SUCCESS;
+}
+
+void breakdown_exit(void)
+{
+	esmi_power_breakdown_stop();
+
+	/* the arena itself is released by sampler_exit() */
+	pthread_mutex_lock(&brk_lock);
+	sockets = NULL;
+	core_energy = pkg = cores = NULL;
+	rails = dimm = NULL;
+	core_sock = NULL;
+	nsockets = nphys = 0;
+	pthread_mutex_unlock(&brk_lock);
+}
+
+static uint32_t brk_power(uint64_t cur, uint64_t prev, uint64_t dt_ns)
+{
+	/* uJ per ns times 1e6 is mW */
+	return (double)(cur - prev) * 1e6 / dt_ns + 0.5;
+}
+
+static void brk_record(struct brk_socket *bs, uint32_t sock_ind, uint64_t now,
+		       uint64_t dt_ns, uint64_t skew_ns, uint64_t pkg_uj,
+		       uint64_t cores_uj, uint32_t rails_mw, uint32_t dimm_mw)
+{
+	struct esmi_power_breakdown *rec;
+
+	if (bs->head - bs->tail == ESMI_BREAKDOWN_HISTORY) {
+		bs->tail++;
+		bs->lost++;
+	}
+	rec = &bs->ring[bs->head++ % ESMI_BREAKDOWN_HISTORY];
+	memset(rec, 0, sizeof(*rec));
+	rec->time_ns = now;
+	rec->interval_us = dt_ns / 1000;
+	rec->sock_ind = sock_ind;
+	rec->rails = rails_mw;
+	rec->dimm = dimm_mw;
+	if (!bs->rails_ok)
+		rec->flags |= ESMI_BREAKDOWN_NO_RAILS;
+	if (!bs->dimm_ok)
+		rec->flags |= ESMI_BREAKDOWN_NO_DIMM;
+	if (skew_ns * BRK_SKEW_SHARE > dt_ns)
+		rec->flags |= ESMI_BREAKDOWN_SKEW;
+
+	if (pkg_uj < bs->pkg_energy || cores_uj < bs->core_energy) {
+		rec->flags |= ESMI_BREAKDOWN_COUNTER_RESET;
+		return;
+	}
+	rec->package = brk_power(pkg_uj, bs->pkg_energy, dt_ns);
+	rec->cores = brk_power(cores_uj, bs->core_energy, dt_ns);
+	if (rec->cores > rec->package * BRK_CORE_SLACK)
+		rec->flags |= ESMI_BREAKDOWN_CORES_OVER_PACKAGE;
+	rec->uncore = rec->cores < rec->package ? rec->package - rec->cores : 0;
+	if (bs->rails_ok && rec->package &&
+	    (rails_mw > rec->package * (1 + BRK_RAIL_TOLERANCE) ||
+	     rails_mw < rec->package * (1 - BRK_RAIL_TOLERANCE)))
+		rec->flags |= ESMI_BREAKDOWN_RAIL_MISMATCH;
+}
+
+static esmi_status_t brk_tick(void)
+{
+	uint64_t start, end, now, dt = 0;
+	struct brk_socket *bs;
+	esmi_status_t ret;
+	uint32_t i;
+
+	memset(cores, 0, nsockets * sizeof(*cores));
+	memset(rails, 0, nsockets * 2 * sizeof(*rails));
+
+	start = monotonic_ns();
+	ret = esmi_all_energies_get(core_energy);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	for (i = 0; i < nsockets; i++) {
+		bs = &sockets[i];
+		ret = esmi_socket_energy_get(i, &pkg[i]);
+		if (ret != ESMI_SUCCESS)
+			return ret;
+		bs->rails_ok = false;
+		if (bs->rails_sup) {
+			ret = esmi_pwr_svi_telemetry_all_rails_get(i, &rails[i]);
+			bs->rails_sup = ret != ESMI_NO_HSMP_MSG_SUP;
+			bs->rails_ok = ret == ESMI_SUCCESS;
+		}
+		bs->dimm_ok = false;
+		if (bs->dimm_sup) {
+			ret = dimm_socket_power_get(i, &dimm[i]);
+			bs->dimm_sup = ret != ESMI_NO_HSMP_MSG_SUP;
+			bs->dimm_ok = ret == ESMI_SUCCESS;
+		}
+	}
+	end = monotonic_ns();
+	now = start + (end - start) / 2;
+
+	for (i = 0; i < nphys; i++)
+		if (core_sock[i] >= 0 && core_sock[i] < (int)nsockets)
+			cores[core_sock[i]] += core_energy[i];
+
+	if (last_ns)
+		dt = now - last_ns;
+	for (i = 0; i < nsockets; i++) {
+		bs = &sockets[i];
+		if (dt)
+			brk_record(bs, i, now, dt, end - start, pkg[i], cores[i],
+				   rails[i], dimm[i]);
+		bs->pkg_energy = pkg[i];
+		bs->core_energy = cores[i];
+	}
+	last_ns = now;
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_power_breakdown_tick(void)
+{
+	esmi_status_t ret;
+
+	pthread_mutex_lock(&brk_lock);
+	ret = brk_state_init();
+	if (ret == ESMI_SUCCESS)
+		ret = brk_tick();
+	pthread_mutex_unlock(&brk_lock);
+
+	return ret;
+}
+
+static void brk_task(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&brk_lock);
+	if (sockets)
+		brk_tick();
+	pthread_mutex_unlock(&brk_lock);
+}
+
+esmi_status_t esmi_power_breakdown_start(uint32_t interval_ms)
+{
+	struct esmi_sampler_config cfg;
+	uint64_t divider;
+	esmi_status_t ret;
+
+	if (!interval_ms)
+		return ESMI_INVALID_INPUT;
+	ret = esmi_sampler_config_get(&cfg);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	divider = interval_ms * 1000000ULL / cfg.period_ns;
+	if (!divider)
+		divider = 1;
+	if (divider > UINT32_MAX)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&task_ctl_lock);
+	if (task_running) {
+		ret = ESMI_DEV_BUSY;
+		goto unlock;
+	}
+	/* the first tick probes the DIMMs, keep it out of the sampler */
+	ret = esmi_power_breakdown_tick();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	ret = esmi_sampler_task_add(brk_task, NULL, divider, &task_id);
+	if (ret == ESMI_SUCCESS) {
+		sampler_task_name_set(task_id, "breakdown");
+		task_running = true;
+	}
+
+unlock:
+	pthread_mutex_unlock(&task_ctl_lock);
+	return ret;
+}
+
+esmi_status_t esmi_power_breakdown_stop(void)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+
+	pthread_mutex_lock(&task_ctl_lock);
+	if (task_running)
+		ret = esmi_sampler_task_remove(task_id);
+	task_running = false;
+	pthread_mutex_unlock(&task_ctl_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_power_breakdown_read(uint32_t sock_ind,
+					struct esmi_power_breakdown *records,
+					uint32_t max, uint32_t *count, uint64_t *lost)
+{
+	struct brk_socket *bs;
+	esmi_status_t ret;
+	uint32_t n = 0;
+
+	if (!records || !count)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&brk_lock);
+	ret = brk_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	bs = &sockets[sock_ind];
+	while (n < max && bs->tail < bs->head)
+		records[n++] = bs->ring[bs->tail++ % ESMI_BREAKDOWN_HISTORY];
+	*count = n;
+	if (lost)
+		*lost = bs->lost;
+	bs->lost = 0;
+
+unlock:
+	pthread_mutex_unlock(&brk_lock);
+	return ret;
+}
@@ -0,0 +1,478 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Per cgroup energy budget enforcement.
+ *
+ * On every apply the energy of each physical core since the previous apply
+ * is split over its SMT siblings by their busy time from /proc/stat, and a
+ * cgroup is charged the part of each cpu's energy matching its share of
+ * the busy time on that cpu. The cgroup cpu time comes per cpu from
+ * cpuacct.usage_percpu on cgroup v1. cgroup v2 only has the total
+ * usage_usec in cpu.stat, which is spread over the cpus of the cgroup
+ * cpuset in proportion to their busy time.
+ *
+ * Once a cgroup used ramp_pct of its budget the boost limit of the cpus
+ * it runs on is lowered linearly towards boost_min, reached when the
+ * budget is used up. The limit moves down at most BUDGET_RAMP_STEP MHz
+ * per apply and is kept on a BUDGET_QUANTUM grid, so the batch writer only
+ * sends a message when the limit crosses a grid step. When the window
+ * rolls over the limit returns to boost_max at once.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define BUDGET_RAMP_STEP	100	/* MHz per apply */
+#define BUDGET_QUANTUM		25	/* MHz */
+#define BUDGET_HOLD		4	/* applies a cpu stays occupied */
+#define STAT_BUF_SIZE		8192
+
+struct budget {
+	bool used;
+	char path[FILEPATHSIZ];
+	struct esmi_energy_budget cfg;
+	uint64_t window_ns;
+	uint64_t window_start;		// CLOCK_MONOTONIC ns
+	double consumed;		// uJ in the current window
+	uint32_t boostlimit;		// current limit, boost_max when released
+	bool usage_init;
+	uint64_t usage_ns;		// previous total cpu time, cgroup v2
+	uint64_t *usage_pc;		// previous cpu time per cpu, cgroup v1
+	bool percpu;			// cgroup v1 per cpu accounting
+	uint8_t *occupied;		// per cpu, non zero while the cgroup runs there
+	uint8_t *cpuset;
+};
+
+static pthread_mutex_t budget_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct budget budgets[ESMI_BUDGET_MAX];
+static uint32_t *limits;		// per cpu limit handed to the batch writer
+static uint32_t *restore;		// per cpu limit to restore, 0 if untouched
+static double *cpu_energy;		// per cpu energy of the interval, uJ
+static double *cpu_busy;		// per cpu busy time of the interval, ns
+static double *cg_time;			// per cpu time of one cgroup, ns
+static uint64_t *energy, *prev_energy;
+static uint64_t *busy, *total, *prev_busy;
+static uint64_t last_ns;
+static uint32_t ncpus, nphys;
+static char *stat_buf;
+static long clk_tck;
+
+static void budget_free(void)
+{
+	free(limits);
+	free(cpu_energy);
+	free(energy);
+	free(busy);
+	free(stat_buf);
+	limits = restore = NULL;
+	cpu_energy = cpu_busy = cg_time = NULL;
+	energy = prev_energy = NULL;
+	busy = total = prev_busy = NULL;
+	stat_buf = NULL;
+}
+
+static esmi_status_t budget_state_init(void)
+{
+	uint32_t threads;
+	esmi_status_t ret;
+
+	if (limits)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_cpus_get(&ncpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_threads_per_core_get(&threads);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	if (!threads || ncpus < threads)
+		return ESMI_IO_ERROR;
+	nphys = ncpus / threads;
+	clk_tck = sysconf(_SC_CLK_TCK);
+	if (clk_tck <= 0)
+		clk_tck = 100;
+
+	limits = calloc(ncpus * 2, sizeof(*limits));
+	cpu_energy = calloc(ncpus * 3, sizeof(*cpu_energy));
+	energy = calloc(nphys * 2, sizeof(*energy));
+	busy = calloc(ncpus * 3, sizeof(*busy));
+	stat_buf = malloc(STAT_BUF_SIZE);
+	if (!limits || !cpu_energy || !energy || !busy || !stat_buf) {
+		budget_free();
+		return ESMI_NO_MEMORY;
+	}
+	restore = limits + ncpus;
+	cpu_busy = cpu_energy + ncpus;
+	cg_time = cpu_busy + ncpus;
+	prev_energy = energy + nphys;
+	total = busy + ncpus;
+	prev_busy = total + ncpus;
+	last_ns = 0;
+
+	return ESMI_SUCCESS;
+}
+
+static void budget_release(struct budget *bg)
+{
+	free(bg->usage_pc);
+	free(bg->occupied);
+	memset(bg, 0, sizeof(*bg));
+}
+
+void budget_exit(void)
+{
+	int i;
+
+	pthread_mutex_lock(&budget_lock);
+	for (i = 0; i < ESMI_BUDGET_MAX; i++)
+		budget_release(&budgets[i]);
+	budget_free();
+	ncpus = nphys = 0;
+	pthread_mutex_unlock(&budget_lock);
+}
+
+esmi_status_t esmi_energy_budget_add(const char *cgroup_path,
+				     const struct esmi_energy_budget *cfg,
+				     uint32_t *budget_id)
+{
+	struct budget *bg = NULL;
+	esmi_status_t ret;
+	int i;
+
+	if (!cgroup_path || !cfg || !budget_id)
+		return ESMI_ARG_PTR_NULL;
+	if (!cfg->budget_uj || !cfg->window_s || cfg->ramp_pct >= 100 ||
+	    !cfg->boost_min || cfg->boost_min > cfg->boost_max ||
+	    cfg->boost_max > UINT16_MAX)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&budget_lock);
+	ret = budget_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	for (i = 0; i < ESMI_BUDGET_MAX; i++) {
+		if (!budgets[i].used) {
+			bg = &budgets[i];
+			break;
+		}
+	}
+	if (!bg) {
+		ret = ESMI_DEV_BUSY;
+		goto unlock;
+	}
+
+	cgroup_path_resolve(cgroup_path, bg->path, sizeof(bg->path));
+	if (access(bg->path, F_OK)) {
+		ret = errno_to_esmi_status(errno);
+		goto unlock;
+	}
+	/* occupied and cpuset share one allocation */
+	bg->occupied = calloc(ncpus * 2, sizeof(*bg->occupied));
+	bg->usage_pc = calloc(ncpus, sizeof(*bg->usage_pc));
+	if (!bg->occupied || !bg->usage_pc) {
+		budget_release(bg);
+		ret = ESMI_NO_MEMORY;
+		goto unlock;
+	}
+	bg->cpuset = bg->occupied + ncpus;
+	bg->cfg = *cfg;
+	bg->window_ns = cfg->window_s * 1000000000ULL;
+	bg->window_start = monotonic_ns();
+	bg->boostlimit = cfg->boost_max;
+	bg->used = true;
+	*budget_id = i;
+
+unlock:
+	pthread_mutex_unlock(&budget_lock);
+	return ret;
+}
+
+esmi_status_t esmi_energy_budget_remove(uint32_t budget_id)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+
+	if (budget_id >= ESMI_BUDGET_MAX)
+		return ESMI_INVALID_INPUT;
+
+	/* the cpus it throttled are restored by the next apply */
+	pthread_mutex_lock(&budget_lock);
+	if (!budgets[budget_id].used)
+		ret = ESMI_INVALID_INPUT;
+	else
+		budget_release(&budgets[budget_id]);
+	pthread_mutex_unlock(&budget_lock);
+
+	return ret;
+}
+
+/* per cpu busy time and energy of the interval since the previous apply */
+static esmi_status_t budget_cpu_update(uint64_t now)
+{
+	double sib_busy;
+	uint32_t cpu, core, j;
+	esmi_status_t ret;
+	uint64_t db;
+	int err;
+
+	err = procstat_read(busy, total, ncpus);
+	if (err)
+		return errno_to_esmi_status(err);
+	ret = esmi_all_energies_get(energy);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		db = last_ns && busy[cpu] >= prev_busy[cpu] ? busy[cpu] - prev_busy[cpu] : 0;
+		cpu_busy[cpu] = db * 1e9 / clk_tck;
+		prev_busy[cpu] = busy[cpu];
+	}
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		core = cpu % nphys;
+		cpu_energy[cpu] = 0;
+		if (!last_ns || energy[core] < prev_energy[core] || !cpu_busy[cpu])
+			continue;
+		/* the siblings of a cpu share its index modulo nphys */
+		sib_busy = 0;
+		for (j = core; j < ncpus; j += nphys)
+			sib_busy += cpu_busy[j];
+		cpu_energy[cpu] = (energy[core] - prev_energy[core]) * cpu_busy[cpu] / sib_busy;
+	}
+	memcpy(prev_energy, energy, nphys * sizeof(*energy));
+	last_ns = now;
+
+	return ESMI_SUCCESS;
+}
+
+/* cgroup v1: cpuacct.usage_percpu lists the ns used on every cpu */
+static esmi_status_t budget_usage_percpu(struct budget *bg)
+{
+	char filepath[FILEPATHSIZ + FILESIZ];
+	uint64_t val;
+	uint32_t cpu;
+	char *p, *end;
+	int err;
+
+	snprintf(filepath, sizeof(filepath), "%s/cpuacct.usage_percpu", bg->path);
+	err = readsys_str(filepath, stat_buf, STAT_BUF_SIZE);
+	if (err)
+		return errno_to_esmi_status(err);
+
+	p = stat_buf;
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		val = strtoull(p, &end, 10);
+		if (end == p)
+			break;
+		p = end;
+		cg_time[cpu] = bg->usage_init && val >= bg->usage_pc[cpu] ?
+			       val - bg->usage_pc[cpu] : 0;
+		bg->usage_pc[cpu] = val;
+	}
+	for (; cpu < ncpus; cpu++)
+		cg_time[cpu] = 0;
+	bg->percpu = true;
+
+	return ESMI_SUCCESS;
+}
+
+/* cgroup v2: usage_usec of cpu.stat spread over the cpuset by busy time */
+static esmi_status_t budget_usage_total(struct budget *bg)
+{
+	char filepath[FILEPATHSIZ + FILESIZ];
+	double set_busy = 0, dt;
+	uint64_t usec = 0;
+	esmi_status_t ret;
+	uint32_t cpu;
+	char *p;
+	int err;
+
+	snprintf(filepath, sizeof(filepath), "%s/cpu.stat", bg->path);
+	err = readsys_str(filepath, stat_buf, STAT_BUF_SIZE);
+	if (err)
+		return errno_to_esmi_status(err);
+	p = strstr(stat_buf, "usage_usec ");
+	if (!p)
+		return ESMI_NOT_SUPPORTED;
+	usec = strtoull(p + strlen("usage_usec "), NULL, 10);
+
+	ret = cgroup_cpuset_get(bg->path, bg->cpuset, ncpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+
+	dt = bg->usage_init && usec * 1000 >= bg->usage_ns ?
+	     usec * 1000.0 - bg->usage_ns : 0;
+	bg->usage_ns = usec * 1000;
+	for (cpu = 0; cpu < ncpus; cpu++)
+		if (bg->cpuset[cpu])
+			set_busy += cpu_busy[cpu];
+	for (cpu = 0; cpu < ncpus; cpu++)
+		cg_time[cpu] = bg->cpuset[cpu] && set_busy > 0 ?
+			       dt * cpu_busy[cpu] / set_busy : 0;
+
+	return ESMI_SUCCESS;
+}
+
+static esmi_status_t budget_charge(struct budget *bg)
+{
+	esmi_status_t ret;
+	uint32_t cpu;
+	double share;
+
+	ret = ESMI_FILE_ERROR;
+	if (!bg->usage_init || bg->percpu)
+		ret = budget_usage_percpu(bg);
+	if (ret != ESMI_SUCCESS && !bg->percpu)
+		ret = budget_usage_total(bg);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		if (cg_time[cpu] > 0)
+			bg->occupied[cpu] = BUDGET_HOLD;
+		else if (bg->occupied[cpu])
+			bg->occupied[cpu]--;
+		if (!bg->usage_init || cpu_busy[cpu] <= 0)
+			continue;
+		share = cg_time[cpu] / cpu_busy[cpu];
+		bg->consumed += cpu_energy[cpu] * (share < 1 ? share : 1);
+	}
+	bg->usage_init = true;
+
+	return ESMI_SUCCESS;
+}
+
+static void budget_limit_update(struct budget *bg, uint64_t now)
+{
+	const struct esmi_energy_budget *cfg = &bg->cfg;
+	double used, soft = cfg->ramp_pct / 100.0;
+	uint32_t target;
+
+	if (now - bg->window_start >= bg->window_ns) {
+		/* a new window, restore at once */
+		bg->window_start += (now - bg->window_start) / bg->window_ns * bg->window_ns;
+		bg->consumed = 0;
+		bg->boostlimit = cfg->boost_max;
+		return;
+	}
+
+	used = bg->consumed / cfg->budget_uj;
+	if (used < soft)
+		target = cfg->boost_max;
+	else if (used >= 1)
+		target = cfg->boost_min;
+	else
+		target = cfg->boost_max - (cfg->boost_max - cfg->boost_min) *
+			 (used - soft) / (1 - soft);
+	target -= target % BUDGET_QUANTUM;
+	if (target < cfg->boost_min)
+		target = cfg->boost_min;
+
+	if (target >= bg->boostlimit)
+		bg->boostlimit = target;
+	else if (bg->boostlimit - target > BUDGET_RAMP_STEP)
+		bg->boostlimit -= BUDGET_RAMP_STEP;
+	else
+		bg->boostlimit = target;
+}
+
+/*
+ * A cpu occupied by several throttled cgroups gets the lowest of their
+ * limits. A cpu no throttled cgroup runs on anymore gets the boost_max of
+ * the cgroup which throttled it last, once, and is left alone afterwards.
+ */
+esmi_status_t esmi_energy_budget_apply(uint32_t *nwrites)
+{
+	esmi_status_t ret, charge_ret = ESMI_SUCCESS;
+	struct budget *bg;
+	uint32_t i, cpu;
+	uint64_t now;
+
+	pthread_mutex_lock(&budget_lock);
+	ret = budget_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	now = monotonic_ns();
+	ret = budget_cpu_update(now);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	memset(limits, 0, ncpus * sizeof(*limits));
+	for (i = 0; i < ESMI_BUDGET_MAX; i++) {
+		bg = &budgets[i];
+		if (!bg->used)
+			continue;
+		ret = budget_charge(bg);
+		if (ret != ESMI_SUCCESS) {
+			/* a vanished cgroup occupies nothing */
+			memset(bg->occupied, 0, ncpus);
+			if (charge_ret == ESMI_SUCCESS)
+				charge_ret = ret;
+		}
+		budget_limit_update(bg, now);
+		if (bg->boostlimit >= bg->cfg.boost_max)
+			continue;
+		for (cpu = 0; cpu < ncpus; cpu++) {
+			if (!bg->occupied[cpu])
+				continue;
+			if (!limits[cpu] || bg->boostlimit < limits[cpu])
+				limits[cpu] = bg->boostlimit;
+			if (bg->cfg.boost_max > restore[cpu])
+				restore[cpu] = bg->cfg.boost_max;
+		}
+	}
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		if (limits[cpu])
+			continue;
+		limits[cpu] = restore[cpu];
+		restore[cpu] = 0;
+	}
+
+	ret = esmi_core_boostlimit_batch_set(limits, ncpus, nwrites);
+
+unlock:
+	pthread_mutex_unlock(&budget_lock);
+	return ret != ESMI_SUCCESS ? ret : charge_ret;
+}
+
+esmi_status_t esmi_energy_budget_status_get(uint32_t budget_id,
+					    struct esmi_energy_budget_status *status)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+	struct budget *bg;
+	uint64_t now;
+
+	if (!status)
+		return ESMI_ARG_PTR_NULL;
+	if (budget_id >= ESMI_BUDGET_MAX)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&budget_lock);
+	bg = &budgets[budget_id];
+	if (!bg->used) {
+		ret = ESMI_INVALID_INPUT;
+	} else {
+		now = monotonic_ns();
+		status->consumed_uj = bg->consumed;
+		status->window_left_ms = now - bg->window_start < bg->window_ns ?
+					 (bg->window_ns - (now - bg->window_start)) / 1000000 : 0;
+		status->boostlimit = bg->boostlimit;
+	}
+	pthread_mutex_unlock(&budget_lock);
+
+	return ret;
+}
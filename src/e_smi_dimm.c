@@ -0,0 +1,424 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * DIMM energy accumulators.
+ *
+ * The DIMM power sensor reports the last reading together with the time
+ * since it was taken, so every reading is placed at now - update_rate.
+ * A sample which returns the same reading again adds nothing, a new
+ * reading adds the trapezoid between the previous reading and this one.
+ * When the gap between two readings is longer than DIMM_MAX_GAP_NS, or the
+ * age field is saturated and the real time of the reading is unknown, the
+ * previous power is held over the gap instead and the gap is counted as
+ * stale time. The accumulators only grow on new readings so they are
+ * monotonic, like the socket and core energy counters.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define DIMM_ADDR_SPACE		256	/* 8 bit DIMM addresses */
+#define DIMM_AGE_MAX		511	/* saturated 9 bit update_rate, ms */
+#define DIMM_SLACK_NS		2000000ULL	/* ms rounding and call latency */
+#define DIMM_MAX_GAP_NS		1000000000ULL
+#define DIMM_PROBE_TRIES	4	/* reads of an address failing transiently */
+
+struct dimm_acc {
+	uint8_t addr;
+	uint16_t power;			// last reading in mW
+	uint64_t read_ns;		// sensor time of the last reading
+	double energy;			// uJ
+	uint64_t stale_ns;
+	uint64_t readings;
+};
+
+struct dimm_socket {
+	struct dimm_acc dimm[ESMI_DIMM_MAX];
+	uint32_t ndimms;
+	bool probed;			// whole address space scanned
+	uint32_t npending;		// addresses to probe again
+	uint8_t tries[DIMM_ADDR_SPACE];	// failed probes, 0 once settled
+	double energy;			// uJ, sum over the DIMMs
+};
+
+static pthread_mutex_t dimm_lock = PTHREAD_MUTEX_INITIALIZER;
+/* serializes start and stop, never taken by the task */
+static pthread_mutex_t task_ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dimm_socket *sockets;
+static uint32_t nsockets;
+static uint32_t task_id;
+static bool task_running;
+
+/*
+ * The state is touched from the sampler thread, so it lives in the locked
+ * and pre-faulted sampler arena, which is released by sampler_exit().
+ */
+static esmi_status_t dimm_state_init(void)
+{
+	esmi_status_t ret;
+
+	if (sockets)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_sockets_get(&nsockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	sockets = sampler_arena_alloc(nsockets * sizeof(*sockets));
+	if (!sockets)
+		return ESMI_NO_MEMORY;
+
+	return ESMI_SUCCESS;
+}
+
+void dimm_exit(void)
+{
+	esmi_dimm_energy_stop();
+
+	pthread_mutex_lock(&dimm_lock);
+	sockets = NULL;
+	nsockets = 0;
+	pthread_mutex_unlock(&dimm_lock);
+}
+
+/*
+ * Populated DIMMs are the addresses the sensor answers for, the SMU
+ * rejects the others as invalid input. An address failing otherwise, a
+ * busy SMU or an I/O error, is probed again on the next samples, up to
+ * DIMM_PROBE_TRIES times.
+ */
+static esmi_status_t dimm_probe_addr(uint32_t sock_ind, uint32_t addr)
+{
+	struct dimm_socket *ds = &sockets[sock_ind];
+	struct dimm_power dp;
+	esmi_status_t ret;
+
+	ret = esmi_dimm_power_consumption_get(sock_ind, addr, &dp);
+	if (ret == ESMI_NO_HSMP_MSG_SUP || ret == ESMI_NO_HSMP_SUP ||
+	    ret == ESMI_NOT_INITIALIZED)
+		return ret;
+
+	if (ret == ESMI_SUCCESS || ret == ESMI_INVALID_INPUT ||
+	    ++ds->tries[addr] >= DIMM_PROBE_TRIES) {
+		if (ds->tries[addr])
+			ds->npending--;
+		ds->tries[addr] = 0;
+	} else if (ds->tries[addr] == 1) {
+		ds->npending++;
+	}
+	if (ret == ESMI_SUCCESS)
+		ds->dimm[ds->ndimms++].addr = addr;
+
+	return ESMI_SUCCESS;
+}
+
+static esmi_status_t dimm_probe(uint32_t sock_ind)
+{
+	struct dimm_socket *ds = &sockets[sock_ind];
+	esmi_status_t ret;
+	uint32_t addr;
+
+	if (ds->probed && !ds->npending)
+		return ESMI_SUCCESS;
+
+	for (addr = 0; addr < DIMM_ADDR_SPACE && ds->ndimms < ESMI_DIMM_MAX; addr++) {
+		if (ds->probed && !ds->tries[addr])
+			continue;
+		ret = dimm_probe_addr(sock_ind, addr);
+		if (ret == ESMI_SUCCESS)
+			continue;
+		/* the scan starts over */
+		if (!ds->probed) {
+			memset(ds->tries, 0, sizeof(ds->tries));
+			ds->npending = 0;
+			ds->ndimms = 0;
+		}
+		return ret;
+	}
+	ds->probed = true;
+	/* no room left for the addresses still pending */
+	if (ds->ndimms == ESMI_DIMM_MAX) {
+		memset(ds->tries, 0, sizeof(ds->tries));
+		ds->npending = 0;
+	}
+
+	return ESMI_SUCCESS;
+}
+
+static void dimm_integrate(struct dimm_socket *ds, struct dimm_acc *da,
+			   struct dimm_power *dp, uint64_t now)
+{
+	uint64_t age = (uint64_t)dp->update_rate * 1000000ULL;
+	uint64_t t = now > age ? now - age : 0;
+	bool saturated = dp->update_rate >= DIMM_AGE_MAX;
+	double de;
+
+	if (!da->readings) {
+		da->power = dp->power;
+		da->read_ns = t;
+		da->readings = 1;
+		return;
+	}
+
+	/* the same reading seen again */
+	if (t <= da->read_ns + DIMM_SLACK_NS && dp->power == da->power)
+		return;
+	if (saturated && dp->power == da->power)
+		return;
+	if (t < da->read_ns)
+		t = da->read_ns;
+
+	/* mW times ns is pJ */
+	if (saturated || t - da->read_ns > DIMM_MAX_GAP_NS) {
+		de = (double)da->power * (t - da->read_ns) / 1e6;
+		da->stale_ns += t - da->read_ns;
+	} else {
+		de = ((double)da->power + dp->power) / 2 * (t - da->read_ns) / 1e6;
+	}
+	da->energy += de;
+	ds->energy += de;
+	da->power = dp->power;
+	da->read_ns = t;
+	da->readings++;
+}
+
+static esmi_status_t dimm_sample_socket(uint32_t sock_ind)
+{
+	struct dimm_socket *ds = &sockets[sock_ind];
+	esmi_status_t ret, status = ESMI_SUCCESS;
+	struct dimm_power dp;
+	uint32_t i;
+
+	ret = dimm_probe(sock_ind);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+
+	for (i = 0; i < ds->ndimms; i++) {
+		ret = esmi_dimm_power_consumption_get(sock_ind, ds->dimm[i].addr, &dp);
+		if (ret != ESMI_SUCCESS) {
+			/* a failed read is a gap, the next reading covers it */
+			status = ret;
+			continue;
+		}
+		dimm_integrate(ds, &ds->dimm[i], &dp, monotonic_ns());
+	}
+
+	return status;
+}
+
+esmi_status_t esmi_dimm_energy_sample(uint32_t sock_ind)
+{
+	esmi_status_t ret;
+
+	pthread_mutex_lock(&dimm_lock);
+	ret = dimm_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	ret = dimm_sample_socket(sock_ind);
+
+unlock:
+	pthread_mutex_unlock(&dimm_lock);
+	return ret;
+}
+
+esmi_status_t dimm_socket_power_get(uint32_t sock_ind, uint32_t *power)
+{
+	struct dimm_socket *ds;
+	esmi_status_t ret;
+	uint32_t i;
+
+	pthread_mutex_lock(&dimm_lock);
+	ret = dimm_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	ret = dimm_sample_socket(sock_ind);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	ds = &sockets[sock_ind];
+	*power = 0;
+	for (i = 0; i < ds->ndimms; i++)
+		*power += ds->dimm[i].power;
+
+unlock:
+	pthread_mutex_unlock(&dimm_lock);
+	return ret;
+}
+
+static void dimm_task(void *arg)
+{
+	uint32_t i;
+
+	(void)arg;
+	pthread_mutex_lock(&dimm_lock);
+	for (i = 0; sockets && i < nsockets; i++)
+		if (sockets[i].probed)
+			dimm_sample_socket(i);
+	pthread_mutex_unlock(&dimm_lock);
+}
+
+esmi_status_t esmi_dimm_energy_start(uint32_t interval_ms)
+{
+	struct esmi_sampler_config cfg;
+	uint64_t divider;
+	esmi_status_t ret;
+	uint32_t i;
+
+	if (!interval_ms)
+		return ESMI_INVALID_INPUT;
+	ret = esmi_sampler_config_get(&cfg);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	divider = interval_ms * 1000000ULL / cfg.period_ns;
+	if (!divider)
+		divider = 1;
+	if (divider > UINT32_MAX)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&task_ctl_lock);
+	if (task_running) {
+		ret = ESMI_DEV_BUSY;
+		goto unlock;
+	}
+	pthread_mutex_lock(&dimm_lock);
+	ret = dimm_state_init();
+	/* probe before the task runs so a tick does not stall on it */
+	for (i = 0; ret == ESMI_SUCCESS && i < nsockets; i++)
+		ret = dimm_probe(i);
+	pthread_mutex_unlock(&dimm_lock);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	/* the sampler runs the task under its own lock, add it without ours */
+	ret = esmi_sampler_task_add(dimm_task, NULL, divider, &task_id);
+	if (ret == ESMI_SUCCESS) {
+		sampler_task_name_set(task_id, "dimm");
+		task_running = true;
+	}
+
+unlock:
+	pthread_mutex_unlock(&task_ctl_lock);
+	return ret;
+}
+
+esmi_status_t esmi_dimm_energy_stop(void)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+
+	pthread_mutex_lock(&task_ctl_lock);
+	if (task_running)
+		ret = esmi_sampler_task_remove(task_id);
+	task_running = false;
+	pthread_mutex_unlock(&task_ctl_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_dimm_energies_get(uint32_t sock_ind, struct esmi_dimm_energy *energies,
+				     uint32_t max, uint32_t *count)
+{
+	struct dimm_socket *ds;
+	esmi_status_t ret;
+	uint32_t i;
+
+	if (!energies || !count)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&dimm_lock);
+	ret = dimm_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	ds = &sockets[sock_ind];
+	if (!ds->probed) {
+		ret = ESMI_NO_DATA;
+		goto unlock;
+	}
+	for (i = 0; i < ds->ndimms && i < max; i++) {
+		energies[i].dimm_addr = ds->dimm[i].addr;
+		energies[i].power = ds->dimm[i].power;
+		energies[i].energy = ds->dimm[i].energy;
+		energies[i].stale_ms = ds->dimm[i].stale_ns / 1000000;
+		energies[i].readings = ds->dimm[i].readings;
+	}
+	*count = i;
+
+unlock:
+	pthread_mutex_unlock(&dimm_lock);
+	return ret;
+}
+
+esmi_status_t esmi_socket_dimm_energy_get(uint32_t sock_ind, uint64_t *penergy)
+{
+	esmi_status_t ret;
+
+	if (!penergy)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&dimm_lock);
+	ret = dimm_state_init();
+	if (ret == ESMI_SUCCESS) {
+		if (sock_ind >= nsockets)
+			ret = ESMI_INVALID_INPUT;
+		else if (!sockets[sock_ind].probed)
+			ret = ESMI_NO_DATA;
+		else
+			*penergy = sockets[sock_ind].energy;
+	}
+	pthread_mutex_unlock(&dimm_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_energies_bulk_get(uint64_t *core_energy, uint64_t *sock_energy,
+				     uint64_t *dimm_energy)
+{
+	esmi_status_t ret;
+	uint32_t i, n;
+
+	if (!core_energy && !sock_energy && !dimm_energy)
+		return ESMI_ARG_PTR_NULL;
+
+	if (core_energy) {
+		ret = esmi_all_energies_get(core_energy);
+		if (ret != ESMI_SUCCESS)
+			return ret;
+	}
+	ret = esmi_number_of_sockets_get(&n);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	for (i = 0; sock_energy && i < n; i++) {
+		ret = esmi_socket_energy_get(i, &sock_energy[i]);
+		if (ret != ESMI_SUCCESS)
+			return ret;
+	}
+	if (!dimm_energy)
+		return ESMI_SUCCESS;
+
+	pthread_mutex_lock(&dimm_lock);
+	ret = dimm_state_init();
+	for (i = 0; ret == ESMI_SUCCESS && i < n; i++)
+		dimm_energy[i] = sockets[i].probed ? sockets[i].energy : 0;
+	pthread_mutex_unlock(&dimm_lock);
+
+	return ret;
+}
@@ -0,0 +1,349 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Energy and power domains.
+ *
+ * The domains are enumerated once: every socket, then the cores, DIMMs,
+ * rails and MI300A dies whose source answered a probe read. A read plans
+ * the sources behind the requested domains, one core energy batch for all
+ * cores and per socket a set of DOMAIN_NEED_* reads, so two domains behind
+ * the same source cost one read. The sockets with reads to do are read on
+ * the persistent per socket workers when there is more than one, like the
+ * batched boost limit writes.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define DOMAIN_NEED_SOCKET	BIT(0)
+#define DOMAIN_NEED_DIMM	BIT(1)
+#define DOMAIN_NEED_RAILS	BIT(2)
+#define DOMAIN_NEED_METRICS	BIT(3)
+
+/* dies of the MI300A metrics table */
+#define DOMAIN_APU_DIES		4
+
+struct domain_socket {
+	struct hsmp_metric_table mtbl;
+	struct esmi_dimm_energy dimms[ESMI_DIMM_MAX];
+	uint32_t ndimms;
+	uint64_t energy;		// socket energy, uJ
+	uint32_t rails;			// SVI power, mW
+	uint64_t energy_ns, dimm_ns, rails_ns, mtbl_ns;
+	esmi_status_t energy_st, dimm_st, rails_st, mtbl_st;
+	uint32_t sock_ind;
+	uint32_t need;			// DOMAIN_NEED_* of the current read
+};
+
+static pthread_mutex_t domain_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct esmi_domain *domains;
+static struct domain_socket *sockets;
+static uint64_t *core_energy;
+static uint32_t ndomains, nsockets, nphys;
+
+static void domain_free(void)
+{
+	free(domains);
+	free(sockets);
+	free(core_energy);
+	domains = NULL;
+	sockets = NULL;
+	core_energy = NULL;
+	ndomains = nsockets = nphys = 0;
+}
+
+static void domain_add(esmi_domain_type_t type, uint32_t parent, uint32_t sock_ind,
+		       uint32_t index, esmi_domain_unit_t unit,
+		       esmi_domain_source_t source)
+{
+	struct esmi_domain *d = &domains[ndomains];
+
+	d->id = ndomains++;
+	d->parent = parent;
+	d->sock_ind = sock_ind;
+	d->index = index;
+	d->type = type;
+	d->unit = unit;
+	d->source = source;
+}
+
+static esmi_status_t domain_state_init(void)
+{
+	uint32_t threads, cpus, proto = 0, power, max, i, j;
+	struct domain_socket *ds;
+	esmi_status_t ret;
+	int sock;
+
+	if (domains)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_sockets_get(&nsockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_number_of_cpus_get(&cpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_threads_per_core_get(&threads);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	if (!threads || cpus < threads)
+		return ESMI_IO_ERROR;
+	nphys = cpus / threads;
+
+	max = nsockets * (1 + ESMI_DIMM_MAX + 1 + DOMAIN_APU_DIES) + nphys;
+	domains = calloc(max, sizeof(*domains));
+	sockets = calloc(nsockets, sizeof(*sockets));
+	core_energy = calloc(nphys, sizeof(*core_energy));
+	if (!domains || !sockets || !core_energy) {
+		domain_free();
+		return ESMI_NO_MEMORY;
+	}
+
+	/* the sockets are the parents, their ids are the socket indices */
+	for (i = 0; i < nsockets; i++) {
+		sockets[i].sock_ind = i;
+		domain_add(ESMI_DOMAIN_SOCKET, ESMI_DOMAIN_NONE, i, i,
+			   ESMI_DOMAIN_UJ, ESMI_SOURCE_ENERGY);
+	}
+	if (esmi_all_energies_get(core_energy) == ESMI_SUCCESS) {
+		for (i = 0; i < nphys; i++) {
+			sock = cpu_socket_get(i);
+			domain_add(ESMI_DOMAIN_CORE,
+				   sock < 0 ? ESMI_DOMAIN_NONE : (uint32_t)sock,
+				   sock < 0 ? 0 : sock, i, ESMI_DOMAIN_UJ,
+				   ESMI_SOURCE_ENERGY);
+		}
+	}
+	for (i = 0; i < nsockets; i++) {
+		ds = &sockets[i];
+		if (esmi_dimm_energy_sample(i) != ESMI_SUCCESS ||
+		    esmi_dimm_energies_get(i, ds->dimms, ESMI_DIMM_MAX,
+					   &ds->ndimms) != ESMI_SUCCESS)
+			continue;
+		for (j = 0; j < ds->ndimms; j++)
+			domain_add(ESMI_DOMAIN_DIMM, i, i, ds->dimms[j].dimm_addr,
+				   ESMI_DOMAIN_UJ, ESMI_SOURCE_DIMM);
+	}
+	for (i = 0; i < nsockets; i++) {
+		if (esmi_pwr_svi_telemetry_all_rails_get(i, &power) == ESMI_SUCCESS)
+			domain_add(ESMI_DOMAIN_RAILS, i, i, i, ESMI_DOMAIN_MW,
+				   ESMI_SOURCE_SVI);
+	}
+	/* only the MI300A table carries the die accumulators */
+	esmi_hsmp_proto_ver_get(&proto);
+	for (i = 0; proto == HSMP_PROTO_VER6 && i < nsockets; i++) {
+		if (esmi_metrics_table_cached_get(i, &sockets[i].mtbl) != ESMI_SUCCESS)
+			continue;
+		for (j = ESMI_DOMAIN_CCD; j <= ESMI_DOMAIN_HBM; j++)
+			domain_add(j, i, i, i, ESMI_DOMAIN_UJ, ESMI_SOURCE_METRICS);
+	}
+
+	return ESMI_SUCCESS;
+}
+
+void domain_exit(void)
+{
+	pthread_mutex_lock(&domain_lock);
+	domain_free();
+	pthread_mutex_unlock(&domain_lock);
+}
+
+esmi_status_t esmi_domains_get(struct esmi_domain *pdomains, uint32_t max,
+			       uint32_t *count)
+{
+	esmi_status_t ret;
+
+	if (!count)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&domain_lock);
+	ret = domain_state_init();
+	if (ret == ESMI_SUCCESS) {
+		if (pdomains)
+			memcpy(pdomains, domains,
+			       (max < ndomains ? max : ndomains) * sizeof(*domains));
+		*count = ndomains;
+	}
+	pthread_mutex_unlock(&domain_lock);
+
+	return ret;
+}
+
+static void *domain_socket_read(void *arg)
+{
+	struct domain_socket *ds = arg;
+
+	if (ds->need & DOMAIN_NEED_SOCKET) {
+		ds->energy_st = esmi_socket_energy_get(ds->sock_ind, &ds->energy);
+		ds->energy_ns = monotonic_ns();
+	}
+	if (ds->need & DOMAIN_NEED_DIMM) {
+		ds->dimm_st = esmi_dimm_energy_sample(ds->sock_ind);
+		if (ds->dimm_st == ESMI_SUCCESS)
+			ds->dimm_st = esmi_dimm_energies_get(ds->sock_ind, ds->dimms,
+							     ESMI_DIMM_MAX, &ds->ndimms);
+		ds->dimm_ns = monotonic_ns();
+	}
+	if (ds->need & DOMAIN_NEED_RAILS) {
+		ds->rails_st = esmi_pwr_svi_telemetry_all_rails_get(ds->sock_ind,
+								    &ds->rails);
+		ds->rails_ns = monotonic_ns();
+	}
+	if (ds->need & DOMAIN_NEED_METRICS) {
+		ds->mtbl_st = esmi_metrics_table_cached_get(ds->sock_ind, &ds->mtbl);
+		ds->mtbl_ns = monotonic_ns();
+	}
+
+	return NULL;
+}
+
+/* UQ16 Joules to micro Joules */
+static uint64_t uq16_to_uj(uint64_t acc)
+{
+	return (acc >> 16) * 1000000 + (((acc & 0xffff) * 1000000) >> 16);
+}
+
+static void domain_fill(struct esmi_domain *d, struct esmi_domain_reading *r,
+			esmi_status_t core_st, uint64_t core_ns)
+{
+	struct domain_socket *ds = &sockets[d->sock_ind];
+	uint32_t i;
+
+	r->value = 0;
+	switch (d->type) {
+	case ESMI_DOMAIN_SOCKET:
+		r->status = ds->energy_st;
+		r->time_ns = ds->energy_ns;
+		r->value = ds->energy;
+		return;
+	case ESMI_DOMAIN_CORE:
+		r->status = core_st;
+		r->time_ns = core_ns;
+		r->value = core_energy[d->index];
+		return;
+	case ESMI_DOMAIN_DIMM:
+		r->status = ds->dimm_st;
+		r->time_ns = ds->dimm_ns;
+		if (r->status != ESMI_SUCCESS)
+			return;
+		/* a DIMM gone since the enumeration */
+		r->status = ESMI_IO_ERROR;
+		for (i = 0; i < ds->ndimms; i++) {
+			if (ds->dimms[i].dimm_addr == d->index) {
+				r->value = ds->dimms[i].energy;
+				r->status = ESMI_SUCCESS;
+				break;
+			}
+		}
+		return;
+	case ESMI_DOMAIN_RAILS:
+		r->status = ds->rails_st;
+		r->time_ns = ds->rails_ns;
+		r->value = ds->rails;
+		return;
+	default:
+		break;
+	}
+
+	r->status = ds->mtbl_st;
+	r->time_ns = ds->mtbl_ns;
+	switch (d->type) {
+	case ESMI_DOMAIN_CCD:
+		r->value = uq16_to_uj(ds->mtbl.ccd_energy_acc);
+		break;
+	case ESMI_DOMAIN_XCD:
+		r->value = uq16_to_uj(ds->mtbl.xcd_energy_acc);
+		break;
+	case ESMI_DOMAIN_AID:
+		r->value = uq16_to_uj(ds->mtbl.aid_energy_acc);
+		break;
+	case ESMI_DOMAIN_HBM:
+		r->value = uq16_to_uj(ds->mtbl.hbm_energy_acc);
+		break;
+	default:
+		r->status = ESMI_INVALID_INPUT;
+		break;
+	}
+}
+
+static const uint32_t domain_needs[ESMI_DOMAIN_TYPE_MAX] = {
+	[ESMI_DOMAIN_SOCKET]	= DOMAIN_NEED_SOCKET,
+	[ESMI_DOMAIN_DIMM]	= DOMAIN_NEED_DIMM,
+	[ESMI_DOMAIN_RAILS]	= DOMAIN_NEED_RAILS,
+	[ESMI_DOMAIN_CCD]	= DOMAIN_NEED_METRICS,
+	[ESMI_DOMAIN_XCD]	= DOMAIN_NEED_METRICS,
+	[ESMI_DOMAIN_AID]	= DOMAIN_NEED_METRICS,
+	[ESMI_DOMAIN_HBM]	= DOMAIN_NEED_METRICS,
+};
+
+esmi_status_t esmi_domains_read(const uint32_t *ids, uint32_t n,
+				struct esmi_domain_reading *out)
+{
+	esmi_status_t ret, core_st = ESMI_SUCCESS;
+	uint64_t core_ns = 0;
+	bool need_cores = false;
+	uint32_t i, busy = 0;
+	struct esmi_domain *d;
+
+	if (!ids || !out)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&domain_lock);
+	ret = domain_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	for (i = 0; i < n; i++) {
+		if (ids[i] >= ndomains) {
+			ret = ESMI_INVALID_INPUT;
+			goto unlock;
+		}
+	}
+
+	/* plan */
+	for (i = 0; i < nsockets; i++)
+		sockets[i].need = 0;
+	for (i = 0; i < n; i++) {
+		d = &domains[ids[i]];
+		if (d->type == ESMI_DOMAIN_CORE)
+			need_cores = true;
+		else
+			sockets[d->sock_ind].need |= domain_needs[d->type];
+	}
+	for (i = 0; i < nsockets; i++)
+		if (sockets[i].need)
+			busy++;
+
+	/* the sockets on the workers, a single busy socket is read inline */
+	if (busy > 1) {
+		workers_run(domain_socket_read, sockets, sizeof(*sockets), nsockets);
+	} else {
+		for (i = 0; i < nsockets; i++)
+			if (sockets[i].need)
+				domain_socket_read(&sockets[i]);
+	}
+	if (need_cores) {
+		core_st = esmi_all_energies_get(core_energy);
+		core_ns = monotonic_ns();
+	}
+
+	for (i = 0; i < n; i++) {
+		domain_fill(&domains[ids[i]], &out[i], core_st, core_ns);
+		if (ret == ESMI_SUCCESS)
+			ret = out[i].status;
+	}
+
+unlock:
+	pthread_mutex_unlock(&domain_lock);
+	return ret;
+}
@@ -0,0 +1,295 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Model based per core power estimation.
+ *
+ * Per socket a linear model of the core power
+ *
+ *	P = a + u * (b + c * f^3)
+ *
+ * with u the C0 share of the core from /proc/stat and f the core frequency
+ * limit in GHz is fitted by recursive least squares while core energy can
+ * be read. Afterwards estimates only need /proc/stat and the frequency
+ * limits. The error bound is twice the running RMS of the prediction error
+ * seen during training.
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define EST_PARAMS		3
+#define EST_FORGET		0.99	/* RLS forgetting factor */
+#define EST_ERR_WEIGHT		0.05	/* weight of a new squared error */
+#define EST_MIN_SAMPLES		16	/* samples before estimates are valid */
+#define EST_MIN_INTERVAL_NS	1000000ULL
+
+struct est_socket {
+	double theta[EST_PARAMS];
+	double cov[EST_PARAMS][EST_PARAMS];
+	double err_var;			// running mean squared error in mW^2
+	uint32_t nsamples;
+};
+
+struct est_core {
+	int sock;
+	double util;			// C0 share over the last interval
+	uint32_t freq;			// frequency limit in MHz
+	uint64_t energy;		// last energy sample in uJ
+	uint64_t energy_ns;		// time of the last energy sample
+	bool valid;			// util and freq are set
+};
+
+static pthread_mutex_t est_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct est_socket *sockets;
+static struct est_core *cores;
+static uint64_t *busy, *total, *prev_busy, *prev_total;
+static uint32_t nsockets, nphys, ncpus;
+
+static esmi_status_t est_state_init(void)
+{
+	uint32_t threads, i;
+	esmi_status_t ret;
+
+	if (cores)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_cpus_get(&ncpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_threads_per_core_get(&threads);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_number_of_sockets_get(&nsockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	if (!threads || ncpus < threads)
+		return ESMI_IO_ERROR;
+	nphys = ncpus / threads;
+
+	sockets = calloc(nsockets, sizeof(*sockets));
+	cores = calloc(nphys, sizeof(*cores));
+	busy = calloc(ncpus * 4, sizeof(*busy));
+	if (!sockets || !cores || !busy) {
+		free(sockets);
+		free(cores);
+		free(busy);
+		sockets = NULL;
+		cores = NULL;
+		busy = NULL;
+		return ESMI_NO_MEMORY;
+	}
+	total = busy + ncpus;
+	prev_busy = total + ncpus;
+	prev_total = prev_busy + ncpus;
+	for (i = 0; i < nphys; i++)
+		cores[i].sock = cpu_socket_get(i);
+	for (i = 0; i < nsockets; i++) {
+		sockets[i].cov[0][0] = 1e6;
+		sockets[i].cov[1][1] = 1e6;
+		sockets[i].cov[2][2] = 1e4;
+	}
+
+	return ESMI_SUCCESS;
+}
+
+void estimate_exit(void)
+{
+	pthread_mutex_lock(&est_lock);
+	free(sockets);
+	free(cores);
+	free(busy);
+	sockets = NULL;
+	cores = NULL;
+	busy = total = prev_busy = prev_total = NULL;
+	nsockets = nphys = ncpus = 0;
+	pthread_mutex_unlock(&est_lock);
+}
+
+static void est_features(struct est_core *ec, double *x)
+{
+	double g = ec->freq / 1000.0;
+
+	x[0] = 1.0;
+	x[1] = ec->util;
+	x[2] = ec->util * g * g * g;
+}
+
+static double est_predict(struct est_socket *es, struct est_core *ec)
+{
+	double x[EST_PARAMS], p = 0;
+	int i;
+
+	est_features(ec, x);
+	for (i = 0; i < EST_PARAMS; i++)
+		p += es->theta[i] * x[i];
+
+	return p > 0 ? p : 0;
+}
+
+static void est_fit(struct est_socket *es, struct est_core *ec, double power)
+{
+	double x[EST_PARAMS], px[EST_PARAMS], k[EST_PARAMS];
+	double denom = EST_FORGET, err = power;
+	int i, j;
+
+	est_features(ec, x);
+	for (i = 0; i < EST_PARAMS; i++) {
+		px[i] = 0;
+		for (j = 0; j < EST_PARAMS; j++)
+			px[i] += es->cov[i][j] * x[j];
+		denom += x[i] * px[i];
+		err -= es->theta[i] * x[i];
+	}
+	for (i = 0; i < EST_PARAMS; i++) {
+		k[i] = px[i] / denom;
+		es->theta[i] += k[i] * err;
+	}
+	for (i = 0; i < EST_PARAMS; i++)
+		for (j = 0; j < EST_PARAMS; j++)
+			es->cov[i][j] = (es->cov[i][j] - k[i] * px[j]) / EST_FORGET;
+
+	/* the a priori error tracks how well the model predicts new samples */
+	if (es->nsamples)
+		es->err_var += EST_ERR_WEIGHT * (err * err - es->err_var);
+	else
+		es->err_var = err * err;
+	es->nsamples++;
+}
+
+/*
+ * The C0 share of a physical core is the highest share among its SMT
+ * siblings, a lower bound of the time any of them kept the core busy.
+ */
+static void est_util_update(uint32_t sock_ind)
+{
+	uint64_t dbusy, dtotal;
+	struct est_core *ec;
+	uint32_t cpu;
+	double u;
+
+	for (cpu = 0; cpu < nphys; cpu++)
+		if (cores[cpu].sock == (int)sock_ind)
+			cores[cpu].util = -1;
+
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		ec = &cores[cpu % nphys];
+		if (ec->sock != (int)sock_ind)
+			continue;
+		dbusy = busy[cpu] - prev_busy[cpu];
+		dtotal = total[cpu] - prev_total[cpu];
+		if (!prev_total[cpu] || !dtotal || dbusy > dtotal)
+			continue;
+		u = (double)dbusy / dtotal;
+		if (u > ec->util)
+			ec->util = u;
+	}
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		if (cores[cpu % nphys].sock != (int)sock_ind)
+			continue;
+		prev_busy[cpu] = busy[cpu];
+		prev_total[cpu] = total[cpu];
+	}
+}
+
+esmi_status_t esmi_core_power_model_update(uint32_t sock_ind, bool train)
+{
+	struct est_core *ec;
+	uint64_t energy, now;
+	esmi_status_t ret;
+	uint32_t i;
+	int err;
+
+	pthread_mutex_lock(&est_lock);
+	ret = est_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+
+	err = procstat_read(busy, total, ncpus);
+	if (err) {
+		ret = errno_to_esmi_status(err);
+		goto unlock;
+	}
+	est_util_update(sock_ind);
+
+	for (i = 0; i < nphys; i++) {
+		ec = &cores[i];
+		if (ec->sock != (int)sock_ind)
+			continue;
+		ret = esmi_current_freq_limit_core_get(i, &ec->freq);
+		if (ret != ESMI_SUCCESS)
+			goto unlock;
+		ec->valid = ec->util >= 0;
+		if (!train) {
+			ec->energy_ns = 0;
+			continue;
+		}
+		ret = esmi_core_energy_get(i, &energy);
+		if (ret != ESMI_SUCCESS)
+			goto unlock;
+		now = monotonic_ns();
+		if (ec->valid && ec->energy_ns && energy >= ec->energy &&
+		    now - ec->energy_ns >= EST_MIN_INTERVAL_NS)
+			/* uJ per ms is mW */
+			est_fit(&sockets[sock_ind], ec, (energy - ec->energy) *
+				1e6 / (now - ec->energy_ns));
+		ec->energy = energy;
+		ec->energy_ns = now;
+	}
+
+unlock:
+	pthread_mutex_unlock(&est_lock);
+	return ret;
+}
+
+esmi_status_t esmi_core_power_estimate_get(uint32_t cpu_ind, uint32_t *ppower,
+					   uint32_t *perror)
+{
+	struct est_socket *es;
+	struct est_core *ec;
+	esmi_status_t ret;
+
+	if (!ppower)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&est_lock);
+	ret = est_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (cpu_ind >= ncpus) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	ec = &cores[cpu_ind % nphys];
+	if (ec->sock < 0 || ec->sock >= (int)nsockets) {
+		ret = ESMI_IO_ERROR;
+		goto unlock;
+	}
+	es = &sockets[ec->sock];
+	if (!ec->valid || es->nsamples < EST_MIN_SAMPLES) {
+		ret = ESMI_NO_DATA;
+		goto unlock;
+	}
+	*ppower = est_predict(es, ec) + 0.5;
+	if (perror)
+		*perror = 2 * sqrt(es->err_var) + 0.5;
+
+unlock:
+	pthread_mutex_unlock(&est_lock);
+	return ret;
+}
@@ -0,0 +1,147 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Diagnostic event ring.
+ *
+ * Failed driver calls, failed argument checks and calls slower than a
+ * threshold are recorded into a fixed ring without locks: a producer
+ * claims a position with one atomic add and publishes the slot through its
+ * sequence number, odd while the slot is written and even once it is
+ * complete. The ring overwrites the
+ * oldest events, so the most recent ones are kept until they are drained.
+ * The single reader validates the sequence number before and after copying
+ * a slot and counts overwritten or torn slots as lost.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define EVENT_RING_SIZE		1024	/* power of 2 */
+#define EVENT_RING_MASK		(EVENT_RING_SIZE - 1)
+
+struct event_slot {
+	uint64_t seq;
+	struct esmi_event ev;
+};
+
+static struct event_slot ring[EVENT_RING_SIZE];
+static uint64_t tail;			// next position to claim
+static uint64_t head;			// next position to drain
+static uint64_t slow_ns;		// 0 disables slow call events
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t event_clock(void)
+{
+	return __atomic_load_n(&slow_ns, __ATOMIC_RELAXED) ? monotonic_ns() : 0;
+}
+
+static void event_record(const char *api, uint32_t index, uint32_t msg_id, int err,
+			 esmi_status_t status, uint64_t start_ns)
+{
+	uint64_t now = 0, latency = 0, pos, threshold;
+	struct event_slot *slot;
+	uint32_t flags = 0;
+
+	threshold = __atomic_load_n(&slow_ns, __ATOMIC_RELAXED);
+	if (threshold && start_ns) {
+		now = monotonic_ns();
+		latency = now - start_ns;
+		if (latency >= threshold)
+			flags |= ESMI_EVENT_SLOW;
+	}
+	if (status != ESMI_SUCCESS)
+		flags |= ESMI_EVENT_ERROR;
+	if (!flags)
+		return;
+	if (!now)
+		now = monotonic_ns();
+
+	pos = __atomic_fetch_add(&tail, 1, __ATOMIC_RELAXED);
+	slot = &ring[pos & EVENT_RING_MASK];
+	__atomic_store_n(&slot->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->ev.time_ns = now;
+	slot->ev.latency_ns = latency;
+	slot->ev.api = api;
+	slot->ev.index = index;
+	slot->ev.msg_id = msg_id;
+	slot->ev.err = err;
+	slot->ev.status = status;
+	slot->ev.flags = flags;
+	__atomic_store_n(&slot->seq, 2 * pos + 2, __ATOMIC_RELEASE);
+}
+
+void event_trace(const char *api, uint32_t index, uint32_t msg_id, int err,
+		 uint64_t start_ns)
+{
+	event_record(api, index, msg_id, err, errno_to_esmi_status(err), start_ns);
+}
+
+esmi_status_t event_status(const char *api, uint32_t index, esmi_status_t status)
+{
+	if (status != ESMI_SUCCESS)
+		event_record(api, index, 0, 0, status, 0);
+
+	return status;
+}
+
+esmi_status_t esmi_event_slow_threshold_set(uint64_t threshold_ns)
+{
+	__atomic_store_n(&slow_ns, threshold_ns, __ATOMIC_RELAXED);
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_events_drain(struct esmi_event *events, uint32_t max,
+				uint32_t *count, uint64_t *lost)
+{
+	uint64_t end, pos, seq, missed = 0;
+	struct event_slot *slot;
+	uint32_t n = 0;
+
+	if (!events || !count)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&drain_lock);
+	end = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+	pos = head;
+	if (end - pos > EVENT_RING_SIZE) {
+		missed += end - pos - EVENT_RING_SIZE;
+		pos = end - EVENT_RING_SIZE;
+	}
+	for (; pos < end && n < max; pos++) {
+		slot = &ring[pos & EVENT_RING_MASK];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq < 2 * pos + 2)
+			/* claimed but not complete yet, drain it next time */
+			break;
+		if (seq != 2 * pos + 2) {
+			missed++;
+			continue;
+		}
+		events[n] = slot->ev;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+			missed++;
+			continue;
+		}
+		n++;
+	}
+	head = pos;
+	pthread_mutex_unlock(&drain_lock);
+
+	*count = n;
+	if (lost)
+		*lost = missed;
+
+	return ESMI_SUCCESS;
+}
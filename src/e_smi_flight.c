@@ -0,0 +1,423 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Telemetry flight recorder.
+ *
+ * A sampler task reads socket power, temperature, the frequency limit
+ * and its source mask, C0 residency and PROCHOT of every socket into a
+ * fixed per socket ring, and checks every new sample against the trigger
+ * conditions. A trigger, or an external call, arms the recorder: sampling
+ * goes on for the post trigger window, then the samples from the pre
+ * trigger window up to that point are copied into a frozen snapshot and
+ * the recorder waits for the next trigger. Writing the snapshot to a file
+ * is left to esmi_flight_recorder_dump(), so the sampler thread does no
+ * file I/O, and ring and snapshot come from the sampler arena, so steady
+ * state recording does not allocate.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define FLT_NO_TRIGGER		UINT64_MAX
+
+struct flt_socket {
+	struct esmi_flight_sample ring[ESMI_FLIGHT_RING];
+	uint64_t head;			// samples written
+	uint8_t sup;			// ESMI_FLIGHT_HAS_* fields supported
+};
+
+static pthread_mutex_t flt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t task_ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct flt_socket *sockets;
+static struct esmi_flight_sample *snap;
+static uint32_t nsockets, snap_count;
+static struct esmi_flight_config config;
+static struct esmi_flight_status status;
+static struct esmi_flight_header snap_hdr;
+static uint64_t trig_ns = FLT_NO_TRIGGER;	// time of the armed trigger
+static uint32_t trig_sock, trig_index;
+static bool ext_trigger;
+static uint32_t task_id;
+static bool task_running;
+
+/* the state is touched from the sampler thread, keep it in the arena */
+static esmi_status_t flt_state_init(void)
+{
+	esmi_status_t ret;
+	uint32_t i;
+
+	if (sockets)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_sockets_get(&nsockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	sockets = sampler_arena_alloc(nsockets * sizeof(*sockets));
+	snap = sampler_arena_alloc(nsockets * ESMI_FLIGHT_RING * sizeof(*snap));
+	if (!sockets || !snap) {
+		sockets = NULL;
+		snap = NULL;
+		return ESMI_NO_MEMORY;
+	}
+	for (i = 0; i < nsockets; i++)
+		sockets[i].sup = ESMI_FLIGHT_HAS_POWER | ESMI_FLIGHT_HAS_TEMP |
+				 ESMI_FLIGHT_HAS_LIMIT | ESMI_FLIGHT_HAS_C0 |
+				 ESMI_FLIGHT_HAS_PROCHOT;
+
+	return ESMI_SUCCESS;
+}
+
+void flight_exit(void)
+{
+	esmi_flight_recorder_stop();
+
+	/* the arena itself is released by sampler_exit() */
+	pthread_mutex_lock(&flt_lock);
+	sockets = NULL;
+	snap = NULL;
+	nsockets = snap_count = 0;
+	memset(&status, 0, sizeof(status));
+	trig_ns = FLT_NO_TRIGGER;
+	ext_trigger = false;
+	pthread_mutex_unlock(&flt_lock);
+}
+
+/* a field the platform does not support is dropped for good */
+static bool flt_field_ok(struct flt_socket *fs, uint8_t field, esmi_status_t ret)
+{
+	if (ret == ESMI_NO_HSMP_MSG_SUP || ret == ESMI_NOT_SUPPORTED)
+		fs->sup &= ~field;
+
+	return ret == ESMI_SUCCESS;
+}
+
+static void flt_read(struct flt_socket *fs, uint32_t sock_ind, struct esmi_flight_sample *s)
+{
+	uint32_t val;
+	uint16_t freq, mask;
+
+	memset(s, 0, sizeof(*s));
+	s->time_ns = monotonic_ns();
+	s->sock_ind = sock_ind;
+	if ((fs->sup & ESMI_FLIGHT_HAS_POWER) &&
+	    flt_field_ok(fs, ESMI_FLIGHT_HAS_POWER, esmi_socket_power_get(sock_ind, &val))) {
+		s->power = val;
+		s->valid |= ESMI_FLIGHT_HAS_POWER;
+	}
+	if ((fs->sup & ESMI_FLIGHT_HAS_TEMP) &&
+	    flt_field_ok(fs, ESMI_FLIGHT_HAS_TEMP, esmi_socket_temperature_get(sock_ind, &val))) {
+		s->temp = val;
+		s->valid |= ESMI_FLIGHT_HAS_TEMP;
+	}
+	if ((fs->sup & ESMI_FLIGHT_HAS_LIMIT) &&
+	    flt_field_ok(fs, ESMI_FLIGHT_HAS_LIMIT,
+			 socket_freq_limit_raw_get(sock_ind, &freq, &mask))) {
+		s->freq_limit = freq;
+		s->limit_mask = mask;
+		s->valid |= ESMI_FLIGHT_HAS_LIMIT;
+	}
+	if ((fs->sup & ESMI_FLIGHT_HAS_C0) &&
+	    flt_field_ok(fs, ESMI_FLIGHT_HAS_C0, esmi_socket_c0_residency_get(sock_ind, &val))) {
+		s->c0 = val;
+		s->valid |= ESMI_FLIGHT_HAS_C0;
+	}
+	if ((fs->sup & ESMI_FLIGHT_HAS_PROCHOT) &&
+	    flt_field_ok(fs, ESMI_FLIGHT_HAS_PROCHOT, esmi_prochot_status_get(sock_ind, &val))) {
+		s->prochot = val;
+		s->valid |= ESMI_FLIGHT_HAS_PROCHOT;
+	}
+}
+
+static bool flt_value(const struct esmi_flight_sample *s, uint32_t field, uint32_t *val)
+{
+	switch (field) {
+	case ESMI_FLIGHT_POWER:
+		*val = s->power;
+		return s->valid & ESMI_FLIGHT_HAS_POWER;
+	case ESMI_FLIGHT_TEMP:
+		*val = s->temp;
+		return s->valid & ESMI_FLIGHT_HAS_TEMP;
+	case ESMI_FLIGHT_FREQ_LIMIT:
+		*val = s->freq_limit;
+		return s->valid & ESMI_FLIGHT_HAS_LIMIT;
+	case ESMI_FLIGHT_LIMIT_MASK:
+		*val = s->limit_mask;
+		return s->valid & ESMI_FLIGHT_HAS_LIMIT;
+	case ESMI_FLIGHT_C0:
+		*val = s->c0;
+		return s->valid & ESMI_FLIGHT_HAS_C0;
+	case ESMI_FLIGHT_PROCHOT:
+		*val = s->prochot;
+		return s->valid & ESMI_FLIGHT_HAS_PROCHOT;
+	}
+
+	return false;
+}
+
+static bool flt_match(const struct esmi_flight_trigger *t, const struct esmi_flight_sample *s,
+		      const struct esmi_flight_sample *prev)
+{
+	uint32_t val, pval;
+
+	if (!flt_value(s, t->field, &val))
+		return false;
+
+	switch (t->op) {
+	case ESMI_FLIGHT_ABOVE:
+		return val > t->value;
+	case ESMI_FLIGHT_BELOW:
+		return val < t->value;
+	case ESMI_FLIGHT_BITS_SET:
+		/* only on the sample the bits appear, not while they stay */
+		return (val & t->value) &&
+		       !(prev && flt_value(prev, t->field, &pval) && (pval & t->value));
+	case ESMI_FLIGHT_RISE:
+		return prev && flt_value(prev, t->field, &pval) && val > pval &&
+		       val - pval > t->value;
+	case ESMI_FLIGHT_CHANGED:
+		return prev && flt_value(prev, t->field, &pval) && val != pval;
+	}
+
+	return false;
+}
+
+static void flt_arm(uint64_t now, uint32_t sock_ind, uint32_t index)
+{
+	status.triggers++;
+	if (trig_ns != FLT_NO_TRIGGER)
+		/* falls into the window already armed */
+		return;
+	if (status.ready) {
+		/* the previous window was not dumped yet */
+		status.dropped++;
+		return;
+	}
+	trig_ns = now;
+	trig_sock = sock_ind;
+	trig_index = index;
+}
+
+/* copy the samples of the trigger window, oldest first per socket */
+static void flt_freeze(uint64_t end)
+{
+	uint64_t start, first;
+	struct flt_socket *fs;
+	uint32_t i;
+
+	start = trig_ns > config.pre_ms * 1000000ULL ? trig_ns - config.pre_ms * 1000000ULL : 0;
+	snap_count = 0;
+	for (i = 0; i < nsockets; i++) {
+		fs = &sockets[i];
+		first = fs->head > ESMI_FLIGHT_RING ? fs->head - ESMI_FLIGHT_RING : 0;
+		while (first < fs->head && fs->ring[first % ESMI_FLIGHT_RING].time_ns < start)
+			first++;
+		for (; first < fs->head && fs->ring[first % ESMI_FLIGHT_RING].time_ns <= end; first++)
+			snap[snap_count++] = fs->ring[first % ESMI_FLIGHT_RING];
+	}
+
+	memset(&snap_hdr, 0, sizeof(snap_hdr));
+	memcpy(snap_hdr.magic, ESMI_FLIGHT_MAGIC, sizeof(snap_hdr.magic));
+	snap_hdr.version = ESMI_FLIGHT_VERSION;
+	snap_hdr.sample_size = sizeof(struct esmi_flight_sample);
+	snap_hdr.nsamples = snap_count;
+	snap_hdr.trigger_ns = trig_ns;
+	snap_hdr.interval_us = config.interval_us;
+	snap_hdr.pre_ms = config.pre_ms;
+	snap_hdr.post_ms = config.post_ms;
+	snap_hdr.trigger_sock = trig_sock;
+	snap_hdr.trigger_index = trig_index;
+
+	status.ready = true;
+	status.windows++;
+	trig_ns = FLT_NO_TRIGGER;
+}
+
+static void flt_tick(void)
+{
+	struct esmi_flight_sample *s, *prev;
+	struct flt_socket *fs;
+	uint64_t now;
+	uint32_t i, t;
+
+	for (i = 0; i < nsockets; i++) {
+		fs = &sockets[i];
+		s = &fs->ring[fs->head % ESMI_FLIGHT_RING];
+		prev = fs->head ? &fs->ring[(fs->head - 1) % ESMI_FLIGHT_RING] : NULL;
+		flt_read(fs, i, s);
+		fs->head++;
+		for (t = 0; t < config.ntriggers; t++)
+			if (flt_match(&config.triggers[t], s, prev))
+				flt_arm(s->time_ns, i, t);
+	}
+	status.samples++;
+
+	now = monotonic_ns();
+	if (ext_trigger) {
+		ext_trigger = false;
+		flt_arm(now, 0, ESMI_FLIGHT_EXTERNAL);
+	}
+	if (trig_ns != FLT_NO_TRIGGER && now - trig_ns >= config.post_ms * 1000000ULL)
+		flt_freeze(now);
+}
+
+static void flt_task(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&flt_lock);
+	if (sockets)
+		flt_tick();
+	pthread_mutex_unlock(&flt_lock);
+}
+
+esmi_status_t esmi_flight_recorder_start(const struct esmi_flight_config *cfg)
+{
+	struct esmi_sampler_config scfg;
+	uint64_t divider, period_ns;
+	esmi_status_t ret;
+	uint32_t i;
+
+	if (!cfg)
+		return ESMI_ARG_PTR_NULL;
+	if (!cfg->interval_us || cfg->ntriggers > ESMI_FLIGHT_MAX_TRIGGERS)
+		return ESMI_INVALID_INPUT;
+	for (i = 0; i < cfg->ntriggers; i++)
+		if (cfg->triggers[i].field > ESMI_FLIGHT_PROCHOT ||
+		    cfg->triggers[i].op > ESMI_FLIGHT_CHANGED)
+			return ESMI_INVALID_INPUT;
+	ret = esmi_sampler_config_get(&scfg);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	divider = cfg->interval_us * 1000ULL / scfg.period_ns;
+	if (!divider)
+		divider = 1;
+	if (divider > UINT32_MAX)
+		return ESMI_INVALID_INPUT;
+	/* the whole window, with a sample of slack, has to fit the ring */
+	period_ns = divider * scfg.period_ns;
+	if (((uint64_t)cfg->pre_ms + cfg->post_ms) * 1000000ULL / period_ns + 2 > ESMI_FLIGHT_RING)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&task_ctl_lock);
+	if (task_running) {
+		ret = ESMI_DEV_BUSY;
+		goto unlock;
+	}
+	pthread_mutex_lock(&flt_lock);
+	ret = flt_state_init();
+	if (ret == ESMI_SUCCESS) {
+		config = *cfg;
+		config.interval_us = period_ns / 1000;
+		trig_ns = FLT_NO_TRIGGER;
+		ext_trigger = false;
+		/* the first read probes the supported fields out of the sampler */
+		for (i = 0; i < nsockets; i++) {
+			flt_read(&sockets[i], i, &sockets[i].ring[sockets[i].head % ESMI_FLIGHT_RING]);
+			sockets[i].head++;
+		}
+	}
+	pthread_mutex_unlock(&flt_lock);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	/* the sampler runs the task under its own lock, add it without ours */
+	ret = esmi_sampler_task_add(flt_task, NULL, divider, &task_id);
+	if (ret == ESMI_SUCCESS) {
+		sampler_task_name_set(task_id, "flight");
+		task_running = true;
+	}
+
+unlock:
+	pthread_mutex_unlock(&task_ctl_lock);
+	return ret;
+}
+
+esmi_status_t esmi_flight_recorder_stop(void)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+
+	pthread_mutex_lock(&task_ctl_lock);
+	if (task_running)
+		ret = esmi_sampler_task_remove(task_id);
+	task_running = false;
+	pthread_mutex_unlock(&task_ctl_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_flight_recorder_trigger(void)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+
+	pthread_mutex_lock(&task_ctl_lock);
+	if (task_running) {
+		pthread_mutex_lock(&flt_lock);
+		ext_trigger = true;
+		pthread_mutex_unlock(&flt_lock);
+	} else {
+		ret = ESMI_NOT_INITIALIZED;
+	}
+	pthread_mutex_unlock(&task_ctl_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_flight_recorder_status_get(struct esmi_flight_status *st)
+{
+	if (!st)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&flt_lock);
+	*st = status;
+	st->armed = trig_ns != FLT_NO_TRIGGER;
+	pthread_mutex_unlock(&flt_lock);
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_flight_recorder_dump(const char *path, uint32_t *nsamples)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+	bool ready;
+	FILE *fp;
+
+	if (!path || !nsamples)
+		return ESMI_ARG_PTR_NULL;
+
+	*nsamples = 0;
+	pthread_mutex_lock(&flt_lock);
+	ready = status.ready;
+	pthread_mutex_unlock(&flt_lock);
+	if (!ready)
+		return ESMI_SUCCESS;
+
+	/* a ready snapshot is not touched by the sampler, write it unlocked */
+	fp = fopen(path, "wb");
+	if (!fp)
+		return errno_to_esmi_status(errno);
+	if (fwrite(&snap_hdr, sizeof(snap_hdr), 1, fp) != 1 ||
+	    fwrite(snap, sizeof(*snap), snap_count, fp) != snap_count)
+		ret = ESMI_IO_ERROR;
+	if (fclose(fp) && ret == ESMI_SUCCESS)
+		ret = ESMI_IO_ERROR;
+	if (ret != ESMI_SUCCESS)
+		return ret;
+
+	pthread_mutex_lock(&flt_lock);
+	*nsamples = snap_count;
+	status.ready = false;
+	pthread_mutex_unlock(&flt_lock);
+
+	return ESMI_SUCCESS;
+}
@@ -0,0 +1,341 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Core idle state residency.
+ *
+ * The cpuidle time (usec) and usage counters of every cpu and state are
+ * opened once and kept in a flat fd table, a sweep is one pread per
+ * counter followed by esmi_all_energies_get(), stamped on either side.
+ * With many cpus the table could use up the fd limit of the process, so
+ * at most half of the fds still free when the table is set up are kept
+ * open. The other counters are opened for every read, counters missing
+ * at setup are never read again.
+ *
+ * The reads are not batched further: every counter is a file of its own,
+ * so preadv() can not cover more than one, and sysfs reads do not support
+ * non-blocking io, io_uring would hand each one to a kernel worker thread.
+ *
+ * The residency of a physical core in a state is the time its SMT
+ * siblings spent in it, averaged over the siblings that have cpuidle
+ * counters, as a share of the interval.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define IDLE_COUNTERS		2	/* time, usage */
+#define IDLE_BUF_SIZE		32
+#define PROC_FD_PATH		"/proc/self/fd"
+#define IDLE_FD_REOPEN		-1	/* over the fd budget, opened per read */
+#define IDLE_FD_ABSENT		-2	/* missing at setup, not read */
+
+static const char *idle_counter_files[IDLE_COUNTERS] = { "time", "usage" };
+
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static int *fds;			// [cpu][state][counter] or IDLE_FD_*
+static uint64_t *counts, *prev_counts;	// like fds
+static uint64_t *energy, *prev_energy;	// per physical core
+static uint8_t *has_states;		// per cpu
+static char names[ESMI_IDLE_MAX_STATES][ESMI_IDLE_NAME_LEN];
+static uint64_t prev_ns;
+static uint32_t ncpus, nphys, nstates;
+
+static void idle_counter_path(char *path, uint32_t cpu, uint32_t state,
+			      uint32_t counter)
+{
+	snprintf(path, FILEPATHSIZ, "%s/cpu%u/cpuidle/state%u/%s", CPU_SYS_PATH,
+		 cpu, state, idle_counter_files[counter]);
+}
+
+static void idle_free(void)
+{
+	uint32_t i;
+
+	if (fds) {
+		for (i = 0; i < ncpus * nstates * IDLE_COUNTERS; i++)
+			if (fds[i] >= 0)
+				close(fds[i]);
+	}
+	free(fds);
+	free(counts);
+	free(energy);
+	free(has_states);
+	fds = NULL;
+	counts = prev_counts = NULL;
+	energy = prev_energy = NULL;
+	has_states = NULL;
+	prev_ns = 0;
+}
+
+/* the states of cpu0, the largest index any cpu has */
+static esmi_status_t idle_states_probe(void)
+{
+	char path[FILEPATHSIZ];
+	char *nl;
+
+	for (nstates = 0; nstates < ESMI_IDLE_MAX_STATES; nstates++) {
+		snprintf(path, FILEPATHSIZ, "%s/cpu0/cpuidle/state%u/name",
+			 CPU_SYS_PATH, nstates);
+		if (readsys_str(path, names[nstates], ESMI_IDLE_NAME_LEN))
+			break;
+		nl = strchr(names[nstates], '\n');
+		if (nl)
+			*nl = '\0';
+	}
+
+	return nstates ? ESMI_SUCCESS : ESMI_NOT_SUPPORTED;
+}
+
+/* half of the fds the process has left, 0 if that can not be told */
+static uint32_t idle_fd_budget(void)
+{
+	struct rlimit rl;
+	struct dirent *de;
+	uint64_t used = 0;
+	DIR *dir;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl))
+		return 0;
+	if (rl.rlim_cur == RLIM_INFINITY)
+		return UINT32_MAX;
+	dir = opendir(PROC_FD_PATH);
+	if (!dir)
+		return 0;
+	while ((de = readdir(dir)))
+		if (de->d_name[0] != '.')
+			used++;
+	closedir(dir);
+	if (used >= rl.rlim_cur)
+		return 0;
+
+	return (rl.rlim_cur - used) / 2 > UINT32_MAX ? UINT32_MAX :
+	       (rl.rlim_cur - used) / 2;
+}
+
+static esmi_status_t idle_state_init(void)
+{
+	char path[FILEPATHSIZ];
+	uint32_t threads, cpu, state, c, i, budget;
+	esmi_status_t ret;
+
+	if (fds)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_cpus_get(&ncpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_threads_per_core_get(&threads);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	if (!threads || ncpus < threads)
+		return ESMI_IO_ERROR;
+	nphys = ncpus / threads;
+	ret = idle_states_probe();
+	if (ret != ESMI_SUCCESS)
+		return ret;
+
+	fds = malloc(ncpus * nstates * IDLE_COUNTERS * sizeof(*fds));
+	counts = calloc(ncpus * nstates * IDLE_COUNTERS * 2, sizeof(*counts));
+	energy = calloc(nphys * 2, sizeof(*energy));
+	has_states = calloc(ncpus, sizeof(*has_states));
+	if (!fds || !counts || !energy || !has_states) {
+		free(fds);
+		fds = NULL;
+		idle_free();
+		return ESMI_NO_MEMORY;
+	}
+	prev_counts = counts + ncpus * nstates * IDLE_COUNTERS;
+	prev_energy = energy + nphys;
+
+	budget = idle_fd_budget();
+	for (cpu = 0, i = 0; cpu < ncpus; cpu++) {
+		for (state = 0; state < nstates; state++) {
+			for (c = 0; c < IDLE_COUNTERS; c++, i++) {
+				idle_counter_path(path, cpu, state, c);
+				if (budget) {
+					fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+					if (fds[i] >= 0) {
+						budget--;
+						has_states[cpu] = 1;
+					} else if (errno == EMFILE || errno == ENFILE) {
+						fds[i] = IDLE_FD_REOPEN;
+						budget = 0;
+						has_states[cpu] = 1;
+					} else {
+						fds[i] = IDLE_FD_ABSENT;
+					}
+				} else if (!access(path, R_OK)) {
+					fds[i] = IDLE_FD_REOPEN;
+					has_states[cpu] = 1;
+				} else {
+					fds[i] = IDLE_FD_ABSENT;
+				}
+			}
+		}
+	}
+
+	return ESMI_SUCCESS;
+}
+
+void idle_exit(void)
+{
+	pthread_mutex_lock(&idle_lock);
+	idle_free();
+	ncpus = nphys = nstates = 0;
+	pthread_mutex_unlock(&idle_lock);
+}
+
+static uint64_t idle_counter_read(uint32_t i, uint32_t cpu, uint32_t state,
+				  uint32_t counter)
+{
+	char path[FILEPATHSIZ], buf[IDLE_BUF_SIZE];
+	ssize_t n;
+	int fd;
+
+	if (fds[i] == IDLE_FD_ABSENT)
+		return counts[i];
+	if (fds[i] >= 0) {
+		n = pread(fds[i], buf, sizeof(buf) - 1, 0);
+		lib_syscalls++;
+	} else {
+		idle_counter_path(path, cpu, state, counter);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return counts[i];
+		n = pread(fd, buf, sizeof(buf) - 1, 0);
+		lib_syscalls++;
+		close(fd);
+	}
+	if (n <= 0)
+		return counts[i];
+	buf[n] = '\0';
+
+	return strtoull(buf, NULL, 10);
+}
+
+static void idle_sweep(void)
+{
+	uint32_t cpu, state, c, i;
+
+	for (cpu = 0, i = 0; cpu < ncpus; cpu++) {
+		if (!has_states[cpu]) {
+			i += nstates * IDLE_COUNTERS;
+			continue;
+		}
+		for (state = 0; state < nstates; state++)
+			for (c = 0; c < IDLE_COUNTERS; c++, i++)
+				counts[i] = idle_counter_read(i, cpu, state, c);
+	}
+}
+
+static void idle_core(struct esmi_idle_snapshot *snap, uint32_t core, uint64_t dns)
+{
+	uint64_t time_us[ESMI_IDLE_MAX_STATES] = { 0 };
+	uint32_t *residency = &snap->residency[core * nstates];
+	uint32_t *entries = &snap->entries[core * nstates];
+	uint32_t cpu, state, siblings = 0, i;
+	double ppm;
+
+	memset(entries, 0, nstates * sizeof(*entries));
+	for (cpu = core; cpu < ncpus; cpu += nphys) {
+		if (!has_states[cpu])
+			continue;
+		siblings++;
+		for (state = 0; state < nstates; state++) {
+			i = (cpu * nstates + state) * IDLE_COUNTERS;
+			/* a counter going backwards is taken as no time */
+			if (counts[i] >= prev_counts[i])
+				time_us[state] += counts[i] - prev_counts[i];
+			if (counts[i + 1] >= prev_counts[i + 1])
+				entries[state] += counts[i + 1] - prev_counts[i + 1];
+		}
+	}
+	for (state = 0; state < nstates; state++) {
+		ppm = siblings ? time_us[state] * 1e9 / siblings / dns : 0;
+		residency[state] = ppm > 1000000 ? 1000000 : ppm;
+	}
+
+	snap->energy[core] = energy[core] >= prev_energy[core] ?
+			     energy[core] - prev_energy[core] : 0;
+	snap->power[core] = snap->energy[core] * 1000000 / dns;
+}
+
+esmi_status_t esmi_idle_residency_get(struct esmi_idle_snapshot *snap)
+{
+	uint64_t start, end, now;
+	esmi_status_t ret;
+	uint32_t core;
+
+	if (!(snap && snap->energy && snap->power && snap->residency && snap->entries))
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&idle_lock);
+	ret = idle_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	start = monotonic_ns();
+	idle_sweep();
+	ret = esmi_all_energies_get(energy);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	end = monotonic_ns();
+	now = start + (end - start) / 2;
+
+	snap->cores = nphys;
+	snap->states = nstates;
+	snap->interval_ns = prev_ns && now > prev_ns ? now - prev_ns : 0;
+	if (snap->interval_ns) {
+		for (core = 0; core < nphys; core++)
+			idle_core(snap, core, snap->interval_ns);
+	} else {
+		memset(snap->energy, 0, nphys * sizeof(*snap->energy));
+		memset(snap->power, 0, nphys * sizeof(*snap->power));
+		memset(snap->residency, 0, nphys * nstates * sizeof(*snap->residency));
+		memset(snap->entries, 0, nphys * nstates * sizeof(*snap->entries));
+	}
+
+	memcpy(prev_counts, counts, ncpus * nstates * IDLE_COUNTERS * sizeof(*counts));
+	memcpy(prev_energy, energy, nphys * sizeof(*energy));
+	prev_ns = now;
+
+unlock:
+	pthread_mutex_unlock(&idle_lock);
+	return ret;
+}
+
+esmi_status_t esmi_idle_states_get(uint32_t *pstates,
+				   char pnames[][ESMI_IDLE_NAME_LEN])
+{
+	esmi_status_t ret;
+
+	if (!pstates)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&idle_lock);
+	ret = idle_state_init();
+	if (ret == ESMI_SUCCESS) {
+		*pstates = nstates;
+		if (pnames)
+			memcpy(pnames, names, nstates * sizeof(names[0]));
+	}
+	pthread_mutex_unlock(&idle_lock);
+
+	return ret;
+}
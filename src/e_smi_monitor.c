@@ -210,40 +210,55 @@ static int read_energy_unit(monitor_types_t type)
 	return ESMI_SUCCESS;
 }
 
-int read_energy_drv(uint32_t sensor_id, uint64_t *pval)
+int read_energy_drv_traced(uint32_t sensor_id, uint64_t *pval, const char *api)
 {
 	char file_path[FILEPATHSIZ];
+	uint64_t start = event_clock();
+	int ret;
 
 	if (NULL == pval) {
 		return EFAULT;
 	}
 	make_path(ENERGY_TYPE, energymon_path, sensor_id, file_path);
 
-	return readsys_u64(file_path, pval);
+	ret = readsys_u64(file_path, pval);
+	event_trace(api, sensor_id, 0, ret, start);
+
+	return ret;
 }
 
-int read_msr_drv(monitor_types_t type, uint32_t sensor_id, uint64_t *pval, uint64_t reg)
+int read_msr_drv_traced(monitor_types_t type, uint32_t sensor_id, uint64_t *pval,
+			uint64_t reg, const char *api)
 {
         int ret;
         char file_path[FILEPATHSIZ];
+	uint64_t start = event_clock();
 
         *pval = 0;
 
 	if (!energy_unit){
 		ret = read_energy_unit(type);
-		if (ret)
+		if (ret) {
+			event_trace(api, sensor_id, 0, ret, start);
 			return ret;
+		}
 	}
         make_path(type, MSR_PATH, sensor_id, file_path);
         ret = readmsr_u64(file_path, pval, reg);
+	event_trace(api, sensor_id, 0, ret, start);
 
         *pval = *pval * pow(0.5, (double)energy_unit) * 1000000;
         return ret;
 }
 
-int batch_read_energy_drv(uint64_t *pval, uint32_t cpus)
+/*
+ * The batch readers record every failed sensor, offline cpus (ENODEV)
+ * excepted, and time the whole batch as one call.
+ */
+int batch_read_energy_drv_traced(uint64_t *pval, uint32_t cpus, const char *api)
 {
 	char file_path[FILEPATHSIZ];
+	uint64_t start = event_clock();
 	int i, ret, status = 0;
 
 	if (NULL == pval) {
@@ -254,48 +269,117 @@ int batch_read_energy_drv(uint64_t *pval, uint32_t cpus)
 		make_path(ENERGY_TYPE, energymon_path, i + 1, file_path);
 		ret = readsys_u64(file_path, &pval[i]);
 		if (ret != 0 && ret != ENODEV) {
+			event_trace(api, i + 1, 0, ret, 0);
 			status = ret;
 		}
 	}
+	event_trace(api, 0, 0, 0, start);
 
 	return status;
 }
 
-int batch_read_msr_drv(monitor_types_t type, uint64_t *pval, uint32_t cpus)
+int batch_read_msr_drv_traced(monitor_types_t type, uint64_t *pval, uint32_t cpus,
+			      const char *api)
 {
 	char file_path[FILEPATHSIZ];
+	uint64_t start = event_clock();
 	int i, ret;
 
 	if (!energy_unit){
 		ret = read_energy_unit(type);
-		if (ret)
+		if (ret) {
+			event_trace(api, 0, 0, ret, start);
 			return ret;
+		}
 	}
 	memset(pval, 0, cpus * sizeof(uint64_t));
 	for (i = 0; i < cpus; i++) {
 		make_path(type, MSR_PATH, i, file_path);
 		ret = readmsr_u64(file_path, &pval[i], ENERGY_CORE_MSR);
-		if (ret != 0 && ret != ENODEV)
+		if (ret != 0 && ret != ENODEV) {
+			event_trace(api, i, 0, ret, start);
 			return ret;
+		}
 
 		pval[i] = pval[i] * pow(0.5, (double)energy_unit) * 1000000;
 	}
+	event_trace(api, 0, 0, 0, start);
+
 	return ret;
 }
 
-int hsmp_xfer(struct hsmp_message *msg, int mode)
+/*
+ * msr_safe executes a whole batch of reads in one ioctl on its batch
+ * device. Without msr_safe, or with a batch interface it does not
+ * understand, every operation is a pread on the per cpu device.
+ */
+#define MSR_BATCH_PATH		"/dev/cpu/msr_batch"
+
+struct msr_batch_array {
+	uint32_t numops;
+	struct msr_batch_op *ops;
+};
+
+#define X86_IOC_MSR_BATCH	_IOWR('c', 0xA2, struct msr_batch_array)
+
+int batch_read_msr_ops_traced(monitor_types_t type, struct msr_batch_op *ops,
+			      uint32_t nops, const char *api)
 {
+	struct msr_batch_array batch = { nops, ops };
+	char file_path[FILEPATHSIZ];
+	uint64_t start = event_clock();
+	int fd, i, ret = 0;
+
+	for (i = 0; i < nops; i++) {
+		ops[i].isrdmsr = 1;
+		ops[i].err = 0;
+		ops[i].wmask = 0;
+	}
+	if (type == MSR_SAFE_TYPE) {
+		fd = open(MSR_BATCH_PATH, O_RDWR | O_CLOEXEC);
+		if (fd >= 0) {
+			ret = ioctl(fd, X86_IOC_MSR_BATCH, &batch);
+			lib_syscalls++;
+			close(fd);
+			if (!ret) {
+				event_trace(api, 0, 0, 0, start);
+				return 0;
+			}
+			ret = 0;
+		}
+	}
+	for (i = 0; i < nops; i++) {
+		make_path(type, MSR_PATH, ops[i].cpu, file_path);
+		ops[i].err = readmsr_u64(file_path, &ops[i].msrdata, ops[i].msr);
+		if (ops[i].err && ops[i].err != ENODEV) {
+			event_trace(api, ops[i].cpu, 0, ops[i].err, 0);
+			ret = ops[i].err;
+		}
+	}
+	event_trace(api, 0, 0, 0, start);
+
+	return ret;
+}
+
+int hsmp_xfer_traced(struct hsmp_message *msg, int mode, const char *api)
+{
+	uint64_t start = event_clock();
 	int fd, ret;
 
 	fd = open(HSMP_CHAR_DEVFILE_NAME, mode);
-	if (fd < 0)
-		return errno;
+	if (fd < 0) {
+		ret = errno;
+		event_trace(api, msg->sock_ind, msg->msg_id, ret, start);
+		return ret;
+	}
 
 	ret = ioctl(fd, HSMP_IOCTL_CMD, msg);
+	lib_syscalls++;
 	if (ret)
 		ret = errno;
 
 	close(fd);
+	event_trace(api, msg->sock_ind, msg->msg_id, ret, start);
 
 	return ret;
 }
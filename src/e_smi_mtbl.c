@@ -0,0 +1,168 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Shared metrics table cache.
+ *
+ * The metrics table of a socket is read with one pread on a cached fd of
+ * its sysfs node and kept for the freshness window, so several metrics
+ * polled together, and the socket energy served from the table, cost one
+ * table read per window instead of one per metric.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define MTBL_DEFAULT_WINDOW_NS	1000000ULL	/* about one SMU refresh */
+
+struct mtbl_socket {
+	struct hsmp_metric_table tbl;
+	uint64_t read_ns;		// 0 before the first read
+	int fd;
+	pthread_mutex_t lock;
+};
+
+static pthread_mutex_t mtbl_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mtbl_socket *sockets;
+static uint32_t nsockets;
+static uint64_t window_ns = MTBL_DEFAULT_WINDOW_NS;
+
+static esmi_status_t mtbl_state_init(void)
+{
+	esmi_status_t ret;
+	uint32_t i;
+
+	if (sockets)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_sockets_get(&nsockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	sockets = calloc(nsockets, sizeof(*sockets));
+	if (!sockets)
+		return ESMI_NO_MEMORY;
+	for (i = 0; i < nsockets; i++) {
+		sockets[i].fd = -1;
+		pthread_mutex_init(&sockets[i].lock, NULL);
+	}
+
+	return ESMI_SUCCESS;
+}
+
+void mtbl_cache_exit(void)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&mtbl_lock);
+	for (i = 0; sockets && i < nsockets; i++) {
+		if (sockets[i].fd >= 0)
+			close(sockets[i].fd);
+		pthread_mutex_destroy(&sockets[i].lock);
+	}
+	free(sockets);
+	sockets = NULL;
+	nsockets = 0;
+	pthread_mutex_unlock(&mtbl_lock);
+}
+
+static struct mtbl_socket *mtbl_socket_get(uint32_t sock_ind, esmi_status_t *ret)
+{
+	struct mtbl_socket *ms = NULL;
+
+	pthread_mutex_lock(&mtbl_lock);
+	*ret = mtbl_state_init();
+	if (*ret == ESMI_SUCCESS) {
+		if (sock_ind < nsockets)
+			ms = &sockets[sock_ind];
+		else
+			*ret = ESMI_INVALID_INPUT;
+	}
+	pthread_mutex_unlock(&mtbl_lock);
+
+	return ms;
+}
+
+/* called with ms->lock held */
+static esmi_status_t mtbl_refresh(struct mtbl_socket *ms, uint32_t sock_ind)
+{
+	char filepath[FILEPATHSIZ];
+	ssize_t num;
+
+	if (ms->fd < 0) {
+		snprintf(filepath, FILEPATHSIZ, "%s/socket%u/metrics_bin",
+			 HSMP_METRICTABLE_PATH, sock_ind);
+		ms->fd = open(filepath, O_RDONLY | O_CLOEXEC);
+		if (ms->fd < 0)
+			return ESMI_FILE_ERROR;
+	}
+	num = pread(ms->fd, &ms->tbl, sizeof(ms->tbl), 0);
+	lib_syscalls++;
+	if (num < 0)
+		return errno_to_esmi_status(errno);
+	if (num != sizeof(ms->tbl))
+		return ESMI_IO_ERROR;
+	ms->read_ns = monotonic_ns();
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t mtbl_cache_read(uint32_t sock_ind, size_t offset, size_t size, void *buf)
+{
+	struct mtbl_socket *ms;
+	esmi_status_t ret;
+	uint64_t window;
+
+	if (offset + size > sizeof(struct hsmp_metric_table))
+		return ESMI_INVALID_INPUT;
+	ms = mtbl_socket_get(sock_ind, &ret);
+	if (!ms)
+		return ret;
+
+	window = __atomic_load_n(&window_ns, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&ms->lock);
+	if (!ms->read_ns || monotonic_ns() - ms->read_ns > window)
+		ret = mtbl_refresh(ms, sock_ind);
+	if (ret == ESMI_SUCCESS)
+		memcpy(buf, (char *)&ms->tbl + offset, size);
+	pthread_mutex_unlock(&ms->lock);
+
+	return ret;
+}
+
+esmi_status_t mtbl_cache_probe(uint32_t sock_ind)
+{
+	struct mtbl_socket *ms;
+	esmi_status_t ret;
+
+	ms = mtbl_socket_get(sock_ind, &ret);
+	if (!ms)
+		return ret;
+
+	pthread_mutex_lock(&ms->lock);
+	ret = mtbl_refresh(ms, sock_ind);
+	pthread_mutex_unlock(&ms->lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_metrics_table_freshness_set(uint32_t window_us)
+{
+	if (window_us > ESMI_MTBL_MAX_WINDOW_US)
+		return ESMI_INVALID_INPUT;
+	__atomic_store_n(&window_ns, (uint64_t)window_us * 1000, __ATOMIC_RELAXED);
+
+	return ESMI_SUCCESS;
+}
@@ -0,0 +1,262 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Online workload phase detection.
+ *
+ * Every tick samples socket power, C0 residency, DDR bandwidth utilization
+ * and the socket frequency limit. Each signal runs a two sided CUSUM on
+ * its deviation from a slowly tracked baseline, normalized by a running
+ * standard deviation. When any CUSUM crosses its threshold the baseline
+ * restarts at the new level and the socket is classified again; a
+ * different label is reported as a phase change. The frequency limit
+ * sources are compared as a bit mask, any change counts as a change point.
+ * The state is a few doubles per signal and socket.
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define PHASE_SIGNALS		3	/* power, c0 residency, ddr bandwidth */
+#define CUSUM_DRIFT		0.5	/* allowed drift in standard deviations */
+#define CUSUM_THRESHOLD		5.0	/* change point threshold */
+#define BASE_WEIGHT		0.05	/* weight of a sample in the baseline */
+#define LEVEL_WEIGHT		0.3	/* weight of a sample in the current level */
+
+/* the noise floor keeps a flat signal from flagging tiny steps */
+static const double noise_floor[PHASE_SIGNALS] = { 2000.0, 2.0, 2.0 };
+static const uint32_t signal_bit[PHASE_SIGNALS] = {
+	ESMI_PHASE_SIG_POWER, ESMI_PHASE_SIG_C0, ESMI_PHASE_SIG_DDR_BW
+};
+
+struct cusum {
+	double mean;
+	double var;
+	double level;			// fast moving average used for labels
+	double pos, neg;
+	bool init;
+};
+
+struct phase_socket {
+	struct cusum sig[PHASE_SIGNALS];
+	uint16_t freq_limit;
+	uint16_t freq_src;
+	bool freq_init;
+	bool ddr_sup;			// DDR bandwidth message supported
+	bool freq_sup;			// frequency limit message supported
+	esmi_phase_t phase;
+};
+
+static pthread_mutex_t phase_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct phase_socket *sockets;
+static uint32_t nsockets;
+
+static esmi_status_t phase_state_init(void)
+{
+	esmi_status_t ret;
+	uint32_t i;
+
+	if (sockets)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_sockets_get(&nsockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	sockets = calloc(nsockets, sizeof(*sockets));
+	if (!sockets)
+		return ESMI_NO_MEMORY;
+	for (i = 0; i < nsockets; i++) {
+		sockets[i].ddr_sup = true;
+		sockets[i].freq_sup = true;
+	}
+
+	return ESMI_SUCCESS;
+}
+
+void phase_exit(void)
+{
+	pthread_mutex_lock(&phase_lock);
+	free(sockets);
+	sockets = NULL;
+	nsockets = 0;
+	pthread_mutex_unlock(&phase_lock);
+}
+
+static bool cusum_update(struct cusum *c, double x, double floor)
+{
+	double sd, z, d;
+
+	if (!c->init) {
+		c->mean = c->level = x;
+		c->var = floor * floor;
+		c->pos = c->neg = 0;
+		c->init = true;
+		return false;
+	}
+
+	c->level += LEVEL_WEIGHT * (x - c->level);
+	sd = sqrt(c->var);
+	if (sd < floor)
+		sd = floor;
+	z = (x - c->mean) / sd;
+	c->pos = fmax(0, c->pos + z - CUSUM_DRIFT);
+	c->neg = fmax(0, c->neg - z - CUSUM_DRIFT);
+	if (c->pos > CUSUM_THRESHOLD || c->neg > CUSUM_THRESHOLD) {
+		/* restart the baseline at the new level */
+		c->mean = c->level = x;
+		c->pos = c->neg = 0;
+		return true;
+	}
+
+	d = x - c->mean;
+	c->mean += BASE_WEIGHT * d;
+	c->var += BASE_WEIGHT * (d * d - c->var);
+
+	return false;
+}
+
+/*
+ * Idle below 10% C0, memory bound when the DDR bandwidth utilization is
+ * high for the time the cores are active, compute bound otherwise.
+ */
+static esmi_phase_t phase_classify(struct phase_socket *ps)
+{
+	double c0 = ps->sig[1].level;
+	double ddr = ps->sig[2].level;
+
+	if (c0 < 10)
+		return ESMI_PHASE_IDLE;
+	if (ps->ddr_sup && (ddr >= 50 || ddr >= c0 * 0.6))
+		return ESMI_PHASE_MEMORY_BOUND;
+
+	return ESMI_PHASE_COMPUTE_BOUND;
+}
+
+esmi_status_t esmi_phase_tick(uint32_t sock_ind, struct esmi_phase_event *event,
+			      bool *changed)
+{
+	struct ddr_bw_metrics bw = { 0 };
+	struct phase_socket *ps;
+	double x[PHASE_SIGNALS];
+	uint32_t power, c0, signals = 0;
+	uint16_t freq = 0, src = 0;
+	esmi_phase_t phase;
+	esmi_status_t ret;
+	int i;
+
+	if (!event || !changed)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&phase_lock);
+	ret = phase_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	ps = &sockets[sock_ind];
+
+	ret = esmi_socket_power_get(sock_ind, &power);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	ret = esmi_socket_c0_residency_get(sock_ind, &c0);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (ps->ddr_sup) {
+		ret = esmi_ddr_bw_get(sock_ind, &bw);
+		if (ret == ESMI_NO_HSMP_MSG_SUP)
+			ps->ddr_sup = false;
+		else if (ret != ESMI_SUCCESS)
+			goto unlock;
+	}
+	if (ps->freq_sup) {
+		ret = socket_freq_limit_raw_get(sock_ind, &freq, &src);
+		if (ret == ESMI_NO_HSMP_MSG_SUP)
+			ps->freq_sup = false;
+		else if (ret != ESMI_SUCCESS)
+			goto unlock;
+	}
+	ret = ESMI_SUCCESS;
+
+	x[0] = power;
+	x[1] = c0;
+	x[2] = bw.utilized_pct;
+	for (i = 0; i < PHASE_SIGNALS; i++) {
+		if (i == 2 && !ps->ddr_sup)
+			continue;
+		if (cusum_update(&ps->sig[i], x[i], noise_floor[i]))
+			signals |= signal_bit[i];
+	}
+	if (ps->freq_sup) {
+		if (ps->freq_init && (src != ps->freq_src || freq != ps->freq_limit))
+			signals |= ESMI_PHASE_SIG_FREQ_LIMIT;
+		ps->freq_limit = freq;
+		ps->freq_src = src;
+		ps->freq_init = true;
+	}
+
+	*changed = false;
+	phase = ps->phase;
+	if (signals || ps->phase == ESMI_PHASE_UNKNOWN)
+		phase = phase_classify(ps);
+	if (phase != ps->phase) {
+		event->sock_ind = sock_ind;
+		event->time_ns = monotonic_ns();
+		event->prev_phase = ps->phase;
+		event->phase = phase;
+		event->signals = signals;
+		event->power = power;
+		event->c0_residency = c0;
+		event->ddr_bw_pct = bw.utilized_pct;
+		event->freq_limit = freq;
+		event->freq_limit_src = src;
+		ps->phase = phase;
+		*changed = true;
+	}
+
+unlock:
+	pthread_mutex_unlock(&phase_lock);
+	return ret;
+}
+
+esmi_status_t esmi_phase_get(uint32_t sock_ind, esmi_phase_t *phase)
+{
+	esmi_status_t ret;
+
+	if (!phase)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&phase_lock);
+	ret = phase_state_init();
+	if (ret == ESMI_SUCCESS) {
+		if (sock_ind >= nsockets)
+			ret = ESMI_INVALID_INPUT;
+		else
+			*phase = sockets[sock_ind].phase;
+	}
+	pthread_mutex_unlock(&phase_lock);
+
+	return ret;
+}
+
+char *esmi_phase_name(esmi_phase_t phase)
+{
+	switch (phase) {
+	case ESMI_PHASE_IDLE:		return "idle";
+	case ESMI_PHASE_COMPUTE_BOUND:	return "compute-bound";
+	case ESMI_PHASE_MEMORY_BOUND:	return "memory-bound";
+	default:			return "unknown";
+	}
+}
@@ -0,0 +1,498 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Telemetry subscriptions.
+ *
+ * Subscriptions to the same metric and index share a source. Periods are
+ * kept in sampler ticks. All subscriptions are served by one sampler task
+ * running every gcd of the subscription periods, which is re-added
+ * whenever that divider changes, and every run of the task advances a
+ * tick count by its divider. Scheduling on that count rather than on the
+ * time of the run keeps the wake-up jitter of the sampler thread from
+ * making a read miss its run.
+ *
+ * A source is read when its next due tick is reached and is then due
+ * again one period of its fastest subscriber later, so every metric is
+ * read once per fastest period however many components subscribed to it.
+ * A reading goes to every subscriber of the source whose own due tick is
+ * reached, and due ticks advance by whole periods, not from the run of
+ * delivery, so slower subscribers keep their average rate.
+ *
+ * Samples go to a callback or into a single producer single consumer ring
+ * per subscriber, the sampler thread only advances the head and the reader
+ * only the tail, so reading takes no lock.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+struct pubsub_source {
+	uint32_t metric;
+	uint32_t index;
+	uint32_t nsubs;
+	uint64_t period;		// ticks, of the fastest subscriber
+	uint64_t next;			// tick
+};
+
+struct pubsub_sub {
+	bool active;
+	uint32_t source;
+	uint64_t period;		// ticks
+	uint64_t next;			// tick
+	esmi_subscriber_fn fn;
+	void *arg;
+	uint32_t head;			// written by the sampler thread
+	uint32_t tail;			// written by the reader
+	struct esmi_sample queue[ESMI_SUBSCRIPTION_QUEUE];
+};
+
+struct pubsub_state {
+	struct pubsub_source sources[ESMI_MAX_SUBSCRIPTIONS];
+	struct pubsub_sub subs[ESMI_MAX_SUBSCRIPTIONS];
+	uint64_t tick;			// sampler ticks the task has run for
+	uint64_t reads, deliveries, dropped;
+};
+
+static pthread_mutex_t pubsub_lock = PTHREAD_MUTEX_INITIALIZER;
+/* serializes the task changes, never taken by the task */
+static pthread_mutex_t task_ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pubsub_state *state;
+static uint32_t task_id, task_divider;
+static bool task_running;
+
+static esmi_status_t read_socket_power(uint32_t index, uint64_t *val)
+{
+	uint32_t power;
+	esmi_status_t ret;
+
+	ret = esmi_socket_power_get(index, &power);
+	*val = power;
+
+	return ret;
+}
+
+static esmi_status_t read_socket_energy(uint32_t index, uint64_t *val)
+{
+	return esmi_socket_energy_get(index, val);
+}
+
+static esmi_status_t read_core_energy(uint32_t index, uint64_t *val)
+{
+	return esmi_core_energy_get(index, val);
+}
+
+static esmi_status_t read_socket_temp(uint32_t index, uint64_t *val)
+{
+	uint32_t tmon;
+	esmi_status_t ret;
+
+	ret = esmi_socket_temperature_get(index, &tmon);
+	*val = tmon;
+
+	return ret;
+}
+
+static esmi_status_t read_core_boostlimit(uint32_t index, uint64_t *val)
+{
+	uint32_t boostlimit;
+	esmi_status_t ret;
+
+	ret = esmi_core_boostlimit_get(index, &boostlimit);
+	*val = boostlimit;
+
+	return ret;
+}
+
+static esmi_status_t read_socket_c0(uint32_t index, uint64_t *val)
+{
+	uint32_t c0;
+	esmi_status_t ret;
+
+	ret = esmi_socket_c0_residency_get(index, &c0);
+	*val = c0;
+
+	return ret;
+}
+
+static esmi_status_t read_socket_freq_limit(uint32_t index, uint64_t *val)
+{
+	uint16_t freq, src;
+	esmi_status_t ret;
+
+	ret = socket_freq_limit_raw_get(index, &freq, &src);
+	*val = freq;
+
+	return ret;
+}
+
+static esmi_status_t read_ddr_bw(uint32_t index, uint64_t *val)
+{
+	struct ddr_bw_metrics bw;
+	esmi_status_t ret;
+
+	if (index > UINT8_MAX)
+		return ESMI_INVALID_INPUT;
+	ret = esmi_ddr_bw_get(index, &bw);
+	*val = bw.utilized_bw;
+
+	return ret;
+}
+
+static esmi_status_t (*const metric_readers[ESMI_METRIC_MAX])(uint32_t, uint64_t *) = {
+	[ESMI_METRIC_SOCKET_POWER]	= read_socket_power,
+	[ESMI_METRIC_SOCKET_ENERGY]	= read_socket_energy,
+	[ESMI_METRIC_CORE_ENERGY]	= read_core_energy,
+	[ESMI_METRIC_SOCKET_TEMP]	= read_socket_temp,
+	[ESMI_METRIC_CORE_BOOSTLIMIT]	= read_core_boostlimit,
+	[ESMI_METRIC_SOCKET_C0]		= read_socket_c0,
+	[ESMI_METRIC_SOCKET_FREQ_LIMIT]	= read_socket_freq_limit,
+	[ESMI_METRIC_DDR_BW]		= read_ddr_bw,
+};
+
+static void metric_read(uint32_t metric, uint32_t index, struct esmi_sample *s)
+{
+	s->metric = metric;
+	s->index = index;
+	s->value = 0;
+	s->status = metric_readers[metric](index, &s->value);
+	s->time_ns = monotonic_ns();
+}
+
+/* The state is touched from the sampler thread, so it lives in the arena */
+static esmi_status_t pubsub_state_init(void)
+{
+	if (state)
+		return ESMI_SUCCESS;
+
+	state = sampler_arena_alloc(sizeof(*state));
+	if (!state)
+		return ESMI_NO_MEMORY;
+	memset(state, 0, sizeof(*state));
+
+	return ESMI_SUCCESS;
+}
+
+static void pubsub_deliver(struct pubsub_sub *sub, const struct esmi_sample *s)
+{
+	uint32_t tail;
+
+	state->deliveries++;
+	if (sub->fn) {
+		sub->fn(s, sub->arg);
+		return;
+	}
+	tail = __atomic_load_n(&sub->tail, __ATOMIC_ACQUIRE);
+	if (sub->head - tail >= ESMI_SUBSCRIPTION_QUEUE) {
+		state->dropped++;
+		return;
+	}
+	sub->queue[sub->head % ESMI_SUBSCRIPTION_QUEUE] = *s;
+	__atomic_store_n(&sub->head, sub->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Next due tick after tick, by whole periods. Only a due tick pulled in
+ * by a new subscriber or left behind by a divider change starts over from
+ * the current tick.
+ */
+static uint64_t pubsub_next(uint64_t next, uint64_t period, uint64_t tick)
+{
+	next += period;
+	if (next <= tick)
+		next = tick + period;
+
+	return next;
+}
+
+/* arg is the divider the task was added with */
+static void pubsub_task(void *arg)
+{
+	struct pubsub_source *src;
+	struct pubsub_sub *sub;
+	struct esmi_sample s;
+	uint64_t tick;
+	uint32_t i, j;
+
+	pthread_mutex_lock(&pubsub_lock);
+	if (!state)
+		goto unlock;
+	state->tick += (uintptr_t)arg;
+	tick = state->tick;
+	for (i = 0; i < ESMI_MAX_SUBSCRIPTIONS; i++) {
+		src = &state->sources[i];
+		if (!src->nsubs || tick < src->next)
+			continue;
+		metric_read(src->metric, src->index, &s);
+		state->reads++;
+		src->next = pubsub_next(src->next, src->period, tick);
+		for (j = 0; j < ESMI_MAX_SUBSCRIPTIONS; j++) {
+			sub = &state->subs[j];
+			if (!sub->active || sub->source != i || tick < sub->next)
+				continue;
+			pubsub_deliver(sub, &s);
+			sub->next = pubsub_next(sub->next, sub->period, tick);
+		}
+	}
+unlock:
+	pthread_mutex_unlock(&pubsub_lock);
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+	uint32_t t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/* a period in sampler ticks, at least one */
+static uint64_t pubsub_ticks(uint32_t period_ms, uint64_t tick_ns)
+{
+	uint64_t ticks = period_ms * 1000000ULL / tick_ns;
+
+	if (!ticks)
+		return 1;
+
+	return ticks > UINT32_MAX ? UINT32_MAX : ticks;
+}
+
+/* called with pubsub_lock, the task divider the subscriptions need */
+static uint32_t pubsub_divider(void)
+{
+	uint32_t i, divider = 0;
+
+	for (i = 0; i < ESMI_MAX_SUBSCRIPTIONS; i++) {
+		if (state->subs[i].active)
+			divider = gcd(divider, state->subs[i].period);
+	}
+
+	return divider;
+}
+
+/* called with task_ctl_lock, without pubsub_lock which the task takes */
+static esmi_status_t pubsub_reschedule(uint32_t divider)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+
+	if (task_running && divider == task_divider)
+		return ESMI_SUCCESS;
+	if (task_running) {
+		esmi_sampler_task_remove(task_id);
+		task_running = false;
+	}
+	if (!divider)
+		return ESMI_SUCCESS;
+
+	ret = esmi_sampler_task_add(pubsub_task, (void *)(uintptr_t)divider,
+				    divider, &task_id);
+	if (ret == ESMI_SUCCESS) {
+		sampler_task_name_set(task_id, "pubsub");
+		task_divider = divider;
+		task_running = true;
+	}
+
+	return ret;
+}
+
+/* called with pubsub_lock */
+static void pubsub_source_update(uint32_t i)
+{
+	struct pubsub_source *src = &state->sources[i];
+	uint32_t j;
+
+	src->nsubs = 0;
+	src->period = UINT64_MAX;
+	for (j = 0; j < ESMI_MAX_SUBSCRIPTIONS; j++) {
+		if (!state->subs[j].active || state->subs[j].source != i)
+			continue;
+		src->nsubs++;
+		if (state->subs[j].period < src->period)
+			src->period = state->subs[j].period;
+	}
+}
+
+esmi_status_t esmi_subscribe(esmi_metric_t metric, uint32_t index, uint32_t period_ms,
+			     esmi_subscriber_fn fn, void *arg, uint32_t *sub_id)
+{
+	struct esmi_sampler_config cfg;
+	uint32_t i, src = ESMI_MAX_SUBSCRIPTIONS, slot = ESMI_MAX_SUBSCRIPTIONS;
+	struct pubsub_sub *sub;
+	struct esmi_sample s;
+	uint32_t divider;
+	esmi_status_t ret;
+
+	if (!sub_id)
+		return ESMI_ARG_PTR_NULL;
+	if (metric >= ESMI_METRIC_MAX || !period_ms)
+		return ESMI_INVALID_INPUT;
+	ret = esmi_sampler_config_get(&cfg);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	/* validates the index and that the platform has the metric */
+	metric_read(metric, index, &s);
+	if (s.status != ESMI_SUCCESS)
+		return s.status;
+
+	pthread_mutex_lock(&task_ctl_lock);
+	pthread_mutex_lock(&pubsub_lock);
+	ret = pubsub_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	for (i = 0; i < ESMI_MAX_SUBSCRIPTIONS; i++) {
+		if (state->sources[i].nsubs && state->sources[i].metric == metric &&
+		    state->sources[i].index == index)
+			src = i;
+		if (!state->subs[i].active && slot == ESMI_MAX_SUBSCRIPTIONS)
+			slot = i;
+	}
+	if (slot == ESMI_MAX_SUBSCRIPTIONS) {
+		ret = ESMI_DEV_BUSY;
+		goto unlock;
+	}
+	/* a new source, there is one free as there is a free subscription */
+	for (i = 0; src == ESMI_MAX_SUBSCRIPTIONS && i < ESMI_MAX_SUBSCRIPTIONS; i++) {
+		if (!state->sources[i].nsubs) {
+			src = i;
+			state->sources[i].metric = metric;
+			state->sources[i].index = index;
+			state->sources[i].next = 0;
+		}
+	}
+
+	sub = &state->subs[slot];
+	memset(sub, 0, sizeof(*sub));
+	sub->source = src;
+	sub->period = pubsub_ticks(period_ms, cfg.period_ns);
+	sub->next = state->tick;
+	sub->fn = fn;
+	sub->arg = arg;
+	__atomic_store_n(&sub->active, true, __ATOMIC_RELEASE);
+	pubsub_source_update(src);
+	/* a faster subscriber pulls the next read of its source in */
+	if (state->sources[src].next > state->tick)
+		state->sources[src].next = state->tick;
+	divider = pubsub_divider();
+	pthread_mutex_unlock(&pubsub_lock);
+
+	ret = pubsub_reschedule(divider);
+	if (ret != ESMI_SUCCESS) {
+		pthread_mutex_lock(&pubsub_lock);
+		__atomic_store_n(&sub->active, false, __ATOMIC_RELEASE);
+		pubsub_source_update(src);
+		pthread_mutex_unlock(&pubsub_lock);
+	} else {
+		*sub_id = slot;
+	}
+	pthread_mutex_unlock(&task_ctl_lock);
+	return ret;
+
+unlock:
+	pthread_mutex_unlock(&pubsub_lock);
+	pthread_mutex_unlock(&task_ctl_lock);
+	return ret;
+}
+
+esmi_status_t esmi_unsubscribe(uint32_t sub_id)
+{
+	uint32_t divider;
+	esmi_status_t ret;
+
+	if (sub_id >= ESMI_MAX_SUBSCRIPTIONS)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&task_ctl_lock);
+	pthread_mutex_lock(&pubsub_lock);
+	if (!state || !state->subs[sub_id].active) {
+		pthread_mutex_unlock(&pubsub_lock);
+		pthread_mutex_unlock(&task_ctl_lock);
+		return ESMI_INVALID_INPUT;
+	}
+	/* the task holds pubsub_lock while calling back, it is done here */
+	__atomic_store_n(&state->subs[sub_id].active, false, __ATOMIC_RELEASE);
+	pubsub_source_update(state->subs[sub_id].source);
+	divider = pubsub_divider();
+	pthread_mutex_unlock(&pubsub_lock);
+
+	ret = pubsub_reschedule(divider);
+	pthread_mutex_unlock(&task_ctl_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_subscription_read(uint32_t sub_id, struct esmi_sample *samples,
+				     uint32_t max, uint32_t *count)
+{
+	struct pubsub_state *st = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+	struct pubsub_sub *sub;
+	uint32_t head, tail, n;
+
+	if (!samples || !count)
+		return ESMI_ARG_PTR_NULL;
+	if (sub_id >= ESMI_MAX_SUBSCRIPTIONS || !st)
+		return ESMI_INVALID_INPUT;
+	sub = &st->subs[sub_id];
+	if (!__atomic_load_n(&sub->active, __ATOMIC_ACQUIRE) || sub->fn)
+		return ESMI_INVALID_INPUT;
+
+	head = __atomic_load_n(&sub->head, __ATOMIC_ACQUIRE);
+	tail = sub->tail;
+	for (n = 0; n < max && tail != head; n++, tail++)
+		samples[n] = sub->queue[tail % ESMI_SUBSCRIPTION_QUEUE];
+	__atomic_store_n(&sub->tail, tail, __ATOMIC_RELEASE);
+	*count = n;
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_pubsub_stats_get(struct esmi_pubsub_stats *stats)
+{
+	uint32_t i;
+
+	if (!stats)
+		return ESMI_ARG_PTR_NULL;
+
+	memset(stats, 0, sizeof(*stats));
+	pthread_mutex_lock(&pubsub_lock);
+	for (i = 0; state && i < ESMI_MAX_SUBSCRIPTIONS; i++) {
+		if (state->subs[i].active)
+			stats->subscriptions++;
+		if (state->sources[i].nsubs)
+			stats->sources++;
+	}
+	if (state) {
+		stats->reads = state->reads;
+		stats->deliveries = state->deliveries;
+		stats->dropped = state->dropped;
+	}
+	pthread_mutex_unlock(&pubsub_lock);
+
+	return ESMI_SUCCESS;
+}
+
+void pubsub_exit(void)
+{
+	pthread_mutex_lock(&task_ctl_lock);
+	pubsub_reschedule(0);
+	pthread_mutex_unlock(&task_ctl_lock);
+
+	/* the arena itself is released by sampler_exit() */
+	pthread_mutex_lock(&pubsub_lock);
+	state = NULL;
+	pthread_mutex_unlock(&pubsub_lock);
+}
@@ -0,0 +1,347 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * QoS class boost limit allocator.
+ *
+ * A class is a cgroup with a boost limit. On every apply the cores occupied
+ * by each class are refreshed, either from the effective cpuset of the
+ * cgroup or by sampling the cpu its runnable threads are queued on, and the
+ * resulting per core limits are handed to the diff based batch writer.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define CGROUP_ROOT	"/sys/fs/cgroup"
+#define CPULIST_SIZE	4096
+#define STAT_LINE_SIZE	1024
+
+/*
+ * A run queue sampled core stays occupied for this many applies after the
+ * last runnable thread was seen on it, so short sleeps do not flip limits.
+ */
+#define QOS_RUNQ_HOLD	4
+
+struct qos_class {
+	int used;
+	char path[FILEPATHSIZ];
+	uint32_t boostlimit;
+	esmi_qos_track_t track;
+	uint8_t *occupied;	// per cpu, non zero while the class uses it
+};
+
+static pthread_mutex_t qos_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct qos_class classes[ESMI_QOS_MAX_CLASSES];
+static uint32_t default_boostlimit;
+static uint32_t *limits;
+static uint8_t *cpumask;
+static uint32_t ncpus;
+
+static esmi_status_t qos_state_init(void)
+{
+	esmi_status_t ret;
+
+	if (limits)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_cpus_get(&ncpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	limits = calloc(ncpus, sizeof(*limits));
+	cpumask = calloc(ncpus, sizeof(*cpumask));
+	if (!limits || !cpumask) {
+		free(limits);
+		free(cpumask);
+		limits = NULL;
+		cpumask = NULL;
+		return ESMI_NO_MEMORY;
+	}
+
+	return ESMI_SUCCESS;
+}
+
+void qos_exit(void)
+{
+	int i;
+
+	pthread_mutex_lock(&qos_lock);
+	for (i = 0; i < ESMI_QOS_MAX_CLASSES; i++) {
+		free(classes[i].occupied);
+		memset(&classes[i], 0, sizeof(classes[i]));
+	}
+	free(limits);
+	free(cpumask);
+	limits = NULL;
+	cpumask = NULL;
+	ncpus = 0;
+	default_boostlimit = 0;
+	pthread_mutex_unlock(&qos_lock);
+}
+
+/*
+ * cgroup v2 exposes cpuset.cpus.effective, v1 cpuset.effective_cpus.
+ * Without a cpuset controller the cgroup may run on any cpu.
+ */
+esmi_status_t cgroup_cpuset_get(const char *path, uint8_t *mask, uint32_t ncpus)
+{
+	static const char *files[] = {
+		"cpuset.cpus.effective",
+		"cpuset.effective_cpus",
+		"cpuset.cpus",
+	};
+	char filepath[FILEPATHSIZ + FILESIZ];
+	char buf[CPULIST_SIZE];
+	int i, ret = ENOENT;
+
+	for (i = 0; i < ARRAY_SIZE(files); i++) {
+		snprintf(filepath, sizeof(filepath), "%s/%s", path, files[i]);
+		ret = readsys_str(filepath, buf, sizeof(buf));
+		if (ret != ENOENT)
+			break;
+	}
+	if (ret == ENOENT && access(path, F_OK) == 0) {
+		memset(mask, 1, ncpus);
+		return ESMI_SUCCESS;
+	}
+	if (ret)
+		return errno_to_esmi_status(ret);
+	/* an empty effective cpuset means the parent's cpus are used */
+	if (buf[0] == '\n' || buf[0] == '\0') {
+		memset(mask, 1, ncpus);
+		return ESMI_SUCCESS;
+	}
+	if (parse_cpulist(buf, mask, ncpus) < 0)
+		return ESMI_UNEXPECTED_SIZE;
+
+	return ESMI_SUCCESS;
+}
+
+/* a relative cgroup path is taken below the cgroup root */
+void cgroup_path_resolve(const char *cgroup_path, char *path, size_t len)
+{
+	if (cgroup_path[0] == '/')
+		snprintf(path, len, "%s", cgroup_path);
+	else
+		snprintf(path, len, "%s/%s", CGROUP_ROOT, cgroup_path);
+}
+
+/*
+ * Return the cpu a thread is queued on if it is runnable, -1 otherwise.
+ * state is the 3rd and processor the 39th field of /proc/<tid>/stat, the
+ * fields are counted after the command name which may contain spaces.
+ */
+static int qos_runnable_cpu(int tid)
+{
+	char filepath[FILESIZ];
+	char buf[STAT_LINE_SIZE];
+	char *p;
+	int field;
+
+	snprintf(filepath, sizeof(filepath), "/proc/%d/stat", tid);
+	if (readsys_str(filepath, buf, sizeof(buf)))
+		return -1;
+	p = strrchr(buf, ')');
+	if (!p || p[1] != ' ' || p[2] != 'R')
+		return -1;
+	for (field = 2; *p && field < 39; p++)
+		if (*p == ' ')
+			field++;
+
+	return field == 39 ? atoi(p) : -1;
+}
+
+static esmi_status_t qos_track_runqueue(struct qos_class *qc)
+{
+	char filepath[FILEPATHSIZ + FILESIZ];
+	FILE *fp;
+	int tid, cpu;
+	uint32_t i;
+
+	snprintf(filepath, sizeof(filepath), "%s/cgroup.threads", qc->path);
+	fp = fopen(filepath, "r");
+	if (!fp) {
+		snprintf(filepath, sizeof(filepath), "%s/tasks", qc->path);
+		fp = fopen(filepath, "r");
+	}
+	if (!fp)
+		return errno_to_esmi_status(errno);
+
+	memset(cpumask, 0, ncpus);
+	while (fscanf(fp, "%d", &tid) == 1) {
+		cpu = qos_runnable_cpu(tid);
+		if (cpu >= 0 && cpu < ncpus)
+			cpumask[cpu] = 1;
+	}
+	fclose(fp);
+
+	for (i = 0; i < ncpus; i++) {
+		if (cpumask[i])
+			qc->occupied[i] = QOS_RUNQ_HOLD;
+		else if (qc->occupied[i])
+			qc->occupied[i]--;
+	}
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_qos_class_add(const char *cgroup_path, uint32_t boostlimit,
+				 esmi_qos_track_t track, uint32_t *class_id)
+{
+	struct qos_class *qc = NULL;
+	esmi_status_t ret;
+	int i;
+
+	if (!cgroup_path || !class_id)
+		return ESMI_ARG_PTR_NULL;
+	if (!boostlimit || boostlimit > UINT16_MAX)
+		return ESMI_INVALID_INPUT;
+	if (track != ESMI_QOS_TRACK_CPUSET && track != ESMI_QOS_TRACK_RUNQUEUE)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&qos_lock);
+	ret = qos_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	for (i = 0; i < ESMI_QOS_MAX_CLASSES; i++) {
+		if (!classes[i].used) {
+			qc = &classes[i];
+			break;
+		}
+	}
+	if (!qc) {
+		ret = ESMI_DEV_BUSY;
+		goto unlock;
+	}
+
+	cgroup_path_resolve(cgroup_path, qc->path, sizeof(qc->path));
+	if (access(qc->path, F_OK)) {
+		ret = errno_to_esmi_status(errno);
+		goto unlock;
+	}
+	qc->occupied = calloc(ncpus, sizeof(*qc->occupied));
+	if (!qc->occupied) {
+		ret = ESMI_NO_MEMORY;
+		goto unlock;
+	}
+	qc->boostlimit = boostlimit;
+	qc->track = track;
+	qc->used = 1;
+	*class_id = i;
+
+unlock:
+	pthread_mutex_unlock(&qos_lock);
+	return ret;
+}
+
+esmi_status_t esmi_qos_class_remove(uint32_t class_id)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+
+	if (class_id >= ESMI_QOS_MAX_CLASSES)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&qos_lock);
+	if (!classes[class_id].used) {
+		ret = ESMI_INVALID_INPUT;
+	} else {
+		free(classes[class_id].occupied);
+		memset(&classes[class_id], 0, sizeof(classes[class_id]));
+	}
+	pthread_mutex_unlock(&qos_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_qos_class_boostlimit_set(uint32_t class_id, uint32_t boostlimit)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+
+	if (class_id >= ESMI_QOS_MAX_CLASSES)
+		return ESMI_INVALID_INPUT;
+	if (!boostlimit || boostlimit > UINT16_MAX)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&qos_lock);
+	if (!classes[class_id].used)
+		ret = ESMI_INVALID_INPUT;
+	else
+		classes[class_id].boostlimit = boostlimit;
+	pthread_mutex_unlock(&qos_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_qos_default_boostlimit_set(uint32_t boostlimit)
+{
+	if (boostlimit > UINT16_MAX)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&qos_lock);
+	default_boostlimit = boostlimit;
+	pthread_mutex_unlock(&qos_lock);
+
+	return ESMI_SUCCESS;
+}
+
+/*
+ * A core shared by several classes gets the highest of their limits, so a
+ * latency critical class is never capped by a batch class next to it.
+ * Cores without any class get the default limit, or are left alone if
+ * no default is set.
+ */
+esmi_status_t esmi_qos_alloc_apply(uint32_t *nwrites)
+{
+	esmi_status_t ret, track_ret = ESMI_SUCCESS;
+	struct qos_class *qc;
+	uint32_t i, cpu;
+
+	pthread_mutex_lock(&qos_lock);
+	ret = qos_state_init();
+	if (ret != ESMI_SUCCESS) {
+		pthread_mutex_unlock(&qos_lock);
+		return ret;
+	}
+
+	memset(limits, 0, ncpus * sizeof(*limits));
+	for (i = 0; i < ESMI_QOS_MAX_CLASSES; i++) {
+		qc = &classes[i];
+		if (!qc->used)
+			continue;
+		if (qc->track == ESMI_QOS_TRACK_CPUSET)
+			ret = cgroup_cpuset_get(qc->path, qc->occupied, ncpus);
+		else
+			ret = qos_track_runqueue(qc);
+		/* a vanished cgroup occupies nothing, report it after applying */
+		if (ret != ESMI_SUCCESS) {
+			memset(qc->occupied, 0, ncpus);
+			if (track_ret == ESMI_SUCCESS)
+				track_ret = ret;
+			continue;
+		}
+		for (cpu = 0; cpu < ncpus; cpu++)
+			if (qc->occupied[cpu] && qc->boostlimit > limits[cpu])
+				limits[cpu] = qc->boostlimit;
+	}
+	for (cpu = 0; cpu < ncpus; cpu++)
+		if (!limits[cpu])
+			limits[cpu] = default_boostlimit;
+
+	ret = esmi_core_boostlimit_batch_set(limits, ncpus, nwrites);
+	pthread_mutex_unlock(&qos_lock);
+
+	return ret != ESMI_SUCCESS ? ret : track_ret;
+}
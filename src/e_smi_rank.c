@@ -0,0 +1,302 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Core performance ranking.
+ *
+ * The score of a cpu is its frequency headroom in MHz, the lower of the
+ * current frequency limit and the boost limit, discounted by the load of
+ * its SMT siblings and by the power its physical core drew since the
+ * previous update relative to the hungriest core of the socket:
+ *
+ *	score = min(freq, boost) * (1 - RANK_SMT_WEIGHT * sibling load)
+ *				 * (1 - RANK_POWER_WEIGHT * power / max power)
+ *
+ * Every socket keeps its cpus in descending score order. Scores move
+ * little between updates, so the order is repaired by insertion sort,
+ * linear in the number of cpus plus the number of rank changes, and a top
+ * k query copies the first k entries.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define RANK_SMT_WEIGHT		0.5
+#define RANK_POWER_WEIGHT	0.25
+
+struct rank_cpu {
+	int sock;
+	uint32_t score;
+	uint32_t freq;			// frequency limit in MHz
+	uint32_t boost;			// boost limit in MHz
+	double sibling_load;		// highest C0 share of the SMT siblings
+};
+
+struct rank_socket {
+	uint32_t *order;		// cpus in descending score order
+	uint32_t ncpus;
+	bool ranked;
+};
+
+static pthread_mutex_t rank_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rank_socket *sockets;
+static struct rank_cpu *cpus;
+static uint32_t *order_buf;
+static double *core_power;		// per physical core, mW
+static double *util;			// per cpu C0 share of the last interval
+static uint64_t *energy, *prev_energy, *energy_ns;
+static uint64_t *busy, *total, *prev_busy, *prev_total;
+static uint32_t nsockets, ncpus, nphys;
+
+static void rank_free(void)
+{
+	free(sockets);
+	free(cpus);
+	free(order_buf);
+	free(core_power);
+	free(util);
+	free(energy);
+	free(busy);
+	sockets = NULL;
+	cpus = NULL;
+	order_buf = NULL;
+	core_power = util = NULL;
+	energy = prev_energy = energy_ns = NULL;
+	busy = total = prev_busy = prev_total = NULL;
+}
+
+static esmi_status_t rank_state_init(void)
+{
+	uint32_t threads, i, pos;
+	esmi_status_t ret;
+	int s;
+
+	if (sockets)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_sockets_get(&nsockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_number_of_cpus_get(&ncpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_threads_per_core_get(&threads);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	if (!threads || ncpus < threads)
+		return ESMI_IO_ERROR;
+	nphys = ncpus / threads;
+
+	sockets = calloc(nsockets, sizeof(*sockets));
+	cpus = calloc(ncpus, sizeof(*cpus));
+	order_buf = calloc(ncpus, sizeof(*order_buf));
+	core_power = calloc(nphys, sizeof(*core_power));
+	util = calloc(ncpus, sizeof(*util));
+	energy = calloc(nphys * 3, sizeof(*energy));
+	busy = calloc(ncpus * 4, sizeof(*busy));
+	if (!sockets || !cpus || !order_buf || !core_power || !util || !energy || !busy) {
+		rank_free();
+		return ESMI_NO_MEMORY;
+	}
+	prev_energy = energy + nphys;
+	energy_ns = prev_energy + nphys;
+	total = busy + ncpus;
+	prev_busy = total + ncpus;
+	prev_total = prev_busy + ncpus;
+
+	for (i = 0; i < ncpus; i++) {
+		cpus[i].sock = cpu_socket_get(i);
+		if (cpus[i].sock >= 0 && cpus[i].sock < (int)nsockets)
+			sockets[cpus[i].sock].ncpus++;
+	}
+	for (s = 0, pos = 0; s < (int)nsockets; s++) {
+		sockets[s].order = order_buf + pos;
+		pos += sockets[s].ncpus;
+		sockets[s].ncpus = 0;
+	}
+	for (i = 0; i < ncpus; i++) {
+		s = cpus[i].sock;
+		if (s >= 0 && s < (int)nsockets)
+			sockets[s].order[sockets[s].ncpus++] = i;
+	}
+
+	return ESMI_SUCCESS;
+}
+
+void rank_exit(void)
+{
+	pthread_mutex_lock(&rank_lock);
+	rank_free();
+	nsockets = ncpus = nphys = 0;
+	pthread_mutex_unlock(&rank_lock);
+}
+
+/*
+ * C0 share of the cpus and power of the physical cores of a socket since
+ * its previous update, other sockets keep their own intervals.
+ */
+static esmi_status_t rank_load_update(uint32_t sock_ind)
+{
+	struct rank_socket *rs = &sockets[sock_ind];
+	uint64_t dbusy, dtotal, now;
+	uint32_t i, cpu, core;
+	esmi_status_t ret;
+	int err;
+
+	err = procstat_read(busy, total, ncpus);
+	if (err)
+		return errno_to_esmi_status(err);
+	ret = esmi_all_energies_get(energy);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	now = monotonic_ns();
+
+	for (i = 0; i < rs->ncpus; i++) {
+		cpu = rs->order[i];
+		dbusy = busy[cpu] - prev_busy[cpu];
+		dtotal = total[cpu] - prev_total[cpu];
+		util[cpu] = prev_total[cpu] && dtotal && dbusy <= dtotal ?
+			    (double)dbusy / dtotal : 0;
+		prev_busy[cpu] = busy[cpu];
+		prev_total[cpu] = total[cpu];
+
+		core = cpu % nphys;
+		if (energy_ns[core] == now)
+			continue;
+		core_power[core] = energy_ns[core] && now > energy_ns[core] &&
+				   energy[core] >= prev_energy[core] ?
+				   /* uJ per ns times 1e6 is mW */
+				   (energy[core] - prev_energy[core]) * 1e6 /
+				   (now - energy_ns[core]) : 0;
+		prev_energy[core] = energy[core];
+		energy_ns[core] = now;
+	}
+
+	return ESMI_SUCCESS;
+}
+
+static void rank_score(uint32_t sock_ind)
+{
+	struct rank_socket *rs = &sockets[sock_ind];
+	struct rank_cpu *rc;
+	double max_power = 0, head, load;
+	uint32_t i, j, cpu;
+
+	for (i = 0; i < rs->ncpus; i++)
+		if (core_power[rs->order[i] % nphys] > max_power)
+			max_power = core_power[rs->order[i] % nphys];
+
+	for (i = 0; i < rs->ncpus; i++) {
+		cpu = rs->order[i];
+		rc = &cpus[cpu];
+		/* the siblings of a cpu share its index modulo nphys */
+		rc->sibling_load = 0;
+		for (j = cpu % nphys; j < ncpus; j += nphys)
+			if (j != cpu && util[j] > rc->sibling_load)
+				rc->sibling_load = util[j];
+
+		head = rc->freq < rc->boost ? rc->freq : rc->boost;
+		load = 1 - RANK_SMT_WEIGHT * rc->sibling_load;
+		if (max_power > 0)
+			load *= 1 - RANK_POWER_WEIGHT * core_power[cpu % nphys] / max_power;
+		rc->score = head * load + 0.5;
+	}
+}
+
+/* insertion sort, cheap on the nearly sorted order of the previous update */
+static void rank_sort(struct rank_socket *rs)
+{
+	uint32_t i, j, cpu, score;
+
+	for (i = 1; i < rs->ncpus; i++) {
+		cpu = rs->order[i];
+		score = cpus[cpu].score;
+		for (j = i; j > 0 && cpus[rs->order[j - 1]].score < score; j--)
+			rs->order[j] = rs->order[j - 1];
+		rs->order[j] = cpu;
+	}
+}
+
+esmi_status_t esmi_core_rank_update(uint32_t sock_ind)
+{
+	struct rank_socket *rs;
+	struct rank_cpu *rc;
+	esmi_status_t ret;
+	uint32_t i;
+
+	pthread_mutex_lock(&rank_lock);
+	ret = rank_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	rs = &sockets[sock_ind];
+
+	for (i = 0; i < rs->ncpus; i++) {
+		rc = &cpus[rs->order[i]];
+		ret = esmi_current_freq_limit_core_get(rs->order[i], &rc->freq);
+		if (ret != ESMI_SUCCESS)
+			goto unlock;
+		ret = esmi_core_boostlimit_get(rs->order[i], &rc->boost);
+		if (ret != ESMI_SUCCESS)
+			goto unlock;
+	}
+	ret = rank_load_update(sock_ind);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	rank_score(sock_ind);
+	rank_sort(rs);
+	rs->ranked = true;
+
+unlock:
+	pthread_mutex_unlock(&rank_lock);
+	return ret;
+}
+
+esmi_status_t esmi_core_rank_topk_get(uint32_t sock_ind, uint32_t k, uint32_t *cpu_list,
+				      uint32_t *scores, uint32_t *count)
+{
+	struct rank_socket *rs;
+	esmi_status_t ret;
+	uint32_t i;
+
+	if (!cpu_list || !count)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&rank_lock);
+	ret = rank_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	rs = &sockets[sock_ind];
+	if (!rs->ranked) {
+		ret = ESMI_NO_DATA;
+		goto unlock;
+	}
+	for (i = 0; i < k && i < rs->ncpus; i++) {
+		cpu_list[i] = rs->order[i];
+		if (scores)
+			scores[i] = cpus[rs->order[i]].score;
+	}
+	*count = i;
+
+unlock:
+	pthread_mutex_unlock(&rank_lock);
+	return ret;
+}
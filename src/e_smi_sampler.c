@@ -0,0 +1,640 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Background sampler runtime.
+ *
+ * One thread runs the registered sampling tasks on an absolute
+ * CLOCK_MONOTONIC schedule. Buffers that tasks touch every tick come from a
+ * single mmap arena, which can be hugepage backed, is pre-faulted and is
+ * locked in memory together with the thread stack, so steady state
+ * sampling does not page fault there. The heap state of the getters a
+ * task calls is left to the application to lock, the sampler does not
+ * mlockall() the process. The thread is pinned to a housekeeping cpu of
+ * the sampled socket unless told otherwise and optionally runs as
+ * SCHED_FIFO. How late each tick woke up is kept in a log2 histogram.
+ *
+ * With a CPU budget the thread times every task run on its own thread
+ * CPU clock. Once per budget window the usage of the window is compared
+ * with the budget: over it, the tasks that cost the most are run half as
+ * often until the estimate fits, and once the usage drops below half the
+ * budget the cheapest throttled task gets its rate doubled back, one step
+ * per window so that the rates do not oscillate.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define SAMPLER_STACK_SIZE	(256 * 1024)
+#define SAMPLER_ARENA_ALIGN	64
+#define HUGEPAGE_SIZE		(2 * 1024 * 1024)
+#define CPULIST_SIZE		4096
+#define BUDGET_WINDOW_NS	1000000000ULL
+#define BUDGET_WINDOW_TICKS	8	/* shortest window in ticks */
+
+struct sampler_task {
+	void (*fn)(void *arg);
+	void *arg;
+	uint32_t divider;
+	uint32_t scale;			// budget throttling, runs every divider * scale
+	uint64_t cpu_ns;		// thread CPU time of the current window
+	uint64_t cost_ns;		// thread CPU time of the previous window
+	char name[ESMI_SAMPLER_NAME_LEN];
+};
+
+static struct esmi_sampler_config config = {
+	.period_ns = 1000000,
+	.cpu = -1,
+	.sock_ind = 0,
+	.sched_priority = 0,
+	.lock_memory = true,
+	.hugepages = false,
+	.prefault = true,
+	.arena_size = HUGEPAGE_SIZE,
+};
+
+static pthread_mutex_t sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+/* held by the sampler thread while running tasks */
+static pthread_mutex_t task_lock;
+static pthread_once_t task_lock_once = PTHREAD_ONCE_INIT;
+static struct sampler_task tasks[ESMI_SAMPLER_MAX_TASKS];
+
+static pthread_t thread;
+static int running;
+static int stop_req;
+static int active_cpu = -1;
+
+static void *arena;
+static size_t arena_len, arena_used;
+static void *stack;
+
+static struct esmi_sampler_jitter jitter;
+
+/* budget state, written by the sampler thread under task_lock */
+static uint32_t budget_ppm;
+static uint32_t usage_ppm;
+static uint64_t syscall_rate;
+
+static void task_lock_init(void)
+{
+	pthread_mutexattr_t attr;
+
+	/* a SCHED_FIFO sampler must not be held off by a normal thread */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&task_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void prefault(void *addr, size_t len)
+{
+	volatile char *p = addr;
+	size_t off;
+	long page = sysconf(_SC_PAGESIZE);
+
+	for (off = 0; off < len; off += page)
+		p[off] = 0;
+}
+
+static esmi_status_t arena_create(void)
+{
+	size_t len = config.arena_size;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	if (arena)
+		return ESMI_SUCCESS;
+
+	if (config.hugepages) {
+		len = (len + HUGEPAGE_SIZE - 1) & ~((size_t)HUGEPAGE_SIZE - 1);
+		arena = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			     flags | MAP_HUGETLB, -1, 0);
+		if (arena == MAP_FAILED) {
+			/* no reserved hugepages, ask for transparent ones */
+			arena = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+			if (arena != MAP_FAILED)
+				madvise(arena, len, MADV_HUGEPAGE);
+		}
+	} else {
+		arena = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+	}
+	if (arena == MAP_FAILED) {
+		arena = NULL;
+		return ESMI_NO_MEMORY;
+	}
+	arena_len = len;
+	arena_used = 0;
+	if (config.prefault)
+		prefault(arena, arena_len);
+
+	return ESMI_SUCCESS;
+}
+
+/*
+ * Zeroed memory for buffers touched by sampling tasks. It is released by
+ * esmi_exit() only.
+ */
+void *sampler_arena_alloc(size_t size)
+{
+	void *p = NULL;
+
+	pthread_mutex_lock(&sampler_lock);
+	if (arena_create() == ESMI_SUCCESS) {
+		size = (size + SAMPLER_ARENA_ALIGN - 1) & ~((size_t)SAMPLER_ARENA_ALIGN - 1);
+		if (size <= arena_len - arena_used) {
+			p = (char *)arena + arena_used;
+			arena_used += size;
+		}
+	}
+	pthread_mutex_unlock(&sampler_lock);
+
+	return p;
+}
+
+/*
+ * The first cpu of the socket which is neither isolated nor nohz_full,
+ * those are kept free for latency sensitive work.
+ */
+static int housekeeping_cpu(uint32_t sock_ind)
+{
+	static const char *files[] = {
+		CPU_SYS_PATH "/isolated",
+		CPU_SYS_PATH "/nohz_full",
+	};
+	uint8_t *excl = NULL, *mask = NULL;
+	char buf[CPULIST_SIZE];
+	uint32_t ncpus, cpu;
+	int i, ret = -1;
+
+	if (esmi_number_of_cpus_get(&ncpus) != ESMI_SUCCESS)
+		return -1;
+	excl = calloc(ncpus, 1);
+	mask = calloc(ncpus, 1);
+	if (!excl || !mask)
+		goto out;
+	for (i = 0; i < ARRAY_SIZE(files); i++) {
+		if (readsys_str((char *)files[i], buf, sizeof(buf)) ||
+		    parse_cpulist(buf, mask, ncpus) <= 0)
+			continue;
+		for (cpu = 0; cpu < ncpus; cpu++)
+			excl[cpu] |= mask[cpu];
+	}
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		if (!excl[cpu] && cpu_socket_get(cpu) == (int)sock_ind) {
+			ret = cpu;
+			break;
+		}
+	}
+out:
+	free(excl);
+	free(mask);
+	return ret;
+}
+
+static void jitter_record(uint64_t late_ns, uint64_t missed)
+{
+	uint64_t us = late_ns / 1000;
+	int bucket = 0;
+
+	while (us && bucket < ESMI_SAMPLER_HIST_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	__atomic_add_fetch(&jitter.ticks, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&jitter.hist[bucket], 1, __ATOMIC_RELAXED);
+	if (missed)
+		__atomic_add_fetch(&jitter.deadline_misses, missed, __ATOMIC_RELAXED);
+	if (late_ns > __atomic_load_n(&jitter.max_lateness_ns, __ATOMIC_RELAXED))
+		__atomic_store_n(&jitter.max_lateness_ns, late_ns, __ATOMIC_RELAXED);
+}
+
+static void ts_add_ns(struct timespec *ts, uint64_t ns)
+{
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / 1000000000ULL;
+	ts->tv_nsec = ns % 1000000000ULL;
+}
+
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Called with task_lock held at the end of a budget window. A task run
+ * every divider * scale ticks is expected to cost half as much per window
+ * after its scale doubles and twice as much after it halves.
+ */
+static void budget_adjust(uint64_t cpu_ns, uint64_t wall_ns)
+{
+	uint64_t est, best;
+	int i, pick;
+
+	usage_ppm = cpu_ns * 1000000 / wall_ns;
+	for (i = 0; i < ESMI_SAMPLER_MAX_TASKS; i++) {
+		tasks[i].cost_ns = tasks[i].cpu_ns;
+		tasks[i].cpu_ns = 0;
+	}
+	if (!budget_ppm)
+		return;
+
+	if (usage_ppm > budget_ppm) {
+		/* throttle the most expensive tasks until the estimate fits */
+		est = cpu_ns;
+		while (est * 1000000 / wall_ns > budget_ppm) {
+			pick = -1;
+			best = 0;
+			for (i = 0; i < ESMI_SAMPLER_MAX_TASKS; i++)
+				if (tasks[i].fn && tasks[i].scale < ESMI_SAMPLER_MAX_SCALE &&
+				    tasks[i].cost_ns > best) {
+					best = tasks[i].cost_ns;
+					pick = i;
+				}
+			if (pick < 0)
+				break;
+			tasks[pick].scale *= 2;
+			tasks[pick].cost_ns /= 2;
+			est -= tasks[pick].cost_ns;
+		}
+	} else if (usage_ppm < budget_ppm / 2) {
+		/* restore the cheapest throttled task if it still fits */
+		pick = -1;
+		best = UINT64_MAX;
+		for (i = 0; i < ESMI_SAMPLER_MAX_TASKS; i++)
+			if (tasks[i].fn && tasks[i].scale > 1 && tasks[i].cost_ns < best) {
+				best = tasks[i].cost_ns;
+				pick = i;
+			}
+		if (pick >= 0 && (cpu_ns + best) * 1000000 / wall_ns <= budget_ppm * 3 / 4)
+			tasks[pick].scale /= 2;
+	}
+}
+
+static void *sampler_main(void *arg)
+{
+	uint64_t period = config.period_ns, tick = 0, deadline, now, missed;
+	uint64_t window, win_start, win_cpu, win_calls, t0, t1, calls;
+	struct timespec next;
+	int i;
+
+	(void)arg;
+	window = BUDGET_WINDOW_NS > BUDGET_WINDOW_TICKS * period ?
+		 BUDGET_WINDOW_NS : BUDGET_WINDOW_TICKS * period;
+	win_start = monotonic_ns();
+	win_cpu = thread_cpu_ns();
+	win_calls = lib_syscalls;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!__atomic_load_n(&stop_req, __ATOMIC_ACQUIRE)) {
+		ts_add_ns(&next, period);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+			;
+		now = monotonic_ns();
+		deadline = next.tv_sec * 1000000000ULL + next.tv_nsec;
+		missed = 0;
+		if (now > deadline) {
+			/* skip the ticks that were missed instead of bursting */
+			missed = (now - deadline) / period;
+			ts_add_ns(&next, missed * period);
+		}
+		jitter_record(now > deadline ? now - deadline : 0, missed);
+
+		pthread_mutex_lock(&task_lock);
+		t0 = budget_ppm ? thread_cpu_ns() : 0;
+		for (i = 0; i < ESMI_SAMPLER_MAX_TASKS; i++) {
+			if (!tasks[i].fn || tick % ((uint64_t)tasks[i].divider * tasks[i].scale))
+				continue;
+			tasks[i].fn(tasks[i].arg);
+			if (budget_ppm) {
+				t1 = thread_cpu_ns();
+				tasks[i].cpu_ns += t1 - t0;
+				t0 = t1;
+			}
+		}
+		if (now - win_start >= window) {
+			t1 = thread_cpu_ns();
+			calls = lib_syscalls;
+			budget_adjust(t1 - win_cpu, now - win_start);
+			syscall_rate = (calls - win_calls) * 1000000000ULL / (now - win_start);
+			win_start = now;
+			win_cpu = t1;
+			win_calls = calls;
+		}
+		pthread_mutex_unlock(&task_lock);
+		tick += 1 + missed;
+	}
+	return NULL;
+}
+
+esmi_status_t esmi_sampler_config_set(const struct esmi_sampler_config *cfg)
+{
+	esmi_status_t ret = ESMI_SUCCESS;
+
+	if (!cfg)
+		return ESMI_ARG_PTR_NULL;
+	if (!cfg->period_ns || !cfg->arena_size ||
+	    cfg->sched_priority < 0 ||
+	    cfg->sched_priority > sched_get_priority_max(SCHED_FIFO))
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&sampler_lock);
+	if (running)
+		ret = ESMI_DEV_BUSY;
+	else if (arena && (cfg->hugepages != config.hugepages ||
+			   cfg->arena_size != config.arena_size))
+		/* buffers were handed out already, the arena stays */
+		ret = ESMI_DEV_BUSY;
+	else
+		config = *cfg;
+	pthread_mutex_unlock(&sampler_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_sampler_config_get(struct esmi_sampler_config *cfg)
+{
+	if (!cfg)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&sampler_lock);
+	*cfg = config;
+	if (running)
+		cfg->cpu = active_cpu;
+	pthread_mutex_unlock(&sampler_lock);
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_sampler_task_add(void (*fn)(void *arg), void *arg,
+				    uint32_t divider, uint32_t *task_id)
+{
+	esmi_status_t ret = ESMI_NO_MEMORY;
+	int i;
+
+	if (!fn || !task_id)
+		return ESMI_ARG_PTR_NULL;
+	if (!divider)
+		return ESMI_INVALID_INPUT;
+
+	pthread_once(&task_lock_once, task_lock_init);
+	pthread_mutex_lock(&task_lock);
+	for (i = 0; i < ESMI_SAMPLER_MAX_TASKS; i++) {
+		if (!tasks[i].fn) {
+			memset(&tasks[i], 0, sizeof(tasks[i]));
+			tasks[i].arg = arg;
+			tasks[i].divider = divider;
+			tasks[i].scale = 1;
+			tasks[i].fn = fn;
+			*task_id = i;
+			ret = ESMI_SUCCESS;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&task_lock);
+
+	return ret;
+}
+
+/* once this returns the task is not running and will not run again */
+esmi_status_t esmi_sampler_task_remove(uint32_t task_id)
+{
+	if (task_id >= ESMI_SAMPLER_MAX_TASKS)
+		return ESMI_INVALID_INPUT;
+
+	pthread_once(&task_lock_once, task_lock_init);
+	pthread_mutex_lock(&task_lock);
+	memset(&tasks[task_id], 0, sizeof(tasks[task_id]));
+	pthread_mutex_unlock(&task_lock);
+
+	return ESMI_SUCCESS;
+}
+
+void sampler_task_name_set(uint32_t task_id, const char *name)
+{
+	if (task_id >= ESMI_SAMPLER_MAX_TASKS)
+		return;
+
+	pthread_once(&task_lock_once, task_lock_init);
+	pthread_mutex_lock(&task_lock);
+	snprintf(tasks[task_id].name, sizeof(tasks[task_id].name), "%s", name);
+	pthread_mutex_unlock(&task_lock);
+}
+
+esmi_status_t esmi_sampler_budget_set(uint32_t ppm)
+{
+	int i;
+
+	if (ppm > 1000000)
+		return ESMI_INVALID_INPUT;
+
+	pthread_once(&task_lock_once, task_lock_init);
+	pthread_mutex_lock(&task_lock);
+	budget_ppm = ppm;
+	if (!ppm)
+		for (i = 0; i < ESMI_SAMPLER_MAX_TASKS; i++)
+			if (tasks[i].fn)
+				tasks[i].scale = 1;
+	pthread_mutex_unlock(&task_lock);
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_sampler_usage_get(struct esmi_sampler_usage *usage)
+{
+	int i;
+
+	if (!usage)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_once(&task_lock_once, task_lock_init);
+	pthread_mutex_lock(&task_lock);
+	usage->budget_ppm = budget_ppm;
+	usage->usage_ppm = usage_ppm;
+	usage->syscalls_per_s = syscall_rate;
+	usage->throttled = 0;
+	for (i = 0; i < ESMI_SAMPLER_MAX_TASKS; i++)
+		if (tasks[i].fn && tasks[i].scale > 1)
+			usage->throttled++;
+	pthread_mutex_unlock(&task_lock);
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_sampler_rates_get(struct esmi_sampler_rate *rates, uint32_t max,
+				     uint32_t *count)
+{
+	uint64_t period;
+	uint32_t n = 0;
+	int i;
+
+	if (!rates || !count)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&sampler_lock);
+	period = config.period_ns;
+	pthread_mutex_unlock(&sampler_lock);
+
+	pthread_once(&task_lock_once, task_lock_init);
+	pthread_mutex_lock(&task_lock);
+	for (i = 0; i < ESMI_SAMPLER_MAX_TASKS && n < max; i++) {
+		if (!tasks[i].fn)
+			continue;
+		memcpy(rates[n].name, tasks[i].name, sizeof(rates[n].name));
+		rates[n].task_id = i;
+		rates[n].divider = tasks[i].divider;
+		rates[n].scale = tasks[i].scale;
+		rates[n].period_ns = period * tasks[i].divider * tasks[i].scale;
+		rates[n].cost_ns = tasks[i].cost_ns;
+		n++;
+	}
+	pthread_mutex_unlock(&task_lock);
+	*count = n;
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_sampler_start(void)
+{
+	struct sched_param param = { 0 };
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	esmi_status_t ret;
+	int err;
+
+	pthread_once(&task_lock_once, task_lock_init);
+	pthread_mutex_lock(&sampler_lock);
+	if (running) {
+		pthread_mutex_unlock(&sampler_lock);
+		return ESMI_SUCCESS;
+	}
+
+	ret = arena_create();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (!stack) {
+		stack = mmap(NULL, SAMPLER_STACK_SIZE, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if (stack == MAP_FAILED) {
+			stack = NULL;
+			ret = ESMI_NO_MEMORY;
+			goto unlock;
+		}
+		if (config.prefault)
+			prefault(stack, SAMPLER_STACK_SIZE);
+	}
+	if (config.lock_memory) {
+		if (mlock(arena, arena_len) || mlock(stack, SAMPLER_STACK_SIZE)) {
+			ret = errno_to_esmi_status(errno);
+			goto unlock;
+		}
+	}
+
+	active_cpu = config.cpu >= 0 ? config.cpu : housekeeping_cpu(config.sock_ind);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, stack, SAMPLER_STACK_SIZE);
+	if (active_cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(active_cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+	if (config.sched_priority > 0) {
+		param.sched_priority = config.sched_priority;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	__atomic_store_n(&stop_req, 0, __ATOMIC_RELEASE);
+	err = pthread_create(&thread, &attr, sampler_main, NULL);
+	pthread_attr_destroy(&attr);
+	if (err) {
+		ret = errno_to_esmi_status(err);
+		goto unlock;
+	}
+	running = 1;
+
+unlock:
+	pthread_mutex_unlock(&sampler_lock);
+	return ret;
+}
+
+esmi_status_t esmi_sampler_stop(void)
+{
+	pthread_mutex_lock(&sampler_lock);
+	if (running) {
+		__atomic_store_n(&stop_req, 1, __ATOMIC_RELEASE);
+		pthread_join(thread, NULL);
+		running = 0;
+	}
+	pthread_mutex_unlock(&sampler_lock);
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_sampler_jitter_get(struct esmi_sampler_jitter *stats)
+{
+	int i;
+
+	if (!stats)
+		return ESMI_ARG_PTR_NULL;
+
+	stats->ticks = __atomic_load_n(&jitter.ticks, __ATOMIC_RELAXED);
+	stats->deadline_misses = __atomic_load_n(&jitter.deadline_misses, __ATOMIC_RELAXED);
+	stats->max_lateness_ns = __atomic_load_n(&jitter.max_lateness_ns, __ATOMIC_RELAXED);
+	for (i = 0; i < ESMI_SAMPLER_HIST_BUCKETS; i++)
+		stats->hist[i] = __atomic_load_n(&jitter.hist[i], __ATOMIC_RELAXED);
+
+	return ESMI_SUCCESS;
+}
+
+void esmi_sampler_jitter_reset(void)
+{
+	int i;
+
+	__atomic_store_n(&jitter.ticks, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&jitter.deadline_misses, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&jitter.max_lateness_ns, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < ESMI_SAMPLER_HIST_BUCKETS; i++)
+		__atomic_store_n(&jitter.hist[i], 0, __ATOMIC_RELAXED);
+}
+
+void sampler_exit(void)
+{
+	esmi_sampler_stop();
+
+	pthread_once(&task_lock_once, task_lock_init);
+	pthread_mutex_lock(&task_lock);
+	memset(tasks, 0, sizeof(tasks));
+	budget_ppm = usage_ppm = 0;
+	syscall_rate = 0;
+	pthread_mutex_unlock(&task_lock);
+
+	pthread_mutex_lock(&sampler_lock);
+	if (arena)
+		munmap(arena, arena_len);
+	if (stack)
+		munmap(stack, SAMPLER_STACK_SIZE);
+	arena = NULL;
+	stack = NULL;
+	arena_len = arena_used = 0;
+	pthread_mutex_unlock(&sampler_lock);
+	esmi_sampler_jitter_reset();
+}
@@ -0,0 +1,249 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Adaptive core energy sweep.
+ *
+ * A sweep first reads the per cpu busy times of /proc/stat, one pread on a
+ * cached fd, and calls a physical core busy when any of its SMT siblings
+ * was busy for at least the idle threshold since the previous sweep. Busy
+ * cores are read every sweep, idle ones every max_skip sweeps. The energy
+ * of a core not read is extrapolated from the power of its last real
+ * interval. The next real read replaces the extrapolation, the difference
+ * is the correction. Reported energy never goes backwards: a real reading
+ * below the extrapolation holds the reported value until the counter
+ * passes it.
+ *
+ * The error bound of a sweep is the sum, over the extrapolated cores, of
+ * the worst correction rate seen on the core times the time since its
+ * last read. Before a core has been corrected once, its rate is taken as
+ * its own power, i.e. the extrapolation may be off by 100%.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define SWEEP_DEFAULT_IDLE_PCT	5
+#define SWEEP_DEFAULT_MAX_SKIP	8
+
+struct sweep_core {
+	uint64_t energy;		// last real reading, uJ
+	uint64_t read_ns;		// time of the last real reading, 0 before
+	uint64_t reported;		// last reported energy, uJ
+	double power;			// mW over the last real interval
+	double err_rate;		// worst correction per time, mW
+	uint32_t skipped;		// sweeps since the last real reading
+	bool corrected;			// err_rate was measured
+};
+
+static pthread_mutex_t sweep_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sweep_core *cores;
+static uint64_t *busy, *total, *prev_busy, *prev_total;
+static bool *core_busy;
+static uint32_t ncpus, nphys;
+static uint32_t idle_pct = SWEEP_DEFAULT_IDLE_PCT;
+static uint32_t max_skip = SWEEP_DEFAULT_MAX_SKIP;
+static struct esmi_energy_sweep_stats stats;
+
+static void sweep_free(void)
+{
+	free(cores);
+	free(busy);
+	free(core_busy);
+	cores = NULL;
+	busy = total = prev_busy = prev_total = NULL;
+	core_busy = NULL;
+}
+
+static esmi_status_t sweep_state_init(void)
+{
+	uint32_t threads;
+	esmi_status_t ret;
+
+	if (cores)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_cpus_get(&ncpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_threads_per_core_get(&threads);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	if (!threads || ncpus < threads)
+		return ESMI_IO_ERROR;
+	nphys = ncpus / threads;
+
+	cores = calloc(nphys, sizeof(*cores));
+	busy = calloc(ncpus * 4, sizeof(*busy));
+	core_busy = calloc(nphys, sizeof(*core_busy));
+	if (!cores || !busy || !core_busy) {
+		sweep_free();
+		return ESMI_NO_MEMORY;
+	}
+	total = busy + ncpus;
+	prev_busy = total + ncpus;
+	prev_total = prev_busy + ncpus;
+	memset(&stats, 0, sizeof(stats));
+
+	return ESMI_SUCCESS;
+}
+
+void sweep_exit(void)
+{
+	pthread_mutex_lock(&sweep_lock);
+	sweep_free();
+	ncpus = nphys = 0;
+	memset(&stats, 0, sizeof(stats));
+	pthread_mutex_unlock(&sweep_lock);
+}
+
+/*
+ * A core is busy if a sibling was busy for idle_pct of the interval. An
+ * interval shorter than a USER_HZ tick leaves the previous verdict.
+ */
+static void sweep_classify(void)
+{
+	uint64_t dbusy, dtotal;
+	uint32_t cpu, core;
+	bool known, hot;
+
+	if (procstat_read(busy, total, ncpus)) {
+		/* without idle times every core is read */
+		memset(core_busy, 1, nphys * sizeof(*core_busy));
+		return;
+	}
+	for (core = 0; core < nphys; core++) {
+		known = hot = false;
+		for (cpu = core; cpu < ncpus && !hot; cpu += nphys) {
+			dbusy = busy[cpu] - prev_busy[cpu];
+			dtotal = total[cpu] - prev_total[cpu];
+			if (!prev_total[cpu] || dbusy > dtotal) {
+				known = hot = true;
+			} else if (dtotal) {
+				known = true;
+				hot = dbusy * 100 >= dtotal * idle_pct;
+			}
+		}
+		if (known)
+			core_busy[core] = hot;
+	}
+	memcpy(prev_busy, busy, ncpus * sizeof(*busy));
+	memcpy(prev_total, total, ncpus * sizeof(*total));
+}
+
+static esmi_status_t sweep_read(struct sweep_core *sc, uint32_t core, uint64_t now)
+{
+	uint64_t energy, guess, err;
+	esmi_status_t ret;
+	double dt;
+
+	ret = esmi_core_energy_get(core, &energy);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	stats.reads++;
+
+	if (sc->read_ns && now > sc->read_ns && energy >= sc->energy) {
+		dt = now - sc->read_ns;
+		if (sc->skipped) {
+			guess = sc->energy + sc->power * dt / 1e6;
+			err = guess > energy ? guess - energy : energy - guess;
+			if (err > stats.max_correction)
+				stats.max_correction = err;
+			/* uJ per ns times 1e6 is mW */
+			if (!sc->corrected || err * 1e6 / dt > sc->err_rate)
+				sc->err_rate = err * 1e6 / dt;
+			sc->corrected = true;
+		}
+		sc->power = (energy - sc->energy) * 1e6 / dt;
+	}
+	sc->energy = energy;
+	sc->read_ns = now;
+	sc->skipped = 0;
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_energy_sweep_get(uint64_t *penergy)
+{
+	struct sweep_core *sc;
+	double bound = 0, rate;
+	esmi_status_t ret;
+	uint64_t now, val;
+	uint32_t core;
+
+	if (!penergy)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&sweep_lock);
+	ret = sweep_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	sweep_classify();
+	now = monotonic_ns();
+	for (core = 0; core < nphys; core++) {
+		sc = &cores[core];
+		if (!sc->read_ns || core_busy[core] || sc->skipped + 1 >= max_skip) {
+			ret = sweep_read(sc, core, now);
+			if (ret != ESMI_SUCCESS)
+				goto unlock;
+			val = sc->energy;
+		} else {
+			sc->skipped++;
+			stats.skipped++;
+			val = sc->energy + sc->power * (now - sc->read_ns) / 1e6;
+			rate = sc->corrected ? sc->err_rate : sc->power;
+			bound += rate * (now - sc->read_ns) / 1e6;
+		}
+		/* never report less than before */
+		if (val < sc->reported)
+			val = sc->reported;
+		sc->reported = val;
+		penergy[core] = val;
+	}
+	stats.sweeps++;
+	stats.error_bound = bound + 0.5;
+
+unlock:
+	pthread_mutex_unlock(&sweep_lock);
+	return ret;
+}
+
+esmi_status_t esmi_energy_sweep_config_set(uint32_t idle_threshold_pct,
+					   uint32_t max_skip_sweeps)
+{
+	if (idle_threshold_pct > 100 || !max_skip_sweeps)
+		return ESMI_INVALID_INPUT;
+
+	pthread_mutex_lock(&sweep_lock);
+	idle_pct = idle_threshold_pct;
+	max_skip = max_skip_sweeps;
+	pthread_mutex_unlock(&sweep_lock);
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_energy_sweep_stats_get(struct esmi_energy_sweep_stats *st)
+{
+	if (!st)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&sweep_lock);
+	*st = stats;
+	st->cores = nphys;
+	st->reduction_ppm = stats.reads + stats.skipped ?
+			    stats.skipped * 1000000 / (stats.reads + stats.skipped) : 0;
+	pthread_mutex_unlock(&sweep_lock);
+
+	return ESMI_SUCCESS;
+}
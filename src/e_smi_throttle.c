@@ -0,0 +1,335 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Time to throttle predictor.
+ *
+ * Per socket a short window of power samples gives a linear power trend.
+ * The fit is done on deviations from the window means when a prediction
+ * is asked for: running sums of absolute times would lose the few s^2 of
+ * variance of a window against t^2 after days of uptime. The temperature
+ * follows a first order RC model dT/dt = a * P + b * T + c fitted by
+ * recursive least squares on consecutive samples. A prediction
+ * extrapolates the power trend, clipped at the power cap, and integrates
+ * the thermal model until the temperature limit is reached.
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define TTT_WINDOW		32	/* power samples in the trend window */
+#define TTT_HORIZON		600.0	/* seconds looked ahead */
+#define TTT_STEP		0.5	/* integration step in seconds */
+#define TTT_FORGET		0.98	/* RLS forgetting factor */
+#define TTT_ERR_WEIGHT		0.1	/* weight of a new error in the averages */
+#define TTT_MIN_THERMAL		8	/* model fits before thermal predictions */
+#define TTT_DEFAULT_LIMIT	95000	/* milli degree C */
+
+struct ttt_socket {
+	/* power trend window, t in seconds since the first sample, P in W */
+	double t[TTT_WINDOW];
+	double p[TTT_WINDOW];
+	uint32_t head, count;
+	uint64_t t0_ns;
+
+	/* thermal model, T in degree C */
+	double theta[3];
+	double cov[3][3];
+	double err_var, y_mean, y_var;
+	uint32_t nfits;
+	double last_t, last_temp, last_power;
+
+	double cap;			// power cap in W
+	uint32_t temp_limit;		// milli degree C
+	uint32_t prochot;
+	uint32_t nsamples;
+};
+
+static pthread_mutex_t ttt_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ttt_socket *sockets;
+static uint32_t nsockets;
+
+static void ttt_reset(struct ttt_socket *ts, uint32_t temp_limit)
+{
+	memset(ts, 0, sizeof(*ts));
+	ts->cov[0][0] = ts->cov[1][1] = ts->cov[2][2] = 1e3;
+	ts->temp_limit = temp_limit;
+}
+
+static esmi_status_t ttt_state_init(void)
+{
+	esmi_status_t ret;
+	uint32_t i;
+
+	if (sockets)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_sockets_get(&nsockets);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	sockets = calloc(nsockets, sizeof(*sockets));
+	if (!sockets)
+		return ESMI_NO_MEMORY;
+	for (i = 0; i < nsockets; i++)
+		ttt_reset(&sockets[i], TTT_DEFAULT_LIMIT);
+
+	return ESMI_SUCCESS;
+}
+
+void throttle_exit(void)
+{
+	pthread_mutex_lock(&ttt_lock);
+	free(sockets);
+	sockets = NULL;
+	nsockets = 0;
+	pthread_mutex_unlock(&ttt_lock);
+}
+
+static void ttt_trend_add(struct ttt_socket *ts, double t, double p)
+{
+	if (ts->count < TTT_WINDOW)
+		ts->count++;
+	ts->t[ts->head] = t;
+	ts->p[ts->head] = p;
+	ts->head = (ts->head + 1) % TTT_WINDOW;
+}
+
+/* least squares power trend, returns the R^2 of the fit */
+static double ttt_trend(struct ttt_socket *ts, double now, double *power,
+			double *slope)
+{
+	double n = ts->count, mt = 0, mp = 0, dt, dp, dtt = 0, dtp = 0, dpp = 0;
+	uint32_t i;
+
+	for (i = 0; i < ts->count; i++) {
+		mt += ts->t[i];
+		mp += ts->p[i];
+	}
+	mt /= n;
+	mp /= n;
+	*power = mp;
+	*slope = 0;
+	if (ts->count < 3)
+		return 0;
+
+	for (i = 0; i < ts->count; i++) {
+		dt = ts->t[i] - mt;
+		dp = ts->p[i] - mp;
+		dtt += dt * dt;
+		dtp += dt * dp;
+		dpp += dp * dp;
+	}
+	if (dtt <= 0)
+		return 0;
+	*slope = dtp / dtt;
+	*power = mp + *slope * (now - mt);
+	if (dpp <= 0)
+		return 1;
+
+	return fmin(1, dtp * dtp / (dtt * dpp));
+}
+
+static void ttt_thermal_fit(struct ttt_socket *ts, double power, double temp,
+			    double y)
+{
+	double x[3] = { power, temp, 1.0 };
+	double px[3], k[3], denom = TTT_FORGET, err = y;
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		px[i] = 0;
+		for (j = 0; j < 3; j++)
+			px[i] += ts->cov[i][j] * x[j];
+		denom += x[i] * px[i];
+		err -= ts->theta[i] * x[i];
+	}
+	for (i = 0; i < 3; i++) {
+		k[i] = px[i] / denom;
+		ts->theta[i] += k[i] * err;
+	}
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 3; j++)
+			ts->cov[i][j] = (ts->cov[i][j] - k[i] * px[j]) / TTT_FORGET;
+
+	ts->err_var += TTT_ERR_WEIGHT * (err * err - ts->err_var);
+	ts->y_mean += TTT_ERR_WEIGHT * (y - ts->y_mean);
+	ts->y_var += TTT_ERR_WEIGHT * ((y - ts->y_mean) * (y - ts->y_mean) - ts->y_var);
+	ts->nfits++;
+}
+
+esmi_status_t esmi_throttle_sample(uint32_t sock_ind)
+{
+	uint32_t power, cap, tmon, prochot;
+	struct ttt_socket *ts;
+	esmi_status_t ret;
+	double t, p, temp;
+	uint64_t now;
+
+	pthread_mutex_lock(&ttt_lock);
+	ret = ttt_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	ts = &sockets[sock_ind];
+
+	ret = esmi_socket_power_get(sock_ind, &power);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	ret = esmi_socket_power_cap_get(sock_ind, &cap);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	ret = esmi_socket_temperature_get(sock_ind, &tmon);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	ret = esmi_prochot_status_get(sock_ind, &prochot);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	now = monotonic_ns();
+
+	if (!ts->nsamples)
+		ts->t0_ns = now;
+	t = (now - ts->t0_ns) / 1e9;
+	p = power / 1000.0;
+	temp = tmon / 1000.0;
+
+	ttt_trend_add(ts, t, p);
+	if (ts->nsamples && t > ts->last_t)
+		ttt_thermal_fit(ts, ts->last_power, ts->last_temp,
+				(temp - ts->last_temp) / (t - ts->last_t));
+	ts->last_t = t;
+	ts->last_temp = temp;
+	ts->last_power = p;
+	ts->cap = cap / 1000.0;
+	ts->prochot = prochot;
+	ts->nsamples++;
+
+unlock:
+	pthread_mutex_unlock(&ttt_lock);
+	return ret;
+}
+
+esmi_status_t esmi_throttle_temp_limit_set(uint32_t sock_ind, uint32_t temp_limit)
+{
+	esmi_status_t ret;
+
+	pthread_mutex_lock(&ttt_lock);
+	ret = ttt_state_init();
+	if (ret == ESMI_SUCCESS) {
+		if (sock_ind >= nsockets || !temp_limit)
+			ret = ESMI_INVALID_INPUT;
+		else
+			sockets[sock_ind].temp_limit = temp_limit;
+	}
+	pthread_mutex_unlock(&ttt_lock);
+
+	return ret;
+}
+
+/*
+ * Integrate the thermal model under the extrapolated power, clipped at
+ * the power cap. Returns the time the limit is reached or INFINITY.
+ */
+static float ttt_thermal_time(struct ttt_socket *ts, double power, double slope)
+{
+	double limit = ts->temp_limit / 1000.0;
+	double temp = ts->last_temp, t, p;
+
+	if (temp >= limit)
+		return 0;
+	for (t = 0; t < TTT_HORIZON; t += TTT_STEP) {
+		p = fmin(fmax(power + slope * t, 0), ts->cap);
+		temp += TTT_STEP * (ts->theta[0] * p + ts->theta[1] * temp +
+				    ts->theta[2]);
+		if (temp >= limit)
+			return t + TTT_STEP;
+	}
+
+	return INFINITY;
+}
+
+esmi_status_t esmi_time_to_throttle_get(uint32_t sock_ind, float *ptime,
+					float *pconfidence, esmi_throttle_t *pcause)
+{
+	double now, power, slope, r2, fill, fit;
+	float t_power = INFINITY, t_thermal = INFINITY;
+	float c_power, c_thermal;
+	struct ttt_socket *ts;
+	esmi_status_t ret;
+
+	if (!ptime || !pconfidence || !pcause)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&ttt_lock);
+	ret = ttt_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (sock_ind >= nsockets) {
+		ret = ESMI_INVALID_INPUT;
+		goto unlock;
+	}
+	ts = &sockets[sock_ind];
+	if (!ts->nsamples) {
+		ret = ESMI_NO_DATA;
+		goto unlock;
+	}
+
+	/* PROCHOT asserted means the socket is throttling already */
+	if (ts->prochot) {
+		*ptime = 0;
+		*pconfidence = 1;
+		*pcause = ESMI_THROTTLE_THERMAL;
+		goto unlock;
+	}
+
+	now = ts->last_t;
+	fill = (double)ts->count / TTT_WINDOW;
+	r2 = ttt_trend(ts, now, &power, &slope);
+	if (ts->cap > 0 && ts->last_power >= ts->cap)
+		t_power = 0;
+	else if (ts->cap > 0 && slope > 0)
+		t_power = fmax(0, (ts->cap - power) / slope);
+	if (t_power > TTT_HORIZON)
+		t_power = INFINITY;
+	c_power = t_power == 0 ? 1 : fill * r2;
+
+	c_thermal = 0;
+	if (ts->nfits >= TTT_MIN_THERMAL && ts->theta[1] < 0) {
+		t_thermal = ttt_thermal_time(ts, power, slope);
+		fit = ts->y_var > 0 ? 1 - ts->err_var / ts->y_var : 0;
+		c_thermal = fmin(1, ts->nfits / (double)TTT_WINDOW) * fmax(0, fit);
+	} else if (ts->last_temp >= ts->temp_limit / 1000.0) {
+		t_thermal = 0;
+		c_thermal = 1;
+	}
+
+	if (isinf(t_power) && isinf(t_thermal)) {
+		*ptime = INFINITY;
+		*pconfidence = fmax(c_power, c_thermal);
+		*pcause = ESMI_THROTTLE_NONE;
+	} else if (t_power <= t_thermal) {
+		*ptime = t_power;
+		*pconfidence = c_power;
+		*pcause = ESMI_THROTTLE_POWER;
+	} else {
+		*ptime = t_thermal;
+		*pconfidence = c_thermal;
+		*pcause = ESMI_THROTTLE_THERMAL;
+	}
+
+unlock:
+	pthread_mutex_unlock(&ttt_lock);
+	return ret;
+}
@@ -0,0 +1,521 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Turbo budget planner.
+ *
+ * Each physical core has a power model P(f) = a + b * u * f^3 (f in GHz,
+ * P in mW, u the share of the interval the core was in C0), fitted by
+ * recursive least squares from core energy deltas and the effective
+ * frequency and C0 share that the APERF and MPERF counters of the core's
+ * cpus give over the same interval. The frequency limit mostly stays put,
+ * a fit against it would not see the f^3 term. Without an MSR driver the
+ * limit is used with u = 1, and in both cases a socket is only planned
+ * once the covariance of b has shrunk, i.e. f^3 varied enough to be told
+ * apart from the static power. Predictions use the last C0 share.
+ *
+ * Given a socket power target the planner hands out frequency in fixed
+ * steps, always to the core with the highest weight per extra milliwatt.
+ * With a convex model this greedy order is optimal, and starting from the
+ * previous plan only the steps that moved since the last call have to be
+ * traded.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+#include <e_smi/e_smi_utils.h>
+
+#define TURBO_FREQ_STEP		100	/* MHz */
+#define TURBO_FORGET		0.95	/* RLS forgetting factor */
+#define TURBO_MIN_COEFF		1e-3	/* keep the model strictly convex */
+#define TURBO_MIN_INTERVAL_NS	1000000ULL
+#define TURBO_MIN_BUSY		0.01	/* C0 share floor of the predictions */
+#define TURBO_EXCITED_COV	0.01	/* cov of b below which f^3 was excited */
+
+struct turbo_core {
+	int sock;
+	uint32_t weight;
+	uint32_t plan;			// planned boostlimit in MHz, 0 if none
+	uint64_t energy;		// last energy sample in uJ
+	uint64_t time_ns;		// time of the last energy sample
+	uint64_t tsc, tsc_ns;		// stamp of the last APERF/MPERF read
+	double busy;			// C0 share of the last interval
+	uint32_t nsamples;
+	double theta[2];		// static power, dynamic coefficient
+	double cov[2][2];
+};
+
+static pthread_mutex_t turbo_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct turbo_core *cores;
+static uint32_t *limits;
+static struct msr_batch_op *ops;		// MPERF, APERF per cpu, NULL
+						// without an MSR driver
+static uint64_t *prev_mperf, *prev_aperf;	// per cpu
+static monitor_types_t msr_type;
+static uint32_t nphys;
+static uint32_t ncpus;
+
+static void turbo_free(void)
+{
+	free(cores);
+	free(limits);
+	free(ops);
+	free(prev_mperf);
+	cores = NULL;
+	limits = NULL;
+	ops = NULL;
+	prev_mperf = prev_aperf = NULL;
+}
+
+static esmi_status_t turbo_state_init(void)
+{
+	uint32_t threads, i;
+	esmi_status_t ret;
+
+	if (cores)
+		return ESMI_SUCCESS;
+
+	ret = esmi_number_of_cpus_get(&ncpus);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	ret = esmi_threads_per_core_get(&threads);
+	if (ret != ESMI_SUCCESS)
+		return ret;
+	if (!threads || ncpus < threads)
+		return ESMI_IO_ERROR;
+	nphys = ncpus / threads;
+
+	cores = calloc(nphys, sizeof(*cores));
+	limits = calloc(ncpus, sizeof(*limits));
+	if (!cores || !limits) {
+		turbo_free();
+		return ESMI_NO_MEMORY;
+	}
+	if (!find_msr_safe() || !find_msr()) {
+		msr_type = !find_msr_safe() ? MSR_SAFE_TYPE : MSR_TYPE;
+		ops = calloc(ncpus * 2, sizeof(*ops));
+		prev_mperf = calloc(ncpus * 2, sizeof(*prev_mperf));
+		if (!ops || !prev_mperf) {
+			turbo_free();
+			return ESMI_NO_MEMORY;
+		}
+		prev_aperf = prev_mperf + ncpus;
+		for (i = 0; i < ncpus; i++) {
+			ops[2 * i].cpu = ops[2 * i + 1].cpu = i;
+			ops[2 * i].msr = MPERF_RO_MSR;
+			ops[2 * i + 1].msr = APERF_RO_MSR;
+		}
+	}
+	for (i = 0; i < nphys; i++) {
+		cores[i].sock = cpu_socket_get(i);
+		cores[i].weight = 1;
+		cores[i].busy = 1;
+	}
+
+	return ESMI_SUCCESS;
+}
+
+void turbo_exit(void)
+{
+	pthread_mutex_lock(&turbo_lock);
+	turbo_free();
+	nphys = ncpus = 0;
+	pthread_mutex_unlock(&turbo_lock);
+}
+
+static double turbo_power(struct turbo_core *tc, uint32_t freq)
+{
+	double g = freq / 1000.0;
+	double u = tc->busy > TURBO_MIN_BUSY ? tc->busy : TURBO_MIN_BUSY;
+
+	return tc->theta[0] + tc->theta[1] * u * g * g * g;
+}
+
+/* the f^3 term varied enough for b to be told apart from a */
+static bool turbo_excited(struct turbo_core *tc)
+{
+	return tc->nsamples && tc->cov[1][1] < TURBO_EXCITED_COV;
+}
+
+static void turbo_model_fit(struct turbo_core *tc, double freq, double busy,
+			    double power)
+{
+	double g = freq / 1000.0;
+	double x[2] = { 1.0, busy * g * g * g };
+	double px[2], k[2], denom, err;
+	int i, j;
+
+	if (tc->nsamples == 0) {
+		if (x[1] <= 0)
+			return;
+		tc->theta[0] = 0;
+		tc->theta[1] = power / x[1];
+		tc->cov[0][0] = 1e6;
+		tc->cov[1][1] = 1e4;
+		tc->cov[0][1] = tc->cov[1][0] = 0;
+		tc->nsamples = 1;
+		return;
+	}
+
+	for (i = 0; i < 2; i++)
+		px[i] = tc->cov[i][0] * x[0] + tc->cov[i][1] * x[1];
+	denom = TURBO_FORGET + x[0] * px[0] + x[1] * px[1];
+	err = power - (tc->theta[0] * x[0] + tc->theta[1] * x[1]);
+	for (i = 0; i < 2; i++) {
+		k[i] = px[i] / denom;
+		tc->theta[i] += k[i] * err;
+	}
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < 2; j++)
+			tc->cov[i][j] = (tc->cov[i][j] - k[i] * px[j]) / TURBO_FORGET;
+
+	if (tc->theta[0] < 0)
+		tc->theta[0] = 0;
+	if (tc->theta[1] < TURBO_MIN_COEFF)
+		tc->theta[1] = TURBO_MIN_COEFF;
+	tc->nsamples++;
+}
+
+/*
+ * Effective frequency in MHz and C0 share of a physical core since the
+ * last read, like esmi_core_activity_get() but on counters of our own so
+ * that neither sampler shortens the interval of the other. False while
+ * the counters give no interval.
+ */
+static bool turbo_activity(struct turbo_core *tc, uint32_t core, uint64_t tsc,
+			   uint64_t ns, double *freq, double *busy)
+{
+	uint64_t dm, da, sum_m = 0, sum_a = 0, max_m = 0, dtsc;
+	struct msr_batch_op *m, *a;
+	uint32_t cpu;
+
+	if (!tc->tsc_ns || ns <= tc->tsc_ns || tsc <= tc->tsc)
+		return false;
+	for (cpu = core; cpu < ncpus; cpu += nphys) {
+		m = &ops[2 * cpu];
+		a = &ops[2 * cpu + 1];
+		if (m->err || a->err || !prev_mperf[cpu] ||
+		    m->msrdata < prev_mperf[cpu] || a->msrdata < prev_aperf[cpu])
+			continue;
+		dm = m->msrdata - prev_mperf[cpu];
+		da = a->msrdata - prev_aperf[cpu];
+		sum_m += dm;
+		sum_a += da;
+		if (dm > max_m)
+			max_m = dm;
+	}
+	if (!sum_m)
+		return false;
+	dtsc = tsc - tc->tsc;
+	*freq = (double)sum_a / sum_m * dtsc * 1000 / (ns - tc->tsc_ns);
+	*busy = max_m >= dtsc ? 1 : (double)max_m / dtsc;
+
+	return true;
+}
+
+static esmi_status_t turbo_sample(uint32_t sock_ind)
+{
+	uint64_t energy, now, tsc = 0, tsc_ns = 0;
+	struct turbo_core *tc;
+	uint32_t i, cpu, freq;
+	double eff, busy;
+	bool counters;
+	esmi_status_t ret;
+
+	counters = ops && !batch_read_msr_ops(msr_type, ops, ncpus * 2);
+	if (counters) {
+		tsc = __rdtsc();
+		tsc_ns = monotonic_ns();
+	}
+	for (i = 0; i < nphys; i++) {
+		tc = &cores[i];
+		if (tc->sock != (int)sock_ind)
+			continue;
+		ret = esmi_core_energy_get(i, &energy);
+		if (ret != ESMI_SUCCESS)
+			return ret;
+		now = monotonic_ns();
+		ret = esmi_current_freq_limit_core_get(i, &freq);
+		if (ret != ESMI_SUCCESS)
+			return ret;
+		eff = freq;
+		busy = 1;
+		if (counters) {
+			if (!turbo_activity(tc, i, tsc, tsc_ns, &eff, &busy))
+				eff = 0;
+			tc->tsc = tsc;
+			tc->tsc_ns = tsc_ns;
+		}
+		if (tc->time_ns && eff > 0 && energy >= tc->energy &&
+		    now - tc->time_ns >= TURBO_MIN_INTERVAL_NS) {
+			/* uJ per ms is mW */
+			turbo_model_fit(tc, eff, busy, (energy - tc->energy) * 1e6 /
+					(now - tc->time_ns));
+			tc->busy = busy;
+		}
+		tc->energy = energy;
+		tc->time_ns = now;
+	}
+	if (counters) {
+		for (cpu = 0; cpu < ncpus; cpu++) {
+			if (cores[cpu % nphys].sock != (int)sock_ind)
+				continue;
+			prev_mperf[cpu] = ops[2 * cpu].err ? 0 : ops[2 * cpu].msrdata;
+			prev_aperf[cpu] = ops[2 * cpu + 1].err ? 0 : ops[2 * cpu + 1].msrdata;
+		}
+	}
+
+	return ESMI_SUCCESS;
+}
+
+esmi_status_t esmi_turbo_core_weight_set(uint32_t cpu_ind, uint32_t weight)
+{
+	esmi_status_t ret;
+
+	pthread_mutex_lock(&turbo_lock);
+	ret = turbo_state_init();
+	if (ret == ESMI_SUCCESS) {
+		if (cpu_ind >= ncpus)
+			ret = ESMI_INVALID_INPUT;
+		else
+			cores[cpu_ind % nphys].weight = weight;
+	}
+	pthread_mutex_unlock(&turbo_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_turbo_model_update(uint32_t sock_ind)
+{
+	esmi_status_t ret;
+
+	pthread_mutex_lock(&turbo_lock);
+	ret = turbo_state_init();
+	if (ret == ESMI_SUCCESS)
+		ret = turbo_sample(sock_ind);
+	pthread_mutex_unlock(&turbo_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_turbo_core_power_estimate(uint32_t cpu_ind, uint32_t freq,
+					     uint32_t *ppower)
+{
+	esmi_status_t ret;
+
+	if (!ppower)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&turbo_lock);
+	ret = turbo_state_init();
+	if (ret == ESMI_SUCCESS) {
+		if (cpu_ind >= ncpus)
+			ret = ESMI_INVALID_INPUT;
+		else if (cores[cpu_ind % nphys].nsamples == 0)
+			ret = ESMI_NO_DATA;
+		else
+			*ppower = turbo_power(&cores[cpu_ind % nphys], freq);
+	}
+	pthread_mutex_unlock(&turbo_lock);
+
+	return ret;
+}
+
+esmi_status_t esmi_turbo_core_plan_get(uint32_t cpu_ind, uint32_t *pboostlimit)
+{
+	esmi_status_t ret;
+
+	if (!pboostlimit)
+		return ESMI_ARG_PTR_NULL;
+
+	pthread_mutex_lock(&turbo_lock);
+	ret = turbo_state_init();
+	if (ret == ESMI_SUCCESS) {
+		if (cpu_ind >= ncpus)
+			ret = ESMI_INVALID_INPUT;
+		else if (!cores[cpu_ind % nphys].plan)
+			ret = ESMI_NO_DATA;
+		else
+			*pboostlimit = cores[cpu_ind % nphys].plan;
+	}
+	pthread_mutex_unlock(&turbo_lock);
+
+	return ret;
+}
+
+/* weighted frequency gained per mW by raising a core one step */
+static double turbo_gain(struct turbo_core *tc, uint32_t fmax)
+{
+	if (!tc->weight || tc->plan + TURBO_FREQ_STEP > fmax)
+		return -1;
+
+	return tc->weight * (double)TURBO_FREQ_STEP /
+		(turbo_power(tc, tc->plan + TURBO_FREQ_STEP) - turbo_power(tc, tc->plan));
+}
+
+/* weighted frequency lost per mW saved by lowering a core one step */
+static double turbo_loss(struct turbo_core *tc, uint32_t fmin)
+{
+	if (tc->plan < fmin + TURBO_FREQ_STEP)
+		return -1;
+
+	return tc->weight * (double)TURBO_FREQ_STEP /
+		(turbo_power(tc, tc->plan) - turbo_power(tc, tc->plan - TURBO_FREQ_STEP));
+}
+
+static void turbo_solve(uint32_t sock_ind, double budget, uint32_t fmin, uint32_t fmax)
+{
+	struct turbo_core *tc, *up, *down;
+	double cost = 0, g, best_up, best_down;
+	uint32_t i, moves, max_moves;
+
+	for (i = 0; i < nphys; i++) {
+		tc = &cores[i];
+		if (tc->sock != (int)sock_ind)
+			continue;
+		/* warm start from the previous plan, snapped to the step grid */
+		if (!tc->weight || !tc->plan || tc->plan < fmin)
+			tc->plan = tc->weight ? fmax : fmin;
+		if (tc->plan > fmax)
+			tc->plan = fmax;
+		tc->plan = fmin + (tc->plan - fmin) / TURBO_FREQ_STEP * TURBO_FREQ_STEP;
+		cost += turbo_power(tc, tc->plan);
+	}
+	max_moves = nphys * ((fmax - fmin) / TURBO_FREQ_STEP + 1);
+
+	/* over budget: take steps from the cores which lose the least */
+	for (moves = 0; cost > budget && moves < max_moves; moves++) {
+		down = NULL;
+		for (i = 0; i < nphys; i++) {
+			tc = &cores[i];
+			if (tc->sock != (int)sock_ind || (g = turbo_loss(tc, fmin)) < 0)
+				continue;
+			if (!down || g < best_down) {
+				down = tc;
+				best_down = g;
+			}
+		}
+		if (!down)
+			break;
+		cost -= turbo_power(down, down->plan);
+		down->plan -= TURBO_FREQ_STEP;
+		cost += turbo_power(down, down->plan);
+	}
+
+	/*
+	 * Hand out the remaining budget, then trade steps from low value to
+	 * high value cores until no trade improves the weighted frequency.
+	 */
+	for (moves = 0; moves < max_moves; moves++) {
+		up = down = NULL;
+		for (i = 0; i < nphys; i++) {
+			tc = &cores[i];
+			if (tc->sock != (int)sock_ind)
+				continue;
+			g = turbo_gain(tc, fmax);
+			if (g >= 0 && (!up || g > best_up)) {
+				up = tc;
+				best_up = g;
+			}
+		}
+		if (!up)
+			break;
+		g = turbo_power(up, up->plan + TURBO_FREQ_STEP) - turbo_power(up, up->plan);
+		if (cost + g <= budget) {
+			up->plan += TURBO_FREQ_STEP;
+			cost += g;
+			continue;
+		}
+		for (i = 0; i < nphys; i++) {
+			tc = &cores[i];
+			if (tc == up || tc->sock != (int)sock_ind ||
+			    (g = turbo_loss(tc, fmin)) < 0)
+				continue;
+			if (!down || g < best_down) {
+				down = tc;
+				best_down = g;
+			}
+		}
+		if (!down || best_down >= best_up)
+			break;
+		cost -= turbo_power(down, down->plan) + turbo_power(up, up->plan);
+		down->plan -= TURBO_FREQ_STEP;
+		up->plan += TURBO_FREQ_STEP;
+		cost += turbo_power(down, down->plan) + turbo_power(up, up->plan);
+		if (cost > budget) {
+			/* the trade did not fit, undo it and stop */
+			cost -= turbo_power(down, down->plan) + turbo_power(up, up->plan);
+			down->plan += TURBO_FREQ_STEP;
+			up->plan -= TURBO_FREQ_STEP;
+			cost += turbo_power(down, down->plan) + turbo_power(up, up->plan);
+			break;
+		}
+	}
+}
+
+/*
+ * The socket power target also covers the uncore, which is estimated as
+ * the measured socket power minus the modelled power of all cores at
+ * their current frequency limit.
+ */
+esmi_status_t esmi_turbo_plan_apply(uint32_t sock_ind, uint32_t power_target,
+				    uint32_t *nwrites)
+{
+	uint32_t i, cpu, freq, sock_power;
+	uint16_t fmax, fmin;
+	double core_power = 0, uncore;
+	esmi_status_t ret;
+
+	pthread_mutex_lock(&turbo_lock);
+	ret = turbo_state_init();
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	ret = turbo_sample(sock_ind);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	ret = esmi_socket_freq_range_get(sock_ind, &fmax, &fmin);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+	if (fmax < fmin) {
+		ret = ESMI_UNEXPECTED_SIZE;
+		goto unlock;
+	}
+	ret = esmi_socket_power_get(sock_ind, &sock_power);
+	if (ret != ESMI_SUCCESS)
+		goto unlock;
+
+	for (i = 0; i < nphys; i++) {
+		if (cores[i].sock != (int)sock_ind)
+			continue;
+		if (!turbo_excited(&cores[i])) {
+			ret = ESMI_NO_DATA;
+			goto unlock;
+		}
+		ret = esmi_current_freq_limit_core_get(i, &freq);
+		if (ret != ESMI_SUCCESS)
+			goto unlock;
+		core_power += turbo_power(&cores[i], freq);
+	}
+	uncore = sock_power > core_power ? sock_power - core_power : 0;
+
+	turbo_solve(sock_ind, power_target - uncore, fmin, fmax);
+
+	memset(limits, 0, ncpus * sizeof(*limits));
+	for (cpu = 0; cpu < ncpus; cpu++)
+		if (cores[cpu % nphys].sock == (int)sock_ind)
+			limits[cpu] = cores[cpu % nphys].plan;
+	ret = esmi_core_boostlimit_batch_set(limits, ncpus, nwrites);
+
+unlock:
+	pthread_mutex_unlock(&turbo_lock);
+	return ret;
+}
@@ -6,122 +6,454 @@
  */
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
-#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 
 #include <e_smi/e_smi_utils.h>
 
+/*
+ * Device attributes are read through a fixed table of cached fds: sysfs
+ * regenerates an attribute on every read from offset 0, so a pread() on
+ * the fd opened by the first read returns fresh values without the open,
+ * the close and the FILE allocation of every later read. Only paths below
+ * the device trees are cached, cgroup directories come and go. A read
+ * failing on a cached fd, e.g. after a cpu went offline and back, drops
+ * the fd and retries once on a fresh one.
+ *
+ * A slot is pinned while a read uses its fd. Dropping a pinned slot, or
+ * closing the cache under a read, only marks it stale, and the fd is
+ * closed by the last reader, so the number can not be reused by another
+ * open() while a pread() is still issued on it.
+ */
+#define FD_CACHE_SIZE		256	/* power of 2 */
+#define FD_CACHE_PROBES		8
+#define FD_CACHE_PATH		256
+#define SYS_BUF_SIZE		64
+
+struct fd_slot {
+	uint64_t hash;
+	int fd;
+	int refs;		// reads using fd
+	int stale;		// closed once refs drops to 0
+	char path[FD_CACHE_PATH];
+};
+
+static const char *fd_cache_prefixes[] = {
+	"/sys/devices/", "/sys/class/", "/dev/cpu/",
+};
+
+static pthread_mutex_t fd_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fd_slot fd_cache[FD_CACHE_SIZE];
+static int fd_cache_used;		// slots with a hash, stale ones included
+
+static uint64_t path_hash(const char *path)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+
+	while (*path)
+		h = (h ^ (unsigned char)*path++) * 0x100000001b3ULL;
+
+	return h ? h : 1;
+}
+
+static int fd_cacheable(const char *path)
+{
+	int i;
+
+	if (strlen(path) >= FD_CACHE_PATH)
+		return 0;
+	for (i = 0; i < sizeof(fd_cache_prefixes) / sizeof(fd_cache_prefixes[0]); i++)
+		if (!strncmp(path, fd_cache_prefixes[i], strlen(fd_cache_prefixes[i])))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Returns an fd for reading path. The slot is pinned and returned in
+ * *pslot when the fd is cached, to be released with fd_cache_put(),
+ * otherwise *pslot is NULL and the fd is closed by the caller.
+ */
+static int fd_cache_get(const char *path, struct fd_slot **pslot)
+{
+	struct fd_slot *slot, *free_slot = NULL;
+	uint64_t h;
+	int i, fd;
+
+	*pslot = NULL;
+	if (!fd_cacheable(path))
+		return open(path, O_RDONLY | O_CLOEXEC);
+
+	h = path_hash(path);
+	pthread_mutex_lock(&fd_cache_lock);
+	for (i = 0; i < FD_CACHE_PROBES; i++) {
+		slot = &fd_cache[(h + i) & (FD_CACHE_SIZE - 1)];
+		if (slot->hash == h && !slot->stale && !strcmp(slot->path, path)) {
+			slot->refs++;
+			*pslot = slot;
+			fd = slot->fd;
+			pthread_mutex_unlock(&fd_cache_lock);
+			return fd;
+		}
+		if (!slot->hash && !free_slot)
+			free_slot = slot;
+	}
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0 && free_slot) {
+		free_slot->hash = h;
+		free_slot->fd = fd;
+		free_slot->refs = 1;
+		strcpy(free_slot->path, path);
+		fd_cache_used++;
+		*pslot = free_slot;
+	}
+	pthread_mutex_unlock(&fd_cache_lock);
+
+	return fd;
+}
+
+/* called with fd_cache_lock */
+static void fd_slot_release(struct fd_slot *slot)
+{
+	if (!slot->stale || slot->refs)
+		return;
+	close(slot->fd);
+	memset(slot, 0, sizeof(*slot));
+	fd_cache_used--;
+}
+
+/* unpins a slot, drop marks it stale so that the next read reopens */
+static void fd_cache_put(struct fd_slot *slot, int drop)
+{
+	pthread_mutex_lock(&fd_cache_lock);
+	if (drop)
+		slot->stale = 1;
+	slot->refs--;
+	fd_slot_release(slot);
+	pthread_mutex_unlock(&fd_cache_lock);
+}
+
+void fd_cache_close(void)
+{
+	int i;
+
+	pthread_mutex_lock(&fd_cache_lock);
+	for (i = 0; fd_cache_used && i < FD_CACHE_SIZE; i++) {
+		if (fd_cache[i].hash) {
+			fd_cache[i].stale = 1;
+			fd_slot_release(&fd_cache[i]);
+		}
+	}
+	pthread_mutex_unlock(&fd_cache_lock);
+}
+
+__thread uint64_t lib_syscalls;
+
+/* pread at offset through the fd cache, returns bytes read or -errno */
+static ssize_t cached_pread(const char *path, void *buf, size_t len, off_t offset)
+{
+	struct fd_slot *slot;
+	ssize_t n = 0;
+	int fd, retry;
+
+	for (retry = 0; retry < 2; retry++) {
+		fd = fd_cache_get(path, &slot);
+		if (fd < 0)
+			return -errno;
+		n = pread(fd, buf, len, offset);
+		lib_syscalls++;
+		if (n < 0)
+			n = -errno;
+		if (!slot) {
+			close(fd);
+			break;
+		}
+		fd_cache_put(slot, n < 0);
+		if (n >= 0)
+			break;
+	}
+
+	return n;
+}
+
+/* the first line of a file, like fgets() */
+static int read_line(const char *filepath, char *buf, uint32_t len)
+{
+	ssize_t n;
+	char *nl;
+
+	if (len < 2)
+		return EINVAL;
+	n = cached_pread(filepath, buf, len - 1, 0);
+	if (n < 0)
+		return -n;
+	if (n == 0)
+		return ENODATA;
+	buf[n] = '\0';
+	nl = strchr(buf, '\n');
+	if (nl)
+		nl[1] = '\0';
+
+	return 0;
+}
+
 int readsys_u32(char *filepath, uint32_t *pval)
 {
-	FILE *fptr;
+	char buf[SYS_BUF_SIZE], *end;
+	int ret;
 
 	if (!(filepath && pval)) {
 		return EFAULT;
 	}
-	fptr = fopen(filepath, "r");
-	if (fptr == NULL) {
-		return errno;
-	}
-	if (fscanf(fptr, "%u", pval) < 0) {
-		fclose(fptr);
-		return errno;
-	}
-	fclose(fptr);
+	ret = read_line(filepath, buf, sizeof(buf));
+	if (ret)
+		return ret;
+	*pval = strtoul(buf, &end, 10);
+	if (end == buf)
+		return EINVAL;
+
 	return 0;
 }
 
+static int writesys_str(char *filepath, const char *str)
+{
+	ssize_t n;
+	int fd, ret = 0;
+
+	fd = open(filepath, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno;
+	n = write(fd, str, strlen(str));
+	lib_syscalls++;
+	if (n < 0)
+		ret = errno;
+	close(fd);
+
+	return ret;
+}
+
 int writesys_s32(char *filepath, int32_t val)
 {
-	FILE *fptr;
+	char buf[SYS_BUF_SIZE];
 
 	if (NULL == filepath) {
 		return EFAULT;
 	}
-	fptr = fopen(filepath, "w");
-	if (fptr == NULL) {
-		return errno;
-	}
-	if (fprintf(fptr, "%d", val) < 0) {
-		fclose(fptr);
-		return errno;
-	}
-	fclose(fptr);
-	return 0;
+	snprintf(buf, sizeof(buf), "%d", val);
+
+	return writesys_str(filepath, buf);
 }
 
 int writesys_u32(char *filepath, uint32_t val)
 {
-	FILE *fptr;
+	char buf[SYS_BUF_SIZE];
 
 	if (NULL == filepath) {
 		return EFAULT;
 	}
-	fptr = fopen(filepath, "w");
-	if (fptr == NULL) {
-		return errno;
-	}
-	if (fprintf(fptr, "%u", val) < 0) {
-		fclose(fptr);
-		return errno;
-	}
-	fclose(fptr);
-	return 0;
+	snprintf(buf, sizeof(buf), "%u", val);
+
+	return writesys_str(filepath, buf);
 }
 
 int readsys_u64(char *filepath, uint64_t *pval)
 {
-	FILE *fptr;
+	char buf[SYS_BUF_SIZE], *end;
+	int ret;
 
 	if (!(filepath && pval)) {
 		return EFAULT;
 	}
-	fptr = fopen(filepath, "r");
-	if (fptr == NULL) {
-		return errno;
-	}
-	if (fscanf(fptr, "%lu", pval) < 0) {
-		fclose(fptr);
-		return errno;
-	}
-	fclose(fptr);
+	ret = read_line(filepath, buf, sizeof(buf));
+	if (ret)
+		return ret;
+	*pval = strtoull(buf, &end, 10);
+	if (end == buf)
+		return EINVAL;
+
 	return 0;
 }
 
 int readsys_str(char *filepath, char *pval, uint32_t len)
 {
-	FILE *fptr;
-
 	if (!(filepath && pval)) {
 		return EFAULT;
 	}
-	fptr = fopen(filepath, "r");
-	if (fptr == NULL) {
-		return errno;
+
+	return read_line(filepath, pval, len);
+}
+
+int readmsr_u64(char *filepath, uint64_t *pval, uint64_t reg)
+{
+	ssize_t n;
+
+	n = cached_pread(filepath, pval, sizeof(uint64_t), reg);
+	if (n < 0)
+		return -n;
+
+	return 0;
+}
+
+/*
+ * Parse a kernel cpu list such as "0-3,8,10-11" into a byte mask of
+ * ncpus entries. Cpus beyond ncpus are ignored.
+ * Returns the number of cpus set in the mask or -1 for a malformed list.
+ */
+int parse_cpulist(const char *str, uint8_t *mask, uint32_t ncpus)
+{
+	unsigned long first, last, i;
+	char *end;
+	int count = 0;
+
+	if (!str || !mask)
+		return -1;
+
+	memset(mask, 0, ncpus);
+	while (*str && *str != '\n') {
+		first = strtoul(str, &end, 10);
+		if (end == str)
+			return -1;
+		last = first;
+		str = end;
+		if (*str == '-') {
+			last = strtoul(++str, &end, 10);
+			if (end == str || last < first)
+				return -1;
+			str = end;
+		}
+		for (i = first; i <= last && i < ncpus; i++) {
+			if (!mask[i])
+				count++;
+			mask[i] = 1;
+		}
+		if (*str == ',')
+			str++;
+		else if (*str && *str != '\n')
+			return -1;
 	}
-	if (!fgets(pval, len, fptr)) {
-		fclose(fptr);
-		return errno;
+
+	return count;
+}
+
+/* CLOCK_MONOTONIC in nano seconds */
+uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define PROC_STAT_PATH	"/proc/stat"
+#define PROC_STAT_SIZE	65536
+
+/*
+ * /proc/stat is kept open and re-read with pread() from offset 0, the
+ * buffer grows to the size of the file once and is reused afterwards.
+ */
+static pthread_mutex_t procstat_lock = PTHREAD_MUTEX_INITIALIZER;
+static int procstat_fd = -1;
+static char *procstat_buf;
+static size_t procstat_size;
+
+static ssize_t procstat_load(void)
+{
+	size_t len = 0;
+	ssize_t n;
+	char *buf;
+
+	if (procstat_fd < 0) {
+		procstat_fd = open(PROC_STAT_PATH, O_RDONLY | O_CLOEXEC);
+		if (procstat_fd < 0)
+			return -1;
 	}
-	fclose(fptr);
-	return 0;
+	if (!procstat_buf) {
+		procstat_buf = malloc(PROC_STAT_SIZE);
+		if (!procstat_buf)
+			return -1;
+		procstat_size = PROC_STAT_SIZE;
+	}
+	for (;;) {
+		n = pread(procstat_fd, procstat_buf + len,
+			  procstat_size - len - 1, len);
+		lib_syscalls++;
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		len += n;
+		if (len == procstat_size - 1) {
+			buf = realloc(procstat_buf, procstat_size * 2);
+			if (!buf)
+				return -1;
+			procstat_buf = buf;
+			procstat_size *= 2;
+		}
+	}
+	procstat_buf[len] = '\0';
+
+	return len;
 }
 
-int readmsr_u64(char *filepath, uint64_t *pval, uint64_t reg)
+/*
+ * Read the per cpu times of /proc/stat in USER_HZ ticks. busy is the time
+ * spent out of the idle and iowait states. Entries of offline cpus and of
+ * cpus beyond ncpus are left untouched.
+ * Returns 0 on success or an errno value.
+ */
+int procstat_read(uint64_t *busy, uint64_t *total, uint32_t ncpus)
 {
-	int fd;
+	unsigned long long v[8];
+	unsigned int cpu;
+	char *line, *next;
+	int n, i;
 
-	fd = open(filepath, O_RDONLY);
-	if (fd < 0)
-		return errno;
+	if (!busy || !total)
+		return EFAULT;
 
-	if (pread(fd, pval, sizeof(uint64_t), reg) < 0) {
-		close(fd);
-		return errno;
+	pthread_mutex_lock(&procstat_lock);
+	if (procstat_load() < 0) {
+		n = errno;
+		pthread_mutex_unlock(&procstat_lock);
+		return n;
 	}
-	close(fd);
+	for (line = procstat_buf; line && *line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			next++;
+		if (strncmp(line, "cpu", 3) || line[3] < '0' || line[3] > '9')
+			continue;
+		memset(v, 0, sizeof(v));
+		n = sscanf(line + 3, "%u %llu %llu %llu %llu %llu %llu %llu %llu",
+			   &cpu, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5],
+			   &v[6], &v[7]);
+		if (n < 5 || cpu >= ncpus)
+			continue;
+		total[cpu] = 0;
+		for (i = 0; i < 8; i++)
+			total[cpu] += v[i];
+		/* idle and iowait are the 4th and 5th fields */
+		busy[cpu] = total[cpu] - v[3] - v[4];
+	}
+	pthread_mutex_unlock(&procstat_lock);
 
 	return 0;
 }
+
+void procstat_close(void)
+{
+	pthread_mutex_lock(&procstat_lock);
+	if (procstat_fd >= 0)
+		close(procstat_fd);
+	procstat_fd = -1;
+	free(procstat_buf);
+	procstat_buf = NULL;
+	procstat_size = 0;
+	pthread_mutex_unlock(&procstat_lock);
+}
@@ -0,0 +1,124 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Per socket worker threads.
+ *
+ * The domain reads and the batched boost limit writes spread one job per
+ * socket over threads, the HSMP mailboxes of different sockets being
+ * independent. The threads are created on first use and then parked on a
+ * condition variable until esmi_exit(), so a call does not pay for, nor
+ * allocate, a thread. The caller takes jobs too, and does all of them if
+ * no thread could be created. One set of jobs runs at a time.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <e_smi/e_smi.h>
+#include <e_smi/e_smi_monitor.h>
+
+#define WORKERS_MAX	16
+
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wk_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t wk_done = PTHREAD_COND_INITIALIZER;
+static pthread_t threads[WORKERS_MAX];
+static uint32_t nthreads;
+static uint64_t gen;			// bumped for every set of jobs
+static int quit;
+
+static void *(*job_fn)(void *);
+static char *job_args;
+static size_t job_size;
+static uint32_t job_n, job_next, job_left;
+
+/* called and returns with wk_lock held */
+static void jobs_drain(void)
+{
+	uint32_t i;
+
+	while (job_next < job_n) {
+		i = job_next++;
+		pthread_mutex_unlock(&wk_lock);
+		job_fn(job_args + i * job_size);
+		pthread_mutex_lock(&wk_lock);
+		if (!--job_left)
+			pthread_cond_signal(&wk_done);
+	}
+}
+
+static void *worker_main(void *arg)
+{
+	uint64_t seen = (uintptr_t)arg;
+
+	pthread_mutex_lock(&wk_lock);
+	for (;;) {
+		while (!quit && gen == seen)
+			pthread_cond_wait(&wk_start, &wk_lock);
+		if (quit)
+			break;
+		seen = gen;
+		jobs_drain();
+	}
+	pthread_mutex_unlock(&wk_lock);
+
+	return NULL;
+}
+
+/* fn(args + i * size) for every i < n, returns once all of them did */
+void workers_run(void *(*fn)(void *), void *args, size_t size, uint32_t n)
+{
+	uint32_t i;
+
+	if (n < 2) {
+		for (i = 0; i < n; i++)
+			fn((char *)args + i * size);
+		return;
+	}
+
+	pthread_mutex_lock(&run_lock);
+	pthread_mutex_lock(&wk_lock);
+	while (nthreads < n - 1 && nthreads < WORKERS_MAX) {
+		/* created before gen moves on, so it takes part in this set */
+		if (pthread_create(&threads[nthreads], NULL, worker_main,
+				   (void *)(uintptr_t)gen))
+			break;
+		nthreads++;
+	}
+	job_fn = fn;
+	job_args = args;
+	job_size = size;
+	job_n = n;
+	job_next = 0;
+	job_left = n;
+	gen++;
+	pthread_cond_broadcast(&wk_start);
+	jobs_drain();
+	while (job_left)
+		pthread_cond_wait(&wk_done, &wk_lock);
+	job_fn = NULL;
+	pthread_mutex_unlock(&wk_lock);
+	pthread_mutex_unlock(&run_lock);
+}
+
+void workers_exit(void)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&run_lock);
+	pthread_mutex_lock(&wk_lock);
+	quit = 1;
+	pthread_cond_broadcast(&wk_start);
+	pthread_mutex_unlock(&wk_lock);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	nthreads = 0;
+	quit = 0;
+	pthread_mutex_unlock(&run_lock);
+}
@@ -0,0 +1,421 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Startup benchmark for the E-SMI library.
+ *
+ * A one-shot tool invocation pays for esmi_init(), one query and esmi_exit().
+ * For a set of common single metric queries this measures those three steps
+ * over a number of iterations and reports min/median/max in micro seconds.
+ *
+ * With -a it instead checks that the getters do not allocate in steady
+ * state: after esmi_init() every getter is called once to warm up the
+ * lazily set up caches, then called again with the allocator of this
+ * binary counting. A getter allocating after its warm up fails the run.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <e_smi/e_smi.h>
+
+#define DEFAULT_ITERATIONS	100
+#define MAX_FREQ_SRC		16
+#define BENCH_SKIPPED		77	/* ctest SKIP_RETURN_CODE */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+
+static int alloc_counting;
+static uint64_t alloc_count;
+static uint64_t *energy_buf;
+static struct esmi_core_activity *activity_buf;
+static struct esmi_idle_snapshot idle_snap;
+
+struct bench_case {
+	const char *name;
+	esmi_status_t (*query)(void);
+};
+
+static esmi_status_t query_none(void)
+{
+	return ESMI_SUCCESS;
+}
+
+static esmi_status_t query_sockpower(void)
+{
+	uint32_t power;
+
+	return esmi_socket_power_get(0, &power);
+}
+
+static esmi_status_t query_sockenergy(void)
+{
+	uint64_t energy;
+
+	return esmi_socket_energy_get(0, &energy);
+}
+
+static esmi_status_t query_coreenergy(void)
+{
+	uint64_t energy;
+
+	return esmi_core_energy_get(0, &energy);
+}
+
+static esmi_status_t query_socktemp(void)
+{
+	uint32_t tmon;
+
+	return esmi_socket_temperature_get(0, &tmon);
+}
+
+static esmi_status_t query_corebl(void)
+{
+	uint32_t boostlimit;
+
+	return esmi_core_boostlimit_get(0, &boostlimit);
+}
+
+static esmi_status_t query_protover(void)
+{
+	uint32_t proto_ver;
+
+	return esmi_hsmp_proto_ver_get(&proto_ver);
+}
+
+static esmi_status_t query_allenergy(void)
+{
+	return esmi_all_energies_get(energy_buf);
+}
+
+static esmi_status_t query_sweep(void)
+{
+	return esmi_energy_sweep_get(energy_buf);
+}
+
+static esmi_status_t query_activity(void)
+{
+	return esmi_core_activity_get(activity_buf);
+}
+
+static esmi_status_t query_idle(void)
+{
+	return esmi_idle_residency_get(&idle_snap);
+}
+
+static esmi_status_t query_c0(void)
+{
+	uint32_t c0;
+
+	return esmi_socket_c0_residency_get(0, &c0);
+}
+
+static esmi_status_t query_freqlimit(void)
+{
+	char *src_type[MAX_FREQ_SRC] = { NULL };
+	uint16_t freq;
+
+	return esmi_socket_current_active_freq_limit_get(0, &freq, src_type);
+}
+
+static esmi_status_t query_corefreq(void)
+{
+	uint32_t freq;
+
+	return esmi_current_freq_limit_core_get(0, &freq);
+}
+
+static esmi_status_t query_ddrbw(void)
+{
+	struct ddr_bw_metrics ddr_bw;
+
+	return esmi_ddr_bw_get(0, &ddr_bw);
+}
+
+static esmi_status_t query_mtbl(void)
+{
+	struct hsmp_metric_table mtbl;
+
+	return esmi_metrics_table_cached_get(0, &mtbl);
+}
+
+static esmi_status_t query_drvver(void)
+{
+	struct hsmp_driver_version ver;
+
+	return esmi_hsmp_driver_version_get(&ver);
+}
+
+static struct bench_case cases[] = {
+	{ "init+exit",		query_none },
+	{ "showsockpower",	query_sockpower },
+	{ "showsockenergy",	query_sockenergy },
+	{ "showcoreenergy",	query_coreenergy },
+	{ "showsockettemp",	query_socktemp },
+	{ "showcorebl",		query_corebl },
+	{ "showhsmpprotover",	query_protover },
+};
+
+static struct bench_case steady_cases[] = {
+	{ "esmi_socket_power_get",			query_sockpower },
+	{ "esmi_socket_energy_get",			query_sockenergy },
+	{ "esmi_core_energy_get",			query_coreenergy },
+	{ "esmi_all_energies_get",			query_allenergy },
+	{ "esmi_energy_sweep_get",			query_sweep },
+	{ "esmi_core_activity_get",			query_activity },
+	{ "esmi_idle_residency_get",			query_idle },
+	{ "esmi_socket_temperature_get",		query_socktemp },
+	{ "esmi_core_boostlimit_get",			query_corebl },
+	{ "esmi_socket_c0_residency_get",		query_c0 },
+	{ "esmi_socket_current_active_freq_limit_get",	query_freqlimit },
+	{ "esmi_current_freq_limit_core_get",		query_corefreq },
+	{ "esmi_ddr_bw_get",				query_ddrbw },
+	{ "esmi_metrics_table_cached_get",		query_mtbl },
+	{ "esmi_hsmp_proto_ver_get",			query_protover },
+	{ "esmi_hsmp_driver_version_get",		query_drvver },
+};
+
+/*
+ * The allocator of the binary interposes the one of libc for the library
+ * too. Only the number of allocations while counting is of interest.
+ */
+void *malloc(size_t size)
+{
+	if (__atomic_load_n(&alloc_counting, __ATOMIC_RELAXED))
+		__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (__atomic_load_n(&alloc_counting, __ATOMIC_RELAXED))
+		__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (__atomic_load_n(&alloc_counting, __ATOMIC_RELAXED))
+		__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size)
+{
+	void *p;
+
+	if (__atomic_load_n(&alloc_counting, __ATOMIC_RELAXED))
+		__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	p = __libc_memalign(align, size);
+	if (!p)
+		return ENOMEM;
+	*ptr = p;
+
+	return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+	if (__atomic_load_n(&alloc_counting, __ATOMIC_RELAXED))
+		__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_memalign(align, size);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void print_stat(uint64_t *samples, uint32_t n)
+{
+	qsort(samples, n, sizeof(*samples), cmp_u64);
+	printf(" %9.1lf %9.1lf %9.1lf |", samples[0] / 1000.0,
+	       samples[n / 2] / 1000.0, samples[n - 1] / 1000.0);
+}
+
+static void run_case(struct bench_case *bc, uint32_t iterations,
+		     uint64_t *t_init, uint64_t *t_query, uint64_t *t_exit)
+{
+	esmi_status_t init_ret = ESMI_SUCCESS, ret = ESMI_SUCCESS;
+	uint64_t t0, t1, t2, t3;
+	uint32_t i;
+
+	for (i = 0; i < iterations; i++) {
+		t0 = now_ns();
+		init_ret = esmi_init();
+		t1 = now_ns();
+		if (init_ret == ESMI_SUCCESS)
+			ret = bc->query();
+		t2 = now_ns();
+		esmi_exit();
+		t3 = now_ns();
+
+		t_init[i] = t1 - t0;
+		t_query[i] = t2 - t1;
+		t_exit[i] = t3 - t2;
+	}
+
+	printf("| %-18s |", bc->name);
+	print_stat(t_init, iterations);
+	print_stat(t_query, iterations);
+	print_stat(t_exit, iterations);
+	if (init_ret != ESMI_SUCCESS)
+		printf(" init: %s\n", esmi_get_err_msg(init_ret));
+	else
+		printf(" %s\n", esmi_get_err_msg(ret));
+}
+
+static void free_steady_bufs(void)
+{
+	free(energy_buf);
+	free(activity_buf);
+	free(idle_snap.energy);
+	free(idle_snap.power);
+	free(idle_snap.residency);
+	free(idle_snap.entries);
+}
+
+/*
+ * Returns the number of getters allocating in steady state, or -1 when
+ * the library does not initialize on this system. A getter failing its
+ * warm up, e.g. for a message the platform does not support, is reported
+ * and skipped.
+ */
+static int run_steady(uint32_t iterations)
+{
+	esmi_status_t ret;
+	uint32_t cpus, threads, cores, states = 0, i;
+	uint64_t allocs;
+	int c, failed = 0;
+
+	ret = esmi_init();
+	if (ret != ESMI_SUCCESS) {
+		printf("esmi_init: %s, allocation check skipped\n", esmi_get_err_msg(ret));
+		return -1;
+	}
+	if (esmi_number_of_cpus_get(&cpus) != ESMI_SUCCESS ||
+	    esmi_threads_per_core_get(&threads) != ESMI_SUCCESS || !threads) {
+		printf("Failed to get the cpu topology\n");
+		esmi_exit();
+		return 1;
+	}
+	cores = cpus / threads;
+	/* without cpuidle the idle residency case fails its warm up */
+	esmi_idle_states_get(&states, NULL);
+	energy_buf = calloc(cores, sizeof(uint64_t));
+	activity_buf = calloc(cores, sizeof(*activity_buf));
+	idle_snap.energy = calloc(cores, sizeof(uint64_t));
+	idle_snap.power = calloc(cores, sizeof(uint32_t));
+	idle_snap.residency = calloc(cores * states + 1, sizeof(uint32_t));
+	idle_snap.entries = calloc(cores * states + 1, sizeof(uint32_t));
+	if (!energy_buf || !activity_buf || !idle_snap.energy || !idle_snap.power ||
+	    !idle_snap.residency || !idle_snap.entries) {
+		printf("Failed to allocate the energy buffers\n");
+		free_steady_bufs();
+		esmi_exit();
+		return 1;
+	}
+
+	printf("E-SMI steady state allocations, %u calls after warm up\n", iterations);
+	for (c = 0; c < ARRAY_SIZE(steady_cases); c++) {
+		ret = steady_cases[c].query();
+		if (ret != ESMI_SUCCESS) {
+			printf("| %-42s | skipped: %s\n", steady_cases[c].name,
+			       esmi_get_err_msg(ret));
+			continue;
+		}
+		alloc_count = 0;
+		__atomic_store_n(&alloc_counting, 1, __ATOMIC_RELAXED);
+		for (i = 0; i < iterations; i++)
+			steady_cases[c].query();
+		__atomic_store_n(&alloc_counting, 0, __ATOMIC_RELAXED);
+		allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+		printf("| %-42s | %8lu | %s\n", steady_cases[c].name, allocs,
+		       allocs ? "FAIL" : "ok");
+		if (allocs)
+			failed++;
+	}
+
+	free_steady_bufs();
+	esmi_exit();
+
+	return failed;
+}
+
+static void show_usage(char *exe_name)
+{
+	printf("Usage: %s [-a] [-n ITERATIONS]\n", exe_name);
+	printf("  -a  check that the getters do not allocate after warm up\n");
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t iterations = DEFAULT_ITERATIONS;
+	uint64_t *t_init, *t_query, *t_exit;
+	int opt, i, steady = 0, failed;
+
+	while ((opt = getopt(argc, argv, "ahn:")) != -1) {
+		switch (opt) {
+		case 'a':
+			steady = 1;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			show_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!iterations) {
+		show_usage(argv[0]);
+		return 1;
+	}
+	if (steady) {
+		failed = run_steady(iterations);
+		return failed < 0 ? BENCH_SKIPPED : failed ? 1 : 0;
+	}
+
+	t_init = calloc(iterations, sizeof(uint64_t));
+	t_query = calloc(iterations, sizeof(uint64_t));
+	t_exit = calloc(iterations, sizeof(uint64_t));
+	if (!t_init || !t_query || !t_exit) {
+		printf("Failed to allocate sample buffers\n");
+		return ESMI_NO_MEMORY;
+	}
+
+	printf("E-SMI startup benchmark, %u iterations, times in usec (min median max)\n",
+	       iterations);
+	printf("| %-18s |%-30s|%-30s|%-30s| status\n",
+	       "query", " esmi_init", " first query", " esmi_exit");
+	for (i = 0; i < ARRAY_SIZE(cases); i++)
+		run_case(&cases[i], iterations, t_init, t_query, t_exit);
+
+	free(t_init);
+	free(t_query);
+	free(t_exit);
+
+	return 0;
+}
@@ -0,0 +1,499 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Command latency benchmark for e_smi_tool.
+ *
+ * Every read only tool option is run as a separate process, the way the
+ * tool is used from scripts, against a simulated device tree built in a
+ * temporary directory: the e_smi_simshim preload library redirects the
+ * sysfs and device paths into it and answers the HSMP ioctls. Each option
+ * runs a number of times for the wall time and page faults of the whole
+ * invocation and the allocations counted by the preload library, and once
+ * more under ptrace to count the system calls by type. The per option
+ * table makes startup regressions visible between releases. The cpu
+ * family and model still come from cpuid, so on a host the library does
+ * not support every option fails at esmi_init() and only that part of
+ * the startup is measured.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include <e_smi/e_smi.h>
+
+#define DEFAULT_ITERATIONS	20
+#define MAX_ARGS		8
+#define MAX_SYSCALLS		512
+#define TOP_SYSCALLS		6
+#define SIM_ROOT_TEMPLATE	"/tmp/esmi_sim.XXXXXX"
+#define SIM_ROOT_SIZE		sizeof(SIM_ROOT_TEMPLATE)
+
+struct bench_cmd {
+	const char *args[MAX_ARGS];
+};
+
+/* read only options, arguments for socket 0, core 0 and the first link */
+static struct bench_cmd cmds[] = {
+	{ { "--version" } },
+	{ { "--showsockenergy" } },
+	{ { "--showsockpower" } },
+	{ { "--showcoreenergy", "0" } },
+	{ { "--showcorebl", "0" } },
+	{ { "--showsockc0resi", "0" } },
+	{ { "--showsmufwver" } },
+	{ { "--showhsmpdriverver" } },
+	{ { "--showhsmpprotover" } },
+	{ { "--showprochotstatus" } },
+	{ { "--showsockettemp" } },
+	{ { "--showddrbw" } },
+	{ { "--showclocks" } },
+	{ { "--showsvipower" } },
+	{ { "--showcclkfreqlimit", "0" } },
+	{ { "--showsockclkfreqlimit", "0" } },
+	{ { "--showdimmpower", "0", "0x80" } },
+	{ { "--showdimmthermal", "0", "0x80" } },
+	{ { "--showdimmtemprange", "0", "0x80" } },
+	{ { "--showiobw", "0", "P0" } },
+	{ { "--showxgmibw", "G0", "AGG_BW" } },
+	{ { "--showlclkdpmlevel", "0", "0" } },
+	{ { "--showmetrictablever" } },
+	{ { "--showcurrpwrefficiencymode", "0" } },
+	{ { "--showcpurailisofreqpolicy", "0" } },
+	{ { "--showdfcstatectrl", "0" } },
+	{ { "--showall" } },
+};
+
+static const struct {
+	long nr;
+	const char *name;
+} syscall_names[] = {
+#define SC(n)	{ SYS_##n, #n }
+#ifdef SYS_open
+	SC(open),
+#endif
+#ifdef SYS_access
+	SC(access),
+#endif
+#ifdef SYS_stat
+	SC(stat),
+#endif
+#ifdef SYS_newfstatat
+	SC(newfstatat),
+#endif
+	SC(openat), SC(read), SC(pread64), SC(write), SC(close), SC(ioctl),
+	SC(fstat), SC(faccessat), SC(mmap), SC(munmap), SC(mprotect), SC(brk),
+	SC(getdents64), SC(lseek), SC(statx), SC(readlinkat),
+#undef SC
+};
+
+struct result {
+	uint64_t wall_ns;
+	uint64_t minflt, majflt;
+	uint64_t allocs, frees, bytes;
+	uint64_t syscalls;
+	uint64_t by_nr[MAX_SYSCALLS];
+	int status;
+};
+
+static char tool_path[PATH_MAX];
+static char shim_path[PATH_MAX];
+static char sim_root[SIM_ROOT_SIZE];		// mkdtemp() of SIM_ROOT_TEMPLATE
+static int use_sim = 1;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sim_write(const char *rel, const char *fmt, ...)
+{
+	char path[PATH_MAX], *p;
+	va_list ap;
+	FILE *fp;
+
+	if (snprintf(path, sizeof(path), "%s/%s", sim_root, rel) >= (int)sizeof(path))
+		return ENAMETOOLONG;
+	/* create the parents */
+	for (p = path + strlen(sim_root) + 1; (p = strchr(p, '/')); p++) {
+		*p = '\0';
+		if (mkdir(path, 0755) && errno != EEXIST)
+			return errno;
+		*p = '/';
+	}
+	fp = fopen(path, "w");
+	if (!fp)
+		return errno;
+	va_start(ap, fmt);
+	vfprintf(fp, fmt, ap);
+	va_end(ap);
+	fclose(fp);
+
+	return 0;
+}
+
+static int sim_create(uint32_t sockets, uint32_t cores, uint32_t threads)
+{
+	struct hsmp_metric_table tbl;
+	uint32_t ncpus = sockets * cores * threads, nphys = sockets * cores, cpu, i;
+	char rel[PATH_MAX];
+	FILE *fp;
+	int err;
+
+	snprintf(sim_root, sizeof(sim_root), "%s", SIM_ROOT_TEMPLATE);
+	if (!mkdtemp(sim_root))
+		return errno;
+
+	err = sim_write("sys/devices/system/cpu/present", "0-%u\n", ncpus - 1);
+	err = err ?: sim_write("sys/devices/system/cpu/online", "0-%u\n", ncpus - 1);
+	err = err ?: sim_write("sys/class/hwmon/hwmon0/name", "%s\n", ENERGY_DEV_NAME);
+	err = err ?: sim_write("dev/hsmp", "");
+	for (cpu = 0; !err && cpu < ncpus; cpu++) {
+		/* cpus of all first threads come first, like Linux numbers them */
+		snprintf(rel, sizeof(rel),
+			 "sys/devices/system/cpu/cpu%u/topology/physical_package_id", cpu);
+		err = sim_write(rel, "%u\n", (cpu % nphys) / cores);
+		snprintf(rel, sizeof(rel), "sys/devices/system/cpu/cpu%u/topology/core_id", cpu);
+		err = err ?: sim_write(rel, "%u\n", cpu % cores);
+	}
+	/* core energies, then the socket energies */
+	for (i = 1; !err && i <= nphys + sockets; i++) {
+		snprintf(rel, sizeof(rel), "sys/class/hwmon/hwmon0/energy%u_input", i);
+		err = sim_write(rel, "%u\n", i * 1000000);
+	}
+	for (i = 0; !err && i < sockets; i++) {
+		snprintf(rel, sizeof(rel), "sys/devices/platform/amd_hsmp/socket%u/metrics_bin", i);
+		err = sim_write(rel, "");
+		if (err)
+			break;
+		if (snprintf(rel, sizeof(rel), "%s/sys/devices/platform/amd_hsmp/socket%u/metrics_bin",
+			     sim_root, i) >= (int)sizeof(rel))
+			return ENAMETOOLONG;
+		fp = fopen(rel, "w");
+		if (!fp)
+			return errno;
+		memset(&tbl, 0, sizeof(tbl));
+		fwrite(&tbl, sizeof(tbl), 1, fp);
+		fclose(fp);
+	}
+	if (err)
+		return err;
+
+	if (snprintf(rel, sizeof(rel), "%s/proc/cpuinfo", sim_root) >= (int)sizeof(rel))
+		return ENAMETOOLONG;
+	err = sim_write("proc/cpuinfo", "");
+	fp = fopen(rel, "w");
+	if (err || !fp)
+		return err ? err : errno;
+	for (cpu = 0; cpu < ncpus; cpu++)
+		fprintf(fp, "processor\t: %u\nphysical id\t: %u\ninitial apicid\t: %u\n"
+			"apicid\t\t: %u\n\n", cpu, (cpu % nphys) / cores, cpu, cpu);
+	fclose(fp);
+
+	return 0;
+}
+
+static void sim_remove(void)
+{
+	char cmd[PATH_MAX + 16];
+
+	if (!sim_root[0])
+		return;
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", sim_root);
+	if (system(cmd))
+		fprintf(stderr, "Failed to remove %s\n", sim_root);
+}
+
+static void child_exec(const struct bench_cmd *bc, int stats_fd, int traced)
+{
+	char *argv[MAX_ARGS + 2];
+	char fdstr[16];
+	int i, null;
+
+	argv[0] = tool_path;
+	for (i = 0; i < MAX_ARGS && bc->args[i]; i++)
+		argv[i + 1] = (char *)bc->args[i];
+	argv[i + 1] = NULL;
+
+	null = open("/dev/null", O_WRONLY);
+	if (null >= 0) {
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		close(null);
+	}
+	snprintf(fdstr, sizeof(fdstr), "%d", stats_fd);
+	setenv("ESMI_BENCH_FD", fdstr, 1);
+	setenv("LD_PRELOAD", shim_path, 1);
+	if (use_sim)
+		setenv("ESMI_SIM_ROOT", sim_root, 1);
+	if (traced) {
+		ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+		raise(SIGSTOP);
+	}
+	execv(tool_path, argv);
+	_exit(127);
+}
+
+/* count the syscall entries of a stopped child until it exits */
+static int trace_child(pid_t pid, struct result *r)
+{
+	struct __ptrace_syscall_info info;
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status))
+		return -1;
+	ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+	for (;;) {
+		if (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) < 0)
+			return -1;
+		if (waitpid(pid, &status, 0) < 0)
+			return -1;
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+			return status;
+		if (!WIFSTOPPED(status) || WSTOPSIG(status) != (SIGTRAP | 0x80))
+			continue;
+		if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) <= 0 ||
+		    info.op != PTRACE_SYSCALL_INFO_ENTRY)
+			continue;
+		r->syscalls++;
+		if (info.entry.nr < MAX_SYSCALLS)
+			r->by_nr[info.entry.nr]++;
+	}
+}
+
+static int run_cmd(const struct bench_cmd *bc, int traced, struct result *r)
+{
+	struct rusage ru = { 0 };
+	uint64_t start;
+	int fds[2], status = 0;
+	char buf[128];
+	ssize_t n;
+	pid_t pid;
+
+	if (pipe(fds))
+		return errno;
+	start = now_ns();
+	pid = fork();
+	if (pid < 0)
+		return errno;
+	if (!pid) {
+		close(fds[0]);
+		child_exec(bc, fds[1], traced);
+	}
+	close(fds[1]);
+	if (traced)
+		status = trace_child(pid, r);
+	else if (wait4(pid, &status, 0, &ru) < 0)
+		status = -1;
+	if (!traced) {
+		r->wall_ns = now_ns() - start;
+		r->minflt = ru.ru_minflt;
+		r->majflt = ru.ru_majflt;
+	}
+	r->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+	n = read(fds[0], buf, sizeof(buf) - 1);
+	close(fds[0]);
+	if (n > 0 && !traced) {
+		buf[n] = '\0';
+		sscanf(buf, "%" SCNu64 " %" SCNu64 " %" SCNu64,
+		       &r->allocs, &r->frees, &r->bytes);
+	}
+
+	return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static const char *syscall_name(long nr)
+{
+	static char buf[16];
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(syscall_names); i++)
+		if (syscall_names[i].nr == nr)
+			return syscall_names[i].name;
+	snprintf(buf, sizeof(buf), "sys%ld", nr);
+
+	return buf;
+}
+
+static void print_top(const struct result *r)
+{
+	uint64_t best;
+	char used[MAX_SYSCALLS] = { 0 };
+	int i, k, pick;
+
+	for (k = 0; k < TOP_SYSCALLS; k++) {
+		pick = -1;
+		best = 0;
+		for (i = 0; i < MAX_SYSCALLS; i++)
+			if (!used[i] && r->by_nr[i] > best) {
+				best = r->by_nr[i];
+				pick = i;
+			}
+		if (pick < 0)
+			break;
+		used[pick] = 1;
+		printf(" %s:%lu", syscall_name(pick), best);
+	}
+}
+
+static void bench_cmd(const struct bench_cmd *bc, uint32_t iterations, uint64_t *wall,
+		      uint64_t *flt, struct result *r)
+{
+	char name[64];
+	uint32_t i;
+	int k, len = 0;
+
+	for (i = 0; i < iterations; i++) {
+		memset(r, 0, sizeof(*r));
+		run_cmd(bc, 0, r);
+		wall[i] = r->wall_ns;
+		flt[i] = r->minflt + r->majflt;
+	}
+	/* keeps the allocation counts and status of the last untraced run */
+	memset(r->by_nr, 0, sizeof(r->by_nr));
+	r->syscalls = 0;
+	run_cmd(bc, 1, r);
+
+	for (k = 0; k < MAX_ARGS && bc->args[k]; k++)
+		len += snprintf(name + len, sizeof(name) - len, "%s%s", k ? " " : "",
+				bc->args[k] + (k ? 0 : 2));
+	qsort(wall, iterations, sizeof(*wall), cmp_u64);
+	qsort(flt, iterations, sizeof(*flt), cmp_u64);
+	printf("| %-30s | %8.1lf %8.1lf | %6lu | %6lu %8lu | %5lu |%s", name,
+	       wall[iterations / 2] / 1000.0, wall[iterations - 1] / 1000.0,
+	       flt[iterations / 2], r->allocs, r->bytes, r->syscalls,
+	       r->status ? " exit" : "");
+	if (r->status)
+		printf(" %d", r->status);
+	print_top(r);
+	printf("\n");
+}
+
+static void show_usage(char *exe_name)
+{
+	printf("Usage: %s [-n ITERATIONS] [-t TOOL] [-p PRELOAD] [-R] [-s SOCKETS]"
+	       " [-c CORES] [-m THREADS]\n\n"
+	       "  -n ITERATIONS\ttimed runs per option (default %d)\n"
+	       "  -t TOOL\te_smi_tool to run (default next to this binary)\n"
+	       "  -p PRELOAD\tpreload library (default next to this binary)\n"
+	       "  -R\t\trun against the real devices instead of a simulated tree\n"
+	       "  -s, -c, -m\tsockets, cores per socket and threads per core of the\n"
+	       "\t\tsimulated tree (default 2, 8, 2)\n", exe_name, DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t iterations = DEFAULT_ITERATIONS, sockets = 2, cores = 8, threads = 2;
+	char self[PATH_MAX], *dir;
+	uint64_t *wall, *flt;
+	struct result *r;
+	ssize_t len;
+	int opt, i, err;
+
+	len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	self[len > 0 ? len : 0] = '\0';
+	dir = dirname(self);
+	snprintf(tool_path, sizeof(tool_path), "%s/e_smi_tool", dir);
+	snprintf(shim_path, sizeof(shim_path), "%s/libe_smi_simshim.so", dir);
+
+	while ((opt = getopt(argc, argv, "hn:t:p:Rs:c:m:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			snprintf(tool_path, sizeof(tool_path), "%s", optarg);
+			break;
+		case 'p':
+			snprintf(shim_path, sizeof(shim_path), "%s", optarg);
+			break;
+		case 'R':
+			use_sim = 0;
+			break;
+		case 's':
+			sockets = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cores = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			show_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!iterations || !sockets || !cores || !threads) {
+		show_usage(argv[0]);
+		return 1;
+	}
+	if (access(tool_path, X_OK) || access(shim_path, R_OK)) {
+		printf("Missing %s or %s\n", tool_path, shim_path);
+		return 1;
+	}
+	if (use_sim) {
+		err = sim_create(sockets, cores, threads);
+		if (err) {
+			printf("Failed to create the simulated tree: %s\n", strerror(err));
+			sim_remove();
+			return 1;
+		}
+	}
+
+	wall = calloc(iterations, sizeof(*wall));
+	flt = calloc(iterations, sizeof(*flt));
+	r = calloc(1, sizeof(*r));
+	if (!wall || !flt || !r) {
+		printf("Failed to allocate sample buffers\n");
+		sim_remove();
+		return ESMI_NO_MEMORY;
+	}
+
+	printf("e_smi_tool command benchmark, %u runs per option, %s\n", iterations,
+	       use_sim ? "simulated device tree" : "real devices");
+	printf("| %-30s | %-17s | %-6s | %-15s | %-5s | top syscalls\n",
+	       "option", "wall usec med/max", "faults", "allocs bytes", "sys");
+	for (i = 0; i < ARRAY_SIZE(cmds); i++)
+		bench_cmd(&cmds[i], iterations, wall, flt, r);
+
+	free(wall);
+	free(flt);
+	free(r);
+	sim_remove();
+
+	return 0;
+}
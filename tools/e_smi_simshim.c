@@ -0,0 +1,242 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Preload library of the command benchmark.
+ *
+ * With ESMI_SIM_ROOT set, paths below /sys, /dev/hsmp, /dev/cpu and
+ * /proc/cpuinfo are looked up below that directory instead, so the tool
+ * runs against a simulated device tree. HSMP ioctls on the simulated
+ * /dev/hsmp succeed with zeroed responses, except for the protocol
+ * version and the mailbox test. Every allocation is counted and with
+ * ESMI_BENCH_FD set the counts are written to that fd at exit.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <e_smi/e_smi.h>
+
+#define SIM_PATH_SIZE		4096
+#define SIM_PROTO_VER		5
+#define SIM_MAX_FDS		1024
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *ptr);
+
+static const char *sim_prefixes[] = {
+	"/sys/", "/dev/hsmp", "/dev/cpu/", "/proc/cpuinfo",
+};
+
+static uint64_t allocs, frees, alloc_bytes;
+static char hsmp_fds[SIM_MAX_FDS];
+
+static const char *sim_path(const char *path, char *buf)
+{
+	const char *root = getenv("ESMI_SIM_ROOT");
+	size_t i;
+
+	if (!root || !path || path[0] != '/')
+		return path;
+	for (i = 0; i < sizeof(sim_prefixes) / sizeof(sim_prefixes[0]); i++) {
+		if (!strncmp(path, sim_prefixes[i], strlen(sim_prefixes[i]))) {
+			snprintf(buf, SIM_PATH_SIZE, "%s%s", root, path);
+			return buf;
+		}
+	}
+
+	return path;
+}
+
+static void sim_track(const char *path, int fd)
+{
+	if (fd >= 0 && fd < SIM_MAX_FDS)
+		hsmp_fds[fd] = getenv("ESMI_SIM_ROOT") && !strcmp(path, HSMP_CHAR_DEVFILE_NAME);
+}
+
+#define REAL(ret, name, ...)						\
+	static ret (*real_##name)(__VA_ARGS__);				\
+	if (!real_##name)						\
+		real_##name = dlsym(RTLD_NEXT, #name)
+
+int open(const char *path, int flags, ...)
+{
+	char buf[SIM_PATH_SIZE];
+	mode_t mode = 0;
+	va_list ap;
+	int fd;
+	REAL(int, open, const char *, int, ...);
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	fd = real_open(sim_path(path, buf), flags, mode);
+	sim_track(path, fd);
+
+	return fd;
+}
+
+int open64(const char *path, int flags, ...)
+{
+	char buf[SIM_PATH_SIZE];
+	mode_t mode = 0;
+	va_list ap;
+	int fd;
+	REAL(int, open64, const char *, int, ...);
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	fd = real_open64(sim_path(path, buf), flags, mode);
+	sim_track(path, fd);
+
+	return fd;
+}
+
+FILE *fopen(const char *path, const char *mode)
+{
+	char buf[SIM_PATH_SIZE];
+	REAL(FILE *, fopen, const char *, const char *);
+
+	return real_fopen(sim_path(path, buf), mode);
+}
+
+FILE *fopen64(const char *path, const char *mode)
+{
+	char buf[SIM_PATH_SIZE];
+	REAL(FILE *, fopen64, const char *, const char *);
+
+	return real_fopen64(sim_path(path, buf), mode);
+}
+
+DIR *opendir(const char *path)
+{
+	char buf[SIM_PATH_SIZE];
+	REAL(DIR *, opendir, const char *);
+
+	return real_opendir(sim_path(path, buf));
+}
+
+int access(const char *path, int mode)
+{
+	char buf[SIM_PATH_SIZE];
+	REAL(int, access, const char *, int);
+
+	return real_access(sim_path(path, buf), mode);
+}
+
+int close(int fd)
+{
+	REAL(int, close, int);
+
+	if (fd >= 0 && fd < SIM_MAX_FDS)
+		hsmp_fds[fd] = 0;
+
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long req, ...)
+{
+	struct hsmp_message *msg;
+	va_list ap;
+	void *arg;
+	REAL(int, ioctl, int, unsigned long, ...);
+
+	va_start(ap, req);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+	if (fd < 0 || fd >= SIM_MAX_FDS || !hsmp_fds[fd] || req != HSMP_IOCTL_CMD)
+		return real_ioctl(fd, req, arg);
+
+	msg = arg;
+	memset(msg->args + msg->num_args, 0,
+	       sizeof(msg->args) - msg->num_args * sizeof(msg->args[0]));
+	if (msg->msg_id == HSMP_GET_PROTO_VER)
+		msg->args[0] = SIM_PROTO_VER;
+	else if (msg->msg_id == HSMP_TEST)
+		msg->args[0] = msg->args[0] + 1;
+
+	return 0;
+}
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_bytes, nmemb * size, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size)
+{
+	void *p;
+
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+	p = __libc_memalign(align, size);
+	if (!p)
+		return ENOMEM;
+	*ptr = p;
+
+	return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+	__atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __libc_memalign(align, size);
+}
+
+void free(void *ptr)
+{
+	if (ptr)
+		__atomic_add_fetch(&frees, 1, __ATOMIC_RELAXED);
+	__libc_free(ptr);
+}
+
+__attribute__((destructor)) static void sim_report(void)
+{
+	const char *env = getenv("ESMI_BENCH_FD");
+	char buf[128];
+	int len;
+
+	if (!env)
+		return;
+	len = snprintf(buf, sizeof(buf), "%lu %lu %lu\n", allocs, frees, alloc_bytes);
+	if (write(atoi(env), buf, len) < 0)
+		return;
+}
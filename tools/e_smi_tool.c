@@ -17,6 +17,8 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <stddef.h>
 
 #include <e_smi/e_smi.h>
 
@@ -93,7 +95,11 @@ static char *allowlistcontent = "# MSR # Write Mask # Comment\n"
 			  "0xC001029A 0x0000000000000000\n"
 			  "0xC001029B 0x0000000000000000\n"
 			  "0xC00102F0 0x0000000000000000\n"
-			  "0xC00102F1 0x0000000000000000\n";
+			  "0xC00102F1 0x0000000000000000\n"
+			  "0x000000E7 0x0000000000000000\n"
+			  "0x000000E8 0x0000000000000000\n"
+			  "0xC00000E7 0x0000000000000000\n"
+			  "0xC00000E8 0x0000000000000000\n";
 
 static int write_msr_allowlist_file()
 {
@@ -1674,6 +1680,319 @@ static esmi_status_t epyc_show_metrics_table(uint8_t sock_id)
 	return ESMI_SUCCESS;
 }
 
+/*
+ * Metrics table watch mode.
+ *
+ * The table is compared word-wise against the previous read and only the
+ * fields that changed are rendered, so the output (and the formatting cost)
+ * scales with the amount of change rather than with the table size.
+ */
+enum mtbl_kind {
+	MTBL_INST,		/* instantaneous value, show old -> new */
+	MTBL_ACC_TIME,		/* accumulator, show rate per second */
+	MTBL_ACC_TICK,		/* accumulator, show average per accumulation tick */
+	MTBL_COUNT		/* plain counter, show delta */
+};
+
+struct mtbl_field {
+	const char *name;
+	uint16_t offset;	/* byte offset in struct hsmp_metric_table */
+	uint8_t width;		/* element size in bytes, 4 or 8 */
+	uint8_t count;		/* number of elements */
+	uint8_t kind;		/* enum mtbl_kind */
+	double scale;		/* raw value to unit conversion */
+	const char *unit;
+};
+
+#define MTBL_SCALAR(f, k, s, u) \
+	{ #f, offsetof(struct hsmp_metric_table, f), \
+	  sizeof(((struct hsmp_metric_table *)0)->f), 1, k, s, u }
+#define MTBL_ARRAY(f, k, s, u) \
+	{ #f, offsetof(struct hsmp_metric_table, f), \
+	  sizeof(((struct hsmp_metric_table *)0)->f[0]), \
+	  ARRAY_SIZE(((struct hsmp_metric_table *)0)->f), k, s, u }
+
+#define UQ10	(1.0 / 1024)
+#define UQ16	(1.0 / 65536)
+
+static const struct mtbl_field mtbl_fields[] = {
+	MTBL_SCALAR(accumulation_counter, MTBL_COUNT, 1, ""),
+	MTBL_SCALAR(max_socket_temperature, MTBL_INST, UQ10, "°C"),
+	MTBL_SCALAR(max_vr_temperature, MTBL_INST, UQ10, "°C"),
+	MTBL_SCALAR(max_hbm_temperature, MTBL_INST, UQ10, "°C"),
+	MTBL_SCALAR(max_socket_temperature_acc, MTBL_ACC_TICK, UQ10, "°C"),
+	MTBL_SCALAR(max_vr_temperature_acc, MTBL_ACC_TICK, UQ10, "°C"),
+	MTBL_SCALAR(max_hbm_temperature_acc, MTBL_ACC_TICK, UQ10, "°C"),
+	MTBL_SCALAR(socket_power_limit, MTBL_INST, UQ10, "W"),
+	MTBL_SCALAR(max_socket_power_limit, MTBL_INST, UQ10, "W"),
+	MTBL_SCALAR(socket_power, MTBL_INST, UQ10, "W"),
+	MTBL_SCALAR(timestamp, MTBL_COUNT, 1, ""),
+	MTBL_SCALAR(socket_energy_acc, MTBL_ACC_TIME, UQ16, "W"),
+	MTBL_SCALAR(ccd_energy_acc, MTBL_ACC_TIME, UQ16, "W"),
+	MTBL_SCALAR(xcd_energy_acc, MTBL_ACC_TIME, UQ16, "W"),
+	MTBL_SCALAR(aid_energy_acc, MTBL_ACC_TIME, UQ16, "W"),
+	MTBL_SCALAR(hbm_energy_acc, MTBL_ACC_TIME, UQ16, "W"),
+	MTBL_SCALAR(cclk_frequency_limit, MTBL_INST, UQ10, "GHz"),
+	MTBL_SCALAR(gfxclk_frequency_limit, MTBL_INST, UQ10, "MHz"),
+	MTBL_SCALAR(fclk_frequency, MTBL_INST, UQ10, "MHz"),
+	MTBL_SCALAR(uclk_frequency, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(socclk_frequency, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(vclk_frequency, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(dclk_frequency, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(lclk_frequency, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(gfxclk_frequency_acc, MTBL_ACC_TICK, UQ10, "MHz"),
+	MTBL_ARRAY(cclk_frequency_acc, MTBL_ACC_TICK, UQ10, "GHz"),
+	MTBL_SCALAR(max_cclk_frequency, MTBL_INST, UQ10, "GHz"),
+	MTBL_SCALAR(min_cclk_frequency, MTBL_INST, UQ10, "GHz"),
+	MTBL_SCALAR(max_gfxclk_frequency, MTBL_INST, UQ10, "MHz"),
+	MTBL_SCALAR(min_gfxclk_frequency, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(fclk_frequency_table, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(uclk_frequency_table, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(socclk_frequency_table, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(vclk_frequency_table, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(dclk_frequency_table, MTBL_INST, UQ10, "MHz"),
+	MTBL_ARRAY(lclk_frequency_table, MTBL_INST, UQ10, "MHz"),
+	MTBL_SCALAR(max_lclk_dpm_range, MTBL_INST, 1, ""),
+	MTBL_SCALAR(min_lclk_dpm_range, MTBL_INST, 1, ""),
+	MTBL_SCALAR(xgmi_width, MTBL_INST, UQ10, ""),
+	MTBL_SCALAR(xgmi_bitrate, MTBL_INST, UQ10, "Gbps"),
+	MTBL_ARRAY(xgmi_read_bandwidth_acc, MTBL_ACC_TIME, UQ10, "Gbps"),
+	MTBL_ARRAY(xgmi_write_bandwidth_acc, MTBL_ACC_TIME, UQ10, "Gbps"),
+	MTBL_SCALAR(socket_c0_residency, MTBL_INST, UQ10, "%"),
+	MTBL_SCALAR(socket_gfx_busy, MTBL_INST, UQ10, "%"),
+	MTBL_SCALAR(dram_bandwidth_utilization, MTBL_INST, UQ10, "%"),
+	MTBL_SCALAR(socket_c0_residency_acc, MTBL_ACC_TICK, UQ10, "%"),
+	MTBL_SCALAR(socket_gfx_busy_acc, MTBL_ACC_TICK, UQ10, "%"),
+	MTBL_SCALAR(dram_bandwidth_acc, MTBL_ACC_TIME, UQ10, "Gbps"),
+	MTBL_SCALAR(max_dram_bandwidth, MTBL_INST, UQ10, "Gbps"),
+	MTBL_SCALAR(dram_bandwidth_utilization_acc, MTBL_ACC_TICK, UQ10, "%"),
+	MTBL_ARRAY(pcie_bandwidth_acc, MTBL_ACC_TIME, UQ10, "Gbps"),
+	MTBL_SCALAR(prochot_residency_acc, MTBL_COUNT, 1, ""),
+	MTBL_SCALAR(ppt_residency_acc, MTBL_COUNT, 1, ""),
+	MTBL_SCALAR(socket_thm_residency_acc, MTBL_COUNT, 1, ""),
+	MTBL_SCALAR(vr_thm_residency_acc, MTBL_COUNT, 1, ""),
+	MTBL_SCALAR(hbm_thm_residency_acc, MTBL_COUNT, 1, ""),
+	MTBL_ARRAY(gfxclk_frequency, MTBL_INST, UQ10, "MHz"),
+};
+
+#define MTBL_WORDS	(sizeof(struct hsmp_metric_table) / sizeof(uint32_t))
+#define MTBL_NO_FIELD	0xFFFF
+
+/* field index and element index of every 32 bit word in the table */
+static uint16_t mtbl_word_field[MTBL_WORDS];
+static uint8_t mtbl_word_elem[MTBL_WORDS];
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_sigint(int sig)
+{
+	(void)sig;
+	watch_stop = 1;
+}
+
+static void build_mtbl_word_map(void)
+{
+	uint32_t i, j, w, first, nwords;
+
+	for (i = 0; i < MTBL_WORDS; i++)
+		mtbl_word_field[i] = MTBL_NO_FIELD;
+
+	for (i = 0; i < ARRAY_SIZE(mtbl_fields); i++) {
+		nwords = mtbl_fields[i].width / sizeof(uint32_t);
+		for (j = 0; j < mtbl_fields[i].count; j++) {
+			first = mtbl_fields[i].offset / sizeof(uint32_t) + j * nwords;
+			for (w = first; w < first + nwords && w < MTBL_WORDS; w++) {
+				mtbl_word_field[w] = i;
+				mtbl_word_elem[w] = j;
+			}
+		}
+	}
+}
+
+static uint64_t mtbl_elem_get(const struct hsmp_metric_table *tbl,
+			      const struct mtbl_field *f, uint32_t elem)
+{
+	const uint8_t *p = (const uint8_t *)tbl + f->offset + elem * f->width;
+	uint64_t v64;
+	uint32_t v32;
+
+	if (f->width == sizeof(uint64_t)) {
+		memcpy(&v64, p, sizeof(v64));
+		return v64;
+	}
+	memcpy(&v32, p, sizeof(v32));
+	return v32;
+}
+
+static void show_mtbl_change(const struct hsmp_metric_table *prev,
+			     const struct hsmp_metric_table *cur,
+			     uint16_t field, uint8_t elem, double dt, uint32_t dticks)
+{
+	const struct mtbl_field *f = &mtbl_fields[field];
+	uint64_t old = mtbl_elem_get(prev, f, elem);
+	uint64_t new = mtbl_elem_get(cur, f, elem);
+	uint64_t delta = new - old;
+	char name[SHOWLINESZ];
+
+	/* a 32 bit accumulator or counter wraps in its own width */
+	if (f->width == sizeof(uint32_t))
+		delta = (uint32_t)delta;
+
+	if (f->count > 1)
+		snprintf(name, sizeof(name), "%s[%u]", f->name, elem);
+	else
+		snprintf(name, sizeof(name), "%s", f->name);
+
+	switch (f->kind) {
+	case MTBL_INST:
+		printf("| %-34s | %14.3lf -> %-14.3lf %s\n", name,
+		       old * f->scale, new * f->scale, f->unit);
+		break;
+	case MTBL_ACC_TIME:
+		printf("| %-34s | %+14.3lf %s\n", name,
+		       dt > 0 ? delta * f->scale / dt : 0.0, f->unit);
+		break;
+	case MTBL_ACC_TICK:
+		printf("| %-34s | %14.3lf %s (avg)\n", name,
+		       dticks ? delta * f->scale / dticks : 0.0, f->unit);
+		break;
+	case MTBL_COUNT:
+	default:
+		printf("| %-34s | %14llu\n", name, (unsigned long long)delta);
+		break;
+	}
+}
+
+static esmi_status_t epyc_watch_metrics_table(uint8_t sock_id, uint32_t interval_ms)
+{
+	static struct hsmp_metric_table tbl[2];
+	struct hsmp_metric_table *prev = &tbl[0], *cur = &tbl[1], *tmp;
+	const uint32_t *pw, *cw;
+	struct timespec t0, tprev, tcur;
+	struct sigaction sa = { 0 };
+	uint32_t i, nchanged, dticks;
+	uint16_t last_field;
+	uint8_t last_elem;
+	esmi_status_t ret;
+	double dt;
+
+	if (!interval_ms) {
+		printf("Watch interval must be non zero\n");
+		return ESMI_INVALID_INPUT;
+	}
+
+	ret = esmi_metrics_table_get(sock_id, prev);
+	if (ret != ESMI_SUCCESS) {
+		printf("Failed to get Metrics Table for socket [%d], Err[%d]: %s\n",
+			sock_id, ret, esmi_get_err_msg(ret));
+		return ret;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tprev);
+	t0 = tprev;
+	build_mtbl_word_map();
+
+	sa.sa_handler = watch_sigint;
+	sigaction(SIGINT, &sa, NULL);
+	watch_stop = 0;
+
+	printf("Watching metrics table of socket[%d] every %u ms, Ctrl-C to stop\n",
+	       sock_id, interval_ms);
+
+	while (!watch_stop) {
+		usleep(interval_ms * 1000);
+		if (watch_stop)
+			break;
+
+		ret = esmi_metrics_table_get(sock_id, cur);
+		if (ret != ESMI_SUCCESS) {
+			printf("Failed to get Metrics Table for socket [%d], Err[%d]: %s\n",
+				sock_id, ret, esmi_get_err_msg(ret));
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &tcur);
+		dt = (tcur.tv_sec - tprev.tv_sec) + (tcur.tv_nsec - tprev.tv_nsec) / 1e9;
+		dticks = cur->accumulation_counter - prev->accumulation_counter;
+
+		pw = (const uint32_t *)prev;
+		cw = (const uint32_t *)cur;
+		nchanged = 0;
+		last_field = MTBL_NO_FIELD;
+		last_elem = 0;
+		for (i = 0; i < MTBL_WORDS; i++) {
+			if (pw[i] == cw[i])
+				continue;
+			/* 64 bit elements span two words, report them once */
+			if (mtbl_word_field[i] == MTBL_NO_FIELD ||
+			    (mtbl_word_field[i] == last_field && mtbl_word_elem[i] == last_elem))
+				continue;
+			last_field = mtbl_word_field[i];
+			last_elem = mtbl_word_elem[i];
+			if (!nchanged)
+				printf("\n[+%.3lf s] socket[%d], %.3lf s since last change\n",
+				       (tcur.tv_sec - t0.tv_sec) + (tcur.tv_nsec - t0.tv_nsec) / 1e9,
+				       sock_id, dt);
+			show_mtbl_change(prev, cur, last_field, last_elem, dt, dticks);
+			nchanged++;
+		}
+		/* keep the old baseline until something changes */
+		if (!nchanged)
+			continue;
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+		tprev = tcur;
+	}
+
+	sa.sa_handler = SIG_DFL;
+	sigaction(SIGINT, &sa, NULL);
+
+	return ret;
+}
+
+#define EVENTS_BATCH	64
+
+/*
+ * Dump the diagnostic events recorded by the library in this process,
+ * i.e. by the options given before --events on the same command line.
+ */
+static esmi_status_t show_diag_events(void)
+{
+	struct esmi_event events[EVENTS_BATCH];
+	uint32_t count, total = 0, i;
+	uint64_t lost, total_lost = 0;
+	esmi_status_t ret;
+
+	printf("\n-----------------------------------------------------------------------------------------------\n");
+	printf("| %14s | %-36s | %5s | %6s | %-16s | %9s |\n",
+	       "Time (ms)", "API", "Index", "Msg Id", "Status", "Lat (us)");
+	printf("-----------------------------------------------------------------------------------------------\n");
+	do {
+		ret = esmi_events_drain(events, EVENTS_BATCH, &count, &lost);
+		if (ret != ESMI_SUCCESS) {
+			printf("Failed to drain events, Err[%d]: %s\n",
+			       ret, esmi_get_err_msg(ret));
+			return ret;
+		}
+		total_lost += lost;
+		for (i = 0; i < count; i++) {
+			printf("| %14.3lf | %-36s | %5u | %6u | %-16.16s | ",
+			       events[i].time_ns / 1000000.0, events[i].api,
+			       events[i].index, events[i].msg_id,
+			       esmi_get_err_msg(events[i].status));
+			if (events[i].flags & ESMI_EVENT_SLOW)
+				printf("%9.1lf |\n", events[i].latency_ns / 1000.0);
+			else
+				printf("%9s |\n", "NA");
+		}
+		total += count;
+	} while (count == EVENTS_BATCH);
+	printf("-----------------------------------------------------------------------------------------------\n");
+	printf("%u event(s), %lu lost\n", total, total_lost);
+
+	return ESMI_SUCCESS;
+}
+
 static int epyc_get_pwr_efficiency_mode(uint8_t sock_ind)
 {
 	esmi_status_t ret;
@@ -1793,6 +2112,7 @@ static char* const feat_comm[] = {
 	"  -h, --help\t\t\t\t\t\t\tShow this help message",
 	"  -A, --showall\t\t\t\t\t\t\tShow all esmi parameter values",
 	"  -V  --version \t\t\t\t\t\tShow e-smi library version",
+	"  --events\t\t\t\t\t\t\tShow failed calls of the preceding options",
 	"  --testmailbox [SOCKET] [VALUE<0-0xFFFFFFFF>]\t\t\tTest HSMP mailbox interface",
 	"  --writemsrallowlist \t\t\t\t\t\tWrite msr-safe allowlist file\n",
 };
@@ -1903,6 +2223,7 @@ static char* const feat_ver6_get[] = {
 	"  --showsockclkfreqlimit [SOCKET]\t\t\t\tShow current clock frequency limit(MHz) for a given socket",
 	"  --showmetrictablever\t\t\t\t\t\tShow Metrics Table Version",
 	"  --showmetrictable [SOCKET]\t\t\t\t\tShow Metrics Table",
+	"  --watch-metrics [SOCKET] [INTERVAL_MS]\t\t\t\tWatch Metrics Table, show only changed fields",
 };
 
 static char* const feat_ver6_set[] = {
@@ -2223,6 +2544,7 @@ static int parsesmi_args(int argc,char **argv)
 	char *bw_type;
 	uint8_t ctrl, mode, value;
 	uint64_t input_data;
+	uint32_t interval;
 
 	//Specifying the expected options
 	static struct option long_options[] = {
@@ -2263,6 +2585,8 @@ static int parsesmi_args(int argc,char **argv)
 		{"showsockclkfreqlimit",	required_argument,	0,	'Q'},
 		{"showmetrictablever",		no_argument,		0,	'D'},
 		{"showmetrictable",		required_argument,	0,	'J'},
+		{"watch-metrics",		required_argument,	0,	'G'},
+		{"events",			no_argument,		0,	'R'},
 		{"version",			no_argument,		0,	'V'},
 		{"writemsrallowlist",		no_argument,		0,	'W'},
 		{"showcurrpwrefficiencymode", 	required_argument, 	0, 	'O'},
@@ -2365,6 +2689,7 @@ static int parsesmi_args(int argc,char **argv)
 	    opt == 'r' ||
 	    opt == 'Q' ||
 	    opt == 'J' ||
+	    opt == 'G' ||
 	    opt == 'O' ||
 	    opt == 'K' ||
 	    opt == 'F' ||
@@ -2399,6 +2724,7 @@ static int parsesmi_args(int argc,char **argv)
 	    opt == 'F' ||
 	    opt == 'P' ||
 	    opt == 'E' ||
+	    opt == 'G' ||
 	    opt == 'b') {
 		// make sure optind is valid  ... or another option
 		if (optind >= argc) {
@@ -2690,6 +3016,12 @@ static int parsesmi_args(int argc,char **argv)
 			sock_id = atoi(optarg);
 			ret = epyc_show_metrics_table(sock_id);
 			break;
+		case 'G' :
+			/* Watch Metrics Table, show only changed fields */
+			sock_id = atoi(optarg);
+			interval = atoi(argv[optind++]);
+			ret = epyc_watch_metrics_table(sock_id, interval);
+			break;
 		case 'N' :
 			/* Test HSMP mailbox i/f */
 			sock_id = atoi(optarg);
@@ -2744,6 +3076,9 @@ static int parsesmi_args(int argc,char **argv)
 			write_msr_allowlist_file();
 			ret = ESMI_SUCCESS;
 			break;
+		case 'R' :
+			ret = show_diag_events();
+			break;
 		case ':' :
 			/* missing option argument */
 			printf(RED "%s: option '-%c' requires an argument."
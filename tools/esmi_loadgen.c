@@ -0,0 +1,754 @@
+/*
+ * University of Illinois/NCSA Open Source License
+ *
+ * Copyright (c) 2023, Advanced Micro Devices, Inc. All rights reserved.
+ *
+ */
+
+/*
+ * Controlled load generator for validating E-SMI telemetry.
+ *
+ * One worker thread per selected cpu runs a sequence of load phases on a
+ * schedule shared by all workers: idle, busy, square waves, duty cycle
+ * ramps and memory bandwidth streaming. Every on/off transition is
+ * recorded as the ground truth timeline. Optionally the main thread
+ * samples core energy and socket power meanwhile and the run reports how
+ * the samples follow the load: the correlation with the true activity,
+ * the lag behind load steps, the steps the samples missed, and with a
+ * baseline pass the worker throughput lost to sampling.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <e_smi/e_smi.h>
+
+#define MAX_PHASES	32
+#define RAMP_SLOT_NS	10000000ULL	/* PWM slot of a ramp */
+#define SPIN_CHECK	1024		/* busy loop iterations per clock read */
+#define START_DELAY_NS	100000000ULL	/* lets all workers reach the start */
+#define EVENTS_PER_SEC	512
+
+enum phase_type {
+	PHASE_IDLE,
+	PHASE_BUSY,
+	PHASE_SQUARE,
+	PHASE_RAMP,
+	PHASE_MEMBW,
+};
+
+static const char *phase_names[] = { "idle", "busy", "square", "ramp", "membw" };
+
+struct phase {
+	enum phase_type type;
+	uint64_t period_ns;
+	uint32_t duty;			// percent, square waves
+	uint32_t mib;			// buffer size, memory bandwidth
+	uint64_t start_ns;		// offset from the start of the run
+	uint64_t end_ns;
+};
+
+struct event {
+	uint64_t t_ns;			// offset from the start of the run
+	uint16_t cpu;
+	uint8_t active;
+	uint8_t phase;
+};
+
+struct worker {
+	pthread_t thread;
+	int cpu;
+	uint64_t ops;
+	struct event *ev;
+	uint32_t nev, maxev;
+	uint8_t active;
+	char *buf;
+	size_t buflen;
+};
+
+struct sample {
+	uint64_t t_ns;			// offset from the start of the run
+	uint64_t energy;		// core energy of the loaded cpus, uJ
+	uint32_t power;			// socket power, mW
+};
+
+static struct phase phases[MAX_PHASES];
+static uint32_t nphases;
+static uint64_t t0;
+static volatile int sink;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+	struct timespec ts = { t / 1000000000ULL, t % 1000000000ULL };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static void set_active(struct worker *w, uint8_t active, uint32_t phase)
+{
+	struct event *e;
+
+	if (w->active == active || w->nev == w->maxev)
+		return;
+	w->active = active;
+	e = &w->ev[w->nev++];
+	e->t_ns = now_ns() - t0;
+	e->cpu = w->cpu;
+	e->active = active;
+	e->phase = phase;
+}
+
+static void spin_until(struct worker *w, uint64_t t, uint32_t phase)
+{
+	uint64_t ops = 0;
+	uint32_t i;
+	int x = 0;
+
+	set_active(w, 1, phase);
+	do {
+		for (i = 0; i < SPIN_CHECK; i++)
+			x = x * 1103515245 + 12345;
+		ops += SPIN_CHECK;
+	} while (now_ns() < t);
+	sink = x;
+	w->ops += ops;
+}
+
+static void idle_until(struct worker *w, uint64_t t, uint32_t phase)
+{
+	set_active(w, 0, phase);
+	sleep_until(t);
+}
+
+/* copy one half of the buffer to the other until t, ops count cache lines */
+static void stream_until(struct worker *w, uint64_t t, uint32_t phase)
+{
+	size_t half = w->buflen / 2;
+
+	set_active(w, 1, phase);
+	if (!half) {
+		spin_until(w, t, phase);
+		return;
+	}
+	do {
+		memcpy(w->buf + half, w->buf, half);
+		w->ops += half / 64;
+	} while (now_ns() < t);
+}
+
+static void run_phase(struct worker *w, uint32_t i)
+{
+	struct phase *p = &phases[i];
+	uint64_t start = t0 + p->start_ns, end = t0 + p->end_ns;
+	uint64_t slot, on, now;
+
+	switch (p->type) {
+	case PHASE_IDLE:
+		idle_until(w, end, i);
+		break;
+	case PHASE_BUSY:
+		spin_until(w, end, i);
+		break;
+	case PHASE_MEMBW:
+		stream_until(w, end, i);
+		break;
+	case PHASE_SQUARE:
+		for (slot = start; slot < end; slot += p->period_ns) {
+			on = slot + p->period_ns * p->duty / 100;
+			if (on > slot)
+				spin_until(w, on < end ? on : end, i);
+			if (on < end && on < slot + p->period_ns)
+				idle_until(w, slot + p->period_ns < end ? slot + p->period_ns : end, i);
+		}
+		break;
+	case PHASE_RAMP:
+		/* the duty cycle of each slot rises from 0 to 100% per period */
+		for (slot = start; slot < end; slot += RAMP_SLOT_NS) {
+			now = (slot - start) % p->period_ns;
+			on = slot + RAMP_SLOT_NS * now / p->period_ns;
+			if (on > slot)
+				spin_until(w, on < end ? on : end, i);
+			if (on < end)
+				idle_until(w, slot + RAMP_SLOT_NS < end ? slot + RAMP_SLOT_NS : end, i);
+		}
+		break;
+	}
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	cpu_set_t set;
+	uint32_t i;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		fprintf(stderr, "Failed to pin a worker to cpu %d\n", w->cpu);
+	if (w->buf)
+		memset(w->buf, 1, w->buflen);
+
+	w->active = 2;		// forces the first event
+	sleep_until(t0);
+	for (i = 0; i < nphases; i++)
+		run_phase(w, i);
+	set_active(w, 0, nphases - 1);
+
+	return NULL;
+}
+
+/*
+ * TYPE[:ARG[:ARG]]@SECONDS, comma separated:
+ * idle@S, busy@S, square:PERIOD_MS:DUTY_PCT@S, ramp:PERIOD_MS@S, membw:MIB@S
+ */
+static int parse_phases(char *spec)
+{
+	uint64_t offset = 0;
+	char *tok, *save, *at;
+	struct phase *p;
+	double secs;
+	uint32_t i, a1, a2;
+	int n;
+
+	for (tok = strtok_r(spec, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (nphases == MAX_PHASES)
+			return -1;
+		at = strchr(tok, '@');
+		if (!at)
+			return -1;
+		*at = '\0';
+		secs = strtod(at + 1, NULL);
+		if (secs <= 0)
+			return -1;
+
+		p = &phases[nphases];
+		memset(p, 0, sizeof(*p));
+		for (i = 0; i < sizeof(phase_names) / sizeof(phase_names[0]); i++)
+			if (!strncmp(tok, phase_names[i], strlen(phase_names[i])))
+				break;
+		if (i == sizeof(phase_names) / sizeof(phase_names[0]))
+			return -1;
+		p->type = i;
+		n = sscanf(tok + strlen(phase_names[i]), ":%u:%u", &a1, &a2);
+		switch (p->type) {
+		case PHASE_SQUARE:
+			if (n != 2 || !a1 || a2 > 100)
+				return -1;
+			p->period_ns = a1 * 1000000ULL;
+			p->duty = a2;
+			break;
+		case PHASE_RAMP:
+			if (n < 1 || a1 * 1000000ULL < RAMP_SLOT_NS)
+				return -1;
+			p->period_ns = a1 * 1000000ULL;
+			break;
+		case PHASE_MEMBW:
+			if (n < 1 || !a1)
+				return -1;
+			p->mib = a1;
+			break;
+		default:
+			break;
+		}
+		p->start_ns = offset;
+		offset += secs * 1e9;
+		p->end_ns = offset;
+		nphases++;
+	}
+
+	return nphases ? 0 : -1;
+}
+
+static int parse_cpus(const char *str, int *cpus, int max)
+{
+	const char *p = str;
+	char *end;
+	long a, b;
+	int n = 0;
+
+	while (*p) {
+		a = strtol(p, &end, 10);
+		if (end == p || a < 0)
+			return -1;
+		b = a;
+		p = end;
+		if (*p == '-') {
+			b = strtol(p + 1, &end, 10);
+			if (end == p + 1 || b < a)
+				return -1;
+			p = end;
+		}
+		for (; a <= b; a++) {
+			if (n == max)
+				return -1;
+			cpus[n++] = a;
+		}
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return -1;
+	}
+
+	return n;
+}
+
+static int socket_cpus(uint32_t sock, int *cpus, int max)
+{
+	uint32_t ncpus, i;
+	int n = 0;
+
+	if (esmi_number_of_cpus_get(&ncpus) != ESMI_SUCCESS)
+		return -1;
+	for (i = 0; i < ncpus && n < max; i++) {
+		char path[128];
+		FILE *fp;
+		int id;
+
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", i);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+		if (fscanf(fp, "%d", &id) == 1 && id == (int)sock)
+			cpus[n++] = i;
+		fclose(fp);
+	}
+
+	return n;
+}
+
+static void run_workers(struct worker *workers, int nworkers)
+{
+	int i;
+
+	t0 = now_ns() + START_DELAY_NS;
+	for (i = 0; i < nworkers; i++) {
+		workers[i].ops = 0;
+		workers[i].nev = 0;
+		pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+	}
+}
+
+static void join_workers(struct worker *workers, int nworkers)
+{
+	int i;
+
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i].thread, NULL);
+}
+
+static uint32_t sample_run(struct sample *samples, uint32_t max, uint64_t interval_ns,
+			   uint64_t *energy, const uint8_t *cores, uint32_t nphys,
+			   uint32_t sock)
+{
+	uint64_t t = t0, end = t0 + phases[nphases - 1].end_ns;
+	uint32_t n = 0, power = 0, i;
+
+	while (t <= end && n < max) {
+		sleep_until(t);
+		samples[n].t_ns = now_ns() - t0;
+		samples[n].energy = 0;
+		if (esmi_all_energies_get(energy) == ESMI_SUCCESS)
+			for (i = 0; i < nphys; i++)
+				if (cores[i])
+					samples[n].energy += energy[i];
+		if (esmi_socket_power_get(sock, &power) == ESMI_SUCCESS)
+			samples[n].power = power;
+		n++;
+		t += interval_ns;
+	}
+
+	return n;
+}
+
+/* share of worker time active in (ta, tb] */
+static double activity(struct worker *workers, int nworkers, uint32_t *cursor,
+		       uint64_t ta, uint64_t tb)
+{
+	double busy = 0;
+	uint64_t from, to, seg_end;
+	struct worker *w;
+	uint32_t k;
+	int i;
+
+	if (tb <= ta)
+		return 0;
+	for (i = 0; i < nworkers; i++) {
+		w = &workers[i];
+		k = cursor[i];
+		/* the last event at or before ta gives the state at ta */
+		while (k + 1 < w->nev && w->ev[k + 1].t_ns <= ta)
+			k++;
+		cursor[i] = k;
+		for (; k < w->nev && w->ev[k].t_ns < tb; k++) {
+			seg_end = k + 1 < w->nev ? w->ev[k + 1].t_ns : tb;
+			if (!w->ev[k].active)
+				continue;
+			from = w->ev[k].t_ns > ta ? w->ev[k].t_ns : ta;
+			to = seg_end < tb ? seg_end : tb;
+			if (to > from)
+				busy += to - from;
+		}
+	}
+
+	return busy / ((double)(tb - ta) * nworkers);
+}
+
+static double correlation(const double *x, const double *y, uint32_t n)
+{
+	double mx = 0, my = 0, sxx = 0, syy = 0, sxy = 0;
+	uint32_t i;
+
+	if (n < 3)
+		return NAN;
+	for (i = 0; i < n; i++) {
+		mx += x[i];
+		my += y[i];
+	}
+	mx /= n;
+	my /= n;
+	for (i = 0; i < n; i++) {
+		sxx += (x[i] - mx) * (x[i] - mx);
+		syy += (y[i] - my) * (y[i] - my);
+		sxy += (x[i] - mx) * (y[i] - my);
+	}
+
+	return sxx > 0 && syy > 0 ? sxy / sqrt(sxx * syy) : NAN;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Step response of a sampled signal: for every on/off edge of the first
+ * worker, the time until the signal crosses the middle between its idle
+ * and busy levels. An edge followed by the next one before the crossing
+ * was missed by the samples.
+ */
+static void report_lag(const char *name, const double *sig, const double *act,
+		       const struct sample *samples, uint32_t n, const struct worker *w)
+{
+	double lo = 0, hi = 0, mid;
+	uint32_t nlo = 0, nhi = 0, k, e, nlag = 0, missed = 0;
+	uint64_t *lags, next;
+
+	for (k = 1; k < n; k++) {
+		if (act[k] < 0.05) {
+			lo += sig[k];
+			nlo++;
+		} else if (act[k] > 0.95) {
+			hi += sig[k];
+			nhi++;
+		}
+	}
+	if (!nlo || !nhi) {
+		printf("%-14s  no idle and busy intervals to compare\n", name);
+		return;
+	}
+	lo /= nlo;
+	hi /= nhi;
+	mid = (lo + hi) / 2;
+
+	lags = calloc(w->nev, sizeof(*lags));
+	if (!lags)
+		return;
+	for (e = 1, k = 1; e < w->nev; e++) {
+		next = e + 1 < w->nev ? w->ev[e + 1].t_ns : UINT64_MAX;
+		while (k < n && samples[k].t_ns <= w->ev[e].t_ns)
+			k++;
+		for (; k < n && samples[k].t_ns < next; k++)
+			if (w->ev[e].active ? sig[k] >= mid : sig[k] <= mid)
+				break;
+		if (k < n && samples[k].t_ns < next)
+			lags[nlag++] = samples[k].t_ns - w->ev[e].t_ns;
+		else if (next != UINT64_MAX)
+			missed++;
+	}
+	if (nlag) {
+		qsort(lags, nlag, sizeof(*lags), cmp_u64);
+		printf("%-14s  idle %9.1lf  busy %9.1lf  lag median %8.2lf ms  max %8.2lf ms"
+		       "  steps %u  missed %u\n", name, lo, hi, lags[nlag / 2] / 1e6,
+		       lags[nlag - 1] / 1e6, nlag, missed);
+	} else {
+		printf("%-14s  idle %9.1lf  busy %9.1lf  no step followed, missed %u\n",
+		       name, lo, hi, missed);
+	}
+	free(lags);
+}
+
+static void report(struct worker *workers, int nworkers, struct sample *samples,
+		   uint32_t n, uint64_t interval_ns)
+{
+	double *act, *epow, *spow;
+	uint32_t *cursor, k, i;
+
+	act = calloc(n * 3, sizeof(*act));
+	cursor = calloc(nworkers, sizeof(*cursor));
+	if (!act || !cursor || n < 2) {
+		free(act);
+		free(cursor);
+		return;
+	}
+	epow = act + n;
+	spow = epow + n;
+	for (k = 1; k < n; k++) {
+		act[k] = activity(workers, nworkers, cursor, samples[k - 1].t_ns, samples[k].t_ns);
+		/* uJ per ns times 1e6 is mW */
+		epow[k] = samples[k].energy >= samples[k - 1].energy ?
+			  (samples[k].energy - samples[k - 1].energy) * 1e6 /
+			  (samples[k].t_ns - samples[k - 1].t_ns) : 0;
+		spow[k] = samples[k].power;
+	}
+
+	printf("\n%u samples every %.3lf ms\n", n, interval_ns / 1e6);
+	printf("correlation with activity: core energy %.3lf, socket power %.3lf\n",
+	       correlation(act + 1, epow + 1, n - 1), correlation(act + 1, spow + 1, n - 1));
+	report_lag("core energy", epow, act, samples, n, &workers[0]);
+	report_lag("socket power", spow, act, samples, n, &workers[0]);
+	for (i = 0; i < nphases; i++)
+		if (phases[i].type == PHASE_SQUARE && 2 * interval_ns > phases[i].period_ns)
+			printf("phase %u: sampling slower than half the %.1lf ms period aliases\n",
+			       i, phases[i].period_ns / 1e6);
+
+	free(act);
+	free(cursor);
+}
+
+static int write_timeline(const char *path, struct worker *workers, int nworkers)
+{
+	FILE *fp;
+	uint32_t k;
+	int i;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return errno;
+	fprintf(fp, "time_ns,cpu,active,phase,type\n");
+	for (i = 0; i < nworkers; i++)
+		for (k = 0; k < workers[i].nev; k++)
+			fprintf(fp, "%lu,%u,%u,%u,%s\n", workers[i].ev[k].t_ns,
+				workers[i].ev[k].cpu, workers[i].ev[k].active,
+				workers[i].ev[k].phase,
+				phase_names[phases[workers[i].ev[k].phase].type]);
+	fclose(fp);
+
+	return 0;
+}
+
+static int write_samples(const char *path, struct sample *samples, uint32_t n)
+{
+	FILE *fp;
+	uint32_t k;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return errno;
+	fprintf(fp, "time_ns,core_energy_uj,socket_power_mw\n");
+	for (k = 0; k < n; k++)
+		fprintf(fp, "%lu,%lu,%u\n", samples[k].t_ns, samples[k].energy,
+			samples[k].power);
+	fclose(fp);
+
+	return 0;
+}
+
+static double ops_rate(struct worker *workers, int nworkers)
+{
+	uint64_t ops = 0;
+	int i;
+
+	for (i = 0; i < nworkers; i++)
+		ops += workers[i].ops;
+
+	return ops / (phases[nphases - 1].end_ns / 1e9);
+}
+
+static void show_usage(char *exe_name)
+{
+	printf("Usage: %s -p PHASES [-c CPULIST | -s SOCKET] [-i INTERVAL_MS] [-B]\n"
+	       "\t\t[-o TIMELINE.csv] [-S SAMPLES.csv]\n\n"
+	       "  -p PHASES\tcomma separated TYPE[:ARGS]@SECONDS list of\n"
+	       "\t\tidle, busy, square:PERIOD_MS:DUTY_PCT, ramp:PERIOD_MS, membw:MIB\n"
+	       "  -c CPULIST\tcpus to load, e.g. 0-3,8 (default 0)\n"
+	       "  -s SOCKET\tload every cpu of SOCKET\n"
+	       "  -i MS\t\tsample core energy and socket power every MS and report\n"
+	       "  -B\t\trun once without sampling first and report the throughput lost\n"
+	       "  -o FILE\twrite the ground truth timeline\n"
+	       "  -S FILE\twrite the samples\n", exe_name);
+}
+
+int main(int argc, char **argv)
+{
+	char *spec = NULL, *cpulist = "0", *timeline = NULL, *samples_path = NULL;
+	uint32_t ncpus = 0, threads = 1, nphys = 1, nsamples = 0, maxsamples = 0;
+	uint64_t interval_ns = 0, *energy = NULL, duration;
+	struct sample *samples = NULL;
+	struct worker *workers;
+	double base_rate = 0;
+	uint8_t *cores = NULL;
+	int opt, i, nworkers, sock = -1, baseline = 0;
+	int *cpus;
+	esmi_status_t ret;
+
+	while ((opt = getopt(argc, argv, "hp:c:s:i:Bo:S:")) != -1) {
+		switch (opt) {
+		case 'p':
+			spec = optarg;
+			break;
+		case 'c':
+			cpulist = optarg;
+			break;
+		case 's':
+			sock = atoi(optarg);
+			break;
+		case 'i':
+			interval_ns = strtoull(optarg, NULL, 0) * 1000000ULL;
+			break;
+		case 'B':
+			baseline = 1;
+			break;
+		case 'o':
+			timeline = optarg;
+			break;
+		case 'S':
+			samples_path = optarg;
+			break;
+		case 'h':
+		default:
+			show_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!spec || parse_phases(spec)) {
+		show_usage(argv[0]);
+		return 1;
+	}
+
+	ret = esmi_init();
+	if (ret == ESMI_SUCCESS) {
+		esmi_number_of_cpus_get(&ncpus);
+		esmi_threads_per_core_get(&threads);
+		nphys = threads ? ncpus / threads : ncpus;
+	} else if (interval_ns || sock >= 0) {
+		printf("ESMI not initialized, sampling and -s need it: %s\n",
+		       esmi_get_err_msg(ret));
+		return ret;
+	}
+
+	cpus = calloc(CPU_SETSIZE, sizeof(*cpus));
+	if (!cpus)
+		return ESMI_NO_MEMORY;
+	nworkers = sock >= 0 ? socket_cpus(sock, cpus, CPU_SETSIZE) :
+		   parse_cpus(cpulist, cpus, CPU_SETSIZE);
+	if (nworkers <= 0) {
+		printf("No cpus to load\n");
+		return 1;
+	}
+	if (sock < 0)
+		sock = 0;
+
+	duration = phases[nphases - 1].end_ns;
+	workers = calloc(nworkers, sizeof(*workers));
+	if (!workers)
+		return ESMI_NO_MEMORY;
+	for (i = 0; i < nworkers; i++) {
+		struct worker *w = &workers[i];
+		uint32_t k, mib = 0;
+
+		w->cpu = cpus[i];
+		/* two events per square period plus slack for the other phases */
+		w->maxev = EVENTS_PER_SEC * (duration / 1000000000ULL + 1);
+		for (k = 0; k < nphases; k++) {
+			if (phases[k].period_ns)
+				w->maxev += 2 * (phases[k].end_ns - phases[k].start_ns) /
+					    (phases[k].type == PHASE_RAMP ? RAMP_SLOT_NS :
+					     phases[k].period_ns) + 2;
+			if (phases[k].mib > mib)
+				mib = phases[k].mib;
+		}
+		w->ev = calloc(w->maxev, sizeof(*w->ev));
+		w->buflen = (size_t)mib << 20;
+		w->buf = mib ? malloc(w->buflen) : NULL;
+		if (!w->ev || (mib && !w->buf)) {
+			printf("Failed to allocate worker buffers\n");
+			return ESMI_NO_MEMORY;
+		}
+	}
+
+	if (interval_ns) {
+		maxsamples = duration / interval_ns + 2;
+		samples = calloc(maxsamples, sizeof(*samples));
+		energy = calloc(nphys, sizeof(*energy));
+		cores = calloc(nphys, sizeof(*cores));
+		if (!samples || !energy || !cores) {
+			printf("Failed to allocate sample buffers\n");
+			return ESMI_NO_MEMORY;
+		}
+		/* SMT siblings share the energy of their core, count it once */
+		for (i = 0; i < nworkers; i++)
+			cores[cpus[i] % nphys] = 1;
+	}
+
+	printf("Loading %d cpu(s) for %.3lf s in %u phase(s)\n", nworkers, duration / 1e9, nphases);
+	if (interval_ns && baseline) {
+		run_workers(workers, nworkers);
+		join_workers(workers, nworkers);
+		base_rate = ops_rate(workers, nworkers);
+	}
+
+	run_workers(workers, nworkers);
+	if (interval_ns)
+		nsamples = sample_run(samples, maxsamples, interval_ns, energy, cores,
+				      nphys, sock);
+	join_workers(workers, nworkers);
+
+	for (i = 0; i < nworkers; i++)
+		if (workers[i].nev == workers[i].maxev)
+			printf("cpu %d: timeline truncated\n", workers[i].cpu);
+	if (timeline && write_timeline(timeline, workers, nworkers))
+		printf("Failed to write %s\n", timeline);
+	if (samples_path && write_samples(samples_path, samples, nsamples))
+		printf("Failed to write %s\n", samples_path);
+	if (interval_ns)
+		report(workers, nworkers, samples, nsamples, interval_ns);
+	if (base_rate > 0)
+		printf("throughput %.4g ops/s, %.4g ops/s without sampling, %.2lf%% lost\n",
+		       ops_rate(workers, nworkers), base_rate,
+		       100 * (1 - ops_rate(workers, nworkers) / base_rate));
+
+	for (i = 0; i < nworkers; i++) {
+		free(workers[i].ev);
+		free(workers[i].buf);
+	}
+	free(workers);
+	free(cpus);
+	free(samples);
+	free(energy);
+	free(cores);
+	if (ret == ESMI_SUCCESS)
+		esmi_exit();
+
+	return 0;
+}